@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/arena.h"
+#include "../src/ast_compact.h"
+#include "../src/debug.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include "../src/source.h"
+#include "../src/string_pool.h"
+#include "../src/vec.h"
+
+#define BENCH_TARGET_SIZE MiB(8)
+#define BENCH_ITERATIONS 10
+
+// Best time of each phase over all iterations. Phases are timed separately
+// so a change to one of them shows up without the noise of the others.
+typedef struct {
+	double tokenize;
+	double parse;
+	double print;
+} PhaseTimes;
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Repeats the input until it is roughly BENCH_TARGET_SIZE bytes, so a small
+// sample file turns into something the front end spends measurable time on.
+// Inputs that are already large enough are used as they are.
+static char *build_corpus(MemArena *arena, SourceFile *src, u64 *out_length) {
+	u64 copies = BENCH_TARGET_SIZE / (src->length + 1) + 1;
+	if (src->length >= BENCH_TARGET_SIZE) copies = 1;
+	u64 length = copies * (src->length + 1);
+
+	char *buf = arena_push(arena, length, true);
+	for (u64 i = 0; i < copies; i++) {
+		memcpy(buf + i * (src->length + 1), src->data, src->length);
+		buf[i * (src->length + 1) + src->length] = '\n';
+	}
+
+	*out_length = length;
+	return buf;
+}
+
+static bool bench_file(const char *path, FILE *sink) {
+	MemArena *arena = arena_create_reserve(GiB(4));
+
+	SourceFile src;
+	if (!source_open(&src, arena, path)) {
+		arena_destroy(arena);
+		return false;
+	}
+
+	u64 length = 0;
+	char *corpus = build_corpus(arena, &src, &length);
+	u64 mark = arena->pos;
+	u64 scratch_mark = arena_scratch()->pos;
+
+	PhaseTimes best = { 1e30, 1e30, 1e30 };
+	u64 token_count = 0;
+	u64 node_count = 0;
+	bool success = true;
+
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		arena_pop_to(arena, mark);
+		StringPool pool = pool_create(arena, KiB(1));
+
+		double t0 = now_seconds();
+		TokenList tokens = tokenize(corpus, length, &pool);
+		double t1 = now_seconds();
+		ParseResult result = parse(&tokens, &pool, arena);
+		double t2 = now_seconds();
+		fprint_ast(sink, result.root);
+		fflush(sink);
+		double t3 = now_seconds();
+
+		best.tokenize = MIN(best.tokenize, t1 - t0);
+		best.parse = MIN(best.parse, t2 - t1);
+		best.print = MIN(best.print, t3 - t2);
+
+		if (i == 0) {
+			CompactAst ast = compact_ast_build(result.root, &pool, NULL);
+			node_count = vec_size(ast.tags);
+			compact_ast_free(&ast);
+		}
+
+		token_count = tokens.count;
+		success = success && result.success;
+		token_list_free(&tokens);
+		pool_destroy(&pool);
+	}
+
+	u64 peak_arena = arena_high_water(arena) - mark;
+	u64 peak_scratch = arena_high_water(arena_scratch()) - scratch_mark;
+	double front_end = best.tokenize + best.parse;
+
+	// One JSON object per line so runs can be collected and diffed by scripts.
+	printf("{\"corpus\":\"%s\",\"bytes\":%llu,\"tokens\":%llu,\"nodes\":%llu,\"iterations\":%d,\"success\":%s,"
+		"\"tokenize_ms\":%.3f,\"parse_ms\":%.3f,\"print_ms\":%.3f,"
+		"\"tokenize_mb_per_s\":%.1f,\"parse_mb_per_s\":%.1f,\"tokens_per_s\":%.0f,\"nodes_per_s\":%.0f,"
+		"\"peak_arena_bytes\":%llu,\"peak_scratch_bytes\":%llu}\n",
+		path, (unsigned long long)length, (unsigned long long)token_count, (unsigned long long)node_count,
+		BENCH_ITERATIONS, success ? "true" : "false",
+		best.tokenize * 1e3, best.parse * 1e3, best.print * 1e3,
+		length / best.tokenize / 1e6, length / front_end / 1e6,
+		token_count / best.tokenize, node_count / best.parse,
+		(unsigned long long)peak_arena, (unsigned long long)peak_scratch);
+
+	source_close(&src);
+	arena_destroy(arena);
+	return success;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("Usage: %s <file.luat>...\n", argv[0]);
+		return 1;
+	}
+
+	FILE *sink = fopen("/dev/null", "w");
+	if (!sink) return 1;
+
+	int failed = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!bench_file(argv[i], sink)) failed++;
+	}
+
+	fclose(sink);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/typedefs.h"
+
+// Writes a synthetic but valid .luat program of roughly the requested size
+// to stdout. Each kind stresses one part of the front end; "mixed" rotates
+// through all of them together with ordinary function bodies.
+
+typedef enum {
+	CORPUS_MIXED,
+	CORPUS_DEEP,
+	CORPUS_WIDE,
+	CORPUS_DECLS,
+	CORPUS_STRINGS,
+} CorpusKind;
+
+static const char *kind_names[] = {
+	[CORPUS_MIXED]   = "mixed",
+	[CORPUS_DEEP]    = "deep",
+	[CORPUS_WIDE]    = "wide",
+	[CORPUS_DECLS]   = "decls",
+	[CORPUS_STRINGS] = "strings",
+};
+
+static u64 rng_state = 0x9e3779b97f4a7c15ull;
+static u64 written = 0;
+static u64 unit = 0;
+
+static u64 next_random(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static u32 range(u32 lo, u32 hi) {
+	return lo + (u32)(next_random() % (hi - lo + 1));
+}
+
+static void emit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void emit(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int n = vprintf(fmt, args);
+	va_end(args);
+	if (n > 0) written += (u64)n;
+}
+
+static const char *binary_ops[] = { "+", "-", "*", "/", "%", "..", "<", "==", "and", "or" };
+
+static void emit_expr(u32 depth) {
+	if (depth == 0) {
+		switch (range(0, 3)) {
+			case 0: emit("%u", range(0, 100000)); break;
+			case 1: emit("v%u", range(0, 63)); break;
+			case 2: emit("\"s%u\"", range(0, 999)); break;
+			case 3: emit("%u.%u", range(0, 999), range(0, 99)); break;
+		}
+		return;
+	}
+
+	switch (range(0, 4)) {
+		case 0:
+		case 1:
+			emit("(");
+			emit_expr(depth - 1);
+			emit(" %s ", binary_ops[range(0, sizeof(binary_ops) / sizeof(*binary_ops) - 1)]);
+			emit_expr(range(0, 1));
+			emit(")");
+			break;
+		case 2:
+			emit("f%u(", range(0, 15));
+			emit_expr(depth - 1);
+			emit(", v%u)", range(0, 63));
+			break;
+		case 3:
+			emit("not ");
+			emit_expr(depth - 1);
+			break;
+		case 4:
+			emit("v%u.field%u[", range(0, 63), range(0, 7));
+			emit_expr(depth - 1);
+			emit("]");
+			break;
+	}
+}
+
+static void emit_deep(void) {
+	emit("local deep%llu: number = ", (unsigned long long)unit);
+	emit_expr(range(32, 128));
+	emit(";\n");
+}
+
+static void emit_wide(void) {
+	u32 width = range(64, 512);
+	emit("local row%llu: Row = Row {", (unsigned long long)unit);
+	for (u32 i = 0; i < width; i++) {
+		if (i % 8 == 0) emit("\n\t");
+		switch (i % 3) {
+			case 0: emit("k%u: %u", i, range(0, 1000)); break;
+			case 1: emit("k%u: \"v%u\"", i, range(0, 1000)); break;
+			case 2: emit("k%u: %s", i, range(0, 1) ? "true" : "false"); break;
+		}
+		if (i + 1 < width) emit(", ");
+	}
+	emit("\n};\n");
+}
+
+static void emit_decls(void) {
+	unsigned long long n = (unsigned long long)unit;
+	u32 methods = range(2, 8);
+
+	emit("trait Shape%llu<T>\n", n);
+	for (u32 i = 0; i < methods; i++) emit("\tfunction m%u(a: T, b: number): [T]\n", i);
+	emit("end\n\n");
+
+	emit("struct Box%llu<T: Shape%llu>\n", n, n);
+	for (u32 i = 0; i < methods; i++) emit("\tfield%u: T,\n", i);
+	emit("\tcount: number\nend\n\n");
+
+	emit("impl<T> Box%llu<T> for Shape%llu<T>\n", n, n);
+	for (u32 i = 0; i < methods; i++) {
+		emit("\tfunction m%u(a: T, b: number): [T]\n", i);
+		emit("\t\tlocal total: number = self.count + b * %u;\n", i + 1);
+		emit("\t\treturn self.field%u;\n", i);
+		emit("\tend\n");
+	}
+	emit("end\n\n");
+}
+
+static void emit_strings(void) {
+	u32 length = range(1024, 16384);
+
+	emit("local text%llu: string = \"", (unsigned long long)unit);
+	for (u32 i = 0; i < length; i++) {
+		u32 r = range(0, 63);
+		if (r == 0) emit("\\n");
+		else if (r == 1) emit("\\\"");
+		else emit("%c", 'a' + (char)(r % 26));
+	}
+	emit("\";\n");
+
+	emit("local asset%llu: string = r##\"\n", (unsigned long long)unit);
+	for (u32 i = 0; i < length; i++) {
+		char c = i % 64 == 63 ? '\n' : (char)('!' + range(0, 90));
+		emit("%c", c == '"' ? '\'' : c);
+	}
+	emit("\n\"##;\n");
+}
+
+static void emit_function(void) {
+	unsigned long long n = (unsigned long long)unit;
+
+	emit("function work%llu(p: Player, delta: number): number\n", n);
+	emit("\t-- generated body %llu\n", n);
+	emit("\tlocal speed: number, falling: bool = 0, true;\n");
+	emit("\tif p.score > %u then\n\t\tprint(\"high\");\n", range(0, 1000));
+	emit("\telseif p.score < 0 then\n\t\tprint(\"low\");\n\telse\n\t\tspeed = speed + delta;\n\tend\n");
+	emit("\twhile falling do\n\t\tspeed = speed + 9.81 * delta;\n\t\tif speed > 100 then\n\t\t\tbreak;\n\t\tend\n\tend\n");
+	emit("\tfor i = 0, %u, 1 do\n\t\tlocal v: number = i * 2;\n\tend\n", range(1, 100));
+	emit("\tfor k, v in pairs(p.inventory) do\n\t\tprint(v);\n\tend\n");
+	emit("\t--[[ block\n\t     comment ]]\n");
+	emit("\treturn speed;\nend\n\n");
+}
+
+static void emit_unit(CorpusKind kind) {
+	switch (kind) {
+		case CORPUS_DEEP:    emit_deep(); break;
+		case CORPUS_WIDE:    emit_wide(); break;
+		case CORPUS_DECLS:   emit_decls(); break;
+		case CORPUS_STRINGS: emit_strings(); break;
+		case CORPUS_MIXED:
+			switch (unit % 5) {
+				case 0: emit_function(); break;
+				case 1: emit_deep(); break;
+				case 2: emit_wide(); break;
+				case 3: emit_decls(); break;
+				case 4: emit_strings(); break;
+			}
+			break;
+	}
+	unit++;
+}
+
+int main(int argc, char **argv) {
+	CorpusKind kind = CORPUS_MIXED;
+	u64 size = MiB(4);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--kind") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+			u32 k = 0;
+			while (k < sizeof(kind_names) / sizeof(*kind_names) && strcmp(kind_names[k], name) != 0) k++;
+			if (k == sizeof(kind_names) / sizeof(*kind_names)) {
+				fprintf(stderr, "Unknown corpus kind '%s'.\n", name);
+				return 1;
+			}
+			kind = (CorpusKind)k;
+		}
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) size = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) rng_state ^= strtoull(argv[++i], NULL, 0) * 0xbf58476d1ce4e5b9ull;
+		else {
+			fprintf(stderr, "Usage: %s [--kind mixed|deep|wide|decls|strings] [--size BYTES] [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	emit("-- generated by gen_corpus --kind %s\n", kind_names[kind]);
+	while (written < size) emit_unit(kind);
+
+	return 0;
+}
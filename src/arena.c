@@ -1,30 +1,73 @@
 #include <stdlib.h>
 #include <memory.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "arena.h"
+#include "stats.h"
 
 #define ARENA_BASE_POS (sizeof(MemArena))
 #define ARENA_ALIGN (sizeof(void*))
+#define ARENA_COMMIT_SIZE KiB(64)
 
 MemArena *arena_create(u64 capacity) {
 	MemArena *arena = (MemArena*)malloc(capacity);
 	arena->capacity = capacity;
 	arena->pos = ARENA_BASE_POS;
+	arena->committed = capacity;
+	arena->high_water = ARENA_BASE_POS;
+	arena->reserved = false;
 
 	return arena;
 };
 
+MemArena *arena_create_reserve(u64 reserve) {
+	reserve = ALIGN_UP_POW2(reserve, ARENA_COMMIT_SIZE);
+
+	void *mem = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+
+	if (mprotect(mem, ARENA_COMMIT_SIZE, PROT_READ | PROT_WRITE) != 0) {
+		munmap(mem, reserve);
+		return NULL;
+	}
+
+	MemArena *arena = (MemArena*)mem;
+	arena->capacity = reserve;
+	arena->pos = ARENA_BASE_POS;
+	arena->committed = ARENA_COMMIT_SIZE;
+	arena->high_water = ARENA_BASE_POS;
+	arena->reserved = true;
+
+	return arena;
+}
+
 void arena_destroy(MemArena *arena) {
-	free(arena);
+	if (arena->reserved) munmap(arena, arena->capacity);
+	else free(arena);
 };
 
+static bool arena_commit(MemArena *arena, u64 new_pos) {
+	if (!arena->reserved || new_pos > arena->capacity) return false;
+
+	u64 new_commit = MIN(ALIGN_UP_POW2(new_pos, ARENA_COMMIT_SIZE), arena->capacity);
+	u8 *start = (u8*)arena + arena->committed;
+
+	if (mprotect(start, new_commit - arena->committed, PROT_READ | PROT_WRITE) != 0) return false;
+
+	arena->committed = new_commit;
+	return true;
+}
+
 void *arena_push(MemArena *arena, u64 size, bool non_zero) {
 	u64 pos_aligned = ALIGN_UP_POW2(arena->pos, ARENA_ALIGN);
 	u64 new_pos = pos_aligned + size;
 
-	if (new_pos > arena->capacity) return NULL;
+	if (new_pos > arena->committed && !arena_commit(arena, new_pos)) return NULL;
 
 	arena->pos = new_pos;
+	STAT_INC(arena_pushes);
+	STAT_ADD(arena_push_bytes, size);
 
 	u8 *out = (u8*)arena + pos_aligned;
 
@@ -36,7 +79,7 @@ void *arena_push(MemArena *arena, u64 size, bool non_zero) {
 };
 
 void *arena_push_byte(MemArena *arena, u8 byte) {
-	if (arena->pos >= arena->capacity) return NULL;
+	if (arena->pos >= arena->committed && !arena_commit(arena, arena->pos + 1)) return NULL;
 	u8 *ptr = (u8*)arena + arena->pos;
 	*ptr = byte;
 	arena->pos++;
@@ -55,11 +98,12 @@ void *arena_resize(MemArena *arena, void *base, u64 old_size, u64 new_size) {
 
 	if (old_end == arena_head) {
 		u64 diff = new_size - old_size;
-		if (arena->pos + diff > arena->capacity) {
+		u64 new_pos = arena->pos + diff;
+		if (new_pos > arena->committed && !arena_commit(arena, new_pos)) {
 			return NULL;
 		}
 
-		arena->pos += diff;
+		arena->pos = new_pos;
 		return base;
 	}
 
@@ -71,6 +115,8 @@ void *arena_resize(MemArena *arena, void *base, u64 old_size, u64 new_size) {
 }
 
 void arena_pop(MemArena *arena, u64 size) {
+	arena->high_water = MAX(arena->high_water, arena->pos);
+
 	size = MIN(size, arena->pos - ARENA_BASE_POS);
 	arena->pos -= size;
 };
@@ -83,3 +129,77 @@ void arena_pop_to(MemArena *arena, u64 pos) {
 void arena_clear(MemArena *arena) {
 	arena_pop_to(arena, ARENA_BASE_POS);
 };
+
+u64 arena_high_water(MemArena *arena) {
+	return MAX(arena->high_water, arena->pos);
+}
+
+u64 arena_committed(MemArena *arena) {
+	return arena->committed;
+}
+
+// The key only exists for its destructor, which releases a thread's
+// scratch arena when the thread exits; worker threads come and go with
+// every parallel lex or parse, and each would otherwise leave its
+// reservation behind.
+static _Thread_local MemArena *scratch = NULL;
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_release(void *arena) {
+	arena_destroy(arena);
+	scratch = NULL;
+}
+
+static void scratch_key_create(void) {
+	pthread_key_create(&scratch_key, scratch_release);
+}
+
+MemArena *arena_scratch(void) {
+	if (!scratch) {
+		scratch = arena_create_reserve(GiB(1));
+		pthread_once(&scratch_once, scratch_key_create);
+		pthread_setspecific(scratch_key, scratch);
+	}
+	return scratch;
+}
+
+void *arena_list_grow(ArenaList *list) {
+	u64 old_size = list->count * list->elem_size;
+	u8 *base = arena_resize(list->arena, list->base, old_size, old_size + list->elem_size);
+	if (!base) return NULL;
+
+	list->base = base;
+	list->count++;
+	return base + old_size;
+}
+
+void *arena_list_append(ArenaList *list, const void *items, u64 count) {
+	if (count == 0) return list->base;
+
+	u64 old_size = list->count * list->elem_size;
+	u64 size = count * list->elem_size;
+	u8 *base = arena_resize(list->arena, list->base, old_size, old_size + size);
+	if (!base) return NULL;
+
+	memcpy(base + old_size, items, size);
+	list->base = base;
+	list->count += count;
+	return base + old_size;
+}
+
+void *arena_list_finish(ArenaList *list, MemArena *dst) {
+	void *out = NULL;
+	if (list->count) {
+		out = arena_push(dst, list->count * list->elem_size, true);
+		memcpy(out, list->base, list->count * list->elem_size);
+	}
+	arena_list_end(list);
+	return out;
+}
+
+void arena_list_end(ArenaList *list) {
+	arena_pop_to(list->arena, list->start);
+	list->base = NULL;
+	list->count = 0;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -7,9 +8,16 @@
 typedef struct {
 	u64 capacity;
 	u64 pos;
+
+	// For reserved arenas only [committed] bytes are backed by memory, the
+	// rest of [capacity] is address space that gets committed on demand.
+	u64 committed;
+	u64 high_water;
+	bool reserved;
 } MemArena;
 
 MemArena *arena_create(u64 capacity);
+MemArena *arena_create_reserve(u64 reserve);
 void arena_destroy(MemArena *arena);
 
 void *arena_push(MemArena *arena, u64 size, bool non_zero);
@@ -19,6 +27,62 @@ void arena_pop(MemArena *arena, u64 size);
 void arena_pop_to(MemArena *arena, u64 pos);
 void arena_clear(MemArena *arena);
 
+u64 arena_high_water(MemArena *arena);
+u64 arena_committed(MemArena *arena);
+
+// Per-thread arena for temporaries that never outlive the call building
+// them, released when its thread exits. Users must pop back to where they
+// started before returning.
+MemArena *arena_scratch(void);
+
+// Stack-style list builder. Items are appended in place at the arena head;
+// nested lists are fine as long as each one is finished or ended before
+// its parent grows again, which keeps both contiguous.
+typedef struct {
+	MemArena *arena;
+	u8 *base;
+	u64 start;
+	u64 count;
+	u64 elem_size;
+} ArenaList;
+
+void *arena_list_grow(ArenaList *list);
+void *arena_list_append(ArenaList *list, const void *items, u64 count);
+void *arena_list_finish(ArenaList *list, MemArena *dst);
+void arena_list_end(ArenaList *list);
+
+static inline ArenaList arena_list_begin(MemArena *arena, u64 elem_size) {
+	ArenaList list = { arena, NULL, arena->pos, 0, elem_size };
+	return list;
+}
+
+static inline void *arena_list_push(ArenaList *list) {
+	MemArena *a = list->arena;
+	u8 *end = list->base + list->count * list->elem_size;
+	if (list->base && end == (u8*)a + a->pos && a->pos + list->elem_size <= a->committed) {
+		a->pos += list->elem_size;
+		list->count++;
+		return end;
+	}
+	return arena_list_grow(list);
+}
+
+// Drops the last item and returns it; the memory stays valid until the next
+// push. At the arena head the slot is given back, so a list used as a stack
+// stays in place.
+static inline void *arena_list_pop(ArenaList *list) {
+	MemArena *a = list->arena;
+	list->count--;
+	u8 *item = list->base + list->count * list->elem_size;
+	if (item + list->elem_size == (u8*)a + a->pos) a->pos -= list->elem_size;
+	return item;
+}
+
+#define ARENA_LIST(T) arena_list_begin(arena_scratch(), sizeof(T))
+#define ARENA_LIST_PUSH(list, T, value) (*(T*)arena_list_push(&(list)) = (value))
+#define ARENA_LIST_AT(list, T, i) (((T*)(list).base)[i])
+#define ARENA_LIST_POP(list, T) (*(T*)arena_list_pop(&(list)))
+
 #define ARENA_BASE(a) ((u8*)a + sizeof(MemArena))
 
 #define PUSH_STRUCT(arena, T)      (T*)arena_push((arena), sizeof(T), false)
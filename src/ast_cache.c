@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ast_cache.h"
+#include "ast_compact.h"
+#include "arena.h"
+#include "vec.h"
+
+#define AST_CACHE_MAGIC "LUATAST"
+#define AST_CACHE_FORMAT 5
+
+// Tag numbering is part of the format, so adding a node kind invalidates
+// old entries without anyone having to remember to bump the format.
+#define AST_CACHE_VERSION ((AST_CACHE_FORMAT << 16) | (NODE_TYPE + TYPE_ARRAY))
+
+#define AST_CACHE_PATH_MAX 4096
+
+// File layout after the header: lhs, rhs, the source offset of every node
+// and extra as u32 arrays, then the length of every string, then one byte
+// per node tag and finally the string bytes back to back. All u32 arrays
+// come first so they stay aligned.
+//
+// The payload carries a hash, so a file whose payload doesn't match is a
+// miss; one that matches is still expanded checked, and any node, list or
+// string index out of range makes it a miss too.
+typedef struct {
+	char magic[8];
+	u32 version;
+	u32 root;
+	u64 source_hash;
+	u64 source_length;
+	u32 node_count;
+	u32 extra_count;
+	u32 string_count;
+	u32 string_bytes;
+	u64 payload_hash;
+} CacheHeader;
+
+// A tree parsed under one nesting limit may be too deep for a stricter
+// one, so the limit is part of the key.
+u64 ast_cache_key(const char *source, u64 length) {
+	return hash_bytes(source, length) ^ ((u64)parser_max_depth() * 0x9e3779b97f4a7c15ull);
+}
+
+static void cache_path(char *out, const char *dir, u64 key) {
+	snprintf(out, AST_CACHE_PATH_MAX, "%s/%016llx.ast", dir, (unsigned long long)key);
+}
+
+Stmt *ast_cache_load(const char *dir, u64 key, u64 length, StringPool *pool, TypeTable *types, MemArena *arena, SpanTable *spans) {
+	char path[AST_CACHE_PATH_MAX];
+	cache_path(path, dir, key);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (u64)st.st_size < sizeof(CacheHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	u64 size = (u64)st.st_size;
+	const u8 *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+
+	const CacheHeader *h = (const CacheHeader*)data;
+	u64 words = 3 * (u64)h->node_count + h->extra_count + h->string_count;
+	u64 expected = sizeof(CacheHeader) + words * sizeof(u32) + h->node_count + h->string_bytes;
+
+	bool valid =
+		memcmp(h->magic, AST_CACHE_MAGIC, sizeof(h->magic)) == 0 &&
+		h->version == AST_CACHE_VERSION &&
+		h->source_hash == key &&
+		h->source_length == length &&
+		h->node_count > h->root &&
+		h->string_count > 0 &&
+		size == expected &&
+		hash_bytes((const char*)data + sizeof(CacheHeader), size - sizeof(CacheHeader)) == h->payload_hash;
+
+	if (!valid) {
+		munmap((void*)data, size);
+		return NULL;
+	}
+
+	const u32 *words_at = (const u32*)(data + sizeof(CacheHeader));
+	const u32 *lengths = words_at + 3 * h->node_count + h->extra_count;
+	const char *bytes = (const char*)(lengths + h->string_count) + h->node_count;
+
+	// The node arrays are used in place; only the string table is rebuilt,
+	// with this run's pool ids, on the scratch arena.
+	CompactAst ast = {0};
+	ast.lhs = (u32*)words_at;
+	ast.rhs = (u32*)words_at + h->node_count;
+	ast.offsets = (u32*)words_at + 2 * h->node_count;
+	ast.extra = (u32*)words_at + 3 * h->node_count;
+	ast.tags = (u8*)(lengths + h->string_count);
+	ast.root = h->root;
+	ast.string_count = h->string_count;
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	ast.strings = PUSH_ARRAY_NZ(scratch, u32, h->string_count);
+	ast.strings[0] = 0;
+
+	u64 at = 0;
+	u32 i = 1;
+	for (; i < h->string_count && at + lengths[i] <= h->string_bytes; i++) {
+		ast.strings[i] = pool_intern_id(pool, bytes + at, lengths[i]);
+		at += lengths[i];
+	}
+
+	// Offsets past the source would place diagnostics nowhere.
+	u32 n = 0;
+	while (n < h->node_count && (ast.offsets[n] <= length || ast.offsets[n] == COMPACT_NO_OFFSET)) n++;
+
+	Stmt *root = NULL;
+	if (i == h->string_count && at == h->string_bytes && n == h->node_count) {
+		root = compact_ast_expand_checked(&ast, h->node_count, h->extra_count, pool, types, arena, spans);
+	}
+
+	arena_pop_to(scratch, mark);
+	munmap((void*)data, size);
+	return root;
+}
+
+bool ast_cache_store(const char *dir, u64 key, u64 length, Stmt *root, StringPool *pool, const SpanTable *spans) {
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) return false;
+
+	CompactAst ast = compact_ast_build_portable(root, pool, spans);
+
+	CacheHeader h = {0};
+	memcpy(h.magic, AST_CACHE_MAGIC, sizeof(h.magic));
+	h.version = AST_CACHE_VERSION;
+	h.root = ast.root;
+	h.source_hash = key;
+	h.source_length = length;
+	h.node_count = vec_size(ast.tags);
+	h.extra_count = vec_size(ast.extra);
+	h.string_count = ast.string_count;
+
+	for (u32 i = 1; i < ast.string_count; i++) {
+		h.string_bytes += (u32)strlen(pool_str(pool, ast.strings[i]));
+	}
+
+	// The payload is put together in one piece so it can be hashed and
+	// written at once.
+	u64 words = 3 * (u64)h.node_count + h.extra_count + h.string_count;
+	u64 payload_size = words * sizeof(u32) + h.node_count + h.string_bytes;
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	u8 *payload = PUSH_ARRAY_NZ(scratch, u8, payload_size);
+	u32 *offsets = (u32*)payload + 2 * h.node_count;
+	u32 *lengths = (u32*)payload + 3 * h.node_count + h.extra_count;
+	u8 *tags = (u8*)(lengths + h.string_count);
+	u8 *bytes = tags + h.node_count;
+
+	memcpy(payload, ast.lhs, h.node_count * sizeof(u32));
+	memcpy((u32*)payload + h.node_count, ast.rhs, h.node_count * sizeof(u32));
+	if (ast.offsets) memcpy(offsets, ast.offsets, h.node_count * sizeof(u32));
+	else for (u32 i = 0; i < h.node_count; i++) offsets[i] = COMPACT_NO_OFFSET;
+	memcpy((u32*)payload + 3 * h.node_count, ast.extra, h.extra_count * sizeof(u32));
+	memcpy(tags, ast.tags, h.node_count);
+	lengths[0] = 0;
+	for (u32 i = 1; i < ast.string_count; i++) {
+		const char *str = pool_str(pool, ast.strings[i]);
+		lengths[i] = (u32)strlen(str);
+		memcpy(bytes, str, lengths[i]);
+		bytes += lengths[i];
+	}
+	h.payload_hash = hash_bytes((const char*)payload, payload_size);
+
+	// Written under a unique name and renamed into place, so a reader never
+	// sees a half-written entry and concurrent writers can't interleave.
+	char path[AST_CACHE_PATH_MAX];
+	char temp[AST_CACHE_PATH_MAX + 64];
+	cache_path(path, dir, key);
+	snprintf(temp, sizeof(temp), "%s.%ld.%lx.tmp", path, (long)getpid(), (unsigned long)pthread_self());
+
+	FILE *f = fopen(temp, "wb");
+	bool ok = f != NULL;
+	if (ok) {
+		ok = fwrite(&h, sizeof(h), 1, f) == 1;
+		ok = ok && fwrite(payload, 1, payload_size, f) == payload_size;
+		ok = (fclose(f) == 0) && ok;
+	}
+
+	if (ok) ok = rename(temp, path) == 0;
+	if (!ok) remove(temp);
+
+	arena_pop_to(scratch, mark);
+	compact_ast_free(&ast);
+	return ok;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdbool.h>
+
+#include "arena.h"
+#include "parser.h"
+#include "string_pool.h"
+#include "typedefs.h"
+
+// On-disk cache of parsed trees, one file per distinct source text and
+// parser nesting limit, named after the hash of both. Entries hold the
+// portable compact form of the tree plus the strings it uses; loading maps
+// the file, interns those strings and expands the nodes straight into the
+// caller's arena.
+
+u64 ast_cache_key(const char *source, u64 length);
+
+// Returns NULL on a miss or when the entry doesn't match (format changed,
+// different length, truncated or corrupted file). Entries keep the offset
+// of every node, so on a hit spans, when given, covers the loaded tree as
+// the parse's table did; its source fields are left as the caller set them.
+Stmt *ast_cache_load(const char *dir, u64 key, u64 length, StringPool *pool, TypeTable *types, MemArena *arena, SpanTable *spans);
+bool ast_cache_store(const char *dir, u64 key, u64 length, Stmt *root, StringPool *pool, const SpanTable *spans);
@@ -0,0 +1,932 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast_compact.h"
+#include "arena.h"
+#include "parser.h"
+#include "type_table.h"
+#include "vec.h"
+
+typedef struct {
+	CompactAst *ast;
+	StringPool *pool;
+	const SpanTable *spans;
+
+	// Pool id -> index into ast->strings, only used for portable trees.
+	u32 *local_keys;
+	u32 *local_values;
+	u32 local_capacity;
+} Lowering;
+
+static NodeIndex add_node(CompactAst *a, u32 tag, u32 lhs, u32 rhs) {
+	NodeIndex index = vec_size(a->tags);
+	vec_push(a->tags, (u8)tag);
+	vec_push(a->lhs, lhs);
+	vec_push(a->rhs, rhs);
+	return index;
+}
+
+static u32 push_extra(CompactAst *a, const u32 *words, u32 count) {
+	u32 at = vec_size(a->extra);
+	for (u32 i = 0; i < count; i++) vec_push(a->extra, words[i]);
+	return at;
+}
+
+// Lists are reserved up front and filled in afterwards, since lowering a
+// child may append to extra itself.
+static u32 reserve_list(CompactAst *a, u32 count) {
+	if (count == 0) return 0;
+	u32 at = vec_size(a->extra);
+	vec_push(a->extra, count);
+	for (u32 i = 0; i < count; i++) vec_push(a->extra, 0);
+	return at;
+}
+
+static void list_set(CompactAst *a, u32 list, u32 i, u32 value) {
+	a->extra[list + 1 + i] = value;
+}
+
+static u32 local_hash(u32 id) {
+	return id * 0x9e3779b1u;
+}
+
+static void local_grow(Lowering *l) {
+	u32 old_capacity = l->local_capacity;
+	u32 *old_keys = l->local_keys;
+	u32 *old_values = l->local_values;
+
+	l->local_capacity = old_capacity ? old_capacity * 2 : 256;
+	l->local_keys = calloc(l->local_capacity, sizeof(u32));
+	l->local_values = calloc(l->local_capacity, sizeof(u32));
+
+	u32 mask = l->local_capacity - 1;
+	for (u32 i = 0; i < old_capacity; i++) {
+		if (!old_keys[i]) continue;
+		u32 index = local_hash(old_keys[i]) & mask;
+		while (l->local_keys[index]) index = (index + 1) & mask;
+		l->local_keys[index] = old_keys[i];
+		l->local_values[index] = old_values[i];
+	}
+
+	free(old_keys);
+	free(old_values);
+}
+
+static u32 local_str(Lowering *l, u32 id) {
+	CompactAst *a = l->ast;
+	if ((a->string_count + 1) * 2 > l->local_capacity) local_grow(l);
+
+	u32 mask = l->local_capacity - 1;
+	u32 index = local_hash(id) & mask;
+	while (l->local_keys[index]) {
+		if (l->local_keys[index] == id) return l->local_values[index];
+		index = (index + 1) & mask;
+	}
+
+	l->local_keys[index] = id;
+	l->local_values[index] = a->string_count;
+	vec_push(a->strings, id);
+	return a->string_count++;
+}
+
+static u32 str_id(Lowering *l, const char *str) {
+	if (!str) return 0;
+
+	u32 id;
+	const char *base = (const char*)l->pool->strings;
+	if (str > base && str < base + l->pool->strings->pos) id = pool_id(l->pool, str);
+	else id = pool_intern_id(l->pool, str, strlen(str));
+
+	return l->ast->strings ? local_str(l, id) : id;
+}
+
+static void pad_offsets(CompactAst *a, u32 count) {
+	while (vec_size(a->offsets) < count) vec_push(a->offsets, COMPACT_NO_OFFSET);
+}
+
+// Types, params and signatures are added without one, so the array is
+// padded up to n first.
+static void lower_offset(Lowering *l, NodeIndex n, const void *node) {
+	if (!l->spans) return;
+	pad_offsets(l->ast, n + 1);
+	span_offset(l->spans, node, &l->ast->offsets[n]);
+}
+
+static NodeIndex lower_expr(Lowering *l, Expr *e);
+static NodeIndex lower_stmt(Lowering *l, Stmt *s);
+static NodeIndex lower_signature(Lowering *l, FuncSignature *sig);
+
+static NodeIndex lower_type(Lowering *l, Type *t) {
+	if (!t) return 0;
+	CompactAst *a = l->ast;
+	u32 tag = NODE_TYPE + t->kind;
+
+	switch (t->kind) {
+		case TYPE_ARRAY: {
+			NodeIndex inner = lower_type(l, t->as.array.inner);
+			return add_node(a, tag, inner, 0);
+		}
+		case TYPE_STRUCT:
+		case TYPE_TRAIT: {
+			u32 args = reserve_list(a, t->as.user_type.arg_count);
+			for (int i = 0; i < t->as.user_type.arg_count; i++) {
+				list_set(a, args, i, lower_type(l, t->as.user_type.args[i]));
+			}
+			return add_node(a, tag, str_id(l, t->as.user_type.name), args);
+		}
+		case TYPE_GENERIC:
+			return add_node(a, tag, str_id(l, t->as.param_name), 0);
+		case TYPE_FUNCTION: {
+			NodeIndex sig = lower_signature(l, t->as.function.sig);
+			return add_node(a, tag, sig, 0);
+		}
+		default:
+			return add_node(a, tag, 0, 0);
+	}
+}
+
+static u32 lower_types(Lowering *l, Type **types, int count) {
+	u32 list = reserve_list(l->ast, count);
+	for (int i = 0; i < count; i++) list_set(l->ast, list, i, lower_type(l, types[i]));
+	return list;
+}
+
+static u32 lower_params(Lowering *l, Param *params, int count) {
+	u32 list = reserve_list(l->ast, count);
+	for (int i = 0; i < count; i++) {
+		NodeIndex type = lower_type(l, params[i].type);
+		list_set(l->ast, list, i, add_node(l->ast, NODE_PARAM, str_id(l, params[i].name), type));
+	}
+	return list;
+}
+
+static u32 lower_generics(Lowering *l, GenericParam *generics, int count) {
+	u32 list = reserve_list(l->ast, count);
+	for (int i = 0; i < count; i++) {
+		u32 constraints = lower_types(l, generics[i].constraints, generics[i].constraint_count);
+		list_set(l->ast, list, i, add_node(l->ast, NODE_GENERIC_PARAM, str_id(l, generics[i].name), constraints));
+	}
+	return list;
+}
+
+static NodeIndex lower_signature(Lowering *l, FuncSignature *sig) {
+	if (!sig) return 0;
+	u32 words[3];
+	words[0] = lower_generics(l, sig->generics, sig->generic_count);
+	words[1] = lower_params(l, sig->params, sig->param_count);
+	words[2] = lower_types(l, sig->return_types, sig->return_count);
+	return add_node(l->ast, NODE_SIGNATURE, push_extra(l->ast, words, 3), 0);
+}
+
+static u32 lower_exprs(Lowering *l, Expr **exprs, int count) {
+	u32 list = reserve_list(l->ast, count);
+	for (int i = 0; i < count; i++) list_set(l->ast, list, i, lower_expr(l, exprs[i]));
+	return list;
+}
+
+// Where a lowered expression's index goes: lhs or rhs of an already added
+// node, or a slot in extra. The arrays may move while lowering, so slots
+// are positions rather than pointers.
+typedef enum { SLOT_NONE, SLOT_LHS, SLOT_RHS, SLOT_EXTRA } SlotKind;
+
+typedef struct {
+	Expr *expr;
+	u32 at;
+	SlotKind kind;
+} LowerWork;
+
+static void push_lower(ArenaList *work, Expr *e, SlotKind kind, u32 at) {
+	if (e) ARENA_LIST_PUSH(*work, LowerWork, ((LowerWork){ e, at, kind }));
+}
+
+static void push_lower_entries(ArenaList *work, u32 list, TableEntry *entries, int count) {
+	for (int i = count - 1; i >= 0; i--) {
+		push_lower(work, entries[i].value, SLOT_EXTRA, list + 1 + 2*i + 1);
+		push_lower(work, entries[i].key, SLOT_EXTRA, list + 1 + 2*i);
+	}
+}
+
+// Parents are added before their children, which then fill in the slot
+// left for them, so operator and call chains of any length lower without
+// recursion. Function bodies go through lower_stmt, which only recurses as
+// deep as the parser allowed statements to nest.
+static NodeIndex lower_expr(Lowering *l, Expr *root) {
+	if (!root) return 0;
+	CompactAst *a = l->ast;
+	NodeIndex first = 0;
+
+	ArenaList work = ARENA_LIST(LowerWork);
+	push_lower(&work, root, SLOT_NONE, 0);
+
+	while (work.count) {
+		LowerWork w = ARENA_LIST_POP(work, LowerWork);
+		Expr *e = w.expr;
+		NodeIndex n = vec_size(a->tags);
+
+		switch (e->kind) {
+			case EXPR_NIL:    add_node(a, NODE_NIL, 0, 0); break;
+			case EXPR_BOOL:   add_node(a, e->as.boolean ? NODE_TRUE : NODE_FALSE, 0, 0); break;
+			case EXPR_VARARG: add_node(a, NODE_VARARG, 0, 0); break;
+			case EXPR_NUMBER: {
+				u32 bits[2];
+				memcpy(bits, &e->as.number, sizeof(bits));
+				add_node(a, NODE_NUMBER, bits[0], bits[1]);
+				break;
+			}
+			case EXPR_STRING:   add_node(a, NODE_STRING, str_id(l, e->as.string), 0); break;
+			case EXPR_VARIABLE: add_node(a, NODE_VARIABLE, str_id(l, e->as.variable.name), 0); break;
+
+			case EXPR_BINARY:
+				add_node(a, NODE_BINARY + e->as.binary.op, 0, 0);
+				push_lower(&work, e->as.binary.right, SLOT_RHS, n);
+				push_lower(&work, e->as.binary.left, SLOT_LHS, n);
+				break;
+			case EXPR_UNARY:
+				add_node(a, NODE_UNARY + e->as.unary.op, 0, 0);
+				push_lower(&work, e->as.unary.operand, SLOT_LHS, n);
+				break;
+			case EXPR_CALL: {
+				u32 args = reserve_list(a, e->as.call.arg_count);
+				add_node(a, NODE_CALL, 0, args);
+				for (int i = e->as.call.arg_count - 1; i >= 0; i--) {
+					push_lower(&work, e->as.call.args[i], SLOT_EXTRA, args + 1 + i);
+				}
+				push_lower(&work, e->as.call.callee, SLOT_LHS, n);
+				break;
+			}
+			case EXPR_INDEX:
+				add_node(a, NODE_INDEX, 0, 0);
+				push_lower(&work, e->as.index.index, SLOT_RHS, n);
+				push_lower(&work, e->as.index.target, SLOT_LHS, n);
+				break;
+			case EXPR_FIELD:
+				add_node(a, NODE_FIELD, 0, str_id(l, e->as.field.field));
+				push_lower(&work, e->as.field.target, SLOT_LHS, n);
+				break;
+			case EXPR_FUNCTION: {
+				NodeIndex sig = lower_signature(l, &e->as.function.signature);
+				NodeIndex body = lower_stmt(l, e->as.function.body);
+				n = add_node(a, NODE_FUNCTION, sig, body);
+				break;
+			}
+			case EXPR_TABLE: {
+				u32 entries = reserve_list(a, e->as.table.entry_count * 2);
+				add_node(a, NODE_TABLE, entries, 0);
+				push_lower_entries(&work, entries, e->as.table.entries, e->as.table.entry_count);
+				break;
+			}
+			case EXPR_STRUCT: {
+				u32 entries = reserve_list(a, e->as.struct_init.entry_count * 2);
+				add_node(a, NODE_STRUCT_INIT, 0, entries);
+				push_lower_entries(&work, entries, e->as.struct_init.entries, e->as.struct_init.entry_count);
+				push_lower(&work, e->as.struct_init.name, SLOT_LHS, n);
+				break;
+			}
+		}
+
+		lower_offset(l, n, e);
+
+		switch (w.kind) {
+			case SLOT_NONE:  first = n; break;
+			case SLOT_LHS:   a->lhs[w.at] = n; break;
+			case SLOT_RHS:   a->rhs[w.at] = n; break;
+			case SLOT_EXTRA: a->extra[w.at] = n; break;
+		}
+	}
+
+	arena_list_end(&work);
+	return first;
+}
+
+static NodeIndex lower_stmt_node(Lowering *l, Stmt *s) {
+	CompactAst *a = l->ast;
+	u32 words[6];
+
+	switch (s->kind) {
+		case STMT_EXPR:
+			return add_node(a, NODE_EXPR_STMT, lower_expr(l, s->as.expression), 0);
+		case STMT_BLOCK: {
+			u32 list = reserve_list(a, s->as.block.stmt_count);
+			for (int i = 0; i < s->as.block.stmt_count; i++) {
+				list_set(a, list, i, lower_stmt(l, s->as.block.stmts[i]));
+			}
+			return add_node(a, NODE_BLOCK, list, 0);
+		}
+		case STMT_RETURN:
+			return add_node(a, NODE_RETURN, lower_exprs(l, s->as.return_stmt.values, s->as.return_stmt.value_count), 0);
+		case STMT_BREAK:
+			return add_node(a, NODE_BREAK, 0, 0);
+		case STMT_ASSIGN: {
+			u32 targets = lower_exprs(l, s->as.assign.targets, s->as.assign.target_count);
+			u32 values = lower_exprs(l, s->as.assign.values, s->as.assign.value_count);
+			return add_node(a, NODE_ASSIGN, targets, values);
+		}
+		case STMT_LOCAL: {
+			u32 decls = lower_params(l, s->as.local.decls, s->as.local.decl_count);
+			u32 values = lower_exprs(l, s->as.local.values, s->as.local.value_count);
+			return add_node(a, NODE_LOCAL, decls, values);
+		}
+		case STMT_IF: {
+			NodeIndex condition = lower_expr(l, s->as.if_stmt.condition);
+			words[0] = lower_stmt(l, s->as.if_stmt.then_branch);
+			words[1] = lower_stmt(l, s->as.if_stmt.else_branch);
+			return add_node(a, NODE_IF, condition, push_extra(a, words, 2));
+		}
+		case STMT_WHILE: {
+			NodeIndex condition = lower_expr(l, s->as.while_stmt.condition);
+			NodeIndex body = lower_stmt(l, s->as.while_stmt.body);
+			return add_node(a, NODE_WHILE, condition, body);
+		}
+		case STMT_REPEAT: {
+			NodeIndex body = lower_stmt(l, s->as.repeat_stmt.body);
+			NodeIndex condition = lower_expr(l, s->as.repeat_stmt.condition);
+			return add_node(a, NODE_REPEAT, body, condition);
+		}
+		case STMT_FOR_NUM:
+			words[0] = lower_expr(l, s->as.for_num.start);
+			words[1] = lower_expr(l, s->as.for_num.end);
+			words[2] = lower_expr(l, s->as.for_num.step);
+			words[3] = lower_stmt(l, s->as.for_num.body);
+			return add_node(a, NODE_FOR_NUM, str_id(l, s->as.for_num.name), push_extra(a, words, 4));
+		case STMT_FOR_GEN: {
+			u32 names = reserve_list(a, s->as.for_gen.name_count);
+			for (int i = 0; i < s->as.for_gen.name_count; i++) {
+				list_set(a, names, i, str_id(l, s->as.for_gen.names[i]));
+			}
+			words[0] = lower_expr(l, s->as.for_gen.iter);
+			words[1] = lower_stmt(l, s->as.for_gen.body);
+			return add_node(a, NODE_FOR_GEN, names, push_extra(a, words, 2));
+		}
+		case STMT_FUNCTION:
+			words[0] = lower_signature(l, s->as.func_decl.signature);
+			words[1] = lower_stmt(l, s->as.func_decl.body);
+			return add_node(a, NODE_FUNCTION_DECL, str_id(l, s->as.func_decl.name), push_extra(a, words, 2));
+		case STMT_STRUCT:
+			words[0] = lower_generics(l, s->as.struct_decl.generics, s->as.struct_decl.generic_count);
+			words[1] = lower_params(l, s->as.struct_decl.fields, s->as.struct_decl.field_count);
+			return add_node(a, NODE_STRUCT_DECL, str_id(l, s->as.struct_decl.name), push_extra(a, words, 2));
+		case STMT_TRAIT: {
+			words[0] = lower_generics(l, s->as.trait_decl.generics, s->as.trait_decl.generic_count);
+			words[1] = reserve_list(a, s->as.trait_decl.func_count * 2);
+			for (int i = 0; i < s->as.trait_decl.func_count; i++) {
+				list_set(a, words[1], 2*i,   str_id(l, s->as.trait_decl.func_names[i]));
+				list_set(a, words[1], 2*i+1, lower_signature(l, s->as.trait_decl.functions[i]));
+			}
+			return add_node(a, NODE_TRAIT_DECL, str_id(l, s->as.trait_decl.name), push_extra(a, words, 2));
+		}
+		case STMT_IMPL: {
+			words[0] = lower_generics(l, s->as.impl_stmt.generics, s->as.impl_stmt.generic_count);
+			words[1] = str_id(l, s->as.impl_stmt.target_name);
+			words[2] = lower_types(l, s->as.impl_stmt.target_args, s->as.impl_stmt.target_arg_count);
+			words[3] = str_id(l, s->as.impl_stmt.trait_name);
+			words[4] = lower_types(l, s->as.impl_stmt.trait_args, s->as.impl_stmt.trait_arg_count);
+			words[5] = reserve_list(a, s->as.impl_stmt.func_count);
+			for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+				list_set(a, words[5], i, lower_stmt(l, s->as.impl_stmt.functions[i]));
+			}
+			return add_node(a, NODE_IMPL, push_extra(a, words, 6), 0);
+		}
+		case STMT_TYPE_ALIAS: {
+			NodeIndex type = lower_type(l, s->as.type_alias.type);
+			return add_node(a, NODE_TYPE_ALIAS, str_id(l, s->as.type_alias.name), type);
+		}
+	}
+
+	return 0;
+}
+
+static NodeIndex lower_stmt(Lowering *l, Stmt *s) {
+	if (!s) return 0;
+	NodeIndex n = lower_stmt_node(l, s);
+	lower_offset(l, n, s);
+	return n;
+}
+
+static void lower_root(Lowering *l, Stmt *root) {
+	CompactAst *a = l->ast;
+	a->root = lower_stmt(l, root);
+	if (l->spans) pad_offsets(a, vec_size(a->tags));
+}
+
+CompactAst compact_ast_build(Stmt *root, StringPool *pool, const SpanTable *spans) {
+	CompactAst ast = {0};
+	add_node(&ast, NODE_NONE, 0, 0);
+	vec_push(ast.extra, 0);
+
+	Lowering l = { &ast, pool, spans, NULL, NULL, 0 };
+	lower_root(&l, root);
+	return ast;
+}
+
+CompactAst compact_ast_build_portable(Stmt *root, StringPool *pool, const SpanTable *spans) {
+	CompactAst ast = {0};
+	add_node(&ast, NODE_NONE, 0, 0);
+	vec_push(ast.extra, 0);
+	vec_push(ast.strings, 0);
+	ast.string_count = 1;
+
+	Lowering l = { &ast, pool, spans, NULL, NULL, 0 };
+	lower_root(&l, root);
+
+	free(l.local_keys);
+	free(l.local_values);
+	return ast;
+}
+
+u64 compact_ast_bytes(const CompactAst *ast) {
+	u64 nodes = vec_size(ast->tags);
+	return nodes * (sizeof(u8) + 2 * sizeof(u32)) + (vec_size(ast->extra) + ast->string_count + vec_size(ast->offsets)) * sizeof(u32);
+}
+
+void compact_ast_free(CompactAst *ast) {
+	vec_free(ast->tags);
+	vec_free(ast->lhs);
+	vec_free(ast->rhs);
+	vec_free(ast->extra);
+	vec_free(ast->strings);
+	vec_free(ast->offsets);
+	ast->string_count = 0;
+	ast->root = 0;
+}
+
+// ==========================================
+// EXPANSION BACK INTO POINTER NODES
+// ==========================================
+
+typedef struct {
+	const CompactAst *ast;
+	StringPool *pool;
+	TypeTable *types;
+	MemArena *arena;
+
+	// Set when the caller wants spans and the tree has offsets.
+	SpanBuilder *spans;
+
+	// Set for arrays read from outside. Every index is then checked against
+	// the counts and every tag against what the parent expects; each node
+	// may be expanded once, so a cycle can't loop, and nesting is bounded
+	// like the parser bounds it. Anything off sets failed, after which
+	// every node reads as the null node.
+	bool checked;
+	bool failed;
+	u32 node_count;
+	u32 extra_count;
+	u8 *seen;
+	u32 depth;
+	u32 max_depth;
+} Expansion;
+
+#define LIST_AT(a, list, i) ((a)->extra[(list) + 1 + (i)])
+
+// Called right after the node is allocated, like the parser records spans.
+static void expand_offset(Expansion *x, NodeIndex n, const void *node) {
+	if (x->spans && x->ast->offsets[n] != COMPACT_NO_OFFSET) span_record(x->spans, node, x->ast->offsets[n]);
+}
+
+static bool fail(Expansion *x) {
+	x->failed = true;
+	return false;
+}
+
+// Whether node n, tagged within [lo, hi], can be expanded.
+static bool enter(Expansion *x, NodeIndex n, u32 lo, u32 hi) {
+	if (!x->checked) return true;
+	if (x->failed || n >= x->node_count || x->seen[n]) return fail(x);
+
+	u32 tag = x->ast->tags[n];
+	if (tag < lo || tag > hi) return fail(x);
+
+	x->seen[n] = 1;
+	return true;
+}
+
+static u32 list_count(Expansion *x, u32 list) {
+	if (!list) return 0;
+	if (x->checked && (x->failed || list >= x->extra_count || x->ast->extra[list] > x->extra_count - list - 1)) {
+		fail(x);
+		return 0;
+	}
+	return x->ast->extra[list];
+}
+
+// A fixed-size record of size words in extra.
+static const u32 *record(Expansion *x, u32 at, u32 size) {
+	static const u32 zeros[6];
+	if (x->checked && (x->failed || at >= x->extra_count || size > x->extra_count - at)) {
+		fail(x);
+		return zeros;
+	}
+	return &x->ast->extra[at];
+}
+
+static const char *id_str(Expansion *x, u32 id) {
+	if (!id) return NULL;
+	if (x->checked && id >= x->ast->string_count) {
+		fail(x);
+		return NULL;
+	}
+	if (x->ast->strings) id = x->ast->strings[id];
+	return pool_str(x->pool, id);
+}
+
+static Expr *expand_expr(Expansion *x, NodeIndex n);
+static Stmt *expand_stmt(Expansion *x, NodeIndex n);
+static FuncSignature *expand_signature(Expansion *x, NodeIndex n);
+
+static Type *expand_type(Expansion *x, NodeIndex n) {
+	if (!n || !enter(x, n, NODE_TYPE, NODE_TYPE + TYPE_ARRAY)) return NULL;
+	if (x->checked && ++x->depth > x->max_depth) {
+		fail(x);
+		return NULL;
+	}
+	const CompactAst *a = x->ast;
+
+	Type key = {0};
+	key.kind = a->tags[n] - NODE_TYPE;
+
+	switch (key.kind) {
+		case TYPE_ARRAY:
+			key.as.array.inner = expand_type(x, a->lhs[n]);
+			break;
+		case TYPE_STRUCT:
+		case TYPE_TRAIT: {
+			u32 list = a->rhs[n];
+			key.as.user_type.name = id_str(x, a->lhs[n]);
+
+			ArenaList args = ARENA_LIST(Type*);
+			u32 count = list_count(x, list);
+			for (u32 i = 0; i < count; i++) {
+				ARENA_LIST_PUSH(args, Type*, expand_type(x, LIST_AT(a, list, i)));
+			}
+			key.as.user_type.arg_count = args.count;
+			key.as.user_type.args = (Type**)args.base;
+
+			Type *t = type_intern(x->types, &key);
+			arena_list_end(&args);
+			x->depth--;
+			return t;
+		}
+		case TYPE_GENERIC:
+			key.as.param_name = id_str(x, a->lhs[n]);
+			break;
+		case TYPE_FUNCTION:
+			key.as.function.sig = expand_signature(x, a->lhs[n]);
+			break;
+		default: break;
+	}
+
+	x->depth--;
+	return type_intern(x->types, &key);
+}
+
+static Type **expand_types(Expansion *x, u32 list, int *count) {
+	*count = list_count(x, list);
+	if (!*count) return NULL;
+	Type **types = PUSH_ARRAY(x->arena, Type*, *count);
+	for (int i = 0; i < *count; i++) types[i] = expand_type(x, LIST_AT(x->ast, list, i));
+	return types;
+}
+
+static Param *expand_params(Expansion *x, u32 list, int *count) {
+	const CompactAst *a = x->ast;
+	*count = list_count(x, list);
+	if (!*count) return NULL;
+	Param *params = PUSH_ARRAY(x->arena, Param, *count);
+	for (int i = 0; i < *count; i++) {
+		NodeIndex n = LIST_AT(a, list, i);
+		if (!enter(x, n, NODE_PARAM, NODE_PARAM)) n = 0;
+		params[i].name = id_str(x, a->lhs[n]);
+		params[i].type = expand_type(x, a->rhs[n]);
+	}
+	return params;
+}
+
+static GenericParam *expand_generics(Expansion *x, u32 list, int *count) {
+	const CompactAst *a = x->ast;
+	*count = list_count(x, list);
+	if (!*count) return NULL;
+	GenericParam *generics = PUSH_ARRAY(x->arena, GenericParam, *count);
+	for (int i = 0; i < *count; i++) {
+		NodeIndex n = LIST_AT(a, list, i);
+		if (!enter(x, n, NODE_GENERIC_PARAM, NODE_GENERIC_PARAM)) n = 0;
+		generics[i].name = id_str(x, a->lhs[n]);
+		generics[i].constraints = expand_types(x, a->rhs[n], &generics[i].constraint_count);
+	}
+	return generics;
+}
+
+static void fill_signature(Expansion *x, NodeIndex n, FuncSignature *sig) {
+	if (!enter(x, n, NODE_SIGNATURE, NODE_SIGNATURE)) return;
+	const u32 *words = record(x, x->ast->lhs[n], 3);
+	sig->generics = expand_generics(x, words[0], &sig->generic_count);
+	sig->params = expand_params(x, words[1], &sig->param_count);
+	sig->return_types = expand_types(x, words[2], &sig->return_count);
+}
+
+static FuncSignature *expand_signature(Expansion *x, NodeIndex n) {
+	if (!n) return NULL;
+	FuncSignature *sig = PUSH_STRUCT(x->arena, FuncSignature);
+	fill_signature(x, n, sig);
+	return sig;
+}
+
+static Expr **expand_exprs(Expansion *x, u32 list, int *count) {
+	*count = list_count(x, list);
+	if (!*count) return NULL;
+	Expr **exprs = PUSH_ARRAY(x->arena, Expr*, *count);
+	for (int i = 0; i < *count; i++) exprs[i] = expand_expr(x, LIST_AT(x->ast, list, i));
+	return exprs;
+}
+
+typedef struct {
+	NodeIndex node;
+	Expr **dest;
+} ExpandWork;
+
+static void push_expand(ArenaList *work, NodeIndex n, Expr **dest) {
+	if (n) ARENA_LIST_PUSH(*work, ExpandWork, ((ExpandWork){ n, dest }));
+}
+
+static TableEntry *push_expand_entries(Expansion *x, ArenaList *work, u32 list, int *count) {
+	*count = list_count(x, list) / 2;
+	if (!*count) return NULL;
+	TableEntry *entries = PUSH_ARRAY(x->arena, TableEntry, *count);
+	for (int i = *count - 1; i >= 0; i--) {
+		push_expand(work, LIST_AT(x->ast, list, 2*i+1), &entries[i].value);
+		push_expand(work, LIST_AT(x->ast, list, 2*i), &entries[i].key);
+	}
+	return entries;
+}
+
+// Mirrors lower_expr: each node is allocated and linked into its parent
+// before its children are, so nothing but function bodies recurses.
+static Expr *expand_expr(Expansion *x, NodeIndex root) {
+	const CompactAst *a = x->ast;
+	Expr *result = NULL;
+
+	ArenaList work = ARENA_LIST(ExpandWork);
+	push_expand(&work, root, &result);
+
+	while (work.count) {
+		ExpandWork w = ARENA_LIST_POP(work, ExpandWork);
+		NodeIndex n = w.node;
+		if (!enter(x, n, NODE_NIL, NODE_STRUCT_INIT)) continue;
+		u32 tag = a->tags[n];
+
+		Expr *e = PUSH_STRUCT(x->arena, Expr);
+		expand_offset(x, n, e);
+		*w.dest = e;
+
+		if (tag >= NODE_BINARY && tag < NODE_UNARY) {
+			e->kind = EXPR_BINARY;
+			e->as.binary.op = tag - NODE_BINARY;
+			push_expand(&work, a->rhs[n], &e->as.binary.right);
+			push_expand(&work, a->lhs[n], &e->as.binary.left);
+			continue;
+		}
+		if (tag >= NODE_UNARY && tag < NODE_CALL) {
+			e->kind = EXPR_UNARY;
+			e->as.unary.op = tag - NODE_UNARY;
+			push_expand(&work, a->lhs[n], &e->as.unary.operand);
+			continue;
+		}
+
+		switch (tag) {
+			case NODE_NIL:    e->kind = EXPR_NIL; break;
+			case NODE_TRUE:   e->kind = EXPR_BOOL; e->as.boolean = true; break;
+			case NODE_FALSE:  e->kind = EXPR_BOOL; e->as.boolean = false; break;
+			case NODE_VARARG: e->kind = EXPR_VARARG; break;
+			case NODE_NUMBER: {
+				u32 bits[2] = { a->lhs[n], a->rhs[n] };
+				e->kind = EXPR_NUMBER;
+				memcpy(&e->as.number, bits, sizeof(bits));
+				break;
+			}
+			case NODE_STRING:   e->kind = EXPR_STRING; e->as.string = id_str(x, a->lhs[n]); break;
+			case NODE_VARIABLE: e->kind = EXPR_VARIABLE; e->as.variable.name = id_str(x, a->lhs[n]); break;
+			case NODE_CALL: {
+				u32 list = a->rhs[n];
+				e->kind = EXPR_CALL;
+				e->as.call.arg_count = list_count(x, list);
+				if (e->as.call.arg_count) {
+					e->as.call.args = PUSH_ARRAY(x->arena, Expr*, e->as.call.arg_count);
+					for (int i = e->as.call.arg_count - 1; i >= 0; i--) {
+						push_expand(&work, LIST_AT(a, list, i), &e->as.call.args[i]);
+					}
+				}
+				push_expand(&work, a->lhs[n], &e->as.call.callee);
+				break;
+			}
+			case NODE_INDEX:
+				e->kind = EXPR_INDEX;
+				push_expand(&work, a->rhs[n], &e->as.index.index);
+				push_expand(&work, a->lhs[n], &e->as.index.target);
+				break;
+			case NODE_FIELD:
+				e->kind = EXPR_FIELD;
+				e->as.field.field = id_str(x, a->rhs[n]);
+				push_expand(&work, a->lhs[n], &e->as.field.target);
+				break;
+			case NODE_FUNCTION:
+				e->kind = EXPR_FUNCTION;
+				fill_signature(x, a->lhs[n], &e->as.function.signature);
+				e->as.function.body = expand_stmt(x, a->rhs[n]);
+				break;
+			case NODE_TABLE:
+				e->kind = EXPR_TABLE;
+				e->as.table.entries = push_expand_entries(x, &work, a->lhs[n], &e->as.table.entry_count);
+				break;
+			case NODE_STRUCT_INIT:
+				e->kind = EXPR_STRUCT;
+				e->as.struct_init.entries = push_expand_entries(x, &work, a->rhs[n], &e->as.struct_init.entry_count);
+				push_expand(&work, a->lhs[n], &e->as.struct_init.name);
+				break;
+		}
+	}
+
+	arena_list_end(&work);
+	return result;
+}
+
+static Stmt *expand_stmt(Expansion *x, NodeIndex n) {
+	if (!n || !enter(x, n, NODE_EXPR_STMT, NODE_TYPE_ALIAS)) return NULL;
+	if (x->checked && ++x->depth > x->max_depth) {
+		fail(x);
+		return NULL;
+	}
+	const CompactAst *a = x->ast;
+	const u32 *words;
+
+	Stmt *s = PUSH_STRUCT(x->arena, Stmt);
+	expand_offset(x, n, s);
+
+	switch (a->tags[n]) {
+		case NODE_EXPR_STMT:
+			s->kind = STMT_EXPR;
+			s->as.expression = expand_expr(x, a->lhs[n]);
+			break;
+		case NODE_BLOCK: {
+			u32 list = a->lhs[n];
+			s->kind = STMT_BLOCK;
+			s->as.block.stmt_count = list_count(x, list);
+			if (s->as.block.stmt_count) {
+				s->as.block.stmts = PUSH_ARRAY(x->arena, Stmt*, s->as.block.stmt_count);
+				for (int i = 0; i < s->as.block.stmt_count; i++) {
+					s->as.block.stmts[i] = expand_stmt(x, LIST_AT(a, list, i));
+				}
+			}
+			break;
+		}
+		case NODE_RETURN:
+			s->kind = STMT_RETURN;
+			s->as.return_stmt.values = expand_exprs(x, a->lhs[n], &s->as.return_stmt.value_count);
+			break;
+		case NODE_BREAK:
+			s->kind = STMT_BREAK;
+			break;
+		case NODE_ASSIGN:
+			s->kind = STMT_ASSIGN;
+			s->as.assign.targets = expand_exprs(x, a->lhs[n], &s->as.assign.target_count);
+			s->as.assign.values = expand_exprs(x, a->rhs[n], &s->as.assign.value_count);
+			break;
+		case NODE_LOCAL:
+			s->kind = STMT_LOCAL;
+			s->as.local.decls = expand_params(x, a->lhs[n], &s->as.local.decl_count);
+			s->as.local.values = expand_exprs(x, a->rhs[n], &s->as.local.value_count);
+			break;
+		case NODE_IF:
+			words = record(x, a->rhs[n], 2);
+			s->kind = STMT_IF;
+			s->as.if_stmt.condition = expand_expr(x, a->lhs[n]);
+			s->as.if_stmt.then_branch = expand_stmt(x, words[0]);
+			s->as.if_stmt.else_branch = expand_stmt(x, words[1]);
+			break;
+		case NODE_WHILE:
+			s->kind = STMT_WHILE;
+			s->as.while_stmt.condition = expand_expr(x, a->lhs[n]);
+			s->as.while_stmt.body = expand_stmt(x, a->rhs[n]);
+			break;
+		case NODE_REPEAT:
+			s->kind = STMT_REPEAT;
+			s->as.repeat_stmt.body = expand_stmt(x, a->lhs[n]);
+			s->as.repeat_stmt.condition = expand_expr(x, a->rhs[n]);
+			break;
+		case NODE_FOR_NUM:
+			words = record(x, a->rhs[n], 4);
+			s->kind = STMT_FOR_NUM;
+			s->as.for_num.name = id_str(x, a->lhs[n]);
+			s->as.for_num.start = expand_expr(x, words[0]);
+			s->as.for_num.end = expand_expr(x, words[1]);
+			s->as.for_num.step = expand_expr(x, words[2]);
+			s->as.for_num.body = expand_stmt(x, words[3]);
+			break;
+		case NODE_FOR_GEN: {
+			u32 list = a->lhs[n];
+			words = record(x, a->rhs[n], 2);
+			s->kind = STMT_FOR_GEN;
+			s->as.for_gen.name_count = list_count(x, list);
+			if (s->as.for_gen.name_count) {
+				s->as.for_gen.names = PUSH_ARRAY(x->arena, const char*, s->as.for_gen.name_count);
+				for (int i = 0; i < s->as.for_gen.name_count; i++) {
+					s->as.for_gen.names[i] = id_str(x, LIST_AT(a, list, i));
+				}
+			}
+			s->as.for_gen.iter = expand_expr(x, words[0]);
+			s->as.for_gen.body = expand_stmt(x, words[1]);
+			break;
+		}
+		case NODE_FUNCTION_DECL:
+			words = record(x, a->rhs[n], 2);
+			s->kind = STMT_FUNCTION;
+			s->as.func_decl.name = id_str(x, a->lhs[n]);
+			s->as.func_decl.signature = expand_signature(x, words[0]);
+			s->as.func_decl.body = expand_stmt(x, words[1]);
+			break;
+		case NODE_STRUCT_DECL:
+			words = record(x, a->rhs[n], 2);
+			s->kind = STMT_STRUCT;
+			s->as.struct_decl.name = id_str(x, a->lhs[n]);
+			s->as.struct_decl.generics = expand_generics(x, words[0], &s->as.struct_decl.generic_count);
+			s->as.struct_decl.fields = expand_params(x, words[1], &s->as.struct_decl.field_count);
+			break;
+		case NODE_TRAIT_DECL: {
+			words = record(x, a->rhs[n], 2);
+			u32 list = words[1];
+			int count = list_count(x, list) / 2;
+			s->kind = STMT_TRAIT;
+			s->as.trait_decl.name = id_str(x, a->lhs[n]);
+			s->as.trait_decl.generics = expand_generics(x, words[0], &s->as.trait_decl.generic_count);
+			s->as.trait_decl.func_count = count;
+			if (count) {
+				s->as.trait_decl.func_names = PUSH_ARRAY(x->arena, const char*, count);
+				s->as.trait_decl.functions = PUSH_ARRAY(x->arena, FuncSignature*, count);
+				for (int i = 0; i < count; i++) {
+					s->as.trait_decl.func_names[i] = id_str(x, LIST_AT(a, list, 2*i));
+					s->as.trait_decl.functions[i] = expand_signature(x, LIST_AT(a, list, 2*i+1));
+				}
+			}
+			break;
+		}
+		case NODE_IMPL: {
+			words = record(x, a->lhs[n], 6);
+			u32 list = words[5];
+			s->kind = STMT_IMPL;
+			s->as.impl_stmt.generics = expand_generics(x, words[0], &s->as.impl_stmt.generic_count);
+			s->as.impl_stmt.target_name = id_str(x, words[1]);
+			s->as.impl_stmt.target_args = expand_types(x, words[2], &s->as.impl_stmt.target_arg_count);
+			s->as.impl_stmt.trait_name = id_str(x, words[3]);
+			s->as.impl_stmt.trait_args = expand_types(x, words[4], &s->as.impl_stmt.trait_arg_count);
+			s->as.impl_stmt.func_count = list_count(x, list);
+			if (s->as.impl_stmt.func_count) {
+				s->as.impl_stmt.functions = PUSH_ARRAY(x->arena, Stmt*, s->as.impl_stmt.func_count);
+				for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+					s->as.impl_stmt.functions[i] = expand_stmt(x, LIST_AT(a, list, i));
+				}
+			}
+			break;
+		}
+		case NODE_TYPE_ALIAS:
+			s->kind = STMT_TYPE_ALIAS;
+			s->as.type_alias.name = id_str(x, a->lhs[n]);
+			s->as.type_alias.type = expand_type(x, a->rhs[n]);
+			break;
+	}
+
+	x->depth--;
+	return s;
+}
+
+Stmt *compact_ast_expand(const CompactAst *ast, StringPool *pool, TypeTable *types, MemArena *arena, SpanTable *spans) {
+	SpanBuilder builder = { .arena = arena };
+	Expansion x = { .ast = ast, .pool = pool, .types = types, .arena = arena };
+	if (spans && ast->offsets) x.spans = &builder;
+
+	Stmt *root = expand_stmt(&x, ast->root);
+	if (x.spans) *spans = span_finish(&builder, spans->source, spans->source_length);
+	return root;
+}
+
+// Statements and types recurse a few levels for every level the parser
+// counts, so a tree it produced stays well within four times its limit.
+Stmt *compact_ast_expand_checked(const CompactAst *ast, u32 node_count, u32 extra_count, StringPool *pool, TypeTable *types, MemArena *arena, SpanTable *spans) {
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	SpanBuilder builder = { .arena = arena };
+
+	Expansion x = {
+		.ast = ast, .pool = pool, .types = types, .arena = arena,
+		.checked = true,
+		.node_count = node_count,
+		.extra_count = extra_count,
+		.seen = PUSH_ARRAY(scratch, u8, node_count),
+		.max_depth = 4 * parser_max_depth(),
+	};
+	if (spans && ast->offsets) x.spans = &builder;
+
+	Stmt *root = expand_stmt(&x, ast->root);
+	arena_pop_to(scratch, mark);
+	if (x.failed) return NULL;
+
+	if (x.spans) *spans = span_finish(&builder, spans->source, spans->source_length);
+	return root;
+}
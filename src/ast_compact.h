@@ -0,0 +1,69 @@
+#pragma once
+#include "arena.h"
+#include "parser.h"
+#include "string_pool.h"
+#include "typedefs.h"
+
+// Index-based form of the AST. Every node is one u8 tag plus two u32 data
+// words; anything that doesn't fit in two words, and every child list, is
+// stored in the shared extra array. Strings are pool ids, index 0 is the
+// null node and extra[0] is the empty list.
+
+typedef u32 NodeIndex;
+
+typedef enum {
+	NODE_NONE,
+
+	NODE_NIL, NODE_TRUE, NODE_FALSE, NODE_NUMBER, NODE_STRING,
+	NODE_VARARG, NODE_VARIABLE,
+	NODE_BINARY,                          // + BinaryOp
+	NODE_UNARY = NODE_BINARY + OP_OR + 1, // + UnaryOp
+	NODE_CALL = NODE_UNARY + OP_LEN + 1,
+	NODE_INDEX, NODE_FIELD,
+	NODE_FUNCTION, NODE_TABLE, NODE_STRUCT_INIT,
+
+	NODE_EXPR_STMT, NODE_BLOCK, NODE_RETURN, NODE_BREAK,
+	NODE_ASSIGN, NODE_LOCAL,
+	NODE_IF, NODE_WHILE, NODE_REPEAT, NODE_FOR_NUM, NODE_FOR_GEN,
+	NODE_FUNCTION_DECL, NODE_STRUCT_DECL, NODE_TRAIT_DECL, NODE_IMPL, NODE_TYPE_ALIAS,
+
+	NODE_PARAM, NODE_GENERIC_PARAM, NODE_SIGNATURE,
+
+	NODE_TYPE,                            // + TypeKind
+} NodeTag;
+
+typedef struct {
+	u8 *tags;
+	u32 *lhs;
+	u32 *rhs;
+	u32 *extra;
+
+	NodeIndex root;
+
+	// Set for portable trees: string operands are then indices into this
+	// table of pool ids, so they can be renumbered for another pool by
+	// rewriting the table alone. Entry 0 is the null string.
+	u32 *strings;
+	u32 string_count;
+
+	// Set when built with spans: the source offset of every node, taken
+	// from the parser's SpanTable, so diagnostics keep their positions
+	// after expansion. Nodes the table doesn't cover hold COMPACT_NO_OFFSET.
+	u32 *offsets;
+} CompactAst;
+
+#define COMPACT_NO_OFFSET UINT32_MAX
+
+// spans may be NULL, which leaves offsets unset.
+CompactAst compact_ast_build(Stmt *root, StringPool *pool, const SpanTable *spans);
+CompactAst compact_ast_build_portable(Stmt *root, StringPool *pool, const SpanTable *spans);
+// Types are interned in the given table, like the parser does. When spans
+// is given and the tree has offsets, it is filled in for the expanded
+// nodes; its source fields are left as the caller set them.
+Stmt *compact_ast_expand(const CompactAst *ast, StringPool *pool, TypeTable *types, MemArena *arena, SpanTable *spans);
+// For arrays read from outside, holding node_count nodes and extra_count
+// extra words: returns NULL instead of reading out of bounds when an index,
+// tag or nesting depth is off.
+Stmt *compact_ast_expand_checked(const CompactAst *ast, u32 node_count, u32 extra_count, StringPool *pool, TypeTable *types, MemArena *arena, SpanTable *spans);
+u64 compact_ast_bytes(const CompactAst *ast);
+void compact_ast_free(CompactAst *ast);
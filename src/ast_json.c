@@ -0,0 +1,435 @@
+#include "ast_json.h"
+#include "arena.h"
+#include "debug.h"
+
+static const char *binary_op_names[] = {
+	[OP_ADD] = "+", [OP_SUB] = "-", [OP_MUL] = "*", [OP_DIV] = "/",
+	[OP_MOD] = "%", [OP_POW] = "^", [OP_CONCAT] = "..",
+	[OP_EQ] = "==", [OP_NEQ] = "~=", [OP_LT] = "<", [OP_LTE] = "<=",
+	[OP_GT] = ">", [OP_GTE] = ">=", [OP_AND] = "and", [OP_OR] = "or",
+};
+
+static const char *unary_op_names[] = {
+	[OP_NEGATE] = "-", [OP_NOT] = "not", [OP_LEN] = "#",
+};
+
+static const char *type_kind_names[] = {
+	[TYPE_VOID] = "void", [TYPE_NIL] = "nil", [TYPE_BOOL] = "bool",
+	[TYPE_NUMBER] = "number", [TYPE_STRING] = "string",
+	[TYPE_STRUCT] = "struct", [TYPE_TRAIT] = "trait", [TYPE_GENERIC] = "generic",
+	[TYPE_FUNCTION] = "function", [TYPE_ARRAY] = "array",
+};
+
+static const char *var_scope_names[] = {
+	[VAR_LOCAL] = "local", [VAR_UPVALUE] = "upvalue", [VAR_GLOBAL] = "global",
+};
+
+// Out-of-range operators print as "?", like the text dump.
+static const char *op_name(const char **names, u32 count, int op) {
+	return op >= 0 && (u32)op < count && names[op] ? names[op] : "?";
+}
+
+static void write_type(Writer *w, Type *type);
+
+// Expressions and statements are written from an explicit stack, so long
+// operator chains and deep nesting don't recurse. Whatever part of a node
+// follows its first child is pushed in reverse and popped in order. Types
+// are shallow and still written recursively.
+typedef enum { WORK_TEXT, WORK_STRING, WORK_EXPR, WORK_STMT } WorkKind;
+
+typedef struct {
+	WorkKind kind;
+	union {
+		const char *text;
+		Expr *expr;
+		Stmt *stmt;
+	} as;
+} Work;
+
+static void push_text(ArenaList *stack, const char *text) {
+	Work work = { WORK_TEXT, { .text = text } };
+	ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+static void push_string(ArenaList *stack, const char *str) {
+	Work work = { WORK_STRING, { .text = str } };
+	ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+static void push_expr(ArenaList *stack, Expr *expr) {
+	Work work = { WORK_EXPR, { .expr = expr } };
+	ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+static void push_stmt(ArenaList *stack, Stmt *stmt) {
+	Work work = { WORK_STMT, { .stmt = stmt } };
+	ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+// Every object starts with its kind, so all later keys take a comma.
+static void begin(Writer *w, const char *kind) {
+	writer_str(w, "{\"kind\":\"");
+	writer_str(w, kind);
+	writer_char(w, '"');
+}
+
+static void key(Writer *w, const char *name) {
+	writer_str(w, ",\"");
+	writer_str(w, name);
+	writer_str(w, "\":");
+}
+
+static void string_or_null(Writer *w, const char *str) {
+	if (str) writer_json_string(w, str);
+	else writer_str(w, "null");
+}
+
+// opening is the key and bracket, e.g. ",\"args\":[".
+static void push_expr_list(ArenaList *stack, const char *opening, Expr **exprs, int count) {
+	push_text(stack, "]");
+	for (int i = count - 1; i >= 0; i--) {
+		push_expr(stack, exprs[i]);
+		if (i > 0) push_text(stack, ",");
+	}
+	push_text(stack, opening);
+}
+
+static void push_stmt_list(ArenaList *stack, const char *opening, Stmt **stmts, int count) {
+	push_text(stack, "]");
+	for (int i = count - 1; i >= 0; i--) {
+		push_stmt(stack, stmts[i]);
+		if (i > 0) push_text(stack, ",");
+	}
+	push_text(stack, opening);
+}
+
+static void push_entry_list(ArenaList *stack, TableEntry *entries, int count) {
+	push_text(stack, "]");
+	for (int i = count - 1; i >= 0; i--) {
+		push_text(stack, "}");
+		push_expr(stack, entries[i].value);
+		push_text(stack, ",\"value\":");
+		push_expr(stack, entries[i].key);
+		push_text(stack, "{\"key\":");
+		if (i > 0) push_text(stack, ",");
+	}
+	push_text(stack, ",\"entries\":[");
+}
+
+static void type_list(Writer *w, const char *name, Type **types, int count) {
+	key(w, name);
+	writer_char(w, '[');
+	for (int i = 0; i < count; i++) {
+		if (i) writer_char(w, ',');
+		write_type(w, types[i]);
+	}
+	writer_char(w, ']');
+}
+
+static void param_list(Writer *w, const char *name, Param *params, int count) {
+	key(w, name);
+	writer_char(w, '[');
+	for (int i = 0; i < count; i++) {
+		if (i) writer_char(w, ',');
+		writer_str(w, "{\"name\":");
+		writer_json_string(w, params[i].name);
+		key(w, "type");
+		write_type(w, params[i].type);
+		writer_char(w, '}');
+	}
+	writer_char(w, ']');
+}
+
+static void generic_list(Writer *w, GenericParam *generics, int count) {
+	key(w, "generics");
+	writer_char(w, '[');
+	for (int i = 0; i < count; i++) {
+		if (i) writer_char(w, ',');
+		writer_str(w, "{\"name\":");
+		writer_json_string(w, generics[i].name);
+		type_list(w, "constraints", generics[i].constraints, generics[i].constraint_count);
+		writer_char(w, '}');
+	}
+	writer_char(w, ']');
+}
+
+static void write_signature(Writer *w, FuncSignature *sig) {
+	if (!sig) {
+		writer_str(w, "null");
+		return;
+	}
+	writer_str(w, "{\"kind\":\"signature\"");
+	generic_list(w, sig->generics, sig->generic_count);
+	param_list(w, "params", sig->params, sig->param_count);
+	type_list(w, "returns", sig->return_types, sig->return_count);
+	writer_char(w, '}');
+}
+
+static void write_type(Writer *w, Type *type) {
+	if (!type) {
+		writer_str(w, "null");
+		return;
+	}
+
+	begin(w, type_kind_names[type->kind]);
+	switch (type->kind) {
+		case TYPE_STRUCT:
+		case TYPE_TRAIT:
+			key(w, "name");
+			writer_json_string(w, type->as.user_type.name);
+			type_list(w, "args", type->as.user_type.args, type->as.user_type.arg_count);
+			break;
+		case TYPE_GENERIC:
+			key(w, "name");
+			writer_json_string(w, type->as.param_name);
+			break;
+		case TYPE_ARRAY:
+			key(w, "inner");
+			write_type(w, type->as.array.inner);
+			break;
+		case TYPE_FUNCTION:
+			key(w, "signature");
+			write_signature(w, type->as.function.sig);
+			break;
+		default:
+			break;
+	}
+	writer_char(w, '}');
+}
+
+static void write_expr(Writer *w, ArenaList *stack, Expr *expr) {
+	if (!expr) {
+		writer_str(w, "null");
+		return;
+	}
+
+	begin(w, expr_kind_str(expr->kind));
+	push_text(stack, "}");
+
+	switch (expr->kind) {
+		case EXPR_NIL:
+		case EXPR_VARARG:
+			break;
+		case EXPR_BOOL:
+			key(w, "value");
+			writer_str(w, expr->as.boolean ? "true" : "false");
+			break;
+		case EXPR_NUMBER:
+			key(w, "value");
+			writer_number_exact(w, expr->as.number);
+			break;
+		case EXPR_STRING:
+			key(w, "value");
+			writer_json_string(w, expr->as.string);
+			break;
+		case EXPR_VARIABLE:
+			key(w, "name");
+			writer_json_string(w, expr->as.variable.name);
+			if (expr->as.variable.scope != VAR_UNRESOLVED) {
+				key(w, "scope");
+				writer_json_string(w, var_scope_names[expr->as.variable.scope]);
+				key(w, "slot");
+				writer_u64(w, expr->as.variable.slot);
+			}
+			break;
+		case EXPR_BINARY:
+			key(w, "op");
+			writer_json_string(w, op_name(binary_op_names, sizeof(binary_op_names) / sizeof(*binary_op_names), (int)expr->as.binary.op));
+			key(w, "left");
+			push_expr(stack, expr->as.binary.right);
+			push_text(stack, ",\"right\":");
+			push_expr(stack, expr->as.binary.left);
+			break;
+		case EXPR_UNARY:
+			key(w, "op");
+			writer_json_string(w, op_name(unary_op_names, sizeof(unary_op_names) / sizeof(*unary_op_names), (int)expr->as.unary.op));
+			key(w, "operand");
+			push_expr(stack, expr->as.unary.operand);
+			break;
+		case EXPR_CALL:
+			key(w, "callee");
+			push_expr_list(stack, ",\"args\":[", expr->as.call.args, expr->as.call.arg_count);
+			push_expr(stack, expr->as.call.callee);
+			break;
+		case EXPR_INDEX:
+			key(w, "target");
+			push_expr(stack, expr->as.index.index);
+			push_text(stack, ",\"index\":");
+			push_expr(stack, expr->as.index.target);
+			break;
+		case EXPR_FIELD:
+			key(w, "target");
+			push_string(stack, expr->as.field.field);
+			push_text(stack, ",\"field\":");
+			push_expr(stack, expr->as.field.target);
+			break;
+		case EXPR_FUNCTION:
+			key(w, "signature");
+			write_signature(w, &expr->as.function.signature);
+			key(w, "body");
+			push_stmt(stack, expr->as.function.body);
+			break;
+		case EXPR_TABLE:
+			push_entry_list(stack, expr->as.table.entries, expr->as.table.entry_count);
+			break;
+		case EXPR_STRUCT:
+			key(w, "name");
+			push_entry_list(stack, expr->as.struct_init.entries, expr->as.struct_init.entry_count);
+			push_expr(stack, expr->as.struct_init.name);
+			break;
+	}
+}
+
+static void write_stmt(Writer *w, ArenaList *stack, Stmt *stmt) {
+	if (!stmt) {
+		writer_str(w, "null");
+		return;
+	}
+
+	begin(w, stmt_kind_str(stmt->kind));
+	push_text(stack, "}");
+
+	switch (stmt->kind) {
+		case STMT_EXPR:
+			key(w, "expression");
+			push_expr(stack, stmt->as.expression);
+			break;
+		case STMT_BLOCK:
+			push_stmt_list(stack, ",\"stmts\":[", stmt->as.block.stmts, stmt->as.block.stmt_count);
+			break;
+		case STMT_RETURN:
+			push_expr_list(stack, ",\"values\":[", stmt->as.return_stmt.values, stmt->as.return_stmt.value_count);
+			break;
+		case STMT_BREAK:
+			break;
+		case STMT_ASSIGN:
+			push_expr_list(stack, ",\"values\":[", stmt->as.assign.values, stmt->as.assign.value_count);
+			push_expr_list(stack, ",\"targets\":[", stmt->as.assign.targets, stmt->as.assign.target_count);
+			break;
+		case STMT_LOCAL:
+			param_list(w, "decls", stmt->as.local.decls, stmt->as.local.decl_count);
+			push_expr_list(stack, ",\"values\":[", stmt->as.local.values, stmt->as.local.value_count);
+			break;
+		case STMT_IF:
+			key(w, "condition");
+			push_stmt(stack, stmt->as.if_stmt.else_branch);
+			push_text(stack, ",\"else\":");
+			push_stmt(stack, stmt->as.if_stmt.then_branch);
+			push_text(stack, ",\"then\":");
+			push_expr(stack, stmt->as.if_stmt.condition);
+			break;
+		case STMT_WHILE:
+			key(w, "condition");
+			push_stmt(stack, stmt->as.while_stmt.body);
+			push_text(stack, ",\"body\":");
+			push_expr(stack, stmt->as.while_stmt.condition);
+			break;
+		case STMT_REPEAT:
+			key(w, "body");
+			push_expr(stack, stmt->as.repeat_stmt.condition);
+			push_text(stack, ",\"condition\":");
+			push_stmt(stack, stmt->as.repeat_stmt.body);
+			break;
+		case STMT_FOR_NUM:
+			key(w, "name");
+			writer_json_string(w, stmt->as.for_num.name);
+			key(w, "start");
+			push_stmt(stack, stmt->as.for_num.body);
+			push_text(stack, ",\"body\":");
+			push_expr(stack, stmt->as.for_num.step);
+			push_text(stack, ",\"step\":");
+			push_expr(stack, stmt->as.for_num.end);
+			push_text(stack, ",\"end\":");
+			push_expr(stack, stmt->as.for_num.start);
+			break;
+		case STMT_FOR_GEN:
+			key(w, "names");
+			writer_char(w, '[');
+			for (int i = 0; i < stmt->as.for_gen.name_count; i++) {
+				if (i) writer_char(w, ',');
+				writer_json_string(w, stmt->as.for_gen.names[i]);
+			}
+			writer_char(w, ']');
+			key(w, "iter");
+			push_stmt(stack, stmt->as.for_gen.body);
+			push_text(stack, ",\"body\":");
+			push_expr(stack, stmt->as.for_gen.iter);
+			break;
+		case STMT_FUNCTION:
+			key(w, "name");
+			writer_json_string(w, stmt->as.func_decl.name);
+			key(w, "signature");
+			write_signature(w, stmt->as.func_decl.signature);
+			key(w, "body");
+			push_stmt(stack, stmt->as.func_decl.body);
+			break;
+		case STMT_STRUCT:
+			key(w, "name");
+			writer_json_string(w, stmt->as.struct_decl.name);
+			generic_list(w, stmt->as.struct_decl.generics, stmt->as.struct_decl.generic_count);
+			param_list(w, "fields", stmt->as.struct_decl.fields, stmt->as.struct_decl.field_count);
+			break;
+		case STMT_TRAIT:
+			key(w, "name");
+			writer_json_string(w, stmt->as.trait_decl.name);
+			generic_list(w, stmt->as.trait_decl.generics, stmt->as.trait_decl.generic_count);
+			key(w, "functions");
+			writer_char(w, '[');
+			for (int i = 0; i < stmt->as.trait_decl.func_count; i++) {
+				if (i) writer_char(w, ',');
+				writer_str(w, "{\"name\":");
+				writer_json_string(w, stmt->as.trait_decl.func_names[i]);
+				key(w, "signature");
+				write_signature(w, stmt->as.trait_decl.functions[i]);
+				writer_char(w, '}');
+			}
+			writer_char(w, ']');
+			break;
+		case STMT_IMPL:
+			generic_list(w, stmt->as.impl_stmt.generics, stmt->as.impl_stmt.generic_count);
+			key(w, "target");
+			writer_json_string(w, stmt->as.impl_stmt.target_name);
+			type_list(w, "target_args", stmt->as.impl_stmt.target_args, stmt->as.impl_stmt.target_arg_count);
+			key(w, "trait");
+			string_or_null(w, stmt->as.impl_stmt.trait_name);
+			type_list(w, "trait_args", stmt->as.impl_stmt.trait_args, stmt->as.impl_stmt.trait_arg_count);
+			push_stmt_list(stack, ",\"functions\":[", stmt->as.impl_stmt.functions, stmt->as.impl_stmt.func_count);
+			break;
+		case STMT_TYPE_ALIAS:
+			key(w, "name");
+			writer_json_string(w, stmt->as.type_alias.name);
+			key(w, "type");
+			write_type(w, stmt->as.type_alias.type);
+			break;
+	}
+}
+
+void write_ast_json(Writer *w, Stmt *root) {
+	ArenaList stack = ARENA_LIST(Work);
+	push_stmt(&stack, root);
+
+	while (stack.count) {
+		Work work = ARENA_LIST_POP(stack, Work);
+		switch (work.kind) {
+			case WORK_TEXT:   writer_str(w, work.as.text); break;
+			case WORK_STRING: string_or_null(w, work.as.text); break;
+			case WORK_EXPR:   write_expr(w, &stack, work.as.expr); break;
+			case WORK_STMT:   write_stmt(w, &stack, work.as.stmt); break;
+		}
+	}
+
+	arena_list_end(&stack);
+	writer_char(w, '\n');
+}
+
+void fprint_ast_json(FILE *f, Stmt *root) {
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	Writer w;
+	writer_init(&w, f, scratch, WRITER_DEFAULT_CAPACITY);
+
+	write_ast_json(&w, root);
+
+	writer_flush(&w);
+	arena_pop_to(scratch, mark);
+}
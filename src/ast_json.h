@@ -0,0 +1,12 @@
+#pragma once
+#include <stdio.h>
+
+#include "parser.h"
+#include "writer.h"
+
+// The tree as JSON for external tools. Every node is an object whose
+// "kind" is the ExprKind/StmtKind name without prefix (types use
+// lower-case TypeKind names); the other keys follow the AST fields.
+// Output is streamed through the writer, never held in memory as a whole.
+void write_ast_json(Writer *w, Stmt *root);
+void fprint_ast_json(FILE *f, Stmt *root);
@@ -0,0 +1,116 @@
+#pragma once
+#include "resolver.h"
+#include "typedefs.h"
+#include "value.h"
+
+// Register bytecode. A function's locals sit in the slots the resolver gave
+// them, numeric and generic for loops keep their hidden state above every
+// local, and temporaries go above both. R is a register, K a constant, U an
+// upvalue and G a global slot.
+//
+// The _NN variants are emitted where the checker proved both operands are
+// numbers and skip the tag checks, which is sound because the checker
+// keeps nil out of declared types; GETSLOT and SETSLOT address a struct
+// field by index; CALL_DIRECT calls an impl method the checker bound
+// statically, without looking the callee up.
+typedef enum {
+	BC_MOVE,        // R[A] = R[B]
+	BC_LOADK,       // R[A] = K[Bx]
+	BC_LOADI,       // R[A] = sBx
+	BC_LOADNIL,     // R[A..A+B-1] = nil
+	BC_LOADBOOL,    // R[A] = B != 0
+
+	BC_GETUPVAL,    // R[A] = U[B]
+	BC_SETUPVAL,    // U[B] = R[A]
+	BC_GETGLOBAL,   // R[A] = G[Bx]
+	BC_SETGLOBAL,   // G[Bx] = R[A]
+
+	BC_ADD, BC_SUB, BC_MUL, BC_DIV, BC_MOD, BC_POW,                 // R[A] = R[B] op R[C]
+	BC_ADD_NN, BC_SUB_NN, BC_MUL_NN, BC_DIV_NN, BC_MOD_NN, BC_POW_NN,
+	BC_CONCAT,      // R[A] = R[B] .. ... .. R[C]
+	BC_EQ, BC_NEQ, BC_LT, BC_LE,
+	BC_LT_NN, BC_LE_NN,
+
+	BC_NEG,         // R[A] = op R[B]
+	BC_NEG_N,
+	BC_NOT,
+	BC_LEN,
+
+	BC_JMP,         // ip += sBx
+	BC_JMPIF,       // if R[A] is truthy: ip += sBx
+	BC_JMPIFNOT,
+	BC_JMPNIL,      // if R[A] is nil: ip += sBx
+
+	BC_NEWTABLE,    // R[A] = {}
+	BC_GETINDEX,    // R[A] = R[B][R[C]]
+	BC_SETINDEX,    // R[A][R[B]] = R[C]
+	BC_GETFIELD,    // R[A] = R[B][K[C]]
+	BC_SETFIELD,    // R[A][K[B]] = R[C]
+
+	BC_NEWSTRUCT,   // R[A] = new instance of layout Bx
+	BC_GETSLOT,     // R[A] = R[B].fields[C]
+	BC_SETSLOT,     // R[A].fields[B] = R[C]
+
+	BC_CLOSURE,     // R[A] = closure of proto Bx
+	BC_METHOD,      // layout B's method K[C] = R[A]
+
+	// Results land in R[A..A+C-1]. CALL passes R[A+1..A+B]; CALL_SELF
+	// passes R[A+1] as self when the callee is a method and the B arguments
+	// from R[A+2]; CALL_DIRECT calls the method whose proto the following
+	// EXTRA names, with self in R[A+1] and the arguments after it.
+	BC_CALL,
+	BC_CALL_SELF,
+	BC_CALL_DIRECT,
+	BC_EXTRA,       // operand of the previous instruction: Bx
+
+	BC_RETURN,      // return R[A..A+B-1]
+	BC_CLOSE,       // close upvalues over R[A] and above
+
+	// R[A] counter, R[A+1] limit, R[A+2] step. FORPREP checks they are
+	// numbers and jumps to the FORLOOP, which steps and jumps back while the
+	// counter is in range.
+	BC_FORPREP,
+	BC_FORLOOP,
+
+	BC_COUNT
+} Opcode;
+
+typedef struct {
+	u16 op;
+	u16 a;
+	union {
+		struct { u16 b, c; };
+		u32 bx;
+		i32 sbx;
+	};
+} Instr;
+
+typedef struct {
+	const char *name;
+	u32 index;
+
+	Instr *code;
+	u32 code_count;
+	Value *constants;
+	u32 constant_count;
+
+	// Registers the frame needs; self is slot 0 of a method.
+	u32 frame_size;
+	u32 param_count;
+	bool method;
+
+	Upvalue *upvalues;
+	u32 upvalue_count;
+} Proto;
+
+typedef struct {
+	Proto **protos;
+	u32 proto_count;
+	Proto *main;
+
+	StructLayout **layouts;
+	u32 layout_count;
+
+	const char **globals;
+	u32 global_count;
+} Program;
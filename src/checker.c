@@ -0,0 +1,1634 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "checker.h"
+#include "arena.h"
+#include "ptr_map.h"
+#include "source.h"
+#include "vec.h"
+
+#define CHECK_MAX_ERRORS 100
+#define CHECK_MESSAGE_MAX 512
+#define TYPE_NAME_MAX 128
+
+#define INSTANCE_MIN_CAPACITY 64
+#define INSTANCE_MAX_LOAD_NUM 3
+#define INSTANCE_MAX_LOAD_DEN 4
+
+#define HASH_K0 0x9e3779b97f4a7c15ull
+#define HASH_K1 0xbf58476d1ce4e5b9ull
+
+#define AS_U64(p) ((u64)(uintptr_t)(p))
+#define AS_PTR(T, v) ((T)(uintptr_t)(v))
+
+typedef enum { DECL_STRUCT, DECL_TRAIT, DECL_ALIAS } DeclKind;
+
+// A callable member of a struct or trait. The type is normalized in the
+// owner's generic scope; owner_args are the impl's target arguments, which
+// a receiver's arguments are matched against to bind the impl's generics.
+typedef struct {
+	const char *name;
+	Stmt *decl;
+	Type *type;
+
+	GenericParam *owner_generics; int owner_generic_count;
+	Type **owner_args; int owner_arg_count;
+} Method;
+
+typedef struct {
+	DeclKind kind;
+	Stmt *stmt;
+	const char *name;
+	GenericParam *generics; int generic_count;
+
+	// Trait name -> implementing STMT_IMPL, for structs.
+	PtrMap impls;
+	// Name -> Method*.
+	PtrMap methods;
+	// Name -> field index + 1, and the field types in the struct's own
+	// generic scope.
+	PtrMap fields;
+	Type **field_types;
+
+	Type *alias;
+	bool alias_done;
+	bool alias_resolving;
+} TypeDecl;
+
+typedef struct {
+	u64 hash;
+	const void *decl;
+	Type **args;
+	u32 arg_count;
+	Type *value;
+} InstanceSlot;
+
+// Instantiations keyed on what was instantiated plus the canonical argument
+// tuple; canonical types make the key pointer-comparable.
+typedef struct {
+	MemArena *arena;
+	InstanceSlot *slots;
+	u64 capacity;
+	u64 count;
+} InstanceTable;
+
+typedef struct {
+	GenericParam *params;
+	int count;
+} GenericScope;
+
+typedef struct FunctionCheck FunctionCheck;
+
+struct FunctionCheck {
+	FunctionCheck *enclosing;
+	FunctionScope *scope;
+
+	// Indexed by the resolver's slots and upvalue indices.
+	Type **slots;
+	Type **upvalues;
+
+	Type **returns;
+	int return_count;
+};
+
+typedef struct {
+	Expr *expr;
+	bool ready;
+} ExprWork;
+
+typedef struct {
+	MemArena *arena;
+	const Resolution *resolution;
+	TypeTable *types;
+	CheckResult *out;
+
+	// Type name -> TypeDecl*.
+	PtrMap decls;
+	// Annotation -> normalized type, for annotations outside any generic
+	// scope, where the result only depends on the annotation itself.
+	PtrMap normalized;
+	// Canonical struct type -> its field types with the arguments applied.
+	PtrMap struct_fields;
+	InstanceTable instances;
+
+	GenericScope *generics;
+	FunctionCheck *fn;
+	Type **globals;
+	const char *context;
+
+	// The node errors are reported at. Lines are only indexed once the
+	// first error needs one.
+	const void *node;
+	const SpanTable *spans;
+	LineIndex lines;
+
+	Diagnostic *errors;
+	ExprWork *work;
+
+	Type *t_void, *t_nil, *t_bool, *t_number, *t_string;
+} Checker;
+
+static inline u64 mix(u64 hash, u64 value) {
+	__uint128_t r = (__uint128_t)(hash ^ value ^ HASH_K0) * HASH_K1;
+	return (u64)r ^ (u64)(r >> 64);
+}
+
+// ==========================================
+// DIAGNOSTICS
+// ==========================================
+
+typedef struct {
+	char *buf;
+	u32 len;
+	u32 cap;
+} NameBuf;
+
+static void name_append(NameBuf *b, const char *s) {
+	while (*s && b->len + 1 < b->cap) b->buf[b->len++] = *s++;
+	b->buf[b->len] = '\0';
+}
+
+static void name_type(NameBuf *b, Type *t);
+
+static void name_types(NameBuf *b, Type **types, int count) {
+	for (int i = 0; i < count; i++) {
+		if (i) name_append(b, ", ");
+		name_type(b, types[i]);
+	}
+}
+
+static void name_type(NameBuf *b, Type *t) {
+	if (!t) { name_append(b, "unknown"); return; }
+
+	switch (t->kind) {
+		case TYPE_VOID:   name_append(b, "void"); break;
+		case TYPE_NIL:    name_append(b, "nil"); break;
+		case TYPE_BOOL:   name_append(b, "bool"); break;
+		case TYPE_NUMBER: name_append(b, "number"); break;
+		case TYPE_STRING: name_append(b, "string"); break;
+		case TYPE_GENERIC: name_append(b, t->as.param_name); break;
+		case TYPE_STRUCT:
+		case TYPE_TRAIT:
+			name_append(b, t->as.user_type.name);
+			if (t->as.user_type.arg_count) {
+				name_append(b, "<");
+				name_types(b, t->as.user_type.args, t->as.user_type.arg_count);
+				name_append(b, ">");
+			}
+			break;
+		case TYPE_ARRAY:
+			name_append(b, "[");
+			name_type(b, t->as.array.inner);
+			name_append(b, "]");
+			break;
+		case TYPE_FUNCTION: {
+			FuncSignature *sig = t->as.function.sig;
+			name_append(b, "function(");
+			for (int i = 0; sig && i < sig->param_count; i++) {
+				if (i) name_append(b, ", ");
+				name_type(b, sig->params[i].type);
+			}
+			name_append(b, ")");
+			if (sig && sig->return_count) {
+				name_append(b, ": ");
+				name_types(b, sig->return_types, sig->return_count);
+			}
+			break;
+		}
+	}
+}
+
+static const char *type_name(Checker *c, Type *t) {
+	char buf[TYPE_NAME_MAX];
+	NameBuf b = { buf, 0, sizeof(buf) };
+	name_type(&b, t);
+
+	char *out = arena_push(c->arena, b.len + 1, true);
+	memcpy(out, buf, b.len + 1);
+	return out;
+}
+
+static void error(Checker *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void error(Checker *c, const char *fmt, ...) {
+	c->out->success = false;
+	if (vec_size(c->errors) >= CHECK_MAX_ERRORS) return;
+
+	char buf[CHECK_MESSAGE_MAX];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n < 0) return;
+	if ((u32)n >= sizeof(buf)) n = sizeof(buf) - 1;
+
+	char *message = arena_push(c->arena, (u64)n + 1, true);
+	memcpy(message, buf, (u64)n + 1);
+
+	Diagnostic d = { 0, 0, c->context, message, 0, true };
+	if (span_offset(c->spans, c->node, &d.offset) && c->spans->source) {
+		if (!c->lines.starts) c->lines = line_index_build(c->arena, c->spans->source, c->spans->source_length);
+		line_index_locate(&c->lines, d.offset, &d.line, &d.column);
+	}
+	vec_push(c->errors, d);
+}
+
+// ==========================================
+// INSTANCES
+// ==========================================
+
+static u64 hash_instance(const void *decl, Type **args, u32 count) {
+	u64 hash = mix(AS_U64(decl), count);
+	for (u32 i = 0; i < count; i++) hash = mix(hash, AS_U64(args[i]));
+	return hash;
+}
+
+static void instances_init(InstanceTable *table, MemArena *arena) {
+	table->arena = arena;
+	table->capacity = INSTANCE_MIN_CAPACITY;
+	table->count = 0;
+	table->slots = PUSH_ARRAY(arena, InstanceSlot, table->capacity);
+}
+
+static void instances_grow(InstanceTable *table) {
+	u64 new_capacity = table->capacity * 2;
+	u64 mask = new_capacity - 1;
+	InstanceSlot *new_slots = PUSH_ARRAY(table->arena, InstanceSlot, new_capacity);
+
+	for (u64 i = 0; i < table->capacity; i++) {
+		InstanceSlot *slot = &table->slots[i];
+		if (!slot->decl) continue;
+
+		u64 index = slot->hash & mask;
+		while (new_slots[index].decl) index = (index + 1) & mask;
+		new_slots[index] = *slot;
+	}
+
+	table->slots = new_slots;
+	table->capacity = new_capacity;
+}
+
+// Returns the slot for the key; a new one has value NULL and owns a copy of
+// the arguments.
+static InstanceSlot *instance_slot(InstanceTable *table, const void *decl, Type **args, u32 count) {
+	if ((table->count + 1) * INSTANCE_MAX_LOAD_DEN > table->capacity * INSTANCE_MAX_LOAD_NUM) {
+		instances_grow(table);
+	}
+
+	u64 hash = hash_instance(decl, args, count);
+	u64 mask = table->capacity - 1;
+	u64 index = hash & mask;
+
+	for (InstanceSlot *slot = &table->slots[index]; slot->decl; slot = &table->slots[index]) {
+		if (
+			slot->hash == hash && slot->decl == decl && slot->arg_count == count &&
+			(count == 0 || memcmp(slot->args, args, count * sizeof(Type*)) == 0)
+		) return slot;
+		index = (index + 1) & mask;
+	}
+
+	InstanceSlot *slot = &table->slots[index];
+	slot->hash = hash;
+	slot->decl = decl;
+	slot->arg_count = count;
+	slot->args = count ? PUSH_ARRAY_NZ(table->arena, Type*, count) : NULL;
+	if (count) memcpy(slot->args, args, count * sizeof(Type*));
+	slot->value = NULL;
+	table->count++;
+	return slot;
+}
+
+// ==========================================
+// TYPES
+// ==========================================
+
+static Type *intern(Checker *c, Type key) {
+	return type_intern(c->types, &key);
+}
+
+static TypeDecl *find_decl(Checker *c, const char *name) {
+	u64 *value = name ? ptr_map_get(&c->decls, name) : NULL;
+	return value ? AS_PTR(TypeDecl*, *value) : NULL;
+}
+
+static GenericParam *find_generic(Checker *c, const char *name) {
+	for (u64 i = vec_size(c->generics); i-- > 0;) {
+		GenericScope *scope = &c->generics[i];
+		for (int j = 0; j < scope->count; j++) {
+			if (scope->params[j].name == name) return &scope->params[j];
+		}
+	}
+	return NULL;
+}
+
+static void push_generics(Checker *c, GenericParam *params, int count) {
+	GenericScope scope = { params, count };
+	vec_push(c->generics, scope);
+}
+
+static void pop_generics(Checker *c) {
+	vec_hdr(c->generics)->size--;
+}
+
+// Constraints are kept as written; only the trait's name matters for them.
+static const char *constraint_name(Type *constraint) {
+	bool named = constraint && (constraint->kind == TYPE_STRUCT || constraint->kind == TYPE_TRAIT);
+	return named ? constraint->as.user_type.name : NULL;
+}
+
+static bool implements(Checker *c, Type *t, const char *trait) {
+	if (!t || !trait) return true;
+
+	switch (t->kind) {
+		case TYPE_STRUCT: {
+			TypeDecl *d = find_decl(c, t->as.user_type.name);
+			return d && ptr_map_get(&d->impls, trait) != NULL;
+		}
+		case TYPE_GENERIC: {
+			GenericParam *param = find_generic(c, t->as.param_name);
+			if (!param) return true;
+			for (int i = 0; i < param->constraint_count; i++) {
+				if (constraint_name(param->constraints[i]) == trait) return true;
+			}
+			return false;
+		}
+		case TYPE_TRAIT:
+			return t->as.user_type.name == trait;
+		default:
+			return false;
+	}
+}
+
+static void check_bounds(Checker *c, GenericParam *params, int count, Type **args, const char *owner) {
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < params[i].constraint_count; j++) {
+			const char *trait = constraint_name(params[i].constraints[j]);
+			if (!implements(c, args[i], trait)) {
+				error(c, "Type '%s' does not implement '%s', required by '%s'.",
+					type_name(c, args[i]), trait, owner);
+			}
+		}
+	}
+}
+
+static Type *normalize(Checker *c, Type *t);
+static Type *function_type(Checker *c, FuncSignature *sig);
+
+static Type *alias_type(Checker *c, TypeDecl *d) {
+	if (d->alias_done) return d->alias;
+	if (d->alias_resolving) {
+		error(c, "Type alias '%s' refers to itself.", d->name);
+		return NULL;
+	}
+
+	// Aliases are declared at the top level, so whatever generics are in
+	// scope where one is used don't apply to its definition.
+	u64 saved = vec_size(c->generics);
+	if (c->generics) vec_hdr(c->generics)->size = 0;
+
+	d->alias_resolving = true;
+	d->alias = normalize(c, d->stmt->as.type_alias.type);
+	d->alias_resolving = false;
+	d->alias_done = true;
+
+	if (c->generics) vec_hdr(c->generics)->size = saved;
+	return d->alias;
+}
+
+static Type *named_type(Checker *c, Type *t) {
+	const char *name = t->as.user_type.name;
+	int arg_count = t->as.user_type.arg_count;
+
+	if (find_generic(c, name)) {
+		if (arg_count) error(c, "Type parameter '%s' takes no type arguments.", name);
+		Type key = { .kind = TYPE_GENERIC, .as.param_name = name };
+		return intern(c, key);
+	}
+
+	TypeDecl *d = find_decl(c, name);
+	if (!d) {
+		error(c, "Unknown type '%s'.", name);
+		return NULL;
+	}
+
+	if (d->kind == DECL_ALIAS) {
+		if (arg_count) error(c, "Type alias '%s' takes no type arguments.", name);
+		return alias_type(c, d);
+	}
+
+	if (arg_count != d->generic_count) {
+		error(c, "Type '%s' expects %d type arguments but got %d.", name, d->generic_count, arg_count);
+		return NULL;
+	}
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	Type **args = arg_count ? PUSH_ARRAY_NZ(scratch, Type*, arg_count) : NULL;
+	for (int i = 0; i < arg_count; i++) args[i] = normalize(c, t->as.user_type.args[i]);
+	check_bounds(c, d->generics, d->generic_count, args, name);
+
+	Type key = { .kind = d->kind == DECL_STRUCT ? TYPE_STRUCT : TYPE_TRAIT };
+	key.as.user_type.name = name;
+	key.as.user_type.args = args;
+	key.as.user_type.arg_count = arg_count;
+	Type *result = intern(c, key);
+
+	arena_pop_to(scratch, mark);
+	return result;
+}
+
+static Type *normalize_uncached(Checker *c, Type *t) {
+	switch (t->kind) {
+		case TYPE_ARRAY: {
+			Type key = { .kind = TYPE_ARRAY };
+			key.as.array.inner = normalize(c, t->as.array.inner);
+			return intern(c, key);
+		}
+		case TYPE_FUNCTION: return function_type(c, t->as.function.sig);
+		case TYPE_STRUCT:   return named_type(c, t);
+		default:            return t;
+	}
+}
+
+// Resolves the names in an annotation: struct, trait, alias or type
+// parameter. The result is canonical in the parse's table.
+static Type *normalize(Checker *c, Type *t) {
+	if (!t || t->kind <= TYPE_STRING) return t;
+
+	bool cached = vec_size(c->generics) == 0;
+	if (cached) {
+		u64 *hit = ptr_map_get(&c->normalized, t);
+		if (hit) return AS_PTR(Type*, *hit);
+	}
+
+	Type *result = normalize_uncached(c, t);
+	if (cached) *ptr_map_put(&c->normalized, t) = AS_U64(result);
+	return result;
+}
+
+static Type **normalize_list(Checker *c, Type **types, int count) {
+	if (!count) return NULL;
+	Type **out = PUSH_ARRAY_NZ(c->arena, Type*, count);
+	for (int i = 0; i < count; i++) out[i] = normalize(c, types[i]);
+	return out;
+}
+
+// Parameter names are kept, so the signature still prints the same; the
+// function's own generics are in scope for its types.
+static Type *function_type(Checker *c, FuncSignature *sig) {
+	if (!sig) return NULL;
+
+	FuncSignature *out = PUSH_STRUCT_NZ(c->arena, FuncSignature);
+	*out = *sig;
+
+	push_generics(c, sig->generics, sig->generic_count);
+	if (sig->param_count) {
+		out->params = PUSH_ARRAY_NZ(c->arena, Param, sig->param_count);
+		for (int i = 0; i < sig->param_count; i++) {
+			out->params[i].name = sig->params[i].name;
+			out->params[i].type = normalize(c, sig->params[i].type);
+		}
+	}
+	out->return_types = normalize_list(c, sig->return_types, sig->return_count);
+	pop_generics(c);
+
+	Type key = { .kind = TYPE_FUNCTION, .as.function.sig = out };
+	return intern(c, key);
+}
+
+typedef struct {
+	GenericParam *params;
+	int count;
+	Type **args;
+} Substitution;
+
+static Type *substitute(Checker *c, Type *t, const Substitution *s);
+
+static Type **substitute_list(Checker *c, Type **types, int count, const Substitution *s, bool *changed) {
+	if (!count) return types;
+	Type **out = PUSH_ARRAY_NZ(c->arena, Type*, count);
+	for (int i = 0; i < count; i++) {
+		out[i] = substitute(c, types[i], s);
+		if (out[i] != types[i]) *changed = true;
+	}
+	return out;
+}
+
+static Type *substitute(Checker *c, Type *t, const Substitution *s) {
+	if (!t) return NULL;
+
+	switch (t->kind) {
+		case TYPE_GENERIC:
+			for (int i = 0; i < s->count; i++) {
+				if (s->params[i].name == t->as.param_name) return s->args[i];
+			}
+			return t;
+		case TYPE_ARRAY: {
+			Type *inner = substitute(c, t->as.array.inner, s);
+			if (inner == t->as.array.inner) return t;
+			Type key = { .kind = TYPE_ARRAY, .as.array.inner = inner };
+			return intern(c, key);
+		}
+		case TYPE_STRUCT:
+		case TYPE_TRAIT: {
+			int count = t->as.user_type.arg_count;
+			if (!count) return t;
+
+			MemArena *scratch = arena_scratch();
+			u64 mark = scratch->pos;
+			Type **args = PUSH_ARRAY_NZ(scratch, Type*, count);
+			bool changed = false;
+			for (int i = 0; i < count; i++) {
+				args[i] = substitute(c, t->as.user_type.args[i], s);
+				changed |= args[i] != t->as.user_type.args[i];
+			}
+
+			Type *result = t;
+			if (changed) {
+				Type key = *t;
+				key.as.user_type.args = args;
+				result = intern(c, key);
+			}
+			arena_pop_to(scratch, mark);
+			return result;
+		}
+		case TYPE_FUNCTION: {
+			FuncSignature *sig = t->as.function.sig;
+			if (!sig) return t;
+
+			bool changed = false;
+			Param *params = sig->params;
+			if (sig->param_count) {
+				params = PUSH_ARRAY_NZ(c->arena, Param, sig->param_count);
+				for (int i = 0; i < sig->param_count; i++) {
+					params[i].name = sig->params[i].name;
+					params[i].type = substitute(c, sig->params[i].type, s);
+					changed |= params[i].type != sig->params[i].type;
+				}
+			}
+			Type **returns = substitute_list(c, sig->return_types, sig->return_count, s, &changed);
+			if (!changed) return t;
+
+			FuncSignature *out = PUSH_STRUCT_NZ(c->arena, FuncSignature);
+			*out = *sig;
+			out->params = params;
+			out->return_types = returns;
+
+			Type key = { .kind = TYPE_FUNCTION, .as.function.sig = out };
+			return intern(c, key);
+		}
+		default:
+			return t;
+	}
+}
+
+// Applies args for params to t, once per distinct (t, args) pair. With
+// drop_generics the result is a plain function type: the call site bound
+// all of the function's own type parameters.
+static Type *instantiate(Checker *c, Type *t, GenericParam *params, int count, Type **args, bool drop_generics) {
+	if (!t || !count) return t;
+
+	InstanceSlot *slot = instance_slot(&c->instances, t, args, (u32)count);
+	if (slot->value) return slot->value;
+
+	Substitution s = { params, count, slot->args };
+	Type *result = substitute(c, t, &s);
+
+	if (drop_generics && result && result->kind == TYPE_FUNCTION && result->as.function.sig->generic_count) {
+		FuncSignature *sig = PUSH_STRUCT_NZ(c->arena, FuncSignature);
+		*sig = *result->as.function.sig;
+		sig->generics = NULL;
+		sig->generic_count = 0;
+		Type key = { .kind = TYPE_FUNCTION, .as.function.sig = sig };
+		result = intern(c, key);
+	}
+
+	// The slot may have moved if substituting added instances.
+	slot = instance_slot(&c->instances, t, args, (u32)count);
+	slot->value = result;
+	return result;
+}
+
+// Binds the type parameters in pattern to the matching parts of actual.
+// The first binding wins; conflicts surface later as assignment errors.
+static void unify(Type *pattern, Type *actual, GenericParam *params, int count, Type **bindings) {
+	if (!pattern || !actual) return;
+
+	switch (pattern->kind) {
+		case TYPE_GENERIC:
+			for (int i = 0; i < count; i++) {
+				if (params[i].name == pattern->as.param_name) {
+					if (!bindings[i]) bindings[i] = actual;
+					return;
+				}
+			}
+			return;
+		case TYPE_ARRAY:
+			if (actual->kind == TYPE_ARRAY) unify(pattern->as.array.inner, actual->as.array.inner, params, count, bindings);
+			return;
+		case TYPE_STRUCT:
+		case TYPE_TRAIT:
+			if (
+				actual->kind == pattern->kind &&
+				actual->as.user_type.name == pattern->as.user_type.name &&
+				actual->as.user_type.arg_count == pattern->as.user_type.arg_count
+			) {
+				for (int i = 0; i < pattern->as.user_type.arg_count; i++) {
+					unify(pattern->as.user_type.args[i], actual->as.user_type.args[i], params, count, bindings);
+				}
+			}
+			return;
+		default:
+			return;
+	}
+}
+
+// A declared type never admits nil: the bytecode compiler specializes on
+// it and reads the payload without looking at the tag.
+static bool assignable(Checker *c, Type *want, Type *got) {
+	if (!want || !got || want == got) return true;
+	if (got == c->t_nil) return false;
+
+	if (want->kind == TYPE_TRAIT) {
+		bool is_value = got->kind == TYPE_STRUCT || got->kind == TYPE_GENERIC;
+		return is_value && implements(c, got, want->as.user_type.name);
+	}
+
+	return false;
+}
+
+static Type **struct_fields(Checker *c, Type *t) {
+	TypeDecl *d = find_decl(c, t->as.user_type.name);
+	if (!d || d->kind != DECL_STRUCT) return NULL;
+	if (!d->generic_count) return d->field_types;
+
+	u64 *hit = ptr_map_get(&c->struct_fields, t);
+	if (hit) return AS_PTR(Type**, *hit);
+
+	int count = d->stmt->as.struct_decl.field_count;
+	Type **fields = count ? PUSH_ARRAY_NZ(c->arena, Type*, count) : NULL;
+	Substitution s = { d->generics, d->generic_count, t->as.user_type.args };
+	for (int i = 0; i < count; i++) fields[i] = substitute(c, d->field_types[i], &s);
+
+	*ptr_map_put(&c->struct_fields, t) = AS_U64(fields);
+	return fields;
+}
+
+// ==========================================
+// DECLARATIONS
+// ==========================================
+
+static void check_constraints(Checker *c, GenericParam *params, int count) {
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < params[i].constraint_count; j++) {
+			const char *name = constraint_name(params[i].constraints[j]);
+			TypeDecl *d = find_decl(c, name);
+			if (!d || d->kind != DECL_TRAIT) error(c, "Constraint '%s' on '%s' is not a trait.", name ? name : "?", params[i].name);
+		}
+	}
+}
+
+static Method *new_method(Checker *c, const char *name, Stmt *decl, Type *type) {
+	Method *m = PUSH_STRUCT(c->arena, Method);
+	m->name = name;
+	m->decl = decl;
+	m->type = type;
+	return m;
+}
+
+static void declare_type(Checker *c, Stmt *s, DeclKind kind, const char *name) {
+	if (!name) return;
+
+	u64 *slot = ptr_map_put(&c->decls, name);
+	if (*slot) {
+		c->context = name;
+		error(c, "Type '%s' is already declared.", name);
+		return;
+	}
+
+	TypeDecl *d = PUSH_STRUCT(c->arena, TypeDecl);
+	d->kind = kind;
+	d->stmt = s;
+	d->name = name;
+	d->impls = ptr_map_create(c->arena, 0);
+	d->methods = ptr_map_create(c->arena, 0);
+	d->fields = ptr_map_create(c->arena, 0);
+
+	if (kind == DECL_STRUCT) {
+		d->generics = s->as.struct_decl.generics;
+		d->generic_count = s->as.struct_decl.generic_count;
+	} else if (kind == DECL_TRAIT) {
+		d->generics = s->as.trait_decl.generics;
+		d->generic_count = s->as.trait_decl.generic_count;
+	}
+
+	*slot = AS_U64(d);
+}
+
+static void define_struct(Checker *c, TypeDecl *d) {
+	Stmt *s = d->stmt;
+	int count = s->as.struct_decl.field_count;
+
+	c->context = d->name;
+	check_constraints(c, d->generics, d->generic_count);
+
+	push_generics(c, d->generics, d->generic_count);
+	d->field_types = count ? PUSH_ARRAY_NZ(c->arena, Type*, count) : NULL;
+	for (int i = 0; i < count; i++) {
+		Param *field = &s->as.struct_decl.fields[i];
+		d->field_types[i] = normalize(c, field->type);
+
+		u64 *slot = ptr_map_put(&d->fields, field->name);
+		if (*slot) error(c, "Field '%s' is declared twice.", field->name);
+		else *slot = (u64)i + 1;
+	}
+	pop_generics(c);
+}
+
+static void define_trait(Checker *c, TypeDecl *d) {
+	Stmt *s = d->stmt;
+
+	c->context = d->name;
+	check_constraints(c, d->generics, d->generic_count);
+
+	push_generics(c, d->generics, d->generic_count);
+	for (int i = 0; i < s->as.trait_decl.func_count; i++) {
+		const char *name = s->as.trait_decl.func_names[i];
+		FuncSignature *sig = s->as.trait_decl.functions[i];
+		check_constraints(c, sig ? sig->generics : NULL, sig ? sig->generic_count : 0);
+
+		u64 *slot = ptr_map_put(&d->methods, name);
+		if (*slot) {
+			error(c, "Function '%s' is declared twice.", name);
+			continue;
+		}
+		*slot = AS_U64(new_method(c, name, NULL, function_type(c, sig)));
+	}
+	pop_generics(c);
+}
+
+static bool same_function(Type *a, Type *b) {
+	if (!a || !b || a == b) return true;
+
+	FuncSignature *x = a->as.function.sig, *y = b->as.function.sig;
+	if (x->param_count != y->param_count || x->return_count != y->return_count) return false;
+
+	for (int i = 0; i < x->param_count; i++) {
+		Type *p = x->params[i].type, *q = y->params[i].type;
+		if (p && q && p != q) return false;
+	}
+	for (int i = 0; i < x->return_count; i++) {
+		Type *p = x->return_types[i], *q = y->return_types[i];
+		if (p && q && p != q) return false;
+	}
+	return true;
+}
+
+// Registers the impl in its struct's index and checks it against the
+// trait, with the trait's type parameters replaced by the impl's arguments.
+static void define_impl(Checker *c, Stmt *s) {
+	const char *target_name = s->as.impl_stmt.target_name;
+	const char *trait_name = s->as.impl_stmt.trait_name;
+
+	c->context = target_name;
+	check_constraints(c, s->as.impl_stmt.generics, s->as.impl_stmt.generic_count);
+
+	TypeDecl *target = find_decl(c, target_name);
+	TypeDecl *named_trait = trait_name ? find_decl(c, trait_name) : NULL;
+	if (target && target->kind == DECL_TRAIT && named_trait && named_trait->kind == DECL_STRUCT) {
+		error(c, "The struct comes first: write 'impl %s for %s'.", trait_name, target_name);
+		return;
+	}
+	if (!target || target->kind != DECL_STRUCT) {
+		error(c, "Cannot implement methods for '%s', which is not a struct.", target_name ? target_name : "?");
+		return;
+	}
+
+	TypeDecl *trait = NULL;
+	if (trait_name) {
+		trait = find_decl(c, trait_name);
+		if (!trait || trait->kind != DECL_TRAIT) {
+			error(c, "'%s' is not a trait.", trait_name);
+			return;
+		}
+
+		u64 *slot = ptr_map_put(&target->impls, trait_name);
+		if (*slot) {
+			error(c, "'%s' already implements '%s'.", target_name, trait_name);
+			return;
+		}
+		*slot = AS_U64(s);
+	}
+
+	push_generics(c, s->as.impl_stmt.generics, s->as.impl_stmt.generic_count);
+
+	int target_arg_count = s->as.impl_stmt.target_arg_count;
+	if (target_arg_count != target->generic_count) {
+		error(c, "Type '%s' expects %d type arguments but got %d.", target_name, target->generic_count, target_arg_count);
+	}
+	Type **target_args = normalize_list(c, s->as.impl_stmt.target_args, target_arg_count);
+	Type **trait_args = normalize_list(c, s->as.impl_stmt.trait_args, s->as.impl_stmt.trait_arg_count);
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	PtrMap own = ptr_map_create(scratch, 0);
+
+	for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+		Stmt *func = s->as.impl_stmt.functions[i];
+		if (!func) continue;
+
+		const char *name = func->as.func_decl.name;
+		FuncSignature *sig = func->as.func_decl.signature;
+		check_constraints(c, sig ? sig->generics : NULL, sig ? sig->generic_count : 0);
+
+		Method *m = new_method(c, name, func, function_type(c, sig));
+		m->owner_generics = s->as.impl_stmt.generics;
+		m->owner_generic_count = s->as.impl_stmt.generic_count;
+		m->owner_args = target_args;
+		m->owner_arg_count = target_arg_count;
+
+		u64 *slot = ptr_map_put(&target->methods, name);
+		if (*slot) error(c, "Method '%s' is already defined for '%s'.", name, target_name);
+		else *slot = AS_U64(m);
+		*ptr_map_put(&own, name) = AS_U64(m);
+	}
+
+	if (trait) {
+		Stmt *t = trait->stmt;
+		int trait_arg_count = s->as.impl_stmt.trait_arg_count;
+		if (trait_arg_count != trait->generic_count) {
+			error(c, "Trait '%s' expects %d type arguments but got %d.", trait_name, trait->generic_count, trait_arg_count);
+			trait_arg_count = 0;
+		}
+
+		for (int i = 0; i < t->as.trait_decl.func_count; i++) {
+			const char *name = t->as.trait_decl.func_names[i];
+			u64 *found = ptr_map_get(&own, name);
+			if (!found) {
+				error(c, "Missing method '%s' required by trait '%s'.", name, trait_name);
+				continue;
+			}
+
+			Method *required = AS_PTR(Method*, *ptr_map_get(&trait->methods, name));
+			Type *expected = instantiate(c, required->type, trait->generics, trait_arg_count, trait_args, false);
+			if (!same_function(expected, AS_PTR(Method*, *found)->type)) {
+				error(c, "Method '%s' has type '%s' but trait '%s' declares '%s'.", name,
+					type_name(c, AS_PTR(Method*, *found)->type), trait_name, type_name(c, expected));
+			}
+		}
+
+		for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+			Stmt *func = s->as.impl_stmt.functions[i];
+			if (func && !ptr_map_get(&trait->methods, func->as.func_decl.name)) {
+				error(c, "Method '%s' is not part of trait '%s'.", func->as.func_decl.name, trait_name);
+			}
+		}
+	}
+
+	arena_pop_to(scratch, mark);
+	pop_generics(c);
+}
+
+static void collect_declarations(Checker *c, Stmt *root) {
+	if (!root || root->kind != STMT_BLOCK) return;
+	Stmt **stmts = root->as.block.stmts;
+	int count = root->as.block.stmt_count;
+
+	for (int i = 0; i < count; i++) {
+		Stmt *s = stmts[i];
+		if (!s) continue;
+		c->node = s;
+		if (s->kind == STMT_STRUCT) declare_type(c, s, DECL_STRUCT, s->as.struct_decl.name);
+		if (s->kind == STMT_TRAIT) declare_type(c, s, DECL_TRAIT, s->as.trait_decl.name);
+		if (s->kind == STMT_TYPE_ALIAS) declare_type(c, s, DECL_ALIAS, s->as.type_alias.name);
+	}
+
+	for (int i = 0; i < count; i++) {
+		Stmt *s = stmts[i];
+		if (!s) continue;
+		c->node = s;
+
+		TypeDecl *d = NULL;
+		if (s->kind == STMT_STRUCT) d = find_decl(c, s->as.struct_decl.name);
+		if (s->kind == STMT_TRAIT) d = find_decl(c, s->as.trait_decl.name);
+		if (!d || d->stmt != s) continue;
+
+		if (d->kind == DECL_STRUCT) define_struct(c, d);
+		else define_trait(c, d);
+	}
+
+	for (int i = 0; i < count; i++) {
+		Stmt *s = stmts[i];
+		if (!s) continue;
+		c->node = s;
+
+		if (s->kind == STMT_TYPE_ALIAS) {
+			TypeDecl *d = find_decl(c, s->as.type_alias.name);
+			c->context = s->as.type_alias.name;
+			if (d && d->stmt == s) alias_type(c, d);
+		}
+		if (s->kind == STMT_IMPL) define_impl(c, s);
+	}
+
+	// Top-level functions can be called before their declaration.
+	for (int i = 0; i < count; i++) {
+		Stmt *s = stmts[i];
+		if (!s || s->kind != STMT_FUNCTION) continue;
+		c->node = s;
+
+		Binding b = resolution_binding(c->resolution, s);
+		if (b.scope == VAR_GLOBAL) {
+			c->context = s->as.func_decl.name;
+			c->globals[b.slot] = function_type(c, s->as.func_decl.signature);
+		}
+	}
+}
+
+// ==========================================
+// EXPRESSIONS
+// ==========================================
+
+static const char *binary_op_names[] = {
+	[OP_ADD] = "+", [OP_SUB] = "-", [OP_MUL] = "*", [OP_DIV] = "/",
+	[OP_MOD] = "%", [OP_POW] = "^", [OP_CONCAT] = "..",
+	[OP_EQ] = "==", [OP_NEQ] = "~=", [OP_LT] = "<", [OP_LTE] = "<=",
+	[OP_GT] = ">", [OP_GTE] = ">=", [OP_AND] = "and", [OP_OR] = "or",
+};
+
+static Type *expr_type(Checker *c, Expr *e) {
+	u64 *value = e ? ptr_map_get(&c->out->expr_types, e) : NULL;
+	return value ? AS_PTR(Type*, *value) : NULL;
+}
+
+static Type *variable_type(Checker *c, Expr *e) {
+	FunctionCheck *fn = c->fn;
+	u32 slot = e->as.variable.slot;
+
+	switch (e->as.variable.scope) {
+		case VAR_LOCAL:   return slot < fn->scope->slot_count ? fn->slots[slot] : NULL;
+		case VAR_UPVALUE: return slot < fn->scope->upvalue_count ? fn->upvalues[slot] : NULL;
+		case VAR_GLOBAL:  return slot < c->resolution->global_count ? c->globals[slot] : NULL;
+		default:          return NULL;
+	}
+}
+
+static bool is_number(Checker *c, Type *t) { return !t || t == c->t_number; }
+
+static Type *binary_type(Checker *c, Expr *e) {
+	Type *left = expr_type(c, e->as.binary.left);
+	Type *right = expr_type(c, e->as.binary.right);
+	BinaryOp op = e->as.binary.op;
+	const char *name = op < sizeof(binary_op_names) / sizeof(*binary_op_names) ? binary_op_names[op] : "?";
+
+	switch (op) {
+		case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW:
+			if (!is_number(c, left) || !is_number(c, right)) {
+				error(c, "Operator '%s' expects numbers, got '%s' and '%s'.", name, type_name(c, left), type_name(c, right));
+			}
+			return c->t_number;
+		case OP_CONCAT: {
+			bool ok_left = is_number(c, left) || left == c->t_string;
+			bool ok_right = is_number(c, right) || right == c->t_string;
+			if (!ok_left || !ok_right) {
+				error(c, "Operator '..' expects strings or numbers, got '%s' and '%s'.", type_name(c, left), type_name(c, right));
+			}
+			return c->t_string;
+		}
+		case OP_LT: case OP_LTE: case OP_GT: case OP_GTE: {
+			bool numbers = is_number(c, left) && is_number(c, right);
+			bool strings = (!left || left == c->t_string) && (!right || right == c->t_string);
+			if (!numbers && !strings) {
+				error(c, "Operator '%s' expects two numbers or two strings, got '%s' and '%s'.", name, type_name(c, left), type_name(c, right));
+			}
+			return c->t_bool;
+		}
+		case OP_EQ: case OP_NEQ:
+			return c->t_bool;
+		case OP_AND: case OP_OR:
+			return left == right ? left : NULL;
+		default:
+			return NULL;
+	}
+}
+
+static Type *unary_type(Checker *c, Expr *e) {
+	Type *operand = expr_type(c, e->as.unary.operand);
+
+	switch (e->as.unary.op) {
+		case OP_NEGATE:
+			if (!is_number(c, operand)) error(c, "Operator '-' expects a number, got '%s'.", type_name(c, operand));
+			return c->t_number;
+		case OP_NOT:
+			return c->t_bool;
+		case OP_LEN: {
+			bool ok = !operand || operand == c->t_string || operand->kind == TYPE_ARRAY;
+			if (!ok) error(c, "Operator '#' expects a string or an array, got '%s'.", type_name(c, operand));
+			return c->t_number;
+		}
+		default:
+			return NULL;
+	}
+}
+
+// A method's type with the impl's type parameters bound from the
+// receiver's arguments.
+static Type *method_type(Checker *c, Method *m, Type *receiver) {
+	int count = m->owner_generic_count;
+	if (!count || !receiver || receiver->kind != TYPE_STRUCT) return m->type;
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	Type **bindings = PUSH_ARRAY(scratch, Type*, count);
+
+	int n = m->owner_arg_count < receiver->as.user_type.arg_count ? m->owner_arg_count : receiver->as.user_type.arg_count;
+	for (int i = 0; i < n; i++) {
+		unify(m->owner_args[i], receiver->as.user_type.args[i], m->owner_generics, count, bindings);
+	}
+
+	Type *t = instantiate(c, m->type, m->owner_generics, count, bindings, false);
+	arena_pop_to(scratch, mark);
+	return t;
+}
+
+static Method *find_method(TypeDecl *d, const char *name) {
+	u64 *value = d ? ptr_map_get(&d->methods, name) : NULL;
+	return value ? AS_PTR(Method*, *value) : NULL;
+}
+
+static Type *bind_method(Checker *c, Expr *e, Method *m, Type *receiver) {
+	if (m->decl) *ptr_map_put(&c->out->methods, e) = AS_U64(m->decl);
+	return method_type(c, m, receiver);
+}
+
+static Type *field_type(Checker *c, Expr *e) {
+	Expr *target = e->as.field.target;
+	Type *t = expr_type(c, target);
+	const char *name = e->as.field.field;
+
+	// Struct.method, for functions in an inherent impl that don't use self.
+	if (!t && target && target->kind == EXPR_VARIABLE && target->as.variable.scope == VAR_GLOBAL) {
+		TypeDecl *d = find_decl(c, target->as.variable.name);
+		if (d && d->kind == DECL_STRUCT) {
+			Method *m = find_method(d, name);
+			if (m) return bind_method(c, e, m, NULL);
+			error(c, "Struct '%s' has no function '%s'.", d->name, name);
+			return NULL;
+		}
+	}
+
+	if (!t) return NULL;
+
+	switch (t->kind) {
+		case TYPE_STRUCT: {
+			TypeDecl *d = find_decl(c, t->as.user_type.name);
+			if (!d) return NULL;
+
+			u64 *field = ptr_map_get(&d->fields, name);
+			if (field) {
+				Type **fields = struct_fields(c, t);
+				return fields ? fields[*field - 1] : NULL;
+			}
+
+			Method *m = find_method(d, name);
+			if (m) return bind_method(c, e, m, t);
+			break;
+		}
+		case TYPE_TRAIT: {
+			Method *m = find_method(find_decl(c, t->as.user_type.name), name);
+			if (m) return m->type;
+			break;
+		}
+		case TYPE_GENERIC: {
+			GenericParam *param = find_generic(c, t->as.param_name);
+			for (int i = 0; param && i < param->constraint_count; i++) {
+				Method *m = find_method(find_decl(c, constraint_name(param->constraints[i])), name);
+				if (m) return m->type;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+
+	error(c, "Type '%s' has no field or method '%s'.", type_name(c, t), name);
+	return NULL;
+}
+
+static Type *index_type(Checker *c, Expr *e) {
+	Type *t = expr_type(c, e->as.index.target);
+	Type *index = expr_type(c, e->as.index.index);
+
+	if (t && t->kind == TYPE_ARRAY) {
+		if (!is_number(c, index)) error(c, "Array index must be a number, got '%s'.", type_name(c, index));
+		return t->as.array.inner;
+	}
+	return NULL;
+}
+
+static Type *call_type(Checker *c, Expr *e) {
+	Type *callee = expr_type(c, e->as.call.callee);
+	if (!callee || callee->kind != TYPE_FUNCTION) {
+		if (callee) error(c, "Cannot call a value of type '%s'.", type_name(c, callee));
+		return NULL;
+	}
+
+	FuncSignature *sig = callee->as.function.sig;
+	int arg_count = e->as.call.arg_count;
+
+	// Type parameters are bound from the arguments, bounds checked through
+	// the impl index, and the signature instantiated once per binding.
+	if (sig->generic_count) {
+		MemArena *scratch = arena_scratch();
+		u64 mark = scratch->pos;
+		Type **bindings = PUSH_ARRAY(scratch, Type*, sig->generic_count);
+
+		for (int i = 0; i < arg_count && i < sig->param_count; i++) {
+			unify(sig->params[i].type, expr_type(c, e->as.call.args[i]), sig->generics, sig->generic_count, bindings);
+		}
+		Expr *name = e->as.call.callee;
+		const char *owner = name->kind == EXPR_VARIABLE ? name->as.variable.name :
+			name->kind == EXPR_FIELD ? name->as.field.field : "call";
+		check_bounds(c, sig->generics, sig->generic_count, bindings, owner);
+
+		callee = instantiate(c, callee, sig->generics, sig->generic_count, bindings, true);
+		sig = callee->as.function.sig;
+		arena_pop_to(scratch, mark);
+	}
+
+	if (arg_count != sig->param_count) {
+		error(c, "Expected %d arguments but got %d.", sig->param_count, arg_count);
+	}
+
+	for (int i = 0; i < arg_count && i < sig->param_count; i++) {
+		Type *want = sig->params[i].type;
+		Type *got = expr_type(c, e->as.call.args[i]);
+		if (!assignable(c, want, got)) {
+			error(c, "Argument '%s' expects '%s' but got '%s'.", sig->params[i].name, type_name(c, want), type_name(c, got));
+		}
+	}
+
+	return sig->return_count ? sig->return_types[0] : NULL;
+}
+
+static Type *struct_init_type(Checker *c, Expr *e) {
+	Expr *name = e->as.struct_init.name;
+	if (!name || name->kind != EXPR_VARIABLE) return NULL;
+
+	TypeDecl *d = find_decl(c, name->as.variable.name);
+	if (!d || d->kind != DECL_STRUCT) {
+		error(c, "Unknown struct '%s'.", name->as.variable.name);
+		return NULL;
+	}
+
+	int count = e->as.struct_init.entry_count;
+	TableEntry *entries = e->as.struct_init.entries;
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	u32 *fields = PUSH_ARRAY(scratch, u32, count);
+
+	for (int i = 0; i < count; i++) {
+		Expr *key = entries[i].key;
+		if (!key || key->kind != EXPR_VARIABLE) continue;
+
+		u64 *field = ptr_map_get(&d->fields, key->as.variable.name);
+		if (field) fields[i] = (u32)*field;
+		else error(c, "Struct '%s' has no field '%s'.", d->name, key->as.variable.name);
+	}
+
+	// A generic struct's arguments come from the field values.
+	Type **args = NULL;
+	if (d->generic_count) {
+		args = PUSH_ARRAY(scratch, Type*, d->generic_count);
+		for (int i = 0; i < count; i++) {
+			if (fields[i]) unify(d->field_types[fields[i] - 1], expr_type(c, entries[i].value), d->generics, d->generic_count, args);
+		}
+		check_bounds(c, d->generics, d->generic_count, args, d->name);
+	}
+
+	Type key = { .kind = TYPE_STRUCT };
+	key.as.user_type.name = d->name;
+	key.as.user_type.args = args;
+	key.as.user_type.arg_count = d->generic_count;
+	Type *t = intern(c, key);
+
+	// A field left out would be nil, so every one has to be given.
+	int field_count = d->stmt->as.struct_decl.field_count;
+	bool *given = PUSH_ARRAY(scratch, bool, field_count + 1);
+	for (int i = 0; i < count; i++) {
+		if (fields[i]) given[fields[i] - 1] = true;
+	}
+	for (int i = 0; i < field_count; i++) {
+		if (!given[i]) error(c, "Struct '%s' is missing field '%s'.", d->name, d->stmt->as.struct_decl.fields[i].name);
+	}
+
+	Type **field_types = struct_fields(c, t);
+	for (int i = 0; i < count; i++) {
+		if (!fields[i]) continue;
+		Type *want = field_types[fields[i] - 1];
+		Type *got = expr_type(c, entries[i].value);
+		if (!assignable(c, want, got)) {
+			error(c, "Field '%s' expects '%s' but got '%s'.", entries[i].key->as.variable.name, type_name(c, want), type_name(c, got));
+		}
+	}
+
+	arena_pop_to(scratch, mark);
+	return t;
+}
+
+static void check_function(Checker *c, FunctionScope *scope, Type *type, Stmt *body, Type *self);
+
+static Type *type_of(Checker *c, Expr *e) {
+	c->node = e;
+	switch (e->kind) {
+		case EXPR_NIL:      return c->t_nil;
+		case EXPR_BOOL:     return c->t_bool;
+		case EXPR_NUMBER:   return c->t_number;
+		case EXPR_STRING:   return c->t_string;
+		case EXPR_VARIABLE: return variable_type(c, e);
+		case EXPR_BINARY:   return binary_type(c, e);
+		case EXPR_UNARY:    return unary_type(c, e);
+		case EXPR_CALL:     return call_type(c, e);
+		case EXPR_INDEX:    return index_type(c, e);
+		case EXPR_FIELD:    return field_type(c, e);
+		case EXPR_STRUCT:   return struct_init_type(c, e);
+		case EXPR_FUNCTION: {
+			FuncSignature *sig = &e->as.function.signature;
+			Type *t = function_type(c, sig);
+			push_generics(c, sig->generics, sig->generic_count);
+			check_function(c, resolution_function(c->resolution, e->as.function.body), t, e->as.function.body, NULL);
+			pop_generics(c);
+			return t;
+		}
+		default:            return NULL;
+	}
+}
+
+#define push_expr(c, e, r) do { if (e) { ExprWork w = { (e), (r) }; vec_push((c)->work, w); } } while (0)
+
+// Post-order from an explicit stack: children are typed before their
+// parent, and long operator chains don't recurse.
+static Type *check_expr(Checker *c, Expr *root) {
+	const void *enclosing = c->node;
+	u32 base = (u32)vec_size(c->work);
+	push_expr(c, root, false);
+
+	while (vec_size(c->work) > base) {
+		ExprWork w = c->work[--vec_hdr(c->work)->size];
+		Expr *e = w.expr;
+
+		if (w.ready) {
+			Type *t = type_of(c, e);
+			if (t) *ptr_map_put(&c->out->expr_types, e) = AS_U64(t);
+			continue;
+		}
+
+		push_expr(c, e, true);
+		switch (e->kind) {
+			case EXPR_BINARY:
+				push_expr(c, e->as.binary.right, false);
+				push_expr(c, e->as.binary.left, false);
+				break;
+			case EXPR_UNARY:
+				push_expr(c, e->as.unary.operand, false);
+				break;
+			case EXPR_CALL:
+				for (int i = e->as.call.arg_count - 1; i >= 0; i--) push_expr(c, e->as.call.args[i], false);
+				push_expr(c, e->as.call.callee, false);
+				break;
+			case EXPR_INDEX:
+				push_expr(c, e->as.index.index, false);
+				push_expr(c, e->as.index.target, false);
+				break;
+			case EXPR_FIELD:
+				push_expr(c, e->as.field.target, false);
+				break;
+			case EXPR_TABLE:
+				for (int i = e->as.table.entry_count - 1; i >= 0; i--) {
+					push_expr(c, e->as.table.entries[i].value, false);
+					push_expr(c, e->as.table.entries[i].key, false);
+				}
+				break;
+			case EXPR_STRUCT:
+				for (int i = e->as.struct_init.entry_count - 1; i >= 0; i--) {
+					push_expr(c, e->as.struct_init.entries[i].value, false);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	c->node = enclosing;
+	return expr_type(c, root);
+}
+
+// ==========================================
+// STATEMENTS
+// ==========================================
+
+static void set_slot(Checker *c, u32 slot, Type *t) {
+	if (slot < c->fn->scope->slot_count) c->fn->slots[slot] = t;
+}
+
+static void check_block(Checker *c, Stmt *block);
+
+static void check_local(Checker *c, Stmt *s) {
+	int value_count = s->as.local.value_count;
+	int decl_count = s->as.local.decl_count;
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	Type **values = PUSH_ARRAY(scratch, Type*, value_count + 1);
+	for (int i = 0; i < value_count; i++) values[i] = check_expr(c, s->as.local.values[i]);
+
+	// A call in last place may spread over the declarations left over.
+	Expr *last = value_count ? s->as.local.values[value_count - 1] : NULL;
+	bool spread = last && last->kind == EXPR_CALL;
+
+	Binding b = resolution_binding(c->resolution, s);
+	for (int i = 0; i < decl_count; i++) {
+		Param *decl = &s->as.local.decls[i];
+		Type *want = normalize(c, decl->type);
+		Type *got = i < value_count ? values[i] : NULL;
+
+		// Nothing would be there but nil, which no declared type admits.
+		if (want && want != c->t_nil && i >= value_count && !spread) {
+			error(c, "'%s' of type '%s' needs an initial value.", decl->name, type_name(c, want));
+		} else if (!assignable(c, want, got)) {
+			error(c, "Cannot assign '%s' to '%s' of type '%s'.", type_name(c, got), decl->name, type_name(c, want));
+		}
+		if (b.scope == VAR_LOCAL) set_slot(c, b.slot + (u32)i, want ? want : got);
+	}
+
+	arena_pop_to(scratch, mark);
+}
+
+static void check_assign(Checker *c, Stmt *s) {
+	int count = s->as.assign.target_count < s->as.assign.value_count ? s->as.assign.target_count : s->as.assign.value_count;
+
+	for (int i = 0; i < s->as.assign.value_count; i++) check_expr(c, s->as.assign.values[i]);
+	for (int i = 0; i < s->as.assign.target_count; i++) check_expr(c, s->as.assign.targets[i]);
+
+	for (int i = 0; i < count; i++) {
+		Type *want = expr_type(c, s->as.assign.targets[i]);
+		Type *got = expr_type(c, s->as.assign.values[i]);
+		if (!assignable(c, want, got)) error(c, "Cannot assign '%s' to a value of type '%s'.", type_name(c, got), type_name(c, want));
+	}
+}
+
+// Functions without a return annotation are not checked; 'void' allows
+// only a bare return.
+static void check_return(Checker *c, Stmt *s) {
+	int count = s->as.return_stmt.value_count;
+	for (int i = 0; i < count; i++) check_expr(c, s->as.return_stmt.values[i]);
+
+	FunctionCheck *fn = c->fn;
+	if (!fn->return_count) return;
+
+	if (fn->return_count == 1 && fn->returns[0] == c->t_void) {
+		if (count) error(c, "A function returning void can't return a value.");
+		return;
+	}
+
+	Expr *last = count ? s->as.return_stmt.values[count - 1] : NULL;
+	bool spread = last && last->kind == EXPR_CALL;
+	if (count > fn->return_count || (count < fn->return_count && !spread)) {
+		error(c, "Expected %d return values but got %d.", fn->return_count, count);
+	}
+
+	for (int i = 0; i < count && i < fn->return_count; i++) {
+		Type *got = expr_type(c, s->as.return_stmt.values[i]);
+		if (!assignable(c, fn->returns[i], got)) {
+			error(c, "Cannot return '%s' as '%s'.", type_name(c, got), type_name(c, fn->returns[i]));
+		}
+	}
+}
+
+static void check_impl(Checker *c, Stmt *s) {
+	const char *saved = c->context;
+	push_generics(c, s->as.impl_stmt.generics, s->as.impl_stmt.generic_count);
+
+	// Methods are checked with self typed as the impl's target.
+	c->context = s->as.impl_stmt.target_name;
+	Type target = { .kind = TYPE_STRUCT };
+	target.as.user_type.name = s->as.impl_stmt.target_name;
+	target.as.user_type.args = s->as.impl_stmt.target_args;
+	target.as.user_type.arg_count = s->as.impl_stmt.target_arg_count;
+	TypeDecl *d = find_decl(c, target.as.user_type.name);
+	Type *self = d && d->kind == DECL_STRUCT ? normalize(c, type_intern(c->types, &target)) : NULL;
+
+	for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+		Stmt *func = s->as.impl_stmt.functions[i];
+		if (!func) continue;
+
+		FuncSignature *sig = func->as.func_decl.signature;
+		c->context = func->as.func_decl.name;
+		c->node = func;
+		Type *t = function_type(c, sig);
+
+		push_generics(c, sig ? sig->generics : NULL, sig ? sig->generic_count : 0);
+		check_function(c, resolution_function(c->resolution, func->as.func_decl.body), t, func->as.func_decl.body, self);
+		pop_generics(c);
+	}
+
+	pop_generics(c);
+	c->context = saved;
+}
+
+static void check_stmt(Checker *c, Stmt *s) {
+	if (!s) return;
+	c->node = s;
+
+	switch (s->kind) {
+		case STMT_EXPR:   check_expr(c, s->as.expression); break;
+		case STMT_BLOCK:  check_block(c, s); break;
+		case STMT_RETURN: check_return(c, s); break;
+		case STMT_ASSIGN: check_assign(c, s); break;
+		case STMT_LOCAL:  check_local(c, s); break;
+		case STMT_IF:
+			for (Stmt *branch = s; ; branch = branch->as.if_stmt.else_branch) {
+				check_expr(c, branch->as.if_stmt.condition);
+				check_block(c, branch->as.if_stmt.then_branch);
+
+				Stmt *next = branch->as.if_stmt.else_branch;
+				if (!next || next->kind != STMT_IF) {
+					check_block(c, next);
+					break;
+				}
+			}
+			break;
+		case STMT_WHILE:
+			check_expr(c, s->as.while_stmt.condition);
+			check_block(c, s->as.while_stmt.body);
+			break;
+		case STMT_REPEAT:
+			check_block(c, s->as.repeat_stmt.body);
+			check_expr(c, s->as.repeat_stmt.condition);
+			break;
+		case STMT_FOR_NUM: {
+			Expr *bounds[] = { s->as.for_num.start, s->as.for_num.end, s->as.for_num.step };
+			for (u32 i = 0; i < 3; i++) {
+				Type *t = bounds[i] ? check_expr(c, bounds[i]) : NULL;
+				if (!is_number(c, t)) error(c, "'for' bounds must be numbers, got '%s'.", type_name(c, t));
+			}
+
+			Binding b = resolution_binding(c->resolution, s);
+			if (b.scope == VAR_LOCAL) set_slot(c, b.slot, c->t_number);
+			check_block(c, s->as.for_num.body);
+			break;
+		}
+		case STMT_FOR_GEN: {
+			check_expr(c, s->as.for_gen.iter);
+
+			Binding b = resolution_binding(c->resolution, s);
+			for (int i = 0; b.scope == VAR_LOCAL && i < s->as.for_gen.name_count; i++) set_slot(c, b.slot + (u32)i, NULL);
+			check_block(c, s->as.for_gen.body);
+			break;
+		}
+		case STMT_FUNCTION: {
+			const char *saved = c->context;
+			FuncSignature *sig = s->as.func_decl.signature;
+			c->context = s->as.func_decl.name;
+			Type *t = function_type(c, sig);
+
+			Binding b = resolution_binding(c->resolution, s);
+			if (b.scope == VAR_LOCAL) set_slot(c, b.slot, t);
+			if (b.scope == VAR_GLOBAL && b.slot < c->resolution->global_count) c->globals[b.slot] = t;
+
+			push_generics(c, sig ? sig->generics : NULL, sig ? sig->generic_count : 0);
+			check_function(c, resolution_function(c->resolution, s->as.func_decl.body), t, s->as.func_decl.body, NULL);
+			pop_generics(c);
+			c->context = saved;
+			break;
+		}
+		case STMT_IMPL: check_impl(c, s); break;
+		default: break;
+	}
+}
+
+static void check_block(Checker *c, Stmt *block) {
+	if (!block) return;
+	if (block->kind != STMT_BLOCK) {
+		check_stmt(c, block);
+		return;
+	}
+	for (int i = 0; i < block->as.block.stmt_count; i++) check_stmt(c, block->as.block.stmts[i]);
+}
+
+// Whether every path through s ends in a return. Loops other than repeat
+// may run zero times, so only a repeat body counts.
+static bool always_returns(Stmt *s) {
+	if (!s) return false;
+
+	switch (s->kind) {
+		case STMT_RETURN: return true;
+		case STMT_REPEAT: return always_returns(s->as.repeat_stmt.body);
+		case STMT_BLOCK:
+			for (int i = 0; i < s->as.block.stmt_count; i++) {
+				if (always_returns(s->as.block.stmts[i])) return true;
+			}
+			return false;
+		case STMT_IF:
+			for (Stmt *branch = s; ; branch = branch->as.if_stmt.else_branch) {
+				if (!always_returns(branch->as.if_stmt.then_branch)) return false;
+
+				Stmt *next = branch->as.if_stmt.else_branch;
+				if (!next || next->kind != STMT_IF) return always_returns(next);
+			}
+		default:
+			return false;
+	}
+}
+
+// Frames live on the scratch arena for the duration of the body; a
+// closure's upvalues are typed from its parent's frame as it is entered.
+static void check_function(Checker *c, FunctionScope *scope, Type *type, Stmt *body, Type *self) {
+	if (!scope) return;
+
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+
+	FunctionCheck fn = {0};
+	fn.enclosing = c->fn;
+	fn.scope = scope;
+	fn.slots = PUSH_ARRAY(scratch, Type*, scope->slot_count + 1);
+	fn.upvalues = PUSH_ARRAY(scratch, Type*, scope->upvalue_count + 1);
+
+	FunctionCheck *parent = c->fn;
+	for (u32 i = 0; parent && i < scope->upvalue_count; i++) {
+		Upvalue *up = &scope->upvalues[i];
+		Type **from = up->local ? parent->slots : parent->upvalues;
+		u32 limit = up->local ? parent->scope->slot_count : parent->scope->upvalue_count;
+		fn.upvalues[i] = up->index < limit ? from[up->index] : NULL;
+	}
+
+	FuncSignature *sig = type ? type->as.function.sig : NULL;
+	u32 first = scope->method ? 1 : 0;
+	if (scope->method && scope->slot_count) fn.slots[0] = self;
+	for (u32 i = 0; sig && i < scope->param_count && first + i < scope->slot_count; i++) {
+		fn.slots[first + i] = sig->params[i].type;
+	}
+	if (sig) {
+		fn.returns = sig->return_types;
+		fn.return_count = sig->return_count;
+	}
+
+	const void *node = c->node;
+	c->fn = &fn;
+	check_block(c, body);
+	c->fn = fn.enclosing;
+
+	// Falling off the end returns nothing, which only void allows.
+	bool returns_value = fn.return_count && !(fn.return_count == 1 && fn.returns[0] == c->t_void);
+	if (returns_value && !always_returns(body)) {
+		c->node = node;
+		error(c, "Function can end without returning a value.");
+	}
+
+	arena_pop_to(scratch, mark);
+}
+
+CheckResult check(Stmt *root, const Resolution *resolution, TypeTable *types, const SpanTable *spans, StringPool *pool, MemArena *arena) {
+	(void)pool;
+
+	CheckResult out = {0};
+	out.success = true;
+	out.expr_types = ptr_map_create(arena, 0);
+	out.methods = ptr_map_create(arena, 0);
+
+	Checker c = {0};
+	c.arena = arena;
+	c.resolution = resolution;
+	c.types = types;
+	c.spans = spans;
+	c.out = &out;
+	c.decls = ptr_map_create(arena, 0);
+	c.normalized = ptr_map_create(arena, 0);
+	c.struct_fields = ptr_map_create(arena, 0);
+	instances_init(&c.instances, arena);
+	c.globals = PUSH_ARRAY(arena, Type*, resolution->global_count + 1);
+
+	c.t_void = intern(&c, (Type){ .kind = TYPE_VOID });
+	c.t_nil = intern(&c, (Type){ .kind = TYPE_NIL });
+	c.t_bool = intern(&c, (Type){ .kind = TYPE_BOOL });
+	c.t_number = intern(&c, (Type){ .kind = TYPE_NUMBER });
+	c.t_string = intern(&c, (Type){ .kind = TYPE_STRING });
+
+	collect_declarations(&c, root);
+
+	c.context = "main chunk";
+	check_function(&c, resolution->main, NULL, root, NULL);
+
+	out.diagnostic_count = (u32)vec_size(c.errors);
+	if (out.diagnostic_count) {
+		out.diagnostics = PUSH_ARRAY_NZ(arena, Diagnostic, out.diagnostic_count);
+		memcpy(out.diagnostics, c.errors, out.diagnostic_count * sizeof(Diagnostic));
+	}
+
+	vec_free(c.errors);
+	vec_free(c.work);
+	vec_free(c.generics);
+	return out;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "arena.h"
+#include "parser.h"
+#include "ptr_map.h"
+#include "resolver.h"
+#include "string_pool.h"
+#include "type_table.h"
+#include "typedefs.h"
+
+// Static checks over a resolved tree: annotations must name declared types
+// with the right number of arguments, impls must match their traits, and
+// expressions, calls, assignments and returns must agree with the declared
+// types. Unannotated and unknown values are left unchecked rather than
+// guessed, so plain Lua-style code passes.
+//
+// Which traits a struct implements is kept in a per-struct index keyed on
+// the trait's name, so a bound check is two map lookups regardless of how
+// many impls exist. Generic structs and functions are instantiated once per
+// canonical argument tuple and looked up from then on.
+
+// Checker errors name the enclosing declaration in lexeme. They point at
+// the node being checked when spans cover it, otherwise line is 0.
+typedef struct {
+	bool success;
+	Diagnostic *diagnostics;
+	u32 diagnostic_count;
+
+	// Expr* -> canonical Type* for every expression with a known type.
+	PtrMap expr_types;
+
+	// EXPR_FIELD callee -> the impl's STMT_FUNCTION for method calls the
+	// checker could bind statically.
+	PtrMap methods;
+} CheckResult;
+
+// spans may be NULL.
+CheckResult check(Stmt *root, const Resolution *resolution, TypeTable *types, const SpanTable *spans, StringPool *pool, MemArena *arena);
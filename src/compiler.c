@@ -0,0 +1,1203 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "arena.h"
+#include "ptr_map.h"
+#include "vec.h"
+
+#define COMPILE_MAX_ERRORS 100
+#define COMPILE_MESSAGE_MAX 256
+
+// Registers are u16 operands.
+#define MAX_REGISTERS 65536
+
+// Long '..' chains are joined this many operands at a time, so building the
+// result copies each byte a handful of times instead of once per operand.
+#define CONCAT_BATCH 4096
+
+#define AS_PTR(T, v) ((T)(uintptr_t)(v))
+
+// Slots declared at or above base belong to the block; if a closure
+// captured one of them, leaving the block closes its upvalues.
+typedef struct BlockScope BlockScope;
+struct BlockScope {
+	BlockScope *enclosing;
+	u32 base;
+	bool captured;
+};
+
+typedef struct LoopScope LoopScope;
+struct LoopScope {
+	LoopScope *enclosing;
+	u32 break_base;
+	u32 base;
+};
+
+typedef struct FuncState FuncState;
+struct FuncState {
+	FuncState *enclosing;
+	Proto *proto;
+	FunctionScope *scope;
+
+	Instr *code;
+	Value *constants;
+	// Interned text -> string constant index + 1.
+	PtrMap strings;
+
+	// Locals live in [0, active). Hidden loop registers sit right above the
+	// resolver's slots, and temporaries start above the locals or, inside
+	// a loop, above its hidden registers.
+	u32 active;
+	u32 hidden;
+	u32 free;
+	u32 frame_size;
+	bool overflowed;
+
+	u32 return_count;
+	BlockScope *block;
+	LoopScope *loop;
+};
+
+typedef struct {
+	MemArena *arena;
+	const Resolution *resolution;
+	const CheckResult *checked;
+	FuncState *fs;
+
+	Proto **protos;
+	// Top-level impl STMT_FUNCTION -> proto index + 1, reserved up front so
+	// calls can be bound before the impl is compiled.
+	PtrMap method_protos;
+
+	// Struct name -> layout index + 1.
+	PtrMap layout_index;
+	StructLayout **layouts;
+	Stmt **layout_decls;
+
+	Expr **spine;
+	u32 *exits;
+	u32 *breaks;
+
+	Diagnostic *errors;
+	const char *context;
+} Compiler;
+
+// ==========================================
+// EMITTING
+// ==========================================
+
+static void error(Compiler *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void error(Compiler *c, const char *fmt, ...) {
+	if (vec_size(c->errors) >= COMPILE_MAX_ERRORS) return;
+
+	char buf[COMPILE_MESSAGE_MAX];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n < 0) return;
+	if ((u32)n >= sizeof(buf)) n = sizeof(buf) - 1;
+
+	char *message = arena_push(c->arena, (u64)n + 1, true);
+	memcpy(message, buf, (u64)n + 1);
+
+	Diagnostic d = { 0, 0, c->context, message, 0, true };
+	vec_push(c->errors, d);
+}
+
+static u32 here(Compiler *c) {
+	return (u32)vec_size(c->fs->code);
+}
+
+static u32 emit(Compiler *c, Instr instr) {
+	vec_push(c->fs->code, instr);
+	return here(c) - 1;
+}
+
+static u32 emit_abc(Compiler *c, Opcode op, u32 a, u32 b, u32 cc) {
+	Instr instr = { .op = (u16)op, .a = (u16)a };
+	instr.b = (u16)b;
+	instr.c = (u16)cc;
+	return emit(c, instr);
+}
+
+static u32 emit_abx(Compiler *c, Opcode op, u32 a, u32 bx) {
+	Instr instr = { .op = (u16)op, .a = (u16)a, .bx = bx };
+	return emit(c, instr);
+}
+
+static u32 emit_jump(Compiler *c, Opcode op, u32 a) {
+	Instr instr = { .op = (u16)op, .a = (u16)a, .sbx = 0 };
+	return emit(c, instr);
+}
+
+static void patch_jump(Compiler *c, u32 at) {
+	c->fs->code[at].sbx = (i32)(here(c) - at - 1);
+}
+
+static void jump_to(Compiler *c, Opcode op, u32 a, u32 target) {
+	Instr instr = { .op = (u16)op, .a = (u16)a, .sbx = (i32)target - (i32)here(c) - 1 };
+	emit(c, instr);
+}
+
+static void move(Compiler *c, u32 dst, u32 src) {
+	if (dst != src) emit_abc(c, BC_MOVE, dst, src, 0);
+}
+
+static void touch(Compiler *c, u32 top) {
+	FuncState *fs = c->fs;
+	if (top <= fs->frame_size) return;
+
+	if (top > MAX_REGISTERS && !fs->overflowed) {
+		fs->overflowed = true;
+		error(c, "Function needs more than %d registers.", MAX_REGISTERS);
+	}
+	fs->frame_size = top;
+}
+
+static u32 reg_alloc(Compiler *c) {
+	u32 r = c->fs->free++;
+	touch(c, c->fs->free);
+	return r;
+}
+
+static u32 temp_base(FuncState *fs) {
+	return fs->hidden ? fs->scope->slot_count + fs->hidden : fs->active;
+}
+
+static u32 add_constant(Compiler *c, Value v) {
+	vec_push(c->fs->constants, v);
+	return (u32)vec_size(c->fs->constants) - 1;
+}
+
+static u32 string_constant(Compiler *c, const char *text) {
+	u64 *slot = ptr_map_put(&c->fs->strings, text);
+	if (!*slot) *slot = (u64)add_constant(c, STRING_VAL(string_copy(c->arena, text, (u32)strlen(text)))) + 1;
+	return (u32)(*slot - 1);
+}
+
+// C operands are u16; a constant past that is loaded into a register.
+static bool short_constant(u32 k) {
+	return k <= UINT16_MAX;
+}
+
+// ==========================================
+// TYPES AND LAYOUTS
+// ==========================================
+
+static Type *type_of(Compiler *c, Expr *e) {
+	u64 *value = e ? ptr_map_get(&c->checked->expr_types, e) : NULL;
+	return value ? AS_PTR(Type*, *value) : NULL;
+}
+
+static bool is_number(Compiler *c, Expr *e) {
+	Type *t = type_of(c, e);
+	return t && t->kind == TYPE_NUMBER;
+}
+
+static u32 find_layout(Compiler *c, const char *name) {
+	u64 *value = name ? ptr_map_get(&c->layout_index, name) : NULL;
+	return value ? (u32)*value : 0;
+}
+
+static int find_field(Compiler *c, u32 layout, const char *name) {
+	Stmt *decl = c->layout_decls[layout - 1];
+	for (int i = 0; i < decl->as.struct_decl.field_count; i++) {
+		if (decl->as.struct_decl.fields[i].name == name) return i;
+	}
+	return -1;
+}
+
+// Index of the field when the checker typed the target as a struct.
+static int static_field(Compiler *c, Expr *field) {
+	Type *t = type_of(c, field->as.field.target);
+	if (!t || t->kind != TYPE_STRUCT) return -1;
+
+	u32 layout = find_layout(c, t->as.user_type.name);
+	return layout ? find_field(c, layout, field->as.field.field) : -1;
+}
+
+static void mark_captured(Compiler *c, u32 slot) {
+	for (BlockScope *b = c->fs->block; b; b = b->enclosing) {
+		if (b->base <= slot) {
+			b->captured = true;
+			return;
+		}
+	}
+}
+
+static void emit_closure(Compiler *c, u32 dst, u32 index) {
+	Proto *proto = c->protos[index];
+	for (u32 i = 0; proto && i < proto->upvalue_count; i++) {
+		if (proto->upvalues[i].local) mark_captured(c, proto->upvalues[i].index);
+	}
+	emit_abx(c, BC_CLOSURE, dst, index);
+}
+
+// ==========================================
+// EXPRESSIONS
+// ==========================================
+
+// Every expr_to evaluates e into dst, which the caller has reserved below
+// free. dst may be a live local (an assignment), so anything that builds
+// its result in steps builds it elsewhere first.
+static void expr_to(Compiler *c, Expr *e, u32 dst);
+static u32 postfix(Compiler *c, Expr *e, u32 want);
+static u32 compile_function(Compiler *c, FunctionScope *scope, Stmt *body, const char *name, u32 index, u32 return_count);
+
+static bool is_postfix(Expr *e) {
+	return e->kind == EXPR_CALL || e->kind == EXPR_FIELD || e->kind == EXPR_INDEX;
+}
+
+// A register holding e: a local's own slot, or a new temporary.
+static u32 expr_any(Compiler *c, Expr *e) {
+	if (e && e->kind == EXPR_VARIABLE && e->as.variable.scope == VAR_LOCAL) return e->as.variable.slot;
+
+	u32 r = reg_alloc(c);
+	expr_to(c, e, r);
+	return r;
+}
+
+// Evaluated for effect only.
+static void expr_discard(Compiler *c, Expr *e) {
+	u32 mark = c->fs->free;
+	if (is_postfix(e)) postfix(c, e, 0);
+	else expr_any(c, e);
+	c->fs->free = mark;
+}
+
+static void number_to(Compiler *c, double n, u32 dst) {
+	if (n >= INT32_MIN && n <= INT32_MAX && n == (double)(i32)n) {
+		Instr instr = { .op = BC_LOADI, .a = (u16)dst, .sbx = (i32)n };
+		emit(c, instr);
+		return;
+	}
+	emit_abx(c, BC_LOADK, dst, add_constant(c, NUMBER_VAL(n)));
+}
+
+static void variable_to(Compiler *c, Expr *e, u32 dst) {
+	u32 slot = e->as.variable.slot;
+
+	switch (e->as.variable.scope) {
+		case VAR_LOCAL:   move(c, dst, slot); break;
+		case VAR_UPVALUE: emit_abc(c, BC_GETUPVAL, dst, slot, 0); break;
+		case VAR_GLOBAL:  emit_abx(c, BC_GETGLOBAL, dst, slot); break;
+		default:          emit_abc(c, BC_LOADNIL, dst, 1, 0); break;
+	}
+}
+
+static bool left_assoc(BinaryOp op) {
+	return op != OP_CONCAT && op != OP_POW;
+}
+
+static void arith(Compiler *c, Expr *e, u32 dst, u32 left, u32 right) {
+	bool nn = is_number(c, e->as.binary.left) && is_number(c, e->as.binary.right);
+
+	switch (e->as.binary.op) {
+		case OP_ADD: emit_abc(c, nn ? BC_ADD_NN : BC_ADD, dst, left, right); break;
+		case OP_SUB: emit_abc(c, nn ? BC_SUB_NN : BC_SUB, dst, left, right); break;
+		case OP_MUL: emit_abc(c, nn ? BC_MUL_NN : BC_MUL, dst, left, right); break;
+		case OP_DIV: emit_abc(c, nn ? BC_DIV_NN : BC_DIV, dst, left, right); break;
+		case OP_MOD: emit_abc(c, nn ? BC_MOD_NN : BC_MOD, dst, left, right); break;
+		case OP_POW: emit_abc(c, nn ? BC_POW_NN : BC_POW, dst, left, right); break;
+		case OP_EQ:  emit_abc(c, BC_EQ, dst, left, right); break;
+		case OP_NEQ: emit_abc(c, BC_NEQ, dst, left, right); break;
+		case OP_LT:  emit_abc(c, nn ? BC_LT_NN : BC_LT, dst, left, right); break;
+		case OP_LTE: emit_abc(c, nn ? BC_LE_NN : BC_LE, dst, left, right); break;
+		case OP_GT:  emit_abc(c, nn ? BC_LT_NN : BC_LT, dst, right, left); break;
+		case OP_GTE: emit_abc(c, nn ? BC_LE_NN : BC_LE, dst, right, left); break;
+		default: break;
+	}
+}
+
+// '..' is associative, so a chain is joined left to right from consecutive
+// registers whatever way the tree leans.
+static void concat_to(Compiler *c, Expr *e, u32 dst) {
+	FuncState *fs = c->fs;
+	u32 spine_base = (u32)vec_size(c->spine);
+
+	Expr *node = e;
+	while (node->kind == EXPR_BINARY && node->as.binary.op == OP_CONCAT) {
+		vec_push(c->spine, node->as.binary.left);
+		node = node->as.binary.right;
+	}
+	vec_push(c->spine, node);
+
+	u32 mark = fs->free;
+	u32 first = fs->free;
+	u32 count = 0;
+	for (u32 i = spine_base; i < vec_size(c->spine); i++) {
+		if (count == CONCAT_BATCH) {
+			emit_abc(c, BC_CONCAT, first, first, first + count - 1);
+			fs->free = first + 1;
+			count = 1;
+		}
+		expr_to(c, c->spine[i], reg_alloc(c));
+		count++;
+	}
+	emit_abc(c, BC_CONCAT, dst, first, first + count - 1);
+
+	fs->free = mark;
+	vec_hdr(c->spine)->size = spine_base;
+}
+
+// a ^ b ^ c groups to the right: the operands are evaluated in order and
+// folded from the last.
+static void pow_to(Compiler *c, Expr *e, u32 dst) {
+	FuncState *fs = c->fs;
+	u32 spine_base = (u32)vec_size(c->spine);
+
+	Expr *node = e;
+	while (node->kind == EXPR_BINARY && node->as.binary.op == OP_POW) {
+		vec_push(c->spine, node);
+		node = node->as.binary.right;
+	}
+
+	u32 mark = fs->free;
+	u32 count = (u32)vec_size(c->spine) - spine_base;
+	u32 first = fs->free;
+	for (u32 i = 0; i < count; i++) expr_to(c, c->spine[spine_base + i]->as.binary.left, reg_alloc(c));
+	u32 acc = expr_any(c, node);
+
+	for (u32 i = count; i-- > 0;) {
+		u32 out = i == 0 ? dst : first + i;
+		arith(c, c->spine[spine_base + i], out, first + i, acc);
+		acc = out;
+	}
+
+	fs->free = mark;
+	vec_hdr(c->spine)->size = spine_base;
+}
+
+// Left-leaning chains are walked down their left spine and applied bottom
+// up, so a long a + b + c ... doesn't recurse once per operand.
+static void binary_to(Compiler *c, Expr *e, u32 dst) {
+	if (e->as.binary.op == OP_CONCAT) { concat_to(c, e, dst); return; }
+	if (e->as.binary.op == OP_POW) { pow_to(c, e, dst); return; }
+
+	FuncState *fs = c->fs;
+	u32 spine_base = (u32)vec_size(c->spine);
+
+	Expr *node = e;
+	while (node->kind == EXPR_BINARY && left_assoc(node->as.binary.op)) {
+		vec_push(c->spine, node);
+		node = node->as.binary.left;
+	}
+
+	u32 mark = fs->free;
+	u32 work = dst < fs->active ? reg_alloc(c) : dst;
+	u32 acc = expr_any(c, node);
+
+	for (u32 i = (u32)vec_size(c->spine); i-- > spine_base;) {
+		Expr *step = c->spine[i];
+		BinaryOp op = step->as.binary.op;
+		u32 step_mark = fs->free;
+
+		if (op == OP_AND || op == OP_OR) {
+			move(c, work, acc);
+			u32 skip = emit_jump(c, op == OP_AND ? BC_JMPIFNOT : BC_JMPIF, work);
+			expr_to(c, step->as.binary.right, work);
+			patch_jump(c, skip);
+			acc = work;
+		} else {
+			u32 right = expr_any(c, step->as.binary.right);
+			u32 out = i == spine_base ? dst : work;
+			arith(c, step, out, acc, right);
+			acc = out;
+		}
+
+		fs->free = step_mark;
+	}
+	move(c, dst, acc);
+
+	fs->free = mark;
+	vec_hdr(c->spine)->size = spine_base;
+}
+
+static void unary_to(Compiler *c, Expr *e, u32 dst) {
+	u32 mark = c->fs->free;
+	u32 operand = expr_any(c, e->as.unary.operand);
+
+	switch (e->as.unary.op) {
+		case OP_NEGATE: emit_abc(c, is_number(c, e->as.unary.operand) ? BC_NEG_N : BC_NEG, dst, operand, 0); break;
+		case OP_NOT:    emit_abc(c, BC_NOT, dst, operand, 0); break;
+		case OP_LEN:    emit_abc(c, BC_LEN, dst, operand, 0); break;
+	}
+	c->fs->free = mark;
+}
+
+static void struct_to(Compiler *c, Expr *e, u32 dst) {
+	Expr *name = e->as.struct_init.name;
+	u32 layout = name && name->kind == EXPR_VARIABLE ? find_layout(c, name->as.variable.name) : 0;
+	if (!layout) {
+		error(c, "Unknown struct '%s'.", name && name->kind == EXPR_VARIABLE ? name->as.variable.name : "?");
+		emit_abc(c, BC_LOADNIL, dst, 1, 0);
+		return;
+	}
+
+	FuncState *fs = c->fs;
+	u32 mark = fs->free;
+	u32 target = dst < fs->active ? reg_alloc(c) : dst;
+	emit_abx(c, BC_NEWSTRUCT, target, layout - 1);
+
+	for (int i = 0; i < e->as.struct_init.entry_count; i++) {
+		TableEntry *entry = &e->as.struct_init.entries[i];
+		int field = entry->key && entry->key->kind == EXPR_VARIABLE ? find_field(c, layout, entry->key->as.variable.name) : -1;
+		if (field < 0) {
+			error(c, "Struct has no field '%s'.", entry->key && entry->key->kind == EXPR_VARIABLE ? entry->key->as.variable.name : "?");
+			continue;
+		}
+
+		u32 entry_mark = fs->free;
+		emit_abc(c, BC_SETSLOT, target, (u32)field, expr_any(c, entry->value));
+		fs->free = entry_mark;
+	}
+
+	move(c, dst, target);
+	fs->free = mark;
+}
+
+static void table_to(Compiler *c, Expr *e, u32 dst) {
+	FuncState *fs = c->fs;
+	u32 mark = fs->free;
+	u32 target = dst < fs->active ? reg_alloc(c) : dst;
+	emit_abc(c, BC_NEWTABLE, target, 0, 0);
+
+	double position = 1;
+	for (int i = 0; i < e->as.table.entry_count; i++) {
+		TableEntry *entry = &e->as.table.entries[i];
+		u32 entry_mark = fs->free;
+
+		u32 key;
+		if (!entry->key) {
+			key = reg_alloc(c);
+			number_to(c, position++, key);
+		} else if (entry->key->kind == EXPR_VARIABLE) {
+			key = reg_alloc(c);
+			emit_abx(c, BC_LOADK, key, string_constant(c, entry->key->as.variable.name));
+		} else {
+			key = expr_any(c, entry->key);
+		}
+		emit_abc(c, BC_SETINDEX, target, key, expr_any(c, entry->value));
+		fs->free = entry_mark;
+	}
+
+	move(c, dst, target);
+	fs->free = mark;
+}
+
+static void expr_to(Compiler *c, Expr *e, u32 dst) {
+	if (!e) {
+		emit_abc(c, BC_LOADNIL, dst, 1, 0);
+		return;
+	}
+
+	FuncState *fs = c->fs;
+	u32 mark = fs->free;
+
+	switch (e->kind) {
+		case EXPR_NIL:      emit_abc(c, BC_LOADNIL, dst, 1, 0); break;
+		case EXPR_BOOL:     emit_abc(c, BC_LOADBOOL, dst, e->as.boolean, 0); break;
+		case EXPR_NUMBER:   number_to(c, e->as.number, dst); break;
+		case EXPR_STRING:   emit_abx(c, BC_LOADK, dst, string_constant(c, e->as.string)); break;
+		case EXPR_VARIABLE: variable_to(c, e, dst); break;
+		case EXPR_BINARY:   binary_to(c, e, dst); break;
+		case EXPR_UNARY:    unary_to(c, e, dst); break;
+		case EXPR_STRUCT:   struct_to(c, e, dst); break;
+		case EXPR_TABLE:    table_to(c, e, dst); break;
+		case EXPR_CALL:
+		case EXPR_FIELD:
+		case EXPR_INDEX:
+			// Right below free, the value can be built in place.
+			if (dst + 1 == fs->free && dst >= fs->active) {
+				fs->free = dst;
+				postfix(c, e, 1);
+			} else {
+				move(c, dst, postfix(c, e, 1));
+			}
+			break;
+		case EXPR_FUNCTION: {
+			FunctionScope *scope = resolution_function(c->resolution, e->as.function.body);
+			u32 index = compile_function(c, scope, e->as.function.body, "function", UINT32_MAX, (u32)e->as.function.signature.return_count);
+			emit_closure(c, dst, index);
+			break;
+		}
+		case EXPR_VARARG:
+			error(c, "'...' is not supported by the bytecode compiler.");
+			emit_abc(c, BC_LOADNIL, dst, 1, 0);
+			break;
+	}
+
+	fs->free = mark;
+}
+
+static void field_get(Compiler *c, Expr *e, u32 dst, u32 object) {
+	int field = static_field(c, e);
+	if (field >= 0) {
+		emit_abc(c, BC_GETSLOT, dst, object, (u32)field);
+		return;
+	}
+
+	u32 k = string_constant(c, e->as.field.field);
+	if (short_constant(k)) {
+		emit_abc(c, BC_GETFIELD, dst, object, k);
+	} else {
+		u32 key = reg_alloc(c);
+		emit_abx(c, BC_LOADK, key, k);
+		emit_abc(c, BC_GETINDEX, dst, object, key);
+		c->fs->free = key;
+	}
+}
+
+static u32 call_args(Compiler *c, Expr *call) {
+	int count = call->as.call.arg_count;
+	if (count > UINT16_MAX) error(c, "Too many arguments in one call.");
+	for (int i = 0; i < count; i++) expr_to(c, call->as.call.args[i], reg_alloc(c));
+	return (u32)count;
+}
+
+// With method set the callee is a field of the object in acc: the object
+// becomes self, and a method the checker bound is called directly.
+static void call_step(Compiler *c, Expr *call, u32 acc, bool method, u32 want) {
+	FuncState *fs = c->fs;
+	fs->free = acc + 1;
+
+	if (!method) {
+		u32 argc = call_args(c, call);
+		emit_abc(c, BC_CALL, acc, argc, want);
+	} else {
+		Expr *callee = call->as.call.callee;
+		u32 self = reg_alloc(c);
+		move(c, self, acc);
+
+		u64 *bound = ptr_map_get(&c->checked->methods, callee);
+		u64 *proto = bound ? ptr_map_get(&c->method_protos, AS_PTR(Stmt*, *bound)) : NULL;
+
+		if (proto) {
+			u32 argc = call_args(c, call);
+			emit_abc(c, BC_CALL_DIRECT, acc, argc, want);
+			emit_abx(c, BC_EXTRA, 0, (u32)(*proto - 1));
+		} else {
+			field_get(c, callee, acc, self);
+			fs->free = self + 1;
+			u32 argc = call_args(c, call);
+			emit_abc(c, BC_CALL_SELF, acc, argc, want);
+		}
+	}
+
+	fs->free = acc + 1;
+	touch(c, acc + want);
+}
+
+// Call, field and index chains, walked down their spine like operator
+// chains. The value ends up in a new register at free, with want results
+// from there for a call; free is left past them.
+static u32 postfix(Compiler *c, Expr *e, u32 want) {
+	FuncState *fs = c->fs;
+	u32 spine_base = (u32)vec_size(c->spine);
+
+	Expr *node = e;
+	while (is_postfix(node)) {
+		vec_push(c->spine, node);
+		if (node->kind == EXPR_CALL) node = node->as.call.callee;
+		else if (node->kind == EXPR_FIELD) node = node->as.field.target;
+		else node = node->as.index.target;
+	}
+
+	u32 acc = reg_alloc(c);
+	expr_to(c, node, acc);
+
+	for (u32 i = (u32)vec_size(c->spine); i-- > spine_base;) {
+		Expr *step = c->spine[i];
+		bool top = i == spine_base;
+
+		switch (step->kind) {
+			case EXPR_FIELD: {
+				Expr *parent = top ? NULL : c->spine[i - 1];
+				if (parent && parent->kind == EXPR_CALL && parent->as.call.callee == step) break;
+				field_get(c, step, acc, acc);
+				break;
+			}
+			case EXPR_INDEX: {
+				u32 key = expr_any(c, step->as.index.index);
+				emit_abc(c, BC_GETINDEX, acc, acc, key);
+				fs->free = acc + 1;
+				break;
+			}
+			case EXPR_CALL: {
+				Expr *callee = step->as.call.callee;
+				bool method = callee && callee->kind == EXPR_FIELD && i + 1 < vec_size(c->spine) && c->spine[i + 1] == callee;
+				call_step(c, step, acc, method, top ? want : 1);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	// A plain field or index yields one value; the rest are nil.
+	if (e->kind != EXPR_CALL && want > 1) emit_abc(c, BC_LOADNIL, acc + 1, want - 1, 0);
+
+	vec_hdr(c->spine)->size = spine_base;
+	fs->free = acc + (want ? want : 1);
+	touch(c, fs->free);
+	return acc;
+}
+
+// Places exactly n values from values[0..count) in consecutive registers
+// at free, spreading a trailing call over the ones left, and leaves free
+// past them.
+static u32 explist(Compiler *c, Expr **values, int count, u32 n) {
+	FuncState *fs = c->fs;
+	u32 start = fs->free;
+	u32 filled = 0;
+
+	for (int i = 0; i < count; i++) {
+		Expr *v = values[i];
+		if ((u32)i >= n) {
+			expr_discard(c, v);
+			continue;
+		}
+
+		bool spread = i == count - 1 && n > (u32)count && v && v->kind == EXPR_CALL;
+		u32 want = spread ? n - (u32)i : 1;
+
+		fs->free = start + (u32)i;
+		if (v && is_postfix(v)) postfix(c, v, want);
+		else expr_to(c, v, reg_alloc(c));
+		filled = (u32)i + want;
+	}
+
+	if (filled < n) emit_abc(c, BC_LOADNIL, start + filled, n - filled, 0);
+	fs->free = start + n;
+	touch(c, fs->free);
+	return start;
+}
+
+// ==========================================
+// STATEMENTS
+// ==========================================
+
+static void compile_stmt(Compiler *c, Stmt *s);
+
+static void block_begin(Compiler *c, BlockScope *b) {
+	b->enclosing = c->fs->block;
+	b->base = c->fs->active;
+	b->captured = false;
+	c->fs->block = b;
+}
+
+static void block_end(Compiler *c, BlockScope *b, bool close) {
+	if (close && b->captured) emit_abc(c, BC_CLOSE, b->base, 0, 0);
+	c->fs->active = b->base;
+	c->fs->block = b->enclosing;
+}
+
+// A block's statements in the current scope, for loop bodies whose scope
+// also holds the loop variables.
+static void compile_stmts(Compiler *c, Stmt *block) {
+	if (!block) return;
+	if (block->kind != STMT_BLOCK) {
+		compile_stmt(c, block);
+		return;
+	}
+	for (int i = 0; i < block->as.block.stmt_count; i++) compile_stmt(c, block->as.block.stmts[i]);
+}
+
+static void compile_block(Compiler *c, Stmt *block) {
+	BlockScope scope;
+	block_begin(c, &scope);
+	compile_stmts(c, block);
+	block_end(c, &scope, true);
+}
+
+static void loop_begin(Compiler *c, LoopScope *loop) {
+	loop->enclosing = c->fs->loop;
+	loop->break_base = (u32)vec_size(c->breaks);
+	loop->base = c->fs->active;
+	c->fs->loop = loop;
+}
+
+static void loop_end(Compiler *c, LoopScope *loop) {
+	for (u32 i = loop->break_base; i < vec_size(c->breaks); i++) patch_jump(c, c->breaks[i]);
+	if (c->breaks) vec_hdr(c->breaks)->size = loop->break_base;
+	c->fs->loop = loop->enclosing;
+}
+
+static void store(Compiler *c, Expr *target, u32 value) {
+	FuncState *fs = c->fs;
+	u32 mark = fs->free;
+
+	switch (target->kind) {
+		case EXPR_VARIABLE: {
+			u32 slot = target->as.variable.slot;
+			if (target->as.variable.scope == VAR_LOCAL) move(c, slot, value);
+			else if (target->as.variable.scope == VAR_UPVALUE) emit_abc(c, BC_SETUPVAL, value, slot, 0);
+			else if (target->as.variable.scope == VAR_GLOBAL) emit_abx(c, BC_SETGLOBAL, value, slot);
+			break;
+		}
+		case EXPR_FIELD: {
+			u32 object = expr_any(c, target->as.field.target);
+			int field = static_field(c, target);
+			u32 k = field < 0 ? string_constant(c, target->as.field.field) : 0;
+
+			if (field >= 0) {
+				emit_abc(c, BC_SETSLOT, object, (u32)field, value);
+			} else if (short_constant(k)) {
+				emit_abc(c, BC_SETFIELD, object, k, value);
+			} else {
+				u32 key = reg_alloc(c);
+				emit_abx(c, BC_LOADK, key, k);
+				emit_abc(c, BC_SETINDEX, object, key, value);
+			}
+			break;
+		}
+		case EXPR_INDEX: {
+			u32 object = expr_any(c, target->as.index.target);
+			u32 key = expr_any(c, target->as.index.index);
+			emit_abc(c, BC_SETINDEX, object, key, value);
+			break;
+		}
+		default:
+			error(c, "Cannot assign to this expression.");
+			break;
+	}
+
+	fs->free = mark;
+}
+
+static void assign_stmt(Compiler *c, Stmt *s) {
+	int target_count = s->as.assign.target_count;
+	Expr **targets = s->as.assign.targets;
+
+	// The common single assignment to a local goes straight to its slot.
+	if (target_count == 1 && s->as.assign.value_count == 1) {
+		Expr *target = targets[0];
+		if (target->kind == EXPR_VARIABLE && target->as.variable.scope == VAR_LOCAL) {
+			expr_to(c, s->as.assign.values[0], target->as.variable.slot);
+		} else {
+			store(c, target, expr_any(c, s->as.assign.values[0]));
+		}
+		return;
+	}
+
+	u32 first = explist(c, s->as.assign.values, s->as.assign.value_count, (u32)target_count);
+	for (int i = 0; i < target_count; i++) store(c, targets[i], first + (u32)i);
+}
+
+static void local_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 count = (u32)s->as.local.decl_count;
+	Binding b = resolution_binding(c->resolution, s);
+	u32 base = b.scope == VAR_LOCAL ? b.slot : fs->active;
+
+	// Outside loops the values are built in the new slots themselves.
+	u32 first = explist(c, s->as.local.values, s->as.local.value_count, count);
+	for (u32 i = 0; i < count && first != base; i++) move(c, base + i, first + i);
+
+	fs->active = base + count;
+}
+
+static void return_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	int count = s->as.return_stmt.value_count;
+	Expr **values = s->as.return_stmt.values;
+
+	if (count == 0) {
+		emit_abc(c, BC_RETURN, 0, 0, 0);
+		return;
+	}
+
+	// A trailing call fills the declared results past the explicit ones.
+	Expr *last = values[count - 1];
+	bool spread = last && last->kind == EXPR_CALL && fs->return_count > (u32)count;
+	if (count == 1 && !spread) {
+		emit_abc(c, BC_RETURN, expr_any(c, values[0]), 1, 0);
+		return;
+	}
+
+	u32 n = spread ? fs->return_count : (u32)count;
+	emit_abc(c, BC_RETURN, explist(c, values, count, n), n, 0);
+}
+
+static void if_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 exit_base = (u32)vec_size(c->exits);
+
+	for (Stmt *branch = s; ; branch = branch->as.if_stmt.else_branch) {
+		u32 cond = expr_any(c, branch->as.if_stmt.condition);
+		u32 skip = emit_jump(c, BC_JMPIFNOT, cond);
+		fs->free = temp_base(fs);
+
+		compile_block(c, branch->as.if_stmt.then_branch);
+
+		Stmt *next = branch->as.if_stmt.else_branch;
+		if (next) {
+			u32 exit = emit_jump(c, BC_JMP, 0);
+			vec_push(c->exits, exit);
+		}
+		patch_jump(c, skip);
+
+		if (!next || next->kind != STMT_IF) {
+			compile_block(c, next);
+			break;
+		}
+	}
+
+	for (u32 i = exit_base; i < vec_size(c->exits); i++) patch_jump(c, c->exits[i]);
+	if (c->exits) vec_hdr(c->exits)->size = exit_base;
+}
+
+static void while_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 start = here(c);
+	u32 cond = expr_any(c, s->as.while_stmt.condition);
+	u32 exit = emit_jump(c, BC_JMPIFNOT, cond);
+	fs->free = temp_base(fs);
+
+	LoopScope loop;
+	loop_begin(c, &loop);
+	compile_block(c, s->as.while_stmt.body);
+	jump_to(c, BC_JMP, 0, start);
+
+	patch_jump(c, exit);
+	loop_end(c, &loop);
+}
+
+static void repeat_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 start = here(c);
+
+	LoopScope loop;
+	loop_begin(c, &loop);
+	BlockScope scope;
+	block_begin(c, &scope);
+
+	// The condition sees the body's locals, so they are closed after it.
+	compile_stmts(c, s->as.repeat_stmt.body);
+	u32 cond = expr_any(c, s->as.repeat_stmt.condition);
+	if (scope.captured) emit_abc(c, BC_CLOSE, scope.base, 0, 0);
+	jump_to(c, BC_JMPIFNOT, cond, start);
+	fs->free = temp_base(fs);
+
+	block_end(c, &scope, false);
+	loop_end(c, &loop);
+}
+
+// Reserves three hidden registers above every local of the function.
+static u32 hidden_begin(Compiler *c) {
+	FuncState *fs = c->fs;
+	u32 h = fs->scope->slot_count + fs->hidden;
+	fs->hidden += 3;
+	fs->free = temp_base(fs);
+	touch(c, fs->free);
+	return h;
+}
+
+static void hidden_end(Compiler *c) {
+	c->fs->hidden -= 3;
+	c->fs->free = temp_base(c->fs);
+}
+
+static void for_num_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 h = hidden_begin(c);
+
+	expr_to(c, s->as.for_num.start, h);
+	expr_to(c, s->as.for_num.end, h + 1);
+	if (s->as.for_num.step) expr_to(c, s->as.for_num.step, h + 2);
+	else number_to(c, 1, h + 2);
+	u32 prep = emit_jump(c, BC_FORPREP, h);
+
+	Binding b = resolution_binding(c->resolution, s);
+	u32 var = b.scope == VAR_LOCAL ? b.slot : fs->active;
+	u32 body = here(c);
+
+	LoopScope loop;
+	loop_begin(c, &loop);
+	BlockScope scope;
+	block_begin(c, &scope);
+
+	// The counter is copied, so the body may assign its variable freely.
+	move(c, var, h);
+	fs->active = var + 1;
+	fs->free = temp_base(fs);
+	compile_stmts(c, s->as.for_num.body);
+	block_end(c, &scope, true);
+
+	patch_jump(c, prep);
+	jump_to(c, BC_FORLOOP, h, body);
+	loop_end(c, &loop);
+	hidden_end(c);
+}
+
+// The iterator function, state and control value live in the hidden
+// registers; each step calls the function and stops at a nil first result.
+static void for_gen_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 h = hidden_begin(c);
+	Expr *iter = s->as.for_gen.iter;
+
+	if (iter && iter->kind == EXPR_CALL) {
+		u32 values = postfix(c, iter, 3);
+		for (u32 i = 0; i < 3; i++) move(c, h + i, values + i);
+	} else {
+		expr_to(c, iter, h);
+		emit_abc(c, BC_LOADNIL, h + 1, 2, 0);
+	}
+	fs->free = temp_base(fs);
+
+	u32 names = (u32)s->as.for_gen.name_count;
+	u32 want = names ? names : 1;
+	u32 start = here(c);
+
+	u32 window = fs->free;
+	for (u32 i = 0; i < 3; i++) move(c, reg_alloc(c), h + i);
+	emit_abc(c, BC_CALL, window, 2, want);
+	touch(c, window + want);
+	u32 exit = emit_jump(c, BC_JMPNIL, window);
+	move(c, h + 2, window);
+
+	Binding b = resolution_binding(c->resolution, s);
+	u32 var = b.scope == VAR_LOCAL ? b.slot : fs->active;
+
+	LoopScope loop;
+	loop_begin(c, &loop);
+	BlockScope scope;
+	block_begin(c, &scope);
+
+	for (u32 i = 0; i < names; i++) move(c, var + i, window + i);
+	fs->active = var + names;
+	fs->free = temp_base(fs);
+	compile_stmts(c, s->as.for_gen.body);
+	block_end(c, &scope, true);
+
+	jump_to(c, BC_JMP, 0, start);
+	patch_jump(c, exit);
+	loop_end(c, &loop);
+	hidden_end(c);
+}
+
+static void function_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	FuncSignature *sig = s->as.func_decl.signature;
+	FunctionScope *scope = resolution_function(c->resolution, s->as.func_decl.body);
+	u32 index = compile_function(c, scope, s->as.func_decl.body, s->as.func_decl.name, UINT32_MAX, sig ? (u32)sig->return_count : 0);
+
+	Binding b = resolution_binding(c->resolution, s);
+	if (b.scope == VAR_LOCAL) {
+		emit_closure(c, b.slot, index);
+		return;
+	}
+
+	u32 r = reg_alloc(c);
+	emit_closure(c, r, index);
+	if (b.scope == VAR_UPVALUE) emit_abc(c, BC_SETUPVAL, r, b.slot, 0);
+	else if (b.scope == VAR_GLOBAL) emit_abx(c, BC_SETGLOBAL, r, b.slot);
+	fs->free = r;
+}
+
+static void impl_stmt(Compiler *c, Stmt *s) {
+	FuncState *fs = c->fs;
+	u32 layout = find_layout(c, s->as.impl_stmt.target_name);
+
+	for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+		Stmt *method = s->as.impl_stmt.functions[i];
+		if (!method) continue;
+
+		u64 *reserved = ptr_map_get(&c->method_protos, method);
+		FuncSignature *sig = method->as.func_decl.signature;
+		FunctionScope *scope = resolution_function(c->resolution, method->as.func_decl.body);
+		u32 index = compile_function(c, scope, method->as.func_decl.body, method->as.func_decl.name,
+			reserved ? (u32)(*reserved - 1) : UINT32_MAX, sig ? (u32)sig->return_count : 0);
+
+		u32 r = reg_alloc(c);
+		emit_closure(c, r, index);
+		u32 k = string_constant(c, method->as.func_decl.name);
+		if (layout && short_constant(k)) emit_abc(c, BC_METHOD, r, layout - 1, k);
+		else if (layout) error(c, "Too many constants in one function.");
+		fs->free = r;
+	}
+}
+
+static void compile_stmt(Compiler *c, Stmt *s) {
+	if (!s) return;
+	FuncState *fs = c->fs;
+
+	switch (s->kind) {
+		case STMT_EXPR:     expr_discard(c, s->as.expression); break;
+		case STMT_BLOCK:    compile_block(c, s); break;
+		case STMT_RETURN:   return_stmt(c, s); break;
+		case STMT_ASSIGN:   assign_stmt(c, s); break;
+		case STMT_LOCAL:    local_stmt(c, s); break;
+		case STMT_IF:       if_stmt(c, s); break;
+		case STMT_WHILE:    while_stmt(c, s); break;
+		case STMT_REPEAT:   repeat_stmt(c, s); break;
+		case STMT_FOR_NUM:  for_num_stmt(c, s); break;
+		case STMT_FOR_GEN:  for_gen_stmt(c, s); break;
+		case STMT_FUNCTION: function_stmt(c, s); break;
+		case STMT_IMPL:     impl_stmt(c, s); break;
+		case STMT_BREAK: {
+			if (!fs->loop) {
+				error(c, "'break' outside a loop.");
+				break;
+			}
+			// Upvalues of the body are closed on the way out.
+			emit_abc(c, BC_CLOSE, fs->loop->base, 0, 0);
+			u32 jump = emit_jump(c, BC_JMP, 0);
+			vec_push(c->breaks, jump);
+			break;
+		}
+		default: break;
+	}
+
+	fs->free = temp_base(fs);
+}
+
+// Compiles into protos[index] when index is reserved, else a new entry.
+static u32 compile_function(Compiler *c, FunctionScope *scope, Stmt *body, const char *name, u32 index, u32 return_count) {
+	if (index == UINT32_MAX) {
+		index = (u32)vec_size(c->protos);
+		vec_push(c->protos, NULL);
+	}
+	if (!scope) {
+		error(c, "Function '%s' was not resolved.", name);
+		return index;
+	}
+
+	Proto *proto = PUSH_STRUCT(c->arena, Proto);
+	proto->name = name;
+	proto->index = index;
+	proto->param_count = scope->param_count;
+	proto->method = scope->method;
+	proto->upvalues = scope->upvalues;
+	proto->upvalue_count = scope->upvalue_count;
+
+	// Strings maps of enclosing functions don't grow while this one is
+	// being compiled, so they share the scratch arena.
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+
+	FuncState fs = {0};
+	fs.enclosing = c->fs;
+	fs.proto = proto;
+	fs.scope = scope;
+	fs.strings = ptr_map_create(scratch, 0);
+	fs.active = scope->param_count + (scope->method ? 1 : 0);
+	fs.free = fs.active;
+	fs.frame_size = MAX(scope->slot_count, fs.active);
+	fs.return_count = return_count;
+
+	BlockScope function_block = { NULL, 0, false };
+	fs.block = &function_block;
+
+	const char *saved = c->context;
+	c->context = name;
+	c->fs = &fs;
+	compile_stmts(c, body);
+	emit_abc(c, BC_RETURN, 0, 0, 0);
+	c->fs = fs.enclosing;
+	c->context = saved;
+
+	proto->frame_size = fs.frame_size;
+	proto->code_count = (u32)vec_size(fs.code);
+	proto->code = PUSH_ARRAY_NZ(c->arena, Instr, proto->code_count);
+	memcpy(proto->code, fs.code, proto->code_count * sizeof(Instr));
+	proto->constant_count = (u32)vec_size(fs.constants);
+	if (proto->constant_count) {
+		proto->constants = PUSH_ARRAY_NZ(c->arena, Value, proto->constant_count);
+		memcpy(proto->constants, fs.constants, proto->constant_count * sizeof(Value));
+	}
+	vec_free(fs.code);
+	vec_free(fs.constants);
+
+	arena_pop_to(scratch, mark);
+	c->protos[index] = proto;
+	return index;
+}
+
+static void collect_layouts(Compiler *c, Stmt *root) {
+	if (!root || root->kind != STMT_BLOCK) return;
+
+	for (int i = 0; i < root->as.block.stmt_count; i++) {
+		Stmt *s = root->as.block.stmts[i];
+		if (!s) continue;
+
+		if (s->kind == STMT_STRUCT && s->as.struct_decl.name) {
+			u64 *slot = ptr_map_put(&c->layout_index, s->as.struct_decl.name);
+			if (*slot) continue;
+
+			StructLayout *layout = PUSH_STRUCT(c->arena, StructLayout);
+			const char *name = s->as.struct_decl.name;
+			layout->name = string_copy(c->arena, name, (u32)strlen(name));
+			layout->field_count = (u32)s->as.struct_decl.field_count;
+			layout->fields = PUSH_ARRAY(c->arena, ObjString*, layout->field_count + 1);
+			for (u32 j = 0; j < layout->field_count; j++) {
+				const char *field = s->as.struct_decl.fields[j].name;
+				layout->fields[j] = string_copy(c->arena, field ? field : "", field ? (u32)strlen(field) : 0);
+			}
+
+			vec_push(c->layouts, layout);
+			vec_push(c->layout_decls, s);
+			*slot = vec_size(c->layouts);
+		}
+
+		if (s->kind == STMT_IMPL) {
+			for (int j = 0; j < s->as.impl_stmt.func_count; j++) {
+				Stmt *method = s->as.impl_stmt.functions[j];
+				if (!method) continue;
+				vec_push(c->protos, NULL);
+				*ptr_map_put(&c->method_protos, method) = vec_size(c->protos);
+			}
+		}
+	}
+}
+
+CompileResult compile(Stmt *root, const Resolution *resolution, const CheckResult *checked, MemArena *arena) {
+	CompileResult out = {0};
+
+	Compiler c = {0};
+	c.arena = arena;
+	c.resolution = resolution;
+	c.checked = checked;
+	c.method_protos = ptr_map_create(arena, 0);
+	c.layout_index = ptr_map_create(arena, 0);
+	c.context = "main chunk";
+
+	collect_layouts(&c, root);
+	u32 main = compile_function(&c, resolution->main, root, "main chunk", UINT32_MAX, 0);
+
+	Program *program = PUSH_STRUCT(arena, Program);
+	program->proto_count = (u32)vec_size(c.protos);
+	program->protos = PUSH_ARRAY_NZ(arena, Proto*, program->proto_count);
+	memcpy(program->protos, c.protos, program->proto_count * sizeof(Proto*));
+	program->main = program->protos[main];
+
+	program->layout_count = (u32)vec_size(c.layouts);
+	program->layouts = PUSH_ARRAY(arena, StructLayout*, program->layout_count + 1);
+	if (program->layout_count) memcpy(program->layouts, c.layouts, program->layout_count * sizeof(StructLayout*));
+
+	program->globals = resolution->globals;
+	program->global_count = resolution->global_count;
+
+	out.diagnostic_count = (u32)vec_size(c.errors);
+	if (out.diagnostic_count) {
+		out.diagnostics = PUSH_ARRAY_NZ(arena, Diagnostic, out.diagnostic_count);
+		memcpy(out.diagnostics, c.errors, out.diagnostic_count * sizeof(Diagnostic));
+	}
+
+	out.success = out.diagnostic_count == 0;
+	out.program = program;
+
+	vec_free(c.protos);
+	vec_free(c.layouts);
+	vec_free(c.layout_decls);
+	vec_free(c.spine);
+	vec_free(c.exits);
+	vec_free(c.breaks);
+	vec_free(c.errors);
+	return out;
+}
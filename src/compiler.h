@@ -0,0 +1,21 @@
+#pragma once
+#include "arena.h"
+#include "bytecode.h"
+#include "checker.h"
+#include "parser.h"
+#include "resolver.h"
+#include "typedefs.h"
+
+// Translates a resolved and checked tree into bytecode. The checker's
+// expression types pick the specialized opcodes and its method bindings
+// become direct calls; values it couldn't type get the generic ones.
+// Errors are limits the VM can't express, reported like checker errors.
+typedef struct {
+	bool success;
+	Program *program;
+
+	Diagnostic *diagnostics;
+	u32 diagnostic_count;
+} CompileResult;
+
+CompileResult compile(Stmt *root, const Resolution *resolution, const CheckResult *checked, MemArena *arena);
@@ -1,6 +1,9 @@
 #include "debug.h"
 #include <stdio.h>
+#include "lexer.h"
+#include "scan.h"
 #include "vec.h" // Nodig voor vec_size()
+#include "writer.h"
 
 // ==========================================
 // TOKEN PRINTING
@@ -13,6 +16,7 @@ const char* token_kind_str(TokenKind kind) {
         case TOKEN_IDENTIFIER: return "IDENTIFIER";
         case TOKEN_STRING: return "STRING";
         case TOKEN_NUMBER: return "NUMBER";
+        case TOKEN_INTEGER: return "INTEGER";
         case TOKEN_LOCAL: return "LOCAL";
         case TOKEN_FUNCTION: return "FUNCTION";
         case TOKEN_STRUCT: return "STRUCT";
@@ -69,24 +73,91 @@ const char* token_kind_str(TokenKind kind) {
     }
 }
 
-void fprint_tokens(FILE *f, Token *tokens) {
-    if (!tokens) return;
-    int count = vec_size(tokens);
+const char* expr_kind_str(ExprKind kind) {
+    switch (kind) {
+        case EXPR_NIL: return "NIL";
+        case EXPR_BOOL: return "BOOL";
+        case EXPR_NUMBER: return "NUMBER";
+        case EXPR_STRING: return "STRING";
+        case EXPR_VARARG: return "VARARG";
+        case EXPR_VARIABLE: return "VARIABLE";
+        case EXPR_BINARY: return "BINARY";
+        case EXPR_UNARY: return "UNARY";
+        case EXPR_CALL: return "CALL";
+        case EXPR_INDEX: return "INDEX";
+        case EXPR_FIELD: return "FIELD";
+        case EXPR_FUNCTION: return "FUNCTION";
+        case EXPR_TABLE: return "TABLE";
+        case EXPR_STRUCT: return "STRUCT";
+        default: return "UNKNOWN";
+    }
+}
+
+const char* stmt_kind_str(StmtKind kind) {
+    switch (kind) {
+        case STMT_EXPR: return "EXPR";
+        case STMT_BLOCK: return "BLOCK";
+        case STMT_RETURN: return "RETURN";
+        case STMT_BREAK: return "BREAK";
+        case STMT_ASSIGN: return "ASSIGN";
+        case STMT_LOCAL: return "LOCAL";
+        case STMT_IF: return "IF";
+        case STMT_WHILE: return "WHILE";
+        case STMT_REPEAT: return "REPEAT";
+        case STMT_FOR_NUM: return "FOR_NUM";
+        case STMT_FOR_GEN: return "FOR_GEN";
+        case STMT_FUNCTION: return "FUNCTION";
+        case STMT_STRUCT: return "STRUCT";
+        case STMT_TRAIT: return "TRAIT";
+        case STMT_IMPL: return "IMPL";
+        case STMT_TYPE_ALIAS: return "TYPE_ALIAS";
+        default: return "UNKNOWN";
+    }
+}
+
+void fprint_tokens(FILE *f, const TokenList *tokens, StringPool *pool) {
+    if (!tokens || !tokens->count) return;
+    int count = tokens->count;
+
+    MemArena *scratch = arena_scratch();
+    u64 mark = scratch->pos;
+    Writer w;
+    writer_init(&w, f, scratch, WRITER_DEFAULT_CAPACITY);
+
+    writer_str(&w, "--- TOKENS (");
+    writer_u64(&w, (u64)count);
+    writer_str(&w, ") ---\n");
+    writer_str(&w, "LINE ");
+    writer_left(&w, "KIND", 15);
+    writer_str(&w, " TEXT\n");
+    writer_str(&w, "------------------------------\n");
 
-    fprintf(f, "--- TOKENS (%d) ---\n", count);
-    fprintf(f, "%-4s %-15s %s\n", "LINE", "KIND", "TEXT");
-    fprintf(f, "------------------------------\n");
+    // Regels worden incrementeel bijgehouden, offsets lopen toch op
+    const char *src = tokens->source;
+    u64 line = 1, pos = 0;
 
     for (int i = 0; i < count; i++) {
-        Token t = tokens[i];
-        // %llu voor u64 (unsigned long long)
-        fprintf(f, "%-4llu %-15s '%s'\n", (unsigned long long)t.line, token_kind_str(t.kind), t.text ? t.text : "");
+        Token t = token_list_get(tokens, i);
+        line += scan_count_byte(src + pos, src + t.offset, '\n');
+        pos = t.offset;
+        char number[20];
+        u32 digits = format_u64(number, line);
+        writer_bytes(&w, number, digits);
+        writer_pad(&w, ' ', digits < 4 ? 5 - digits : 1);
+        writer_left(&w, token_kind_str(t.kind), 15);
+        writer_str(&w, " '");
+        if (t.kind == TOKEN_NUMBER || t.kind == TOKEN_INTEGER) writer_bytes(&w, src + t.offset, t.length);
+        else writer_str(&w, token_text(pool, t));
+        writer_str(&w, "'\n");
     }
-    fprintf(f, "------------------------------\n\n");
+    writer_str(&w, "------------------------------\n\n");
+
+    writer_flush(&w);
+    arena_pop_to(scratch, mark);
 }
 
-void print_tokens(Token *tokens) {
-    fprint_tokens(stdout, tokens);
+void print_tokens(const TokenList *tokens, StringPool *pool) {
+    fprint_tokens(stdout, tokens, pool);
 }
 
 // ==========================================
@@ -94,12 +165,10 @@ void print_tokens(Token *tokens) {
 // ==========================================
 
 // Forward declarations
-void print_type(FILE *f, Type *t);
-void print_expr_recursive(FILE *f, Expr *expr);
-void print_ast_recursive(FILE *f, Stmt *node, int indent);
+void print_type(Writer *w, Type *t);
 
-void print_indent(FILE *f, int indent) {
-    for (int i = 0; i < indent; i++) fprintf(f, "  ");
+void print_indent(Writer *w, int indent) {
+    writer_pad(w, ' ', (u64)indent * 2);
 }
 
 static const char* bin_op_str(BinaryOp op) {
@@ -125,46 +194,46 @@ static const char* unary_op_str(UnaryOp op) {
     }
 }
 
-static void print_generic_params(FILE *f, GenericParam *generics, int count) {
+static void print_generic_params(Writer *w, GenericParam *generics, int count) {
     if (count == 0 || !generics) return;
-    fprintf(f, "<");
+    writer_char(w, '<');
     for (int i = 0; i < count; i++) {
-        fprintf(f, "%s", generics[i].name);
+        writer_str(w, generics[i].name);
         if (generics[i].constraint_count > 0) {
-            fprintf(f, ": ");
+            writer_str(w, ": ");
             for (int j = 0; j < generics[i].constraint_count; j++) {
-                print_type(f, generics[i].constraints[j]);
-                if (j < generics[i].constraint_count - 1) fprintf(f, " + ");
+                print_type(w, generics[i].constraints[j]);
+                if (j < generics[i].constraint_count - 1) writer_str(w, " + ");
             }
         }
-        if (i < count - 1) fprintf(f, ", ");
+        if (i < count - 1) writer_str(w, ", ");
     }
-    fprintf(f, ">");
+    writer_char(w, '>');
 }
 
-static void print_func_signature(FILE *f, FuncSignature *sig) {
+static void print_func_signature(Writer *w, FuncSignature *sig) {
     if (!sig) return;
-    print_generic_params(f, sig->generics, sig->generic_count);
+    print_generic_params(w, sig->generics, sig->generic_count);
 
-    fprintf(f, "(");
+    writer_char(w, '(');
     for (int i = 0; i < sig->param_count; i++) {
-        fprintf(f, "%s", sig->params[i].name);
+        writer_str(w, sig->params[i].name);
         if (sig->params[i].type) {
-            fprintf(f, ": ");
-            print_type(f, sig->params[i].type);
+            writer_str(w, ": ");
+            print_type(w, sig->params[i].type);
         }
-        if (i < sig->param_count - 1) fprintf(f, ", ");
+        if (i < sig->param_count - 1) writer_str(w, ", ");
     }
-    fprintf(f, ")");
+    writer_char(w, ')');
 
     if (sig->return_count > 0) {
-        fprintf(f, " -> ");
-        if (sig->return_count > 1) fprintf(f, "(");
+        writer_str(w, " -> ");
+        if (sig->return_count > 1) writer_char(w, '(');
         for (int i = 0; i < sig->return_count; i++) {
-            print_type(f, sig->return_types[i]); // Let op: return_types is Type** in je laatste AST
-            if (i < sig->return_count - 1) fprintf(f, ", ");
+            print_type(w, sig->return_types[i]); // Let op: return_types is Type** in je laatste AST
+            if (i < sig->return_count - 1) writer_str(w, ", ");
         }
-        if (sig->return_count > 1) fprintf(f, ")");
+        if (sig->return_count > 1) writer_char(w, ')');
     }
 }
 
@@ -172,46 +241,46 @@ static void print_func_signature(FILE *f, FuncSignature *sig) {
 // TYPE PRINTING
 // ==========================================
 
-void print_type(FILE *f, Type *t) {
-    if (!t) { fprintf(f, "?"); return; }
+void print_type(Writer *w, Type *t) {
+    if (!t) { writer_char(w, '?'); return; }
 
     switch (t->kind) {
-        case TYPE_VOID:   fprintf(f, "void"); break;
-        case TYPE_NIL:    fprintf(f, "nil"); break;
-        case TYPE_BOOL:   fprintf(f, "bool"); break;
-        case TYPE_NUMBER: fprintf(f, "number"); break;
-        case TYPE_STRING: fprintf(f, "string"); break;
+        case TYPE_VOID:   writer_str(w, "void"); break;
+        case TYPE_NIL:    writer_str(w, "nil"); break;
+        case TYPE_BOOL:   writer_str(w, "bool"); break;
+        case TYPE_NUMBER: writer_str(w, "number"); break;
+        case TYPE_STRING: writer_str(w, "string"); break;
         
         case TYPE_ARRAY:
-            fprintf(f, "[");
-            print_type(f, t->as.array.inner);
-            fprintf(f, "]");
+            writer_char(w, '[');
+            print_type(w, t->as.array.inner);
+            writer_char(w, ']');
             break;
 
         case TYPE_STRUCT:
         case TYPE_TRAIT:
         case TYPE_GENERIC: 
             if (t->kind == TYPE_GENERIC) {
-                fprintf(f, "%s", t->as.param_name);
+                writer_str(w, t->as.param_name);
             } else {
-                fprintf(f, "%s", t->as.user_type.name);
+                writer_str(w, t->as.user_type.name);
                 if (t->as.user_type.arg_count > 0) {
-                    fprintf(f, "<");
+                    writer_char(w, '<');
                     for (int i = 0; i < t->as.user_type.arg_count; i++) {
-                        print_type(f, t->as.user_type.args[i]);
-                        if (i < t->as.user_type.arg_count - 1) fprintf(f, ", ");
+                        print_type(w, t->as.user_type.args[i]);
+                        if (i < t->as.user_type.arg_count - 1) writer_str(w, ", ");
                     }
-                    fprintf(f, ">");
+                    writer_char(w, '>');
                 }
             }
             break;
 
         case TYPE_FUNCTION:
-            fprintf(f, "fn");
-            print_func_signature(f, t->as.function.sig);
+            writer_str(w, "fn");
+            print_func_signature(w, t->as.function.sig);
             break;
             
-        default: fprintf(f, "UnknownType"); break;
+        default: writer_str(w, "UnknownType"); break;
     }
 }
 
@@ -219,85 +288,137 @@ void print_type(FILE *f, Type *t) {
 // EXPRESSION PRINTING
 // ==========================================
 
-void print_expr_recursive(FILE *f, Expr *expr) {
-    if (!expr) { fprintf(f, "nil"); return; }
+// De printer werkt met een expliciete stack in plaats van recursie, zodat
+// diepe bomen (lange '..' ketens, geneste structs) de C stack niet opblazen.
+// Wat van een node nog moet komen wordt omgekeerd gepusht en komt zo in
+// de goede volgorde weer van de stack.
+typedef enum { WORK_TEXT, WORK_INDENT, WORK_EXPR, WORK_STMT } WorkKind;
+
+typedef struct {
+    WorkKind kind;
+    int indent;
+    union {
+        const char *text;
+        Expr *expr;
+        Stmt *stmt;
+    } as;
+} Work;
+
+static void push_text(ArenaList *stack, const char *text) {
+    Work work = { WORK_TEXT, 0, { .text = text } };
+    ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+static void push_indent(ArenaList *stack, int indent) {
+    Work work = { WORK_INDENT, indent, { .text = NULL } };
+    ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+static void push_expr(ArenaList *stack, Expr *expr) {
+    Work work = { WORK_EXPR, 0, { .expr = expr } };
+    ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+static void push_stmt(ArenaList *stack, Stmt *stmt, int indent) {
+    if (!stmt) return;
+    Work work = { WORK_STMT, indent, { .stmt = stmt } };
+    ARENA_LIST_PUSH(*stack, Work, work);
+}
+
+// Komma-gescheiden lijst, achterstevoren gepusht
+static void push_expr_list(ArenaList *stack, Expr **exprs, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        push_expr(stack, exprs[i]);
+        if (i > 0) push_text(stack, ", ");
+    }
+}
+
+static void print_expr(Writer *w, ArenaList *stack, Expr *expr) {
+    if (!expr) { writer_str(w, "nil"); return; }
 
     switch (expr->kind) {
-        case EXPR_NIL:      fprintf(f, "nil"); break;
-        case EXPR_BOOL:     fprintf(f, expr->as.boolean ? "true" : "false"); break;
-        case EXPR_NUMBER:   fprintf(f, "%g", expr->as.number); break;
-        case EXPR_STRING:   fprintf(f, "\"%s\"", expr->as.string); break;
-        case EXPR_VARIABLE: fprintf(f, "%s", expr->as.variable); break;
-        case EXPR_VARARG:   fprintf(f, "..."); break;
+        case EXPR_NIL:      writer_str(w, "nil"); break;
+        case EXPR_BOOL:     writer_str(w, expr->as.boolean ? "true" : "false"); break;
+        case EXPR_NUMBER:   writer_number(w, expr->as.number); break;
+        case EXPR_STRING:
+            writer_char(w, '"');
+            writer_str(w, expr->as.string);
+            writer_char(w, '"');
+            break;
+        case EXPR_VARIABLE: writer_str(w, expr->as.variable.name); break;
+        case EXPR_VARARG:   writer_str(w, "..."); break;
 
         case EXPR_BINARY:
-            fprintf(f, "(");
-            print_expr_recursive(f, expr->as.binary.left);
-            fprintf(f, " %s ", bin_op_str(expr->as.binary.op));
-            print_expr_recursive(f, expr->as.binary.right);
-            fprintf(f, ")");
+            writer_char(w, '(');
+            push_text(stack, ")");
+            push_expr(stack, expr->as.binary.right);
+            push_text(stack, " ");
+            push_text(stack, bin_op_str(expr->as.binary.op));
+            push_text(stack, " ");
+            push_expr(stack, expr->as.binary.left);
             break;
 
         case EXPR_UNARY:
-            fprintf(f, "(%s", unary_op_str(expr->as.unary.op));
-            print_expr_recursive(f, expr->as.unary.operand);
-            fprintf(f, ")");
+            writer_char(w, '(');
+            writer_str(w, unary_op_str(expr->as.unary.op));
+            push_text(stack, ")");
+            push_expr(stack, expr->as.unary.operand);
             break;
 
         case EXPR_CALL:
-            print_expr_recursive(f, expr->as.call.callee);
-            fprintf(f, "(");
-            for (int i = 0; i < expr->as.call.arg_count; i++) {
-                print_expr_recursive(f, expr->as.call.args[i]);
-                if (i < expr->as.call.arg_count - 1) fprintf(f, ", ");
-            }
-            fprintf(f, ")");
+            push_text(stack, ")");
+            push_expr_list(stack, expr->as.call.args, expr->as.call.arg_count);
+            push_text(stack, "(");
+            push_expr(stack, expr->as.call.callee);
             break;
 
         case EXPR_INDEX:
-            print_expr_recursive(f, expr->as.index.target);
-            fprintf(f, "[");
-            print_expr_recursive(f, expr->as.index.index);
-            fprintf(f, "]");
+            push_text(stack, "]");
+            push_expr(stack, expr->as.index.index);
+            push_text(stack, "[");
+            push_expr(stack, expr->as.index.target);
             break;
 
         case EXPR_FIELD:
-            print_expr_recursive(f, expr->as.field.target);
-            fprintf(f, ".%s", expr->as.field.field);
+            push_text(stack, expr->as.field.field);
+            push_text(stack, ".");
+            push_expr(stack, expr->as.field.target);
             break;
 
         case EXPR_FUNCTION:
-            fprintf(f, "fn");
-            print_func_signature(f, &expr->as.function.signature);
-            fprintf(f, " { ... }");
+            writer_str(w, "fn");
+            print_func_signature(w, &expr->as.function.signature);
+            writer_str(w, " { ... }");
             break;
 
         case EXPR_TABLE:
-            fprintf(f, "{");
-            for (int i = 0; i < expr->as.table.entry_count; i++) {
-                if (expr->as.table.entries[i].key) {
-                    fprintf(f, "[");
-                    print_expr_recursive(f, expr->as.table.entries[i].key);
-                    fprintf(f, "]=");
+            writer_char(w, '{');
+            push_text(stack, "}");
+            for (int i = expr->as.table.entry_count - 1; i >= 0; i--) {
+                TableEntry *entry = &expr->as.table.entries[i];
+                push_expr(stack, entry->value);
+                if (entry->key) {
+                    push_text(stack, "]=");
+                    push_expr(stack, entry->key);
+                    push_text(stack, "[");
                 }
-                print_expr_recursive(f, expr->as.table.entries[i].value);
-                if (i < expr->as.table.entry_count - 1) fprintf(f, ", ");
+                if (i > 0) push_text(stack, ", ");
             }
-            fprintf(f, "}");
             break;
-            
+
         case EXPR_STRUCT:
-						print_expr_recursive(f, expr->as.struct_init.name);
-						fprintf(f, " { ");
-            for (int i = 0; i < expr->as.struct_init.entry_count; i++) {
-                if (expr->as.struct_init.entries[i].key) {
-                   print_expr_recursive(f, expr->as.struct_init.entries[i].key); 
-                   fprintf(f, " = ");
+            push_text(stack, " }");
+            for (int i = expr->as.struct_init.entry_count - 1; i >= 0; i--) {
+                TableEntry *entry = &expr->as.struct_init.entries[i];
+                push_expr(stack, entry->value);
+                if (entry->key) {
+                    push_text(stack, " = ");
+                    push_expr(stack, entry->key);
                 }
-                print_expr_recursive(f, expr->as.struct_init.entries[i].value);
-                if (i < expr->as.struct_init.entry_count - 1) fprintf(f, ", ");
+                if (i > 0) push_text(stack, ", ");
             }
-            fprintf(f, " }");
+            push_text(stack, " { ");
+            push_expr(stack, expr->as.struct_init.name);
             break;
     }
 }
@@ -306,217 +427,253 @@ void print_expr_recursive(FILE *f, Expr *expr) {
 // STATEMENT PRINTING
 // ==========================================
 
-void print_ast_recursive(FILE *f, Stmt *node, int indent) {
-    if (!node) return;
+static void print_type_args(Writer *w, Type **args, int count) {
+    if (count == 0) return;
+    writer_char(w, '<');
+    for (int i = 0; i < count; i++) {
+        print_type(w, args[i]);
+        if (i < count - 1) writer_str(w, ", ");
+    }
+    writer_char(w, '>');
+}
 
-    print_indent(f, indent);
+static void print_stmt(Writer *w, ArenaList *stack, Stmt *node, int indent) {
+    print_indent(w, indent);
 
     switch (node->kind) {
         case STMT_EXPR:
-            fprintf(f, "EXPR ");
-            print_expr_recursive(f, node->as.expression);
-            fprintf(f, "\n");
+            writer_str(w, "EXPR ");
+            push_text(stack, "\n");
+            push_expr(stack, node->as.expression);
             break;
 
         case STMT_BLOCK:
-            fprintf(f, "BLOCK\n");
-            for (int i = 0; i < node->as.block.stmt_count; i++) {
-                print_ast_recursive(f, node->as.block.stmts[i], indent + 1);
+            writer_str(w, "BLOCK\n");
+            push_text(stack, "END BLOCK\n");
+            push_indent(stack, indent);
+            for (int i = node->as.block.stmt_count - 1; i >= 0; i--) {
+                push_stmt(stack, node->as.block.stmts[i], indent + 1);
             }
-            print_indent(f, indent);
-            fprintf(f, "END BLOCK\n");
             break;
 
         case STMT_RETURN:
-            fprintf(f, "RETURN ");
-            for (int i = 0; i < node->as.return_stmt.value_count; i++) {
-                print_expr_recursive(f, node->as.return_stmt.values[i]);
-                if (i < node->as.return_stmt.value_count - 1) fprintf(f, ", ");
-            }
-            fprintf(f, "\n");
+            writer_str(w, "RETURN ");
+            push_text(stack, "\n");
+            push_expr_list(stack, node->as.return_stmt.values, node->as.return_stmt.value_count);
             break;
 
         case STMT_BREAK:
-            fprintf(f, "BREAK\n");
+            writer_str(w, "BREAK\n");
             break;
 
         case STMT_ASSIGN:
-            fprintf(f, "ASSIGN ");
-            for (int i = 0; i < node->as.assign.target_count; i++) {
-                print_expr_recursive(f, node->as.assign.targets[i]);
-                if (i < node->as.assign.target_count - 1) fprintf(f, ", ");
-            }
-            fprintf(f, " = ");
-            for (int i = 0; i < node->as.assign.value_count; i++) {
-                print_expr_recursive(f, node->as.assign.values[i]);
-                if (i < node->as.assign.value_count - 1) fprintf(f, ", ");
-            }
-            fprintf(f, "\n");
+            writer_str(w, "ASSIGN ");
+            push_text(stack, "\n");
+            push_expr_list(stack, node->as.assign.values, node->as.assign.value_count);
+            push_text(stack, " = ");
+            push_expr_list(stack, node->as.assign.targets, node->as.assign.target_count);
             break;
 
         case STMT_LOCAL:
-            fprintf(f, "LOCAL ");
+            writer_str(w, "LOCAL ");
             for (int i = 0; i < node->as.local.decl_count; i++) {
-                fprintf(f, "%s", node->as.local.decls[i].name);
+                writer_str(w, node->as.local.decls[i].name);
                 if (node->as.local.decls[i].type) {
-                    fprintf(f, ": ");
-                    print_type(f, node->as.local.decls[i].type);
+                    writer_str(w, ": ");
+                    print_type(w, node->as.local.decls[i].type);
                 }
-                if (i < node->as.local.decl_count - 1) fprintf(f, ", ");
+                if (i < node->as.local.decl_count - 1) writer_str(w, ", ");
             }
+            push_text(stack, "\n");
             if (node->as.local.value_count > 0) {
-                fprintf(f, " = ");
-                for (int i = 0; i < node->as.local.value_count; i++) {
-                    print_expr_recursive(f, node->as.local.values[i]);
-                    if (i < node->as.local.value_count - 1) fprintf(f, ", ");
-                }
+                push_expr_list(stack, node->as.local.values, node->as.local.value_count);
+                push_text(stack, " = ");
             }
-            fprintf(f, "\n");
             break;
 
         case STMT_IF:
-            fprintf(f, "IF ");
-            print_expr_recursive(f, node->as.if_stmt.condition);
-            fprintf(f, " THEN\n");
-            print_ast_recursive(f, node->as.if_stmt.then_branch, indent + 1);
-            
+            writer_str(w, "IF ");
             if (node->as.if_stmt.else_branch) {
-                print_indent(f, indent);
-                fprintf(f, "ELSE\n");
-                print_ast_recursive(f, node->as.if_stmt.else_branch, indent + 1);
+                push_stmt(stack, node->as.if_stmt.else_branch, indent + 1);
+                push_text(stack, "ELSE\n");
+                push_indent(stack, indent);
             }
+            push_stmt(stack, node->as.if_stmt.then_branch, indent + 1);
+            push_text(stack, " THEN\n");
+            push_expr(stack, node->as.if_stmt.condition);
             break;
 
         case STMT_WHILE:
-            fprintf(f, "WHILE ");
-            print_expr_recursive(f, node->as.while_stmt.condition);
-            fprintf(f, " DO\n");
-            print_ast_recursive(f, node->as.while_stmt.body, indent + 1);
+            writer_str(w, "WHILE ");
+            push_stmt(stack, node->as.while_stmt.body, indent + 1);
+            push_text(stack, " DO\n");
+            push_expr(stack, node->as.while_stmt.condition);
             break;
 
         case STMT_REPEAT:
-            fprintf(f, "REPEAT\n");
-            print_ast_recursive(f, node->as.repeat_stmt.body, indent + 1);
-            print_indent(f, indent);
-            fprintf(f, "UNTIL ");
-            print_expr_recursive(f, node->as.repeat_stmt.condition);
-            fprintf(f, "\n");
+            writer_str(w, "REPEAT\n");
+            push_text(stack, "\n");
+            push_expr(stack, node->as.repeat_stmt.condition);
+            push_text(stack, "UNTIL ");
+            push_indent(stack, indent);
+            push_stmt(stack, node->as.repeat_stmt.body, indent + 1);
             break;
 
         case STMT_FOR_NUM:
-            fprintf(f, "FOR %s = ", node->as.for_num.name);
-            print_expr_recursive(f, node->as.for_num.start);
-            fprintf(f, ", ");
-            print_expr_recursive(f, node->as.for_num.end);
+            writer_str(w, "FOR ");
+            writer_str(w, node->as.for_num.name);
+            writer_str(w, " = ");
+            push_stmt(stack, node->as.for_num.body, indent + 1);
+            push_text(stack, " DO\n");
             if (node->as.for_num.step) {
-                fprintf(f, ", ");
-                print_expr_recursive(f, node->as.for_num.step);
+                push_expr(stack, node->as.for_num.step);
+                push_text(stack, ", ");
             }
-            fprintf(f, " DO\n");
-            print_ast_recursive(f, node->as.for_num.body, indent + 1);
+            push_expr(stack, node->as.for_num.end);
+            push_text(stack, ", ");
+            push_expr(stack, node->as.for_num.start);
             break;
 
         case STMT_FOR_GEN:
-            fprintf(f, "FOR ");
-            for(int i=0; i < node->as.for_gen.name_count; i++) {
-                fprintf(f, "%s", node->as.for_gen.names[i]);
-                if (i < node->as.for_gen.name_count - 1) fprintf(f, ", ");
+            writer_str(w, "FOR ");
+            for (int i = 0; i < node->as.for_gen.name_count; i++) {
+                writer_str(w, node->as.for_gen.names[i]);
+                if (i < node->as.for_gen.name_count - 1) writer_str(w, ", ");
             }
-            fprintf(f, " IN ");
-            print_expr_recursive(f, node->as.for_gen.iter);
-            fprintf(f, " DO\n");
-            print_ast_recursive(f, node->as.for_gen.body, indent + 1);
+            writer_str(w, " IN ");
+            push_stmt(stack, node->as.for_gen.body, indent + 1);
+            push_text(stack, " DO\n");
+            push_expr(stack, node->as.for_gen.iter);
             break;
 
         case STMT_FUNCTION:
-            fprintf(f, "FUNCTION %s", node->as.func_decl.name);
-            print_func_signature(f, node->as.func_decl.signature);
-            fprintf(f, "\n");
-            print_ast_recursive(f, node->as.func_decl.body, indent + 1);
-            print_indent(f, indent);
-            fprintf(f, "END FUNC\n");
+            writer_str(w, "FUNCTION ");
+            writer_str(w, node->as.func_decl.name);
+            print_func_signature(w, node->as.func_decl.signature);
+            writer_char(w, '\n');
+            push_text(stack, "END FUNC\n");
+            push_indent(stack, indent);
+            push_stmt(stack, node->as.func_decl.body, indent + 1);
             break;
 
         case STMT_STRUCT:
-            fprintf(f, "STRUCT %s", node->as.struct_decl.name);
-            print_generic_params(f, node->as.struct_decl.generics, node->as.struct_decl.generic_count);
-            fprintf(f, "\n");
+            writer_str(w, "STRUCT ");
+            writer_str(w, node->as.struct_decl.name);
+            print_generic_params(w, node->as.struct_decl.generics, node->as.struct_decl.generic_count);
+            writer_char(w, '\n');
             for (int i = 0; i < node->as.struct_decl.field_count; i++) {
-                print_indent(f, indent + 1);
-                fprintf(f, "%s: ", node->as.struct_decl.fields[i].name);
-                print_type(f, node->as.struct_decl.fields[i].type);
-                fprintf(f, "\n");
+                print_indent(w, indent + 1);
+                writer_str(w, node->as.struct_decl.fields[i].name);
+                writer_str(w, ": ");
+                print_type(w, node->as.struct_decl.fields[i].type);
+                writer_char(w, '\n');
             }
-            print_indent(f, indent);
-            fprintf(f, "END STRUCT\n");
+            print_indent(w, indent);
+            writer_str(w, "END STRUCT\n");
             break;
 
         case STMT_TRAIT:
-            fprintf(f, "TRAIT %s", node->as.trait_decl.name);
-            print_generic_params(f, node->as.trait_decl.generics, node->as.trait_decl.generic_count);
-            fprintf(f, "\n");
+            writer_str(w, "TRAIT ");
+            writer_str(w, node->as.trait_decl.name);
+            print_generic_params(w, node->as.trait_decl.generics, node->as.trait_decl.generic_count);
+            writer_char(w, '\n');
             for (int i = 0; i < node->as.trait_decl.func_count; i++) {
-                print_indent(f, indent + 1);
-                fprintf(f, "fn %s", node->as.trait_decl.func_names[i]);
-                print_func_signature(f, node->as.trait_decl.functions[i]);
-                fprintf(f, "\n");
+                print_indent(w, indent + 1);
+                writer_str(w, "fn ");
+                writer_str(w, node->as.trait_decl.func_names[i]);
+                print_func_signature(w, node->as.trait_decl.functions[i]);
+                writer_char(w, '\n');
             }
-            print_indent(f, indent);
-            fprintf(f, "END TRAIT\n");
+            print_indent(w, indent);
+            writer_str(w, "END TRAIT\n");
             break;
 
         case STMT_IMPL:
-            fprintf(f, "IMPL");
-            print_generic_params(f, node->as.impl_stmt.generics, node->as.impl_stmt.generic_count);
-            fprintf(f, " ");
-            
+            writer_str(w, "IMPL");
+            print_generic_params(w, node->as.impl_stmt.generics, node->as.impl_stmt.generic_count);
+            writer_char(w, ' ');
+
+            writer_str(w, node->as.impl_stmt.target_name);
+            print_type_args(w, node->as.impl_stmt.target_args, node->as.impl_stmt.target_arg_count);
+
             if (node->as.impl_stmt.trait_name) {
-                fprintf(f, "%s", node->as.impl_stmt.trait_name);
-                if (node->as.impl_stmt.trait_arg_count > 0) {
-                    fprintf(f, "<");
-                    for(int i=0; i<node->as.impl_stmt.trait_arg_count; i++) {
-                        print_type(f, node->as.impl_stmt.trait_args[i]);
-                        if (i < node->as.impl_stmt.trait_arg_count - 1) fprintf(f, ", ");
-                    }
-                    fprintf(f, ">");
-                }
-                fprintf(f, " FOR ");
+                writer_str(w, " FOR ");
+                writer_str(w, node->as.impl_stmt.trait_name);
+                print_type_args(w, node->as.impl_stmt.trait_args, node->as.impl_stmt.trait_arg_count);
             }
+            writer_char(w, '\n');
 
-            fprintf(f, "%s", node->as.impl_stmt.target_name);
-            if (node->as.impl_stmt.target_arg_count > 0) {
-                fprintf(f, "<");
-                for(int i=0; i<node->as.impl_stmt.target_arg_count; i++) {
-                    print_type(f, node->as.impl_stmt.target_args[i]);
-                    if (i < node->as.impl_stmt.target_arg_count - 1) fprintf(f, ", ");
-                }
-                fprintf(f, ">");
-            }
-            fprintf(f, "\n");
-            
-            for (int i = 0; i < node->as.impl_stmt.func_count; i++) {
-                print_ast_recursive(f, node->as.impl_stmt.functions[i], indent + 1);
+            push_text(stack, "END IMPL\n");
+            push_indent(stack, indent);
+            for (int i = node->as.impl_stmt.func_count - 1; i >= 0; i--) {
+                push_stmt(stack, node->as.impl_stmt.functions[i], indent + 1);
             }
-            print_indent(f, indent);
-            fprintf(f, "END IMPL\n");
             break;
 
         case STMT_TYPE_ALIAS:
-            fprintf(f, "TYPE %s = ", node->as.type_alias.name);
-            print_type(f, node->as.type_alias.type);
-            fprintf(f, "\n");
+            writer_str(w, "TYPE ");
+            writer_str(w, node->as.type_alias.name);
+            writer_str(w, " = ");
+            print_type(w, node->as.type_alias.type);
+            writer_char(w, '\n');
             break;
     }
 }
 
-void fprint_ast(FILE *f, Stmt *root) {
-    if (!root) {
-        fprintf(f, "(Empty AST)\n");
-        return;
+static void print_tree(Writer *w, Stmt *root) {
+    ArenaList stack = ARENA_LIST(Work);
+    push_stmt(&stack, root, 0);
+
+    while (stack.count) {
+        Work work = ARENA_LIST_POP(stack, Work);
+        switch (work.kind) {
+            case WORK_TEXT:   writer_str(w, work.as.text); break;
+            case WORK_INDENT: print_indent(w, work.indent); break;
+            case WORK_EXPR:   print_expr(w, &stack, work.as.expr); break;
+            case WORK_STMT:   print_stmt(w, &stack, work.as.stmt, work.indent); break;
+        }
     }
-    print_ast_recursive(f, root, 0);
+
+    arena_list_end(&stack);
+}
+
+void fprint_ast(FILE *f, Stmt *root) {
+    MemArena *scratch = arena_scratch();
+    u64 mark = scratch->pos;
+    Writer w;
+    writer_init(&w, f, scratch, WRITER_DEFAULT_CAPACITY);
+
+    if (root) print_tree(&w, root);
+    else writer_str(&w, "(Empty AST)\n");
+
+    writer_flush(&w);
+    arena_pop_to(scratch, mark);
 }
 
 void print_ast(Stmt *root) {
     fprint_ast(stdout, root);
 }
+
+// ==========================================
+// DIAGNOSTICS
+// ==========================================
+
+void fprint_diagnostic_list(FILE *f, const char *path, const Diagnostic *diagnostics, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        const Diagnostic *d = &diagnostics[i];
+        if (path) fprintf(f, "%s:", path);
+
+        if (d->line && d->column) fprintf(f, "[line %u:%u] ", d->line, d->column);
+        else if (d->line) fprintf(f, "[line %u] ", d->line);
+
+        // Zonder regel is lexeme altijd de omringende declaratie
+        if (d->lexeme && (d->declaration || !d->line)) fprintf(f, "Error in '%s': %s\n", d->lexeme, d->message);
+        // Lexer fouten hebben geen lexeme, de melding zegt al genoeg
+        else if (d->lexeme) fprintf(f, "Error at '%s': %s\n", d->lexeme, d->message);
+        else fprintf(f, "Error: %s\n", d->message);
+    }
+}
+
+void fprint_diagnostics(FILE *f, const char *path, const ParseResult *result) {
+    fprint_diagnostic_list(f, path, result->diagnostics, result->diagnostic_count);
+}
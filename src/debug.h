@@ -1,13 +1,20 @@
 #pragma once
 #include <stdio.h>
 #include "parser.h"
+#include "string_pool.h"
 #include "token.h" // Zorg dat hier je Token typedefs in staan
 
 // --- Token Printing ---
 const char* token_kind_str(TokenKind kind);
-void fprint_tokens(FILE *f, Token *tokens);
-void print_tokens(Token *tokens); // Wrapper voor stdout
+void fprint_tokens(FILE *f, const TokenList *tokens, StringPool *pool);
+void print_tokens(const TokenList *tokens, StringPool *pool); // Wrapper voor stdout
 
 // --- AST Printing ---
+const char* expr_kind_str(ExprKind kind);
+const char* stmt_kind_str(StmtKind kind);
 void fprint_ast(FILE *f, Stmt *root);
 void print_ast(Stmt *root);       // Wrapper voor stdout
+
+// --- Diagnostics ---
+void fprint_diagnostics(FILE *f, const char *path, const ParseResult *result); // path mag NULL zijn
+void fprint_diagnostic_list(FILE *f, const char *path, const Diagnostic *diagnostics, u32 count);
@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "arena.h"
+#include "lexer.h"
+#include "source.h"
+#include "type_table.h"
+
+static void items_reserve(Document *doc, u32 capacity) {
+	if (capacity <= doc->item_capacity) return;
+
+	u32 cap = doc->item_capacity ? doc->item_capacity : 256;
+	while (cap < capacity) cap *= 2;
+
+	doc->items = realloc(doc->items, cap * sizeof(DocItem));
+	doc->item_capacity = cap;
+}
+
+static DocItem parse_item(Document *doc, u32 *index, u32 errors) {
+	DocItem item;
+	item.first_token = *index;
+	item.begin = doc->tokens.offsets[*index];
+	item.max_errors = PARSER_MAX_ERRORS - errors;
+
+	ParseResult result = parse_statement_at(&doc->tokens, index, item.max_errors, doc->pool, doc->types, doc->arena);
+	item.stmt = result.root;
+	item.diagnostics = result.diagnostics;
+	item.diagnostic_count = result.diagnostic_count;
+
+	for (u32 i = 0; i < item.diagnostic_count; i++) item.diagnostics[i].offset -= item.begin;
+
+	return item;
+}
+
+// Whether the items from first on still parse as they did once errors
+// errors come before them. Once the cap is reached a full parse halts, so
+// an item that now reaches it, or one that reached it before but no longer
+// does, has to be reparsed. Where the count before an item is unchanged it
+// is unchanged for every later one too.
+static bool items_hold(const Document *doc, u32 first, u32 errors) {
+	for (u32 i = first; i < doc->item_count; i++) {
+		const DocItem *item = &doc->items[i];
+		u32 left = PARSER_MAX_ERRORS - errors;
+
+		if (item->max_errors == left) return true;
+		if (item->diagnostic_count >= MIN(left, item->max_errors)) return false;
+		errors += item->diagnostic_count;
+	}
+	return true;
+}
+
+void document_open(Document *doc, const char *text, u64 length, StringPool *pool, MemArena *arena) {
+	*doc = (Document){0};
+	doc->pool = pool;
+	doc->types = type_table_create(arena, 0);
+	doc->arena = arena;
+
+	doc->capacity = length ? length : 1;
+	doc->text = malloc(doc->capacity);
+	memcpy(doc->text, text, length);
+	doc->length = length;
+
+	doc->tokens = tokenize(doc->text, doc->length, pool);
+
+	u32 index = 0, errors = 0;
+	while (doc->tokens.kinds[index] != TOKEN_EOF) {
+		items_reserve(doc, doc->item_count + 1);
+		DocItem item = parse_item(doc, &index, errors);
+		doc->items[doc->item_count++] = item;
+		errors += item.diagnostic_count;
+	}
+}
+
+void document_close(Document *doc) {
+	free(doc->text);
+	free(doc->items);
+	token_list_free(&doc->tokens);
+	*doc = (Document){0};
+}
+
+// Last item starting at or before offset, or 0.
+static u32 find_item(const Document *doc, u32 offset) {
+	u32 lo = 0, hi = doc->item_count;
+	while (hi - lo > 1) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (doc->items[mid].begin <= offset) lo = mid;
+		else hi = mid;
+	}
+	return lo;
+}
+
+void document_edit(Document *doc, u32 offset, u32 removed, const char *inserted, u32 inserted_length) {
+	offset = (u32)MIN(offset, doc->length);
+	removed = (u32)MIN(removed, doc->length - offset);
+
+	u64 old_length = doc->length;
+	u64 new_length = old_length - removed + inserted_length;
+	i64 delta = (i64)inserted_length - (i64)removed;
+
+	if (new_length > doc->capacity) {
+		while (doc->capacity < new_length) doc->capacity *= 2;
+		doc->text = realloc(doc->text, doc->capacity);
+	}
+
+	memmove(doc->text + offset + inserted_length, doc->text + offset + removed, old_length - offset - removed);
+	memcpy(doc->text + offset, inserted, inserted_length);
+	doc->length = new_length;
+
+	TokenList *tokens = &doc->tokens;
+	tokens->source = doc->text;
+	tokens->source_length = new_length;
+
+	// The statement before the edited one looked at its first token to know
+	// where it ended, so it is reparsed as well.
+	u32 first_item = find_item(doc, offset);
+	if (first_item > 0) first_item--;
+
+	u32 t0 = doc->item_count ? doc->items[first_item].first_token : 0;
+	u32 relex_from = first_item ? doc->items[first_item].begin : 0;
+
+	// Relex until a token lands on an old token start past the edit; the
+	// text from there on is unchanged, and so is every token after it.
+	Scanner s;
+	scanner_init(&s, doc->text, new_length, doc->pool);
+	s.start = s.current = doc->text + relex_from;
+
+	u32 old_count = tokens->count;
+	u32 new_edit_end = offset + inserted_length;
+	u32 j = t0;
+
+	ArenaList fresh = ARENA_LIST(Token);
+	while (true) {
+		Token t = lexer_next(&s);
+
+		if (t.offset >= new_edit_end) {
+			u32 old_offset = (u32)(t.offset - delta);
+			while (j < old_count && tokens->offsets[j] < old_offset) j++;
+			if (j < old_count && tokens->offsets[j] == old_offset) break;
+		}
+
+		ARENA_LIST_PUSH(fresh, Token, t);
+		if (t.kind == TOKEN_EOF) { j = old_count; break; }
+	}
+
+	u32 m = (u32)fresh.count;
+	u32 tail = old_count - j;
+	u32 new_count = t0 + m + tail;
+	i64 token_shift = (i64)(t0 + m) - (i64)j;
+
+	if (new_count > tokens->capacity) token_list_reserve(tokens, new_count);
+
+	memmove(tokens->kinds   + t0 + m, tokens->kinds   + j, tail * sizeof(u8));
+	memmove(tokens->offsets + t0 + m, tokens->offsets + j, tail * sizeof(u32));
+	memmove(tokens->lengths + t0 + m, tokens->lengths + j, tail * sizeof(u32));
+	memmove(tokens->ids     + t0 + m, tokens->ids     + j, tail * sizeof(u32));
+	for (u32 i = t0 + m; i < new_count; i++) tokens->offsets[i] += (u32)delta;
+
+	for (u32 i = 0; i < m; i++) {
+		Token t = ARENA_LIST_AT(fresh, Token, i);
+		tokens->kinds[t0 + i] = (u8)t.kind;
+		tokens->offsets[t0 + i] = t.offset;
+		tokens->lengths[t0 + i] = t.length;
+		tokens->ids[t0 + i] = t.id;
+	}
+	tokens->count = new_count;
+	arena_list_end(&fresh);
+
+	// Reparse until a statement ends where an old one began inside the
+	// reused tokens; from there the old items parse the same way, unless
+	// the error count before them changed enough to move the error cap.
+	u32 errors = 0;
+	for (u32 i = 0; i < first_item; i++) errors += doc->items[i].diagnostic_count;
+
+	ArenaList reparsed = ARENA_LIST(DocItem);
+	u32 index = t0;
+	u32 q = first_item;
+
+	while (true) {
+		if (index >= t0 + m) {
+			u32 old_index = (u32)(index - token_shift);
+			while (q < doc->item_count && doc->items[q].first_token < old_index) q++;
+			if (q < doc->item_count && doc->items[q].first_token == old_index && items_hold(doc, q, errors)) break;
+		}
+
+		if (tokens->kinds[index] == TOKEN_EOF) {
+			q = doc->item_count;
+			break;
+		}
+
+		DocItem item = parse_item(doc, &index, errors);
+		ARENA_LIST_PUSH(reparsed, DocItem, item);
+		errors += item.diagnostic_count;
+	}
+
+	u32 kept_tail = doc->item_count - q;
+	u32 new_item_count = first_item + (u32)reparsed.count + kept_tail;
+	items_reserve(doc, new_item_count);
+
+	DocItem *items = doc->items;
+	memmove(items + first_item + reparsed.count, items + q, kept_tail * sizeof(DocItem));
+	memcpy(items + first_item, reparsed.base, reparsed.count * sizeof(DocItem));
+
+	// Kept items parse the same under what is left of the cap now, so that
+	// becomes their budget and the next edit can compare against it.
+	for (u32 i = first_item + (u32)reparsed.count; i < new_item_count; i++) {
+		items[i].begin += (u32)delta;
+		items[i].first_token += (u32)token_shift;
+		items[i].max_errors = PARSER_MAX_ERRORS - errors;
+		errors += items[i].diagnostic_count;
+	}
+	doc->item_count = new_item_count;
+	arena_list_end(&reparsed);
+}
+
+Stmt *document_root(Document *doc) {
+	Stmt *node = PUSH_STRUCT(doc->arena, Stmt);
+	node->kind = STMT_BLOCK;
+
+	u32 count = 0;
+	for (u32 i = 0; i < doc->item_count; i++) count += doc->items[i].stmt != NULL;
+
+	node->as.block.stmt_count = count;
+	node->as.block.stmts = count ? PUSH_ARRAY(doc->arena, Stmt*, count) : NULL;
+
+	u32 n = 0;
+	for (u32 i = 0; i < doc->item_count; i++) {
+		if (doc->items[i].stmt) node->as.block.stmts[n++] = doc->items[i].stmt;
+	}
+
+	return node;
+}
+
+bool document_success(const Document *doc) {
+	for (u32 i = 0; i < doc->item_count; i++) {
+		if (doc->items[i].diagnostic_count) return false;
+	}
+	return true;
+}
+
+u32 document_diagnostics(const Document *doc, Diagnostic *out, u32 max) {
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	LineIndex lines = {0};
+
+	u32 total = 0;
+	for (u32 i = 0; i < doc->item_count; i++) {
+		const DocItem *item = &doc->items[i];
+
+		for (u32 k = 0; k < item->diagnostic_count; k++, total++) {
+			if (total >= max) continue;
+			if (!lines.starts) lines = line_index_build(scratch, doc->text, doc->length);
+
+			Diagnostic d = item->diagnostics[k];
+			d.offset += item->begin;
+			line_index_locate(&lines, d.offset, &d.line, &d.column);
+			out[total] = d;
+		}
+	}
+
+	arena_pop_to(scratch, mark);
+	return total;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "arena.h"
+#include "parser.h"
+#include "string_pool.h"
+#include "token.h"
+#include "typedefs.h"
+
+// One top-level statement of a document. Items tile the token list: an item
+// runs from its first token up to the next item's first token, so tokens a
+// failed statement skipped while recovering belong to it too.
+typedef struct {
+	u32 begin;
+	u32 first_token;
+	Stmt *stmt;
+
+	// The part of the error cap left after the statements before this one.
+	// The tree holds for as long as the same part is left, or for any part
+	// the statement stays under.
+	u32 max_errors;
+
+	// Offsets here are relative to begin so they survive edits before it.
+	Diagnostic *diagnostics;
+	u32 diagnostic_count;
+} DocItem;
+
+// An editable source buffer kept lexed and parsed. An edit relexes from the
+// enclosing statement until the new tokens line up with the old ones again,
+// then reparses statements until one ends on an old statement boundary;
+// everything after that, trees included, is reused and only shifted.
+//
+// Replaced trees are not freed; the arena grows with every edit until the
+// document is closed.
+typedef struct {
+	char *text;
+	u64 length;
+	u64 capacity;
+
+	StringPool *pool;
+	TypeTable *types;
+	MemArena *arena;
+
+	TokenList tokens;
+
+	DocItem *items;
+	u32 item_count;
+	u32 item_capacity;
+} Document;
+
+void document_open(Document *doc, const char *text, u64 length, StringPool *pool, MemArena *arena);
+void document_close(Document *doc);
+
+// Replaces [offset, offset + removed) with the inserted bytes.
+void document_edit(Document *doc, u32 offset, u32 removed, const char *inserted, u32 inserted_length);
+
+// Block of all top-level statements, rebuilt in the arena on every call.
+Stmt *document_root(Document *doc);
+bool document_success(const Document *doc);
+
+// Copies up to max diagnostics with absolute offsets and current lines into
+// out and returns how many the document has in total.
+u32 document_diagnostics(const Document *doc, Diagnostic *out, u32 max);
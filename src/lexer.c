@@ -1,80 +1,82 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <stdbool.h>
-#include <ctype.h>
 #include <string.h>
 
 #include "lexer.h"
 #include "arena.h"
+#include "scan.h"
 #include "string_pool.h"
 #include "token.h"
-#include "vec.h"
 
-typedef struct {
-	const char *word;
-	TokenKind kind;
-} Keyword;
-
-static Keyword keywords[] = {
-	{"local",    TOKEN_LOCAL},
-	{"function", TOKEN_FUNCTION},
-	{"return",   TOKEN_RETURN},
-	{"if",       TOKEN_IF},
-	{"then",     TOKEN_THEN},
-	{"else",     TOKEN_ELSE},
-	{"elseif",   TOKEN_ELSEIF},
-	{"end",      TOKEN_END},
-	{"while",    TOKEN_WHILE},
-	{"do",       TOKEN_DO},
-	{"repeat",   TOKEN_REPEAT},
-	{"until",    TOKEN_UNTIL},
-	{"for",      TOKEN_FOR},
-	{"in",       TOKEN_IN},
-	{"break",    TOKEN_BREAK},
-	{"nil",      TOKEN_NIL},
-	{"true",     TOKEN_TRUE},
-	{"false",    TOKEN_FALSE},
-	{"and",      TOKEN_AND},
-	{"or",       TOKEN_OR},
-	{"not",      TOKEN_NOT},
-	{"type",     TOKEN_TYPE},
-	{"impl",     TOKEN_IMPL},
-	{"trait",    TOKEN_TRAIT},
-	{"struct",   TOKEN_STRUCT},
+// Text for every kind whose spelling is fixed, so those tokens never go
+// through the pool. NULL means the text depends on the source.
+static const char *fixed_text[] = {
+	[TOKEN_EOF] = "",
+
+	[TOKEN_LOCAL] = "local", [TOKEN_FUNCTION] = "function", [TOKEN_STRUCT] = "struct",
+	[TOKEN_TRAIT] = "trait", [TOKEN_IMPL] = "impl", [TOKEN_RETURN] = "return",
+	[TOKEN_IF] = "if", [TOKEN_THEN] = "then", [TOKEN_ELSE] = "else", [TOKEN_ELSEIF] = "elseif",
+	[TOKEN_END] = "end", [TOKEN_WHILE] = "while", [TOKEN_DO] = "do", [TOKEN_REPEAT] = "repeat",
+	[TOKEN_UNTIL] = "until", [TOKEN_FOR] = "for", [TOKEN_IN] = "in", [TOKEN_BREAK] = "break",
+	[TOKEN_NIL] = "nil", [TOKEN_TRUE] = "true", [TOKEN_FALSE] = "false",
+	[TOKEN_AND] = "and", [TOKEN_OR] = "or", [TOKEN_NOT] = "not",
+	[TOKEN_TYPE] = "type",
+
+	[TOKEN_LPAREN] = "(", [TOKEN_RPAREN] = ")",
+	[TOKEN_LBRACE] = "{", [TOKEN_RBRACE] = "}",
+	[TOKEN_LBRACK] = "[", [TOKEN_RBRACK] = "]",
+
+	[TOKEN_COMMA] = ",", [TOKEN_DOT] = ".", [TOKEN_COLON] = ":", [TOKEN_SEMICOLON] = ";",
+
+	[TOKEN_PLUS] = "+", [TOKEN_MINUS] = "-",
+	[TOKEN_STAR] = "*", [TOKEN_SLASH] = "/",
+	[TOKEN_PERCENT] = "%", [TOKEN_CARET] = "^",
+	[TOKEN_HASH] = "#",
+
+	[TOKEN_EQ] = "=", [TOKEN_EQ_EQ] = "==",
+	[TOKEN_NOT_EQ] = "~=",
+	[TOKEN_LT] = "<", [TOKEN_LTEQ] = "<=",
+	[TOKEN_GT] = ">", [TOKEN_GTEQ] = ">=",
+
+	[TOKEN_DOT_DOT] = "..",
+	[TOKEN_DOT_DOT_DOT] = "...",
+	[TOKEN_PIPE] = "|",
 };
 
-#define KEYWORD_COUNT (sizeof(keywords)/sizeof(keywords[0]))
+// Bytes that can continue an identifier. Non-ASCII bytes never do, which is
+// what isalnum says in the C locale, without going through the locale.
+static const bool ident_char[256] = {
+	['a' ... 'z'] = true, ['A' ... 'Z'] = true, ['0' ... '9'] = true, ['_'] = true,
+};
 
-typedef struct {
-	const char *start;
-	const char *current;
-	u64 line;
-	StringPool *pool;
-} Scanner;
+#define is_ident_char(c) ident_char[(u8)(c)]
 
 static inline Token make_empty_token(Scanner *s, TokenKind kind) {
 	Token token;
 	token.kind = kind;
-	token.start = s->start;
-	token.length = (u64)(s->current-s->start);
-	token.line = s->line;
+	token.offset = (u32)(s->start - s->source);
+	token.length = (u32)(s->current - s->start);
+	token.id = 0;
 	return token;
 }
 
 static inline Token make_token(Scanner *s, TokenKind kind) {
 	Token token = make_empty_token(s, kind);
-	token.text = pool_intern(s->pool, token.start, token.length);
+	if (!fixed_text[kind]) token.id = pool_intern_id(s->pool, s->start, token.length);
 	return token;
 }
 
 static inline Token error_token(Scanner *s, char *msg) {
 	Token token = make_empty_token(s, TOKEN_ERROR);
-	token.text = pool_intern(s->pool, msg, strlen(msg));
+	token.id = pool_intern_id(s->pool, msg, strlen(msg));
 	return token;
 }
 
-#define is_at_end(s) (*(s)->current == '\0')
-#define peek(s) (*(s)->current)
-#define peek_next(s) (is_at_end(s) ? '\0' : (s)->current[1])
+#define is_at_end(s) ((s)->current >= (s)->end)
+#define peek(s) (is_at_end(s) ? '\0' : *(s)->current)
+#define peek_next(s) ((s)->current + 1 >= (s)->end ? '\0' : (s)->current[1])
 
 static char advance(Scanner *s) {
 	s->current++;
@@ -92,15 +94,15 @@ static int scan_opening_level(Scanner *s) {
 	int level = 0;
 	const char *temp = s->current;
 
-	while (*temp == '=') {
+	while (temp < s->end && *temp == '=') {
 		level++;
 		temp++;
 	}
 
-	if (*temp != '[') return -1;
+	if (temp >= s->end || *temp != '[') return -1;
 	for (int i = 0; i < level + 1; i++) advance(s);
 	if (peek(s) == '\r') advance(s);
-	if (peek(s) == '\n') { advance(s); s->line++; }
+	if (peek(s) == '\n') advance(s);
 	return level;
 }
 
@@ -108,6 +110,7 @@ static bool scan_closing(Scanner *s, int level) {
 	if (peek(s) != ']') return false;
 
 	const char *temp = s->current+1;
+	if (s->end - temp < level + 1) return false;
 
 	for (int i = 0; i < level; i++) {
 		if (temp[i] != '=') return false;
@@ -130,11 +133,8 @@ static void skip_whitespace(Scanner *s) {
 			case ' ':
 			case '\r':
 			case '\t':
-				advance(s);
-				break;
 			case '\n':
-				advance(s);
-				s->line++;
+				s->current = scan_skip_space(s->current + 1, s->end);
 				break;
 			case '-': if (peek_next(s) == '-') {
 				advance(s); advance(s);
@@ -143,14 +143,15 @@ static void skip_whitespace(Scanner *s) {
 					advance(s);
 					int level = scan_opening_level(s);
 					if (level >= 0) {
-						while (!scan_closing(s, level) && !is_at_end(s)) {
-							if (peek(s) == '\n') s->line++;
-							advance(s);
+						while (!is_at_end(s)) {
+							s->current = scan_find_byte(s->current, s->end, ']');
+							if (scan_closing(s, level)) break;
+							if (!is_at_end(s)) advance(s);
 						}
 						break;
 					}
 				}
-				while (peek(s) != '\n' && !is_at_end(s)) advance(s);
+				s->current = scan_find_byte(s->current, s->end, '\n');
 				break;
 			} else return;
 			default: return;
@@ -158,23 +159,53 @@ static void skip_whitespace(Scanner *s) {
 	}
 }
 
+// Keywords are dispatched on length and first character, so most identifiers
+// are rejected without touching memcmp at all.
+#define KEYWORD(word, kind) \
+	if (memcmp(start, word, sizeof(word) - 1) == 0) return kind
+
 static TokenKind get_identifier_kind(const char *start, u64 length) {
-	for (ulong i = 0; i < KEYWORD_COUNT; i++) {
-		Keyword *k = &keywords[i];
-		if (
-			strlen(k->word) == length &&
-			memcmp(start, k->word, length) == 0
-		) {
-			return k->kind;
-		}
+	switch (length) {
+		case 2: switch (start[0]) {
+			case 'd': KEYWORD("do", TOKEN_DO); break;
+			case 'i': KEYWORD("if", TOKEN_IF); KEYWORD("in", TOKEN_IN); break;
+			case 'o': KEYWORD("or", TOKEN_OR); break;
+		} break;
+		case 3: switch (start[0]) {
+			case 'a': KEYWORD("and", TOKEN_AND); break;
+			case 'e': KEYWORD("end", TOKEN_END); break;
+			case 'f': KEYWORD("for", TOKEN_FOR); break;
+			case 'n': KEYWORD("nil", TOKEN_NIL); KEYWORD("not", TOKEN_NOT); break;
+		} break;
+		case 4: switch (start[0]) {
+			case 'e': KEYWORD("else", TOKEN_ELSE); break;
+			case 'i': KEYWORD("impl", TOKEN_IMPL); break;
+			case 't': KEYWORD("then", TOKEN_THEN); KEYWORD("true", TOKEN_TRUE); KEYWORD("type", TOKEN_TYPE); break;
+		} break;
+		case 5: switch (start[0]) {
+			case 'b': KEYWORD("break", TOKEN_BREAK); break;
+			case 'f': KEYWORD("false", TOKEN_FALSE); break;
+			case 'l': KEYWORD("local", TOKEN_LOCAL); break;
+			case 't': KEYWORD("trait", TOKEN_TRAIT); break;
+			case 'u': KEYWORD("until", TOKEN_UNTIL); break;
+			case 'w': KEYWORD("while", TOKEN_WHILE); break;
+		} break;
+		case 6: switch (start[0]) {
+			case 'e': KEYWORD("elseif", TOKEN_ELSEIF); break;
+			case 'r': KEYWORD("return", TOKEN_RETURN); KEYWORD("repeat", TOKEN_REPEAT); break;
+			case 's': KEYWORD("struct", TOKEN_STRUCT); break;
+		} break;
+		case 8: KEYWORD("function", TOKEN_FUNCTION); break;
 	}
 
 	return TOKEN_IDENTIFIER;
 }
 
+#undef KEYWORD
+
 static Token identifier(Scanner *s) {
 	const char *start = s->start;
-	while (isalnum(*s->current) || *s->current == '_') s->current++;
+	while (!is_at_end(s) && is_ident_char(*s->current)) s->current++;
 	
 	int length = s->current - s->start;
 	
@@ -183,179 +214,643 @@ static Token identifier(Scanner *s) {
 	return make_token(s, kind);
 };
 
-static Token number(Scanner *s) {
-	while (isdigit(*s->current)) s->current++;
-	if (match(s, '.')) while (isdigit(*s->current)) s->current++;
+#define is_digit(c) ((unsigned)((c) - '0') < 10)
+#define is_hex_digit(c) (is_digit(c) || (unsigned)(((c) | 0x20) - 'a') < 6)
+#define hex_value(c) (is_digit(c) ? (c) - '0' : ((c) | 0x20) - 'a' + 10)
+
+#define NUMBER_MAX_DIGITS 19
+#define NUMBER_MAX_EXPONENT 100000
 
-	return make_token(s, TOKEN_NUMBER);
+// Every power of ten up to 1e22 is exact in a double.
+static const double exact_powers[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
 };
 
+static Token integer_token(Scanner *s, u32 value) {
+	Token token = make_empty_token(s, TOKEN_INTEGER);
+	token.id = value;
+	return token;
+}
+
+static Token number_token(Scanner *s, double value) {
+	Token token = make_empty_token(s, TOKEN_NUMBER);
+	token.id = pool_intern_id(s->pool, (const char*)&value, sizeof(value));
+	return token;
+}
+
+// Literals the fast paths can't decode exactly go through strtod, which
+// needs them terminated.
+static Token slow_number(Scanner *s) {
+	u64 length = s->current - s->start;
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+
+	char *text = arena_push(scratch, length + 1, true);
+	memcpy(text, s->start, length);
+	text[length] = '\0';
+	double value = strtod(text, NULL);
+
+	arena_pop_to(scratch, mark);
+	return number_token(s, value);
+}
+
+// Skips the digits of an exponent after 'e' or 'p' and returns its value,
+// clamped far past the range of a double. At least one digit is required.
+static bool scan_exponent(Scanner *s, i32 *exponent) {
+	bool negative = false;
+	if (peek(s) == '+' || peek(s) == '-') negative = advance(s) == '-';
+	if (!is_digit(peek(s))) return false;
+
+	i32 value = 0;
+	while (is_digit(peek(s))) {
+		i32 d = advance(s) - '0';
+		if (value < NUMBER_MAX_EXPONENT) value = value * 10 + d;
+	}
+	*exponent = negative ? -value : value;
+	return true;
+}
+
+static Token hex_number(Scanner *s) {
+	advance(s);
+
+	u64 mantissa = 0;
+	u32 digits = 0, scanned = 0;
+	while (is_hex_digit(peek(s))) {
+		char c = advance(s);
+		if (mantissa || c != '0') digits++;
+		mantissa = (mantissa << 4) | (u64)hex_value(c);
+		scanned++;
+	}
+
+	bool fraction = false;
+	if (peek(s) == '.' && peek_next(s) != '.') {
+		advance(s);
+		fraction = true;
+		while (is_hex_digit(peek(s))) { advance(s); scanned++; }
+	}
+
+	if (!scanned) return error_token(s, "Malformed number.");
+
+	if (peek(s) == 'p' || peek(s) == 'P') {
+		advance(s);
+		i32 exponent;
+		if (!scan_exponent(s, &exponent)) return error_token(s, "Malformed number.");
+		fraction = true;
+	}
+
+	// Hex fractions are rare enough that strtod can have them.
+	if (fraction || digits > 16) return slow_number(s);
+	if (mantissa <= UINT32_MAX) return integer_token(s, (u32)mantissa);
+	return number_token(s, (double)mantissa);
+}
+
+// Decodes the literal while scanning it. Plain integers that fit in 32 bits
+// are carried in the token id. Anything else is exact when the significant
+// digits and the power of ten both fit in a double (Clinger's fast path);
+// only longer literals and larger exponents reach strtod.
+static Token number(Scanner *s) {
+	if (s->start[0] == '0' && (peek(s) == 'x' || peek(s) == 'X')) return hex_number(s);
+
+	u64 mantissa = 0;
+	u32 digits = 0;
+	i32 scale = 0;
+	bool plain = true;
+
+	s->current = s->start;
+	while (is_digit(peek(s))) {
+		u32 d = advance(s) - '0';
+		if (mantissa || d) digits++;
+		mantissa = mantissa * 10 + d;
+	}
+
+	if (peek(s) == '.' && peek_next(s) != '.') {
+		advance(s);
+		plain = false;
+		while (is_digit(peek(s))) {
+			u32 d = advance(s) - '0';
+			if (mantissa || d) digits++;
+			mantissa = mantissa * 10 + d;
+			scale--;
+		}
+	}
+
+	if (peek(s) == 'e' || peek(s) == 'E') {
+		advance(s);
+		i32 exponent;
+		if (!scan_exponent(s, &exponent)) return error_token(s, "Malformed number.");
+		scale += exponent;
+		plain = false;
+	}
+
+	if (digits > NUMBER_MAX_DIGITS) return slow_number(s);
+	if (plain && mantissa <= UINT32_MAX) return integer_token(s, (u32)mantissa);
+	if (mantissa == 0) return number_token(s, 0.0);
+
+	if (mantissa <= (1ull << 53) && scale >= -22 && scale <= 22) {
+		double value = (double)mantissa;
+		value = scale < 0 ? value / exact_powers[-scale] : value * exact_powers[scale];
+		return number_token(s, value);
+	}
+
+	return slow_number(s);
+}
+
 static Token string(Scanner *s) {
 	char quote = advance(s);
 
-	char *buf = NULL;
+	// Most literals have no escapes, those are interned straight from the
+	// source. Otherwise the clean prefix is copied in one go and decoding
+	// starts at the first backslash.
+	const char *body = s->current;
+	const char *close = memchr(body, quote, s->end - body);
+	const char *escape = memchr(body, '\\', (close ? close : s->end) - body);
+
+	if (!escape) {
+		if (!close) {
+			s->current = s->end;
+			return error_token(s, "Unterminated string.");
+		}
+
+		s->current = close + 1;
+		Token token = make_empty_token(s, TOKEN_STRING);
+		token.id = pool_intern_id(s->pool, body, close - body);
+		return token;
+	}
+
+	ArenaList buf = ARENA_LIST(char);
+	arena_list_append(&buf, body, escape - body);
+	s->current = escape;
+
 	while (peek(s) != quote && !is_at_end(s)) {
 		char c = advance(s);
 
 		if (c == '\\') {
 			char esc = peek(s);
 
-			if (isdigit(esc)) {
+			if (is_digit(esc)) {
 				int val = 0;
-				for (int i = 0; i < 3 && isdigit(peek(s)); i++) {
+				for (int i = 0; i < 3 && is_digit(peek(s)); i++) {
 					val = val * 10 + (advance(s) - '0');
 				}
 
 				char byte = (char)val;
-				vec_push(buf, byte);
+				ARENA_LIST_PUSH(buf, char, byte);
 				continue;
 			}
 
 			switch (esc) {
-				case 'a':  advance(s); { char b = '\a'; vec_push(buf, b); } break;
-				case 'b':  advance(s); { char b = '\b'; vec_push(buf, b); } break;
-				case 'f':  advance(s); { char b = '\f'; vec_push(buf, b); } break;
-				case 'n':  advance(s); { char b = '\n'; vec_push(buf, b); } break;
-				case 'r':  advance(s); { char b = '\r'; vec_push(buf, b); } break;
-				case 't':  advance(s); { char b = '\t'; vec_push(buf, b); } break;
-				case 'v':  advance(s); { char b = '\v'; vec_push(buf, b); } break;
-				case '\\': advance(s); { char b = '\\'; vec_push(buf, b); } break;
-				case '"':  advance(s); { char b = '"';  vec_push(buf, b); } break;
-				case '\'': advance(s); { char b = '\''; vec_push(buf, b); } break;
-				case '\n': advance(s); s->line++; { char b = '\n'; vec_push(buf, b); } break;
-				default: vec_push(buf, advance(s)); break;
+				case 'a':  advance(s); { char b = '\a'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case 'b':  advance(s); { char b = '\b'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case 'f':  advance(s); { char b = '\f'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case 'n':  advance(s); { char b = '\n'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case 'r':  advance(s); { char b = '\r'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case 't':  advance(s); { char b = '\t'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case 'v':  advance(s); { char b = '\v'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case '\\': advance(s); { char b = '\\'; ARENA_LIST_PUSH(buf, char, b); } break;
+				case '"':  advance(s); { char b = '"';  ARENA_LIST_PUSH(buf, char, b); } break;
+				case '\'': advance(s); { char b = '\''; ARENA_LIST_PUSH(buf, char, b); } break;
+				case '\n': advance(s); { char b = '\n'; ARENA_LIST_PUSH(buf, char, b); } break;
+				default: if (!is_at_end(s)) ARENA_LIST_PUSH(buf, char, advance(s)); break;
 			}
 		} else {
-			if (c == '\n') s->line++;
-			vec_push(buf, c);
+			ARENA_LIST_PUSH(buf, char, c);
 		}
 	}
 
 	if (is_at_end(s)) {
-		vec_free(buf);
+		arena_list_end(&buf);
 		return error_token(s, "Unterminated string.");
 	}
 
 	advance(s);
-	vec_push(buf, '\0');
 
 	Token token = make_empty_token(s, TOKEN_STRING);
-	token.text = pool_intern(s->pool, buf, vec_size(buf)-1);
+	token.id = pool_intern_id(s->pool, buf.count ? (char*)buf.base : "", buf.count);
 
-	vec_free(buf);
+	arena_list_end(&buf);
 	return token;
 }
 
-Token raw_string(Scanner *s) {
+static Token raw_string(Scanner *s) {
 	int hashes = 0;
 	while (match(s, '#')) hashes++;
 
 	if (peek(s) != '"') return error_token(s, "Expected '\"' after raw string prefix.");
 	advance(s);
 
-	char *buf = NULL;
 	match(s, '\n');
-	
-	while (!is_at_end(s)) {
-		if (peek(s) == '"') {
-			const char *temp = s->current+1;
-
-			bool closed = true;
-			for (int i = 0; i < hashes; i++) {
-				if (temp[i] != '#') { closed = false; break; }
-			}
-
-			if (closed) {
-				advance(s);
-				for (int i = 0; i < hashes; i++) advance(s);
-				Token token = make_empty_token(s, TOKEN_STRING);
-				token.text = pool_intern(s->pool, buf, vec_size(buf));
-				vec_free(buf);
-				return token;
-			}
+	const char *body = s->current;
+
+	// Raw strings are never decoded, so the contents are always a slice of
+	// the source: jump between quotes until one is followed by enough '#'.
+	const char *quote;
+	while ((quote = memchr(s->current, '"', s->end - s->current))) {
+		const char *tail = quote + 1;
+
+		int i = 0;
+		while (i < hashes && tail + i < s->end && tail[i] == '#') i++;
+
+		s->current = tail;
+		if (i == hashes) {
+			s->current += hashes;
+			Token token = make_empty_token(s, TOKEN_STRING);
+			token.id = pool_intern_id(s->pool, body, quote - body);
+			return token;
 		}
-		char c = advance(s);
-		vec_push(buf, c);
 	}
 
-	vec_free(buf);
+	s->current = s->end;
 	return error_token(s, "Unterminated string.");
 }
 
-Token scan_token(Scanner *s) {
+// What scan_token does with a token's first byte. Bytes that can't start a
+// token stay SCAN_ERROR.
+typedef enum {
+	SCAN_ERROR, SCAN_SINGLE, SCAN_IDENT, SCAN_RAW, SCAN_NUMBER, SCAN_STRING,
+	SCAN_EQ, SCAN_TILDE, SCAN_LT, SCAN_GT, SCAN_DOT,
+	SCAN_COUNT,
+} ScanAction;
+
+static const u8 first_byte[256] = {
+	['a' ... 'q'] = SCAN_IDENT, ['r'] = SCAN_RAW, ['s' ... 'z'] = SCAN_IDENT,
+	['A' ... 'Z'] = SCAN_IDENT, ['_'] = SCAN_IDENT,
+	['0' ... '9'] = SCAN_NUMBER,
+	['"'] = SCAN_STRING, ['\''] = SCAN_STRING,
+
+	['('] = SCAN_SINGLE, [')'] = SCAN_SINGLE, ['{'] = SCAN_SINGLE, ['}'] = SCAN_SINGLE,
+	['['] = SCAN_SINGLE, [']'] = SCAN_SINGLE, [','] = SCAN_SINGLE, [':'] = SCAN_SINGLE,
+	[';'] = SCAN_SINGLE, ['+'] = SCAN_SINGLE, ['-'] = SCAN_SINGLE, ['*'] = SCAN_SINGLE,
+	['/'] = SCAN_SINGLE, ['%'] = SCAN_SINGLE, ['^'] = SCAN_SINGLE, ['#'] = SCAN_SINGLE,
+	['|'] = SCAN_SINGLE,
+
+	['='] = SCAN_EQ, ['~'] = SCAN_TILDE, ['<'] = SCAN_LT, ['>'] = SCAN_GT, ['.'] = SCAN_DOT,
+};
+
+static const u8 single_token[256] = {
+	['('] = TOKEN_LPAREN, [')'] = TOKEN_RPAREN, ['{'] = TOKEN_LBRACE, ['}'] = TOKEN_RBRACE,
+	['['] = TOKEN_LBRACK, [']'] = TOKEN_RBRACK, [','] = TOKEN_COMMA, [':'] = TOKEN_COLON,
+	[';'] = TOKEN_SEMICOLON, ['+'] = TOKEN_PLUS, ['-'] = TOKEN_MINUS, ['*'] = TOKEN_STAR,
+	['/'] = TOKEN_SLASH, ['%'] = TOKEN_PERCENT, ['^'] = TOKEN_CARET, ['#'] = TOKEN_HASH,
+	['|'] = TOKEN_PIPE,
+};
+
+static Token scan_token(Scanner *s) {
 	skip_whitespace(s);
 
 	s->start = s->current;
 
-	if (is_at_end(s)) return make_token(s, TOKEN_EOF);
-
-	char c = advance(s);
+	if (is_at_end(s)) {
+		if (s->too_large) {
+			s->too_large = false;
+			return error_token(s, "Source is too large: 4 GiB or more.");
+		}
+		return make_token(s, TOKEN_EOF);
+	}
 
-	if ((c != 'r' && isalpha(c)) || c == '_') return identifier(s);
-	if (isdigit(c)) return number(s);
+	u8 c = (u8)advance(s);
 
 	#define TOKEN(KIND) make_token(s, KIND)
 
-	switch (c) {
-		case '(': return TOKEN(TOKEN_LPAREN);
-		case ')': return TOKEN(TOKEN_RPAREN);
-		case '{': return TOKEN(TOKEN_LBRACE);
-		case '}': return TOKEN(TOKEN_RBRACE);
-		case '[': return TOKEN(TOKEN_LBRACK);
-		case ']': return TOKEN(TOKEN_RBRACK);
-
-		case ',': return TOKEN(TOKEN_COMMA);
-		case ':': return TOKEN(TOKEN_COLON);
-		case ';': return TOKEN(TOKEN_SEMICOLON);
-
-		case '+': return TOKEN(TOKEN_PLUS);
-		case '-': return TOKEN(TOKEN_MINUS);
-		case '*': return TOKEN(TOKEN_STAR);
-		case '/': return TOKEN(TOKEN_SLASH);
-		case '%': return TOKEN(TOKEN_PERCENT);
-		case '^': return TOKEN(TOKEN_CARET);
-		case '#': return TOKEN(TOKEN_HASH);
-		case '|': return TOKEN(TOKEN_PIPE);
-
-		case '=': if (match(s, '=')) return TOKEN(TOKEN_EQ_EQ);
-		          else return TOKEN(TOKEN_EQ);
-		case '~': if (match(s, '=')) return TOKEN(TOKEN_NOT_EQ);
-		          else return error_token(s, "Unknown character.");
-		case '<': if (match(s, '=')) return TOKEN(TOKEN_LTEQ);
-		          else return TOKEN(TOKEN_LT);
-		case '>': if (match(s, '=')) return TOKEN(TOKEN_GTEQ);
-		          else return TOKEN(TOKEN_GT);
-
-		case '.': if (match(s, '.')) {
-								if (match(s, '.')) return TOKEN(TOKEN_DOT_DOT_DOT);
-								else return TOKEN(TOKEN_DOT_DOT);
-							} else return TOKEN(TOKEN_DOT);
-		case 'r': if (peek(s) == '"' || peek(s) == '#') return raw_string(s);
-		          else return identifier(s);
-		case '"':
-		case '\'':
-			s->current--;
-			return string(s);
+#if defined(__GNUC__)
+	static const void *labels[SCAN_COUNT] = {
+		[SCAN_ERROR] = &&L_SCAN_ERROR, [SCAN_SINGLE] = &&L_SCAN_SINGLE,
+		[SCAN_IDENT] = &&L_SCAN_IDENT, [SCAN_RAW] = &&L_SCAN_RAW,
+		[SCAN_NUMBER] = &&L_SCAN_NUMBER, [SCAN_STRING] = &&L_SCAN_STRING,
+		[SCAN_EQ] = &&L_SCAN_EQ, [SCAN_TILDE] = &&L_SCAN_TILDE,
+		[SCAN_LT] = &&L_SCAN_LT, [SCAN_GT] = &&L_SCAN_GT, [SCAN_DOT] = &&L_SCAN_DOT,
+	};
+	goto *labels[first_byte[c]];
+	#define CASE(action) L_##action:
+#else
+	switch (first_byte[c]) {
+	#define CASE(action) case action:
+#endif
+
+	CASE(SCAN_SINGLE) return TOKEN(single_token[c]);
+	CASE(SCAN_IDENT) return identifier(s);
+	CASE(SCAN_RAW) if (peek(s) == '"' || peek(s) == '#') return raw_string(s);
+	               else return identifier(s);
+	CASE(SCAN_NUMBER) return number(s);
+	CASE(SCAN_STRING) s->current--; return string(s);
+
+	CASE(SCAN_EQ) if (match(s, '=')) return TOKEN(TOKEN_EQ_EQ);
+	              else return TOKEN(TOKEN_EQ);
+	CASE(SCAN_TILDE) if (match(s, '=')) return TOKEN(TOKEN_NOT_EQ);
+	                 else return error_token(s, "Unknown character.");
+	CASE(SCAN_LT) if (match(s, '=')) return TOKEN(TOKEN_LTEQ);
+	              else return TOKEN(TOKEN_LT);
+	CASE(SCAN_GT) if (match(s, '=')) return TOKEN(TOKEN_GTEQ);
+	              else return TOKEN(TOKEN_GT);
+	CASE(SCAN_DOT) if (match(s, '.')) {
+	                   if (match(s, '.')) return TOKEN(TOKEN_DOT_DOT_DOT);
+	                   else return TOKEN(TOKEN_DOT_DOT);
+	               } else return TOKEN(TOKEN_DOT);
+
+	CASE(SCAN_ERROR)
+#if !defined(__GNUC__)
+	default: break;
 	}
+#endif
+
+	#undef CASE
+	#undef TOKEN
 
 	return error_token(s, "Unknown character");
 }
 
-Token *tokenize(char *source, StringPool *pool) {
-	Token *tokens = NULL; 
+void scanner_init(Scanner *s, const char *source, u64 length, StringPool *pool) {
+	s->too_large = length > TOKEN_MAX_SOURCE_LENGTH;
+	s->source = source;
+	s->start = source;
+	s->current = source;
+	s->end = s->too_large ? source : source + length;
+	s->pool = pool;
+}
 
-	Scanner s = { source, source, 1, pool };
+Token lexer_next(Scanner *s) {
+	return scan_token(s);
+}
 
-	while (!is_at_end(&s)) {
-		Token t = scan_token(&s);
-		vec_push(tokens, t);
+const char *token_text(StringPool *pool, Token token) {
+	const char *text = fixed_text[token.kind];
+	return text ? text : pool_str(pool, token.id);
+}
+
+void token_list_reserve(TokenList *list, u32 cap) {
+	list->kinds   = realloc(list->kinds,   cap * sizeof(u8));
+	list->offsets = realloc(list->offsets, cap * sizeof(u32));
+	list->lengths = realloc(list->lengths, cap * sizeof(u32));
+	list->ids     = realloc(list->ids,     cap * sizeof(u32));
+	list->capacity = cap;
+}
+
+static void token_list_push(TokenList *list, Token t) {
+	if (list->count == list->capacity) {
+		token_list_reserve(list, list->capacity ? list->capacity * 2 : 1024);
+	}
+
+	u32 i = list->count++;
+	list->kinds[i] = (u8)t.kind;
+	list->offsets[i] = t.offset;
+	list->lengths[i] = t.length;
+	list->ids[i] = t.id;
+}
+
+TokenList tokenize(const char *source, u64 length, StringPool *pool) {
+	TokenList list = {0};
+	list.source = source;
+	list.source_length = length;
+
+	Scanner s;
+	scanner_init(&s, source, length, pool);
+
+	while (true) {
+		Token t = lexer_next(&s);
+		token_list_push(&list, t);
 		if (t.kind == TOKEN_EOF) break;
 	}
 
-	if (tokens && tokens[vec_size(tokens)-1].kind != TOKEN_EOF) {
-		Token eof = make_empty_token(&s, TOKEN_EOF);
-		vec_push(tokens, eof);
+	return list;
+}
+
+#define LEX_CHUNK_MIN KiB(64)
+#define LEX_CHUNK_ARENA_RESERVE GiB(1)
+#define LEX_MAX_CHUNKS 256
+
+// Skips a long bracket body ("[==[" already consumed up to level) and
+// returns the byte after its closing "]==]", or end.
+static const char *skip_long_bracket(const char *p, const char *end, int level) {
+	while ((p = scan_find_byte(p, end, ']')) < end) {
+		p++;
+		int i = 0;
+		while (i < level && p + i < end && p[i] == '=') i++;
+		if (i == level && p + i < end && p[i] == ']') return p + i + 1;
 	}
+	return end;
+}
+
+// Picks up to wanted split points at roughly equal fractions of the input.
+// A split is the start of a line that this rough pass believes is outside
+// any string or comment. The guess is verified when the chunks are stitched
+// back together, so a wrong one only costs re-lexing, never different output.
+static u32 find_splits(const char *source, u64 length, u32 *splits, u32 wanted) {
+	const char *p = source;
+	const char *end = source + length;
+	u32 found = 0;
+	const char *target = source + length / (wanted + 1);
+
+	while (p < end && found < wanted) {
+		char c = *p++;
+
+		switch (c) {
+			case '\n':
+				if (p >= target) {
+					splits[found++] = (u32)(p - source);
+					target = source + length * (found + 1) / (wanted + 1);
+				}
+				break;
+			case '"':
+			case '\'':
+				while (p < end && *p != c && *p != '\n') p += (*p == '\\') ? 2 : 1;
+				if (p < end && *p == c) p++;
+				break;
+			case '-':
+				if (p < end && *p == '-') {
+					p++;
+					if (p < end && *p == '[') {
+						const char *q = p + 1;
+						while (q < end && *q == '=') q++;
+						if (q < end && *q == '[') { p = skip_long_bracket(q + 1, end, (int)(q - p - 1)); break; }
+					}
+					p = scan_find_byte(p, end, '\n');
+				}
+				break;
+			case 'r':
+				if ((p - 1 == source || !is_ident_char(p[-2])) && p < end && (*p == '"' || *p == '#')) {
+					int hashes = 0;
+					while (p < end && *p == '#') { p++; hashes++; }
+					if (p >= end || *p != '"') break;
+					p++;
+					while ((p = scan_find_byte(p, end, '"')) < end) {
+						p++;
+						int i = 0;
+						while (i < hashes && p + i < end && p[i] == '#') i++;
+						if (i == hashes) { p += hashes; break; }
+					}
+				} else {
+					while (p < end && is_ident_char(*p)) p++;
+				}
+				break;
+			default:
+				if (is_ident_char(c)) while (p < end && is_ident_char(*p)) p++;
+				break;
+		}
+	}
+
+	return found;
+}
+
+typedef struct {
+	const char *source;
+	u64 length;
+	u32 begin;
+	u32 end;
+	bool last;
+	SharedStringPool *shared;
+
+	// Tokens starting in [begin, end). The first token at or past end is
+	// kept in stop, with resume positioned right after it.
+	TokenList tokens;
+	Token stop;
+	Scanner resume;
+
+	pthread_t thread;
+	bool threaded;
+} LexChunk;
+
+static void *lex_chunk(void *arg) {
+	LexChunk *chunk = arg;
+
+	MemArena *arena = arena_create_reserve(LEX_CHUNK_ARENA_RESERVE);
+	StringPool pool = pool_create_view(chunk->shared, arena, KiB(1));
+
+	Scanner s;
+	scanner_init(&s, chunk->source, chunk->length, &pool);
+	s.start = s.current = chunk->source + chunk->begin;
+
+	while (true) {
+		Token t = lexer_next(&s);
+		if (!chunk->last && t.offset >= chunk->end) {
+			chunk->stop = t;
+			break;
+		}
+		token_list_push(&chunk->tokens, t);
+		if (t.kind == TOKEN_EOF) break;
+	}
+
+	chunk->resume = s;
+	chunk->resume.pool = NULL;
+
+	pool_destroy(&pool);
+	arena_destroy(arena);
+	return NULL;
+}
+
+static void token_list_append(TokenList *dst, const TokenList *src, u32 from) {
+	u32 n = src->count - from;
+	if (dst->count + n > dst->capacity) token_list_reserve(dst, dst->count + n);
+
+	memcpy(dst->kinds   + dst->count, src->kinds   + from, n * sizeof(u8));
+	memcpy(dst->offsets + dst->count, src->offsets + from, n * sizeof(u32));
+	memcpy(dst->lengths + dst->count, src->lengths + from, n * sizeof(u32));
+	memcpy(dst->ids     + dst->count, src->ids     + from, n * sizeof(u32));
+	dst->count += n;
+}
+
+TokenList tokenize_parallel(const char *source, u64 length, SharedStringPool *shared, u32 jobs) {
+	// Chunk bounds are u32 offsets; the sequential lexer reports the error.
+	if (length > TOKEN_MAX_SOURCE_LENGTH) {
+		MemArena *arena = arena_create_reserve(LEX_CHUNK_ARENA_RESERVE);
+		StringPool pool = pool_create_view(shared, arena, KiB(1));
+		TokenList list = tokenize(source, length, &pool);
+		pool_destroy(&pool);
+		arena_destroy(arena);
+		return list;
+	}
+
+	u32 splits[LEX_MAX_CHUNKS];
+	u64 wanted = MIN(MIN(MAX(jobs, 1), LEX_MAX_CHUNKS), length / LEX_CHUNK_MIN + 1);
+	u32 chunk_count = find_splits(source, length, splits, (u32)wanted - 1) + 1;
+
+	LexChunk chunks[LEX_MAX_CHUNKS];
+	for (u32 i = 0; i < chunk_count; i++) {
+		LexChunk *c = &chunks[i];
+		*c = (LexChunk){0};
+		c->source = source;
+		c->length = length;
+		c->begin = i == 0 ? 0 : splits[i - 1];
+		c->end = i == chunk_count - 1 ? (u32)length : splits[i];
+		c->last = i == chunk_count - 1;
+		c->shared = shared;
+	}
+
+	for (u32 i = 1; i < chunk_count; i++) {
+		chunks[i].threaded = pthread_create(&chunks[i].thread, NULL, lex_chunk, &chunks[i]) == 0;
+	}
+	lex_chunk(&chunks[0]);
+	for (u32 i = 1; i < chunk_count; i++) {
+		if (chunks[i].threaded) pthread_join(chunks[i].thread, NULL);
+		else lex_chunk(&chunks[i]);
+	}
+
+	TokenList list = {0};
+	list.source = source;
+	list.source_length = length;
+
+	u32 total = 0;
+	for (u32 i = 0; i < chunk_count; i++) total += chunks[i].tokens.count;
+	token_list_reserve(&list, total + 1);
+
+	// The lexer carries no state between tokens besides its position, so
+	// once the sequential stream produces a token at the same offset as one
+	// in a chunk, the rest of that chunk is exactly what it would produce.
+	// Until then, a chunk that started inside a string or comment is re-lexed
+	// from where the previous one stopped.
+	MemArena *arena = arena_create_reserve(LEX_CHUNK_ARENA_RESERVE);
+	StringPool pool = pool_create_view(shared, arena, KiB(1));
+
+	Token next = {0};
+	Scanner cursor = {0};
+	bool done = false;
+
+	for (u32 i = 0; i < chunk_count && !done; i++) {
+		LexChunk *c = &chunks[i];
+		const TokenList *tokens = &c->tokens;
+		u32 from = 0;
+
+		if (i > 0) {
+			bool synced = false;
+			while (true) {
+				while (from < tokens->count && tokens->offsets[from] < next.offset) from++;
+				if (from < tokens->count && tokens->offsets[from] == next.offset) { synced = true; break; }
+				if (!c->last && next.offset >= c->end) break;
+
+				token_list_push(&list, next);
+				if (next.kind == TOKEN_EOF) { done = true; break; }
+				next = lexer_next(&cursor);
+			}
+			if (!synced) continue;
+		}
+
+		token_list_append(&list, tokens, from);
+		if (c->last) break;
+
+		next = c->stop;
+		cursor = c->resume;
+		cursor.pool = &pool;
+	}
+
+	for (u32 i = 0; i < chunk_count; i++) token_list_free(&chunks[i].tokens);
+	pool_destroy(&pool);
+	arena_destroy(arena);
+
+	return list;
+}
+
+Token token_list_get(const TokenList *list, u32 index) {
+	Token t;
+	t.kind = list->kinds[index];
+	t.offset = list->offsets[index];
+	t.length = list->lengths[index];
+	t.id = list->ids[index];
+	return t;
+}
 
-	return tokens;
+void token_list_free(TokenList *list) {
+	free(list->kinds);
+	free(list->offsets);
+	free(list->lengths);
+	free(list->ids);
+	*list = (TokenList){0};
 }
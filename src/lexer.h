@@ -1,6 +1,46 @@
 #pragma once
+#include <string.h>
+
 #include "arena.h"
 #include "token.h"
 #include "string_pool.h"
 
-Token *tokenize(char *source, StringPool *pool);
+typedef struct {
+	const char *source;
+	const char *start;
+	const char *current;
+	const char *end;
+	StringPool *pool;
+
+	// Set for a source over TOKEN_MAX_SOURCE_LENGTH, which is scanned as
+	// empty: its only tokens are an error and EOF.
+	bool too_large;
+} Scanner;
+
+void scanner_init(Scanner *s, const char *source, u64 length, StringPool *pool);
+
+// Scans and returns the next token. Once the end of input is reached every
+// further call returns TOKEN_EOF again.
+Token lexer_next(Scanner *s);
+
+// Keywords, punctuation and EOF have fixed text and no intern id; every
+// other token's text lives in the pool, except for numbers, whose spelling
+// is only in the source.
+const char *token_text(StringPool *pool, Token token);
+
+static inline double token_number(StringPool *pool, Token token) {
+	if (token.kind == TOKEN_INTEGER) return (double)token.id;
+	double value;
+	memcpy(&value, pool_str(pool, token.id), sizeof(value));
+	return value;
+}
+
+TokenList tokenize(const char *source, u64 length, StringPool *pool);
+
+// Splits the input at line starts and lexes the pieces on up to [jobs]
+// threads. The result is identical to tokenize(); ids index the shared
+// pool's strings, so any view of it can resolve them.
+TokenList tokenize_parallel(const char *source, u64 length, SharedStringPool *shared, u32 jobs);
+Token token_list_get(const TokenList *list, u32 index);
+void token_list_reserve(TokenList *list, u32 capacity);
+void token_list_free(TokenList *list);
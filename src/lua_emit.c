@@ -0,0 +1,895 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua_emit.h"
+#include "arena.h"
+#include "ptr_map.h"
+#include "vec.h"
+
+// Folded '..' results stop growing here, so a long chain of literals
+// doesn't copy its prefix once per operand.
+#define FOLD_MAX_STRING 1024
+
+// Top-level impl methods live in this one local table, keyed by owner and
+// name. A local per method would run into Lua's 200 locals in the main
+// chunk and LuaJIT's 60 upvalues in any function calling many of them;
+// the table costs one of each and a constant-key index per call, which
+// still skips the metatable.
+#define LUA_METHOD_TABLE "__methods"
+
+#define AS_PTR(T, v) ((T)(uintptr_t)(v))
+
+// ==========================================
+// CONSTANT FOLDING
+// ==========================================
+
+static bool is_literal(const Expr *e) {
+	return e && (e->kind == EXPR_NIL || e->kind == EXPR_BOOL || e->kind == EXPR_NUMBER || e->kind == EXPR_STRING);
+}
+
+static bool is_truthy(const Expr *e) {
+	return !(e->kind == EXPR_NIL || (e->kind == EXPR_BOOL && !e->as.boolean));
+}
+
+static bool literal_equal(const Expr *a, const Expr *b) {
+	if (a->kind != b->kind) return false;
+	switch (a->kind) {
+		case EXPR_NIL:    return true;
+		case EXPR_BOOL:   return a->as.boolean == b->as.boolean;
+		case EXPR_NUMBER: return a->as.number == b->as.number;
+		case EXPR_STRING: return strcmp(a->as.string, b->as.string) == 0;
+		default:          return false;
+	}
+}
+
+static void set_number(Expr *e, double n) {
+	e->kind = EXPR_NUMBER;
+	e->as.number = n;
+}
+
+static void set_bool(Expr *e, bool b) {
+	e->kind = EXPR_BOOL;
+	e->as.boolean = b;
+}
+
+// Results Lua would print as inf or nan have no literal and stay unfolded.
+static bool fold_arith(Expr *e, double x, double y) {
+	double n;
+	switch (e->as.binary.op) {
+		case OP_ADD: n = x + y; break;
+		case OP_SUB: n = x - y; break;
+		case OP_MUL: n = x * y; break;
+		case OP_DIV: n = x / y; break;
+		case OP_MOD: n = x - floor(x / y) * y; break;
+		case OP_POW: n = pow(x, y); break;
+		case OP_LT:  set_bool(e, x < y); return true;
+		case OP_LTE: set_bool(e, x <= y); return true;
+		case OP_GT:  set_bool(e, x > y); return true;
+		case OP_GTE: set_bool(e, x >= y); return true;
+		default:     return false;
+	}
+	if (!isfinite(n)) return false;
+	set_number(e, n);
+	return true;
+}
+
+static void fold_binary(Expr *e, MemArena *arena) {
+	Expr *left = e->as.binary.left;
+	Expr *right = e->as.binary.right;
+	BinaryOp op = e->as.binary.op;
+
+	// A literal left operand decides and/or on its own.
+	if ((op == OP_AND || op == OP_OR) && is_literal(left) && right) {
+		bool take_left = op == OP_AND ? !is_truthy(left) : is_truthy(left);
+		*e = take_left ? *left : *right;
+		return;
+	}
+
+	if (!is_literal(left) || !is_literal(right)) return;
+
+	if (op == OP_EQ || op == OP_NEQ) {
+		bool equal = literal_equal(left, right);
+		set_bool(e, op == OP_EQ ? equal : !equal);
+		return;
+	}
+
+	if (left->kind == EXPR_NUMBER && right->kind == EXPR_NUMBER) {
+		fold_arith(e, left->as.number, right->as.number);
+		return;
+	}
+
+	if (op == OP_CONCAT && left->kind == EXPR_STRING && right->kind == EXPR_STRING) {
+		u64 a = strlen(left->as.string), b = strlen(right->as.string);
+		if (a + b > FOLD_MAX_STRING) return;
+
+		char *s = arena_push(arena, a + b + 1, true);
+		memcpy(s, left->as.string, a);
+		memcpy(s + a, right->as.string, b + 1);
+		e->kind = EXPR_STRING;
+		e->as.string = s;
+	}
+}
+
+static void fold_unary(Expr *e) {
+	Expr *operand = e->as.unary.operand;
+	if (!is_literal(operand)) return;
+
+	switch (e->as.unary.op) {
+		case OP_NEGATE:
+			if (operand->kind == EXPR_NUMBER) set_number(e, -operand->as.number);
+			break;
+		case OP_NOT:
+			set_bool(e, !is_truthy(operand));
+			break;
+		case OP_LEN:
+			if (operand->kind == EXPR_STRING) set_number(e, (double)strlen(operand->as.string));
+			break;
+	}
+}
+
+static void fold_stmt(Stmt *s, MemArena *arena);
+
+static void fold_block(Stmt *block, MemArena *arena) {
+	if (!block) return;
+	if (block->kind != STMT_BLOCK) {
+		fold_stmt(block, arena);
+		return;
+	}
+	for (int i = 0; i < block->as.block.stmt_count; i++) fold_stmt(block->as.block.stmts[i], arena);
+}
+
+// Nodes are listed parents first and folded in reverse, so every operand
+// is final before its operator looks at it.
+static void fold_expr(Expr *root, MemArena *arena) {
+	if (!root) return;
+
+	Expr **nodes = NULL;
+	vec_push(nodes, root);
+	for (u32 i = 0; i < vec_size(nodes); i++) {
+		Expr *e = nodes[i];
+
+		#define VISIT(child) do { if (child) vec_push(nodes, (child)); } while (0)
+		switch (e->kind) {
+			case EXPR_BINARY:
+				VISIT(e->as.binary.left);
+				VISIT(e->as.binary.right);
+				break;
+			case EXPR_UNARY:
+				VISIT(e->as.unary.operand);
+				break;
+			case EXPR_CALL:
+				VISIT(e->as.call.callee);
+				for (int j = 0; j < e->as.call.arg_count; j++) VISIT(e->as.call.args[j]);
+				break;
+			case EXPR_INDEX:
+				VISIT(e->as.index.target);
+				VISIT(e->as.index.index);
+				break;
+			case EXPR_FIELD:
+				VISIT(e->as.field.target);
+				break;
+			case EXPR_TABLE:
+				for (int j = 0; j < e->as.table.entry_count; j++) {
+					VISIT(e->as.table.entries[j].key);
+					VISIT(e->as.table.entries[j].value);
+				}
+				break;
+			case EXPR_STRUCT:
+				for (int j = 0; j < e->as.struct_init.entry_count; j++) VISIT(e->as.struct_init.entries[j].value);
+				break;
+			case EXPR_FUNCTION:
+				fold_block(e->as.function.body, arena);
+				break;
+			default:
+				break;
+		}
+		#undef VISIT
+	}
+
+	for (u32 i = (u32)vec_size(nodes); i-- > 0;) {
+		Expr *e = nodes[i];
+		if (e->kind == EXPR_BINARY) fold_binary(e, arena);
+		else if (e->kind == EXPR_UNARY) fold_unary(e);
+	}
+	vec_free(nodes);
+}
+
+static void fold_exprs(Expr **exprs, int count, MemArena *arena) {
+	for (int i = 0; i < count; i++) fold_expr(exprs[i], arena);
+}
+
+static void fold_stmt(Stmt *s, MemArena *arena) {
+	if (!s) return;
+
+	switch (s->kind) {
+		case STMT_EXPR:   fold_expr(s->as.expression, arena); break;
+		case STMT_BLOCK:  fold_block(s, arena); break;
+		case STMT_RETURN: fold_exprs(s->as.return_stmt.values, s->as.return_stmt.value_count, arena); break;
+		case STMT_ASSIGN:
+			fold_exprs(s->as.assign.targets, s->as.assign.target_count, arena);
+			fold_exprs(s->as.assign.values, s->as.assign.value_count, arena);
+			break;
+		case STMT_LOCAL:  fold_exprs(s->as.local.values, s->as.local.value_count, arena); break;
+		case STMT_IF:
+			for (Stmt *branch = s; ; branch = branch->as.if_stmt.else_branch) {
+				fold_expr(branch->as.if_stmt.condition, arena);
+				fold_block(branch->as.if_stmt.then_branch, arena);
+
+				Stmt *next = branch->as.if_stmt.else_branch;
+				if (!next || next->kind != STMT_IF) {
+					fold_block(next, arena);
+					break;
+				}
+			}
+			break;
+		case STMT_WHILE:
+			fold_expr(s->as.while_stmt.condition, arena);
+			fold_block(s->as.while_stmt.body, arena);
+			break;
+		case STMT_REPEAT:
+			fold_block(s->as.repeat_stmt.body, arena);
+			fold_expr(s->as.repeat_stmt.condition, arena);
+			break;
+		case STMT_FOR_NUM:
+			fold_expr(s->as.for_num.start, arena);
+			fold_expr(s->as.for_num.end, arena);
+			fold_expr(s->as.for_num.step, arena);
+			fold_block(s->as.for_num.body, arena);
+			break;
+		case STMT_FOR_GEN:
+			fold_expr(s->as.for_gen.iter, arena);
+			fold_block(s->as.for_gen.body, arena);
+			break;
+		case STMT_FUNCTION:
+			fold_block(s->as.func_decl.body, arena);
+			break;
+		case STMT_IMPL:
+			for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+				if (s->as.impl_stmt.functions[i]) fold_block(s->as.impl_stmt.functions[i]->as.func_decl.body, arena);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void fold_constants(Stmt *root, MemArena *arena) {
+	fold_stmt(root, arena);
+}
+
+// ==========================================
+// EMITTING
+// ==========================================
+
+// Like the JSON writer, output comes from an explicit stack so chains and
+// nesting don't recurse. A statement's flag says it is the last one of its
+// block, where Lua allows 'return' and 'break'.
+typedef enum { WORK_TEXT, WORK_EXPR, WORK_STMT, WORK_METHOD, WORK_NEWLINE, WORK_INDENT, WORK_DEDENT } WorkKind;
+
+typedef struct {
+	WorkKind kind;
+	bool last;
+	union {
+		const char *text;
+		Expr *expr;
+		Stmt *stmt;
+	} as;
+} Work;
+
+typedef struct {
+	const char *owner;
+	// The method's field in LUA_METHOD_TABLE, or NULL when it is called
+	// through the owner's table.
+	const char *path;
+} MethodName;
+
+typedef struct {
+	Writer *w;
+	ArenaList stack;
+	const CheckResult *checked;
+	MemArena *arena;
+	u32 depth;
+
+	// Struct name -> its STMT_STRUCT.
+	PtrMap structs;
+	// Impl STMT_FUNCTION -> index + 1 into methods.
+	PtrMap method_index;
+	MethodName *methods;
+	Stmt **branches;
+} Emitter;
+
+static void push(Emitter *em, WorkKind kind) {
+	Work work = { kind, false, { .text = NULL } };
+	ARENA_LIST_PUSH(em->stack, Work, work);
+}
+
+static void push_text(Emitter *em, const char *text) {
+	Work work = { WORK_TEXT, false, { .text = text } };
+	ARENA_LIST_PUSH(em->stack, Work, work);
+}
+
+static void push_expr(Emitter *em, Expr *e) {
+	Work work = { WORK_EXPR, false, { .expr = e } };
+	ARENA_LIST_PUSH(em->stack, Work, work);
+}
+
+static void push_stmt(Emitter *em, Stmt *s, bool last) {
+	Work work = { WORK_STMT, last, { .stmt = s } };
+	ARENA_LIST_PUSH(em->stack, Work, work);
+}
+
+// Lua's binding powers, with unary operators at 7 and operands at 10.
+static int binary_prec(BinaryOp op) {
+	switch (op) {
+		case OP_OR:     return 1;
+		case OP_AND:    return 2;
+		case OP_EQ: case OP_NEQ: case OP_LT: case OP_LTE: case OP_GT: case OP_GTE: return 3;
+		case OP_CONCAT: return 4;
+		case OP_ADD: case OP_SUB: return 5;
+		case OP_MUL: case OP_DIV: case OP_MOD: return 6;
+		case OP_POW:    return 8;
+	}
+	return 0;
+}
+
+static int expr_prec(const Expr *e) {
+	if (!e) return 10;
+	if (e->kind == EXPR_BINARY) return binary_prec(e->as.binary.op);
+	if (e->kind == EXPR_UNARY) return 7;
+	if (e->kind == EXPR_NUMBER && signbit(e->as.number)) return 7;
+	return 10;
+}
+
+static bool right_assoc(BinaryOp op) {
+	return op == OP_CONCAT || op == OP_POW;
+}
+
+static void push_operand(Emitter *em, Expr *e, bool parens) {
+	if (parens) push_text(em, ")");
+	push_expr(em, e);
+	if (parens) push_text(em, "(");
+}
+
+// Calls, fields and indexing need a prefix expression on their left.
+static void push_prefix(Emitter *em, Expr *e) {
+	bool plain = e && (e->kind == EXPR_VARIABLE || e->kind == EXPR_CALL || e->kind == EXPR_FIELD || e->kind == EXPR_INDEX);
+	push_operand(em, e, !plain);
+}
+
+static void push_list(Emitter *em, Expr **exprs, int count) {
+	for (int i = count - 1; i >= 0; i--) {
+		push_expr(em, exprs[i]);
+		if (i > 0) push_text(em, ", ");
+	}
+}
+
+static void push_entries(Emitter *em, TableEntry *entries, int count) {
+	for (int i = count - 1; i >= 0; i--) {
+		push_expr(em, entries[i].value);
+		Expr *key = entries[i].key;
+		if (key && key->kind == EXPR_VARIABLE) {
+			push_text(em, " = ");
+			push_text(em, key->as.variable.name);
+		} else if (key) {
+			push_text(em, "] = ");
+			push_expr(em, key);
+			push_text(em, "[");
+		}
+		if (i > 0) push_text(em, ", ");
+	}
+}
+
+// Statements that produce no Lua: type declarations, loops that never run
+// and if chains whose conditions are all constant false.
+static bool is_erased(const Stmt *s) {
+	if (!s || s->kind == STMT_TRAIT || s->kind == STMT_TYPE_ALIAS) return true;
+
+	if (s->kind == STMT_WHILE) {
+		Expr *cond = s->as.while_stmt.condition;
+		return is_literal(cond) && !is_truthy(cond);
+	}
+
+	if (s->kind == STMT_IF) {
+		for (const Stmt *branch = s; branch; branch = branch->as.if_stmt.else_branch) {
+			if (branch->kind != STMT_IF) return false;
+			Expr *cond = branch->as.if_stmt.condition;
+			if (!is_literal(cond) || is_truthy(cond)) return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+// The block's statements one level in, then the closing keyword.
+static void push_body(Emitter *em, Stmt *block, const char *closing) {
+	push_text(em, closing);
+	push(em, WORK_NEWLINE);
+	push(em, WORK_DEDENT);
+
+	if (block && block->kind == STMT_BLOCK) {
+		Stmt **stmts = block->as.block.stmts;
+		int last = block->as.block.stmt_count - 1;
+		while (last >= 0 && is_erased(stmts[last])) last--;
+
+		for (int i = last; i >= 0; i--) {
+			if (is_erased(stmts[i])) continue;
+			push_stmt(em, stmts[i], i == last);
+			push(em, WORK_NEWLINE);
+		}
+	} else if (!is_erased(block)) {
+		push_stmt(em, block, true);
+		push(em, WORK_NEWLINE);
+	}
+
+	push(em, WORK_INDENT);
+}
+
+static void write_params(Emitter *em, const FuncSignature *sig, bool method) {
+	Writer *w = em->w;
+	writer_char(w, '(');
+	if (method) writer_str(w, "self");
+	for (int i = 0; sig && i < sig->param_count; i++) {
+		if (i || method) writer_str(w, ", ");
+		writer_str(w, sig->params[i].name);
+	}
+	writer_char(w, ')');
+}
+
+static MethodName *bound_method(Emitter *em, Expr *callee) {
+	u64 *bound = ptr_map_get(&em->checked->methods, callee);
+	u64 *index = bound ? ptr_map_get(&em->method_index, AS_PTR(Stmt*, *bound)) : NULL;
+	return index ? &em->methods[*index - 1] : NULL;
+}
+
+// Values the checker typed as structs, traits or generics carry their
+// methods in a metatable, so calling one passes self. A struct's own
+// function-valued fields are called plainly.
+static bool is_method_call(Emitter *em, Expr *field) {
+	u64 *value = ptr_map_get(&em->checked->expr_types, field->as.field.target);
+	Type *t = value ? AS_PTR(Type*, *value) : NULL;
+	if (!t || (t->kind != TYPE_STRUCT && t->kind != TYPE_TRAIT && t->kind != TYPE_GENERIC)) return false;
+	if (t->kind != TYPE_STRUCT) return true;
+
+	u64 *decl = ptr_map_get(&em->structs, t->as.user_type.name);
+	Stmt *s = decl ? AS_PTR(Stmt*, *decl) : NULL;
+	for (int i = 0; s && i < s->as.struct_decl.field_count; i++) {
+		if (s->as.struct_decl.fields[i].name == field->as.field.field) return false;
+	}
+	return true;
+}
+
+static void write_number(Writer *w, double n) {
+	if (isnan(n)) writer_str(w, "(0/0)");
+	else if (isinf(n)) writer_str(w, n > 0 ? "math.huge" : "(-math.huge)");
+	else writer_number_exact(w, n);
+}
+
+static void write_call(Emitter *em, Expr *e) {
+	Expr *callee = e->as.call.callee;
+	push_text(em, ")");
+	push_list(em, e->as.call.args, e->as.call.arg_count);
+
+	if (callee && callee->kind == EXPR_FIELD) {
+		MethodName *method = bound_method(em, callee);
+		if (method) {
+			// The object becomes the explicit first argument.
+			if (e->as.call.arg_count) push_text(em, ", ");
+			push_expr(em, callee->as.field.target);
+			push_text(em, "(");
+			if (method->path) {
+				push_text(em, method->path);
+			} else {
+				push_text(em, callee->as.field.field);
+				push_text(em, ".");
+				push_text(em, method->owner);
+			}
+			return;
+		}
+
+		if (is_method_call(em, callee)) {
+			push_text(em, "(");
+			push_text(em, callee->as.field.field);
+			push_text(em, ":");
+			push_prefix(em, callee->as.field.target);
+			return;
+		}
+	}
+
+	push_text(em, "(");
+	push_prefix(em, callee);
+}
+
+static void write_expr(Emitter *em, Expr *e) {
+	Writer *w = em->w;
+	if (!e) {
+		writer_str(w, "nil");
+		return;
+	}
+
+	switch (e->kind) {
+		case EXPR_NIL:      writer_str(w, "nil"); break;
+		case EXPR_BOOL:     writer_str(w, e->as.boolean ? "true" : "false"); break;
+		case EXPR_NUMBER:   write_number(w, e->as.number); break;
+		case EXPR_STRING:   writer_lua_string(w, e->as.string); break;
+		case EXPR_VARARG:   writer_str(w, "..."); break;
+		case EXPR_VARIABLE: writer_str(w, e->as.variable.name); break;
+		case EXPR_BINARY: {
+			static const char *names[] = {
+				[OP_ADD] = " + ", [OP_SUB] = " - ", [OP_MUL] = " * ", [OP_DIV] = " / ",
+				[OP_MOD] = " % ", [OP_POW] = " ^ ", [OP_CONCAT] = " .. ",
+				[OP_EQ] = " == ", [OP_NEQ] = " ~= ", [OP_LT] = " < ", [OP_LTE] = " <= ",
+				[OP_GT] = " > ", [OP_GTE] = " >= ", [OP_AND] = " and ", [OP_OR] = " or ",
+			};
+			BinaryOp op = e->as.binary.op;
+			int prec = binary_prec(op);
+			int left = expr_prec(e->as.binary.left), right = expr_prec(e->as.binary.right);
+
+			push_operand(em, e->as.binary.right, right < prec || (right == prec && !right_assoc(op)));
+			push_text(em, names[op]);
+			push_operand(em, e->as.binary.left, left < prec || (left == prec && right_assoc(op)));
+			break;
+		}
+		case EXPR_UNARY: {
+			Expr *operand = e->as.unary.operand;
+			push_operand(em, operand, expr_prec(operand) < 7);
+			switch (e->as.unary.op) {
+				case OP_NEGATE: {
+					// "--" would start a comment.
+					bool minus = operand && expr_prec(operand) == 7 && (operand->kind != EXPR_UNARY || operand->as.unary.op == OP_NEGATE);
+					writer_str(w, minus ? "- " : "-");
+					break;
+				}
+				case OP_NOT: writer_str(w, "not "); break;
+				case OP_LEN: writer_char(w, '#'); break;
+			}
+			break;
+		}
+		case EXPR_CALL:
+			write_call(em, e);
+			break;
+		case EXPR_INDEX:
+			push_text(em, "]");
+			push_expr(em, e->as.index.index);
+			push_text(em, "[");
+			push_prefix(em, e->as.index.target);
+			break;
+		case EXPR_FIELD:
+			push_text(em, e->as.field.field);
+			push_text(em, ".");
+			push_prefix(em, e->as.field.target);
+			break;
+		case EXPR_FUNCTION:
+			writer_str(w, "function");
+			write_params(em, &e->as.function.signature, false);
+			push_body(em, e->as.function.body, "end");
+			break;
+		case EXPR_TABLE:
+			writer_char(w, '{');
+			push_text(em, "}");
+			push_entries(em, e->as.table.entries, e->as.table.entry_count);
+			break;
+		case EXPR_STRUCT: {
+			Expr *name = e->as.struct_init.name;
+			writer_str(w, "setmetatable({");
+			push_text(em, ")");
+			if (name && name->kind == EXPR_VARIABLE) push_text(em, name->as.variable.name);
+			else push_expr(em, name);
+			push_text(em, "}, ");
+			push_entries(em, e->as.struct_init.entries, e->as.struct_init.entry_count);
+			break;
+		}
+	}
+}
+
+static void write_names(Writer *w, const char **names, int count) {
+	for (int i = 0; i < count; i++) {
+		if (i) writer_str(w, ", ");
+		writer_str(w, names[i]);
+	}
+}
+
+// Constant conditions were folded to literals; branches they rule out are
+// left out and a branch they always take ends the chain as its 'else'.
+static void write_if(Emitter *em, Stmt *s) {
+	u32 base = (u32)vec_size(em->branches);
+	Stmt *otherwise = NULL;
+
+	for (Stmt *branch = s; ; branch = branch->as.if_stmt.else_branch) {
+		Expr *cond = branch->as.if_stmt.condition;
+		Stmt *next = branch->as.if_stmt.else_branch;
+
+		if (is_literal(cond) && is_truthy(cond)) {
+			otherwise = branch->as.if_stmt.then_branch;
+			break;
+		}
+		if (!is_literal(cond)) vec_push(em->branches, branch);
+		if (!next || next->kind != STMT_IF) {
+			otherwise = next;
+			break;
+		}
+	}
+
+	u32 count = (u32)vec_size(em->branches) - base;
+	if (count == 0) {
+		if (otherwise) {
+			writer_str(em->w, "do");
+			push_body(em, otherwise, "end");
+		}
+		return;
+	}
+
+	// Each body closes with the keyword that follows it.
+	if (otherwise) {
+		push_body(em, otherwise, "end");
+		push_text(em, "else");
+	}
+	for (u32 i = count; i-- > 0;) {
+		Stmt *branch = em->branches[base + i];
+		push_body(em, branch->as.if_stmt.then_branch, i + 1 == count && !otherwise ? "end" : "");
+		push_text(em, " then");
+		push_expr(em, branch->as.if_stmt.condition);
+		push_text(em, i ? "elseif " : "if ");
+	}
+	vec_hdr(em->branches)->size = base;
+}
+
+static MethodName *method_name(Emitter *em, Stmt *method) {
+	u64 *index = ptr_map_get(&em->method_index, method);
+	return index ? &em->methods[*index - 1] : NULL;
+}
+
+static void write_method(Emitter *em, Stmt *method) {
+	Writer *w = em->w;
+	MethodName *name = method_name(em, method);
+
+	writer_str(w, "function ");
+	if (name->path) {
+		writer_str(w, name->path);
+	} else {
+		writer_str(w, name->owner);
+		writer_char(w, '.');
+		writer_str(w, method->as.func_decl.name);
+	}
+	write_params(em, method->as.func_decl.signature, true);
+
+	// The metatable still gets the method, for calls the checker couldn't
+	// bind.
+	if (name->path) {
+		push_text(em, name->path);
+		push_text(em, " = ");
+		push_text(em, method->as.func_decl.name);
+		push_text(em, ".");
+		push_text(em, name->owner);
+		push(em, WORK_NEWLINE);
+	}
+	push_body(em, method->as.func_decl.body, "end");
+}
+
+static void write_impl(Emitter *em, Stmt *s) {
+	const char *owner = s->as.impl_stmt.target_name;
+	bool first = true;
+
+	for (int i = s->as.impl_stmt.func_count - 1; i >= 0; i--) {
+		Stmt *method = s->as.impl_stmt.functions[i];
+		if (!method || !method->as.func_decl.name) continue;
+
+		// Impls below the top level are only reached here.
+		if (!method_name(em, method)) {
+			MethodName name = { owner ? owner : "?", NULL };
+			vec_push(em->methods, name);
+			*ptr_map_put(&em->method_index, method) = vec_size(em->methods);
+		}
+
+		if (!first) push(em, WORK_NEWLINE);
+		Work work = { WORK_METHOD, false, { .stmt = method } };
+		ARENA_LIST_PUSH(em->stack, Work, work);
+		first = false;
+	}
+}
+
+static void write_stmt(Emitter *em, Stmt *s, bool last) {
+	Writer *w = em->w;
+
+	switch (s->kind) {
+		case STMT_EXPR:
+			if (s->as.expression && s->as.expression->kind == EXPR_CALL) {
+				push_expr(em, s->as.expression);
+			} else {
+				writer_str(w, "local _ = ");
+				push_expr(em, s->as.expression);
+			}
+			break;
+		case STMT_BLOCK:
+			writer_str(w, "do");
+			push_body(em, s, "end");
+			break;
+		case STMT_RETURN:
+		case STMT_BREAK: {
+			// Lua only takes them as the last statement of a block.
+			if (!last) push_text(em, " end");
+			if (s->kind == STMT_RETURN) {
+				push_list(em, s->as.return_stmt.values, s->as.return_stmt.value_count);
+				if (s->as.return_stmt.value_count) push_text(em, " ");
+			}
+			push_text(em, s->kind == STMT_RETURN ? "return" : "break");
+			if (!last) push_text(em, "do ");
+			break;
+		}
+		case STMT_ASSIGN:
+			push_list(em, s->as.assign.values, s->as.assign.value_count);
+			push_text(em, " = ");
+			push_list(em, s->as.assign.targets, s->as.assign.target_count);
+			break;
+		case STMT_LOCAL:
+			writer_str(w, "local ");
+			for (int i = 0; i < s->as.local.decl_count; i++) {
+				if (i) writer_str(w, ", ");
+				writer_str(w, s->as.local.decls[i].name);
+			}
+			if (s->as.local.value_count) {
+				writer_str(w, " = ");
+				push_list(em, s->as.local.values, s->as.local.value_count);
+			}
+			break;
+		case STMT_IF:
+			write_if(em, s);
+			break;
+		case STMT_WHILE: {
+			Expr *cond = s->as.while_stmt.condition;
+			if (is_literal(cond) && !is_truthy(cond)) break;
+			push_body(em, s->as.while_stmt.body, "end");
+			push_text(em, " do");
+			push_expr(em, cond);
+			writer_str(w, "while ");
+			break;
+		}
+		case STMT_REPEAT:
+			writer_str(w, "repeat");
+			push_expr(em, s->as.repeat_stmt.condition);
+			push_body(em, s->as.repeat_stmt.body, "until ");
+			break;
+		case STMT_FOR_NUM:
+			writer_str(w, "for ");
+			writer_str(w, s->as.for_num.name);
+			writer_str(w, " = ");
+			push_body(em, s->as.for_num.body, "end");
+			push_text(em, " do");
+			if (s->as.for_num.step) {
+				push_expr(em, s->as.for_num.step);
+				push_text(em, ", ");
+			}
+			push_expr(em, s->as.for_num.end);
+			push_text(em, ", ");
+			push_expr(em, s->as.for_num.start);
+			break;
+		case STMT_FOR_GEN:
+			writer_str(w, "for ");
+			write_names(w, s->as.for_gen.names, s->as.for_gen.name_count);
+			writer_str(w, " in ");
+			push_body(em, s->as.for_gen.body, "end");
+			push_text(em, " do");
+			push_expr(em, s->as.for_gen.iter);
+			break;
+		case STMT_FUNCTION:
+			writer_str(w, "function ");
+			writer_str(w, s->as.func_decl.name);
+			write_params(em, s->as.func_decl.signature, false);
+			push_body(em, s->as.func_decl.body, "end");
+			break;
+		case STMT_STRUCT: {
+			const char *name = s->as.struct_decl.name;
+			writer_str(w, "local ");
+			writer_str(w, name);
+			writer_str(w, " = {}");
+			push_text(em, name);
+			push_text(em, ".__index = ");
+			push_text(em, name);
+			push(em, WORK_NEWLINE);
+			break;
+		}
+		case STMT_IMPL:
+			write_impl(em, s);
+			break;
+		case STMT_TRAIT:
+		case STMT_TYPE_ALIAS:
+			break;
+	}
+}
+
+// Names every top-level impl method and gives it a field in the table.
+static void collect_methods(Emitter *em, Stmt *root) {
+	if (!root || root->kind != STMT_BLOCK) return;
+
+	for (int i = 0; i < root->as.block.stmt_count; i++) {
+		Stmt *s = root->as.block.stmts[i];
+		if (s && s->kind == STMT_STRUCT && s->as.struct_decl.name) *ptr_map_put(&em->structs, s->as.struct_decl.name) = (u64)(uintptr_t)s;
+	}
+
+	for (int i = 0; i < root->as.block.stmt_count; i++) {
+		Stmt *s = root->as.block.stmts[i];
+		if (!s || s->kind != STMT_IMPL) continue;
+
+		const char *owner = s->as.impl_stmt.target_name;
+		if (!owner) continue;
+
+		for (int j = 0; j < s->as.impl_stmt.func_count; j++) {
+			Stmt *method = s->as.impl_stmt.functions[j];
+			if (!method || !method->as.func_decl.name) continue;
+
+			u64 t = strlen(LUA_METHOD_TABLE), a = strlen(owner), b = strlen(method->as.func_decl.name);
+			char *path = arena_push(em->arena, t + a + b + 4, true);
+			memcpy(path, LUA_METHOD_TABLE ".", t + 1);
+			memcpy(path + t + 1, owner, a);
+			memcpy(path + t + 1 + a, "__", 2);
+			memcpy(path + t + 3 + a, method->as.func_decl.name, b + 1);
+
+			MethodName name = { owner, path };
+
+			vec_push(em->methods, name);
+			*ptr_map_put(&em->method_index, method) = vec_size(em->methods);
+		}
+	}
+}
+
+void write_lua(Writer *w, Stmt *root, const CheckResult *checked) {
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+
+	Emitter em = {0};
+	em.w = w;
+	em.checked = checked;
+	em.arena = scratch;
+	em.structs = ptr_map_create(scratch, 0);
+	em.method_index = ptr_map_create(scratch, 0);
+	collect_methods(&em, root);
+
+	// Declared up front so every function body sees it as an upvalue.
+	if (vec_size(em.methods)) writer_str(w, "local " LUA_METHOD_TABLE " = {}\n");
+
+	em.stack = arena_list_begin(scratch, sizeof(Work));
+	if (root && root->kind == STMT_BLOCK) {
+		Stmt **stmts = root->as.block.stmts;
+		int last = root->as.block.stmt_count - 1;
+		while (last >= 0 && is_erased(stmts[last])) last--;
+
+		for (int i = last; i >= 0; i--) {
+			if (is_erased(stmts[i])) continue;
+			push(&em, WORK_NEWLINE);
+			push_stmt(&em, stmts[i], i == last);
+		}
+	}
+
+	while (em.stack.count) {
+		Work work = ARENA_LIST_POP(em.stack, Work);
+		switch (work.kind) {
+			case WORK_TEXT:    writer_str(w, work.as.text); break;
+			case WORK_EXPR:    write_expr(&em, work.as.expr); break;
+			case WORK_STMT:    write_stmt(&em, work.as.stmt, work.last); break;
+			case WORK_METHOD:  write_method(&em, work.as.stmt); break;
+			case WORK_INDENT:  em.depth++; break;
+			case WORK_DEDENT:  em.depth--; break;
+			case WORK_NEWLINE:
+				writer_char(w, '\n');
+				writer_pad(w, '\t', em.depth);
+				break;
+		}
+	}
+
+	arena_list_end(&em.stack);
+	vec_free(em.methods);
+	vec_free(em.branches);
+	arena_pop_to(scratch, mark);
+}
+
+void fprint_lua(FILE *f, Stmt *root, const CheckResult *checked) {
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+	Writer w;
+	writer_init(&w, f, scratch, WRITER_DEFAULT_CAPACITY);
+
+	write_lua(&w, root, checked);
+
+	writer_flush(&w);
+	arena_pop_to(scratch, mark);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdio.h>
+
+#include "arena.h"
+#include "checker.h"
+#include "parser.h"
+#include "writer.h"
+
+// Plain Lua for LuaJIT from a checked tree. Types are erased, structs
+// become metatables and impl methods functions on them. Method calls the
+// checker bound to an impl call the method's function directly instead of
+// going through the metatable; if conditions and while conditions that
+// are constant drop their dead branches.
+
+// Rewrites operators over literals into the literal they evaluate to, as
+// Lua would at run time. Runs on the tree in place, so it goes last:
+// expression types and method bindings stay attached to the nodes they
+// were computed for. Folded strings are allocated in the arena.
+void fold_constants(Stmt *root, MemArena *arena);
+
+void write_lua(Writer *w, Stmt *root, const CheckResult *checked);
+void fprint_lua(FILE *f, Stmt *root, const CheckResult *checked);
@@ -0,0 +1,87 @@
+#include "luat.h"
+#include "arena.h"
+#include "document.h"
+#include "lexer.h"
+#include "parser.h"
+#include "string_pool.h"
+
+#define LUAT_ARENA_RESERVE GiB(4)
+#define LUAT_SLOTS_RESERVE GiB(1)
+#define LUAT_DOCUMENT_RESERVE GiB(4)
+
+struct LuatDocument {
+	MemArena *arena;
+	StringPool pool;
+	Document doc;
+};
+
+// The pool's slot table regrows in an arena of its own, which outlives the
+// per-parse arena the trees go into. The context itself lives there too.
+LuatContext *luat_context_create(bool keep_strings) {
+	MemArena *slots = arena_create_reserve(LUAT_SLOTS_RESERVE);
+	if (!slots) return NULL;
+
+	MemArena *arena = arena_create_reserve(LUAT_ARENA_RESERVE);
+	if (!arena) {
+		arena_destroy(slots);
+		return NULL;
+	}
+
+	LuatContext *ctx = PUSH_STRUCT(slots, LuatContext);
+	ctx->arena = arena;
+	ctx->pool = pool_create(slots, KiB(1));
+	ctx->keep_strings = keep_strings;
+	return ctx;
+}
+
+void luat_context_destroy(LuatContext *ctx) {
+	MemArena *slots = ctx->pool.arena;
+	pool_destroy(&ctx->pool);
+	arena_destroy(ctx->arena);
+	arena_destroy(slots);
+}
+
+ParseResult luat_parse(LuatContext *ctx, const char *source, u64 length) {
+	arena_clear(ctx->arena);
+	if (!ctx->keep_strings) pool_clear(&ctx->pool);
+
+	Scanner scanner;
+	scanner_init(&scanner, source, length, &ctx->pool);
+	return parse_stream(&scanner, ctx->arena);
+}
+
+// Nothing a document parses is ever cleared, so its pool can share the
+// arena with the trees.
+LuatDocument *luat_document_open(const char *text, u64 length) {
+	MemArena *arena = arena_create_reserve(LUAT_DOCUMENT_RESERVE);
+	if (!arena) return NULL;
+
+	LuatDocument *doc = PUSH_STRUCT(arena, LuatDocument);
+	doc->arena = arena;
+	doc->pool = pool_create(arena, KiB(1));
+	document_open(&doc->doc, text, length, &doc->pool, arena);
+	return doc;
+}
+
+void luat_document_close(LuatDocument *doc) {
+	MemArena *arena = doc->arena;
+	document_close(&doc->doc);
+	pool_destroy(&doc->pool);
+	arena_destroy(arena);
+}
+
+void luat_document_edit(LuatDocument *doc, u32 offset, u32 removed, const char *inserted, u32 inserted_length) {
+	document_edit(&doc->doc, offset, removed, inserted, inserted_length);
+}
+
+ParseResult luat_document_result(LuatDocument *doc) {
+	ParseResult result = {0};
+	result.root = document_root(&doc->doc);
+	result.success = document_success(&doc->doc);
+	result.types = doc->doc.types;
+
+	result.diagnostic_count = document_diagnostics(&doc->doc, NULL, 0);
+	result.diagnostics = PUSH_ARRAY(doc->arena, Diagnostic, result.diagnostic_count);
+	document_diagnostics(&doc->doc, result.diagnostics, result.diagnostic_count);
+	return result;
+}
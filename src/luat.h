@@ -0,0 +1,50 @@
+#pragma once
+#include <stdbool.h>
+
+#include "arena.h"
+#include "parser.h"
+#include "string_pool.h"
+#include "typedefs.h"
+
+// Entry point for embedding the front end in a long-running process. A
+// context owns the arena trees are parsed into and the pool their strings
+// are interned in. Each parse hands back what the previous one used, so
+// once a stream of inputs has committed the memory its largest member
+// needs, parsing stops calling malloc or mmap altogether.
+//
+// A context is used by one thread at a time.
+typedef struct {
+	MemArena *arena;
+	StringPool pool;
+
+	// Interned strings carry over between parses instead of being cleared,
+	// so text seen before is a hit. Pool memory then grows with the number
+	// of distinct strings ever seen rather than the largest single input.
+	bool keep_strings;
+} LuatContext;
+
+LuatContext *luat_context_create(bool keep_strings);
+void luat_context_destroy(LuatContext *ctx);
+
+// The source does not need to be NUL-terminated. The result's tree, types
+// and diagnostics stay valid until the next parse on ctx or until ctx is
+// destroyed; with keep_strings pool text stays valid for the context's life.
+ParseResult luat_parse(LuatContext *ctx, const char *source, u64 length);
+
+// An editable source kept parsed between edits, for editors and language
+// servers: an edit relexes and reparses only the statements around it and
+// reuses the trees of all others. A document has an arena and a pool of its
+// own, independent of any context.
+typedef struct LuatDocument LuatDocument;
+
+LuatDocument *luat_document_open(const char *text, u64 length);
+void luat_document_close(LuatDocument *doc);
+
+// Replaces [offset, offset + removed) with the inserted bytes.
+void luat_document_edit(LuatDocument *doc, u32 offset, u32 removed, const char *inserted, u32 inserted_length);
+
+// The tree as of the last edit, with diagnostics as a full parse of the
+// current text would report them. Span lookups are not available. Results
+// stay valid until the document is closed, so earlier ones remain usable
+// while it is edited further.
+ParseResult luat_document_result(LuatDocument *doc);
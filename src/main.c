@@ -1,78 +1,464 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "arena.h"
+#include "ast_cache.h"
+#include "ast_compact.h"
+#include "ast_json.h"
+#include "checker.h"
+#include "compiler.h"
 #include "debug.h"
 #include "lexer.h"
+#include "lua_emit.h"
 #include "parser.h"
+#include "resolver.h"
+#include "source.h"
+#include "stats.h"
 #include "string_pool.h"
+#include "type_table.h"
 #include "vec.h"
+#include "vm.h"
+#include "watch.h"
 
-char *read_file(MemArena *arena, const char *path) {
-	FILE *f = fopen(path, "rb");
+#define WORKER_ARENA_RESERVE GiB(4)
+#define MAX_JOBS 256
 
-	if (!f) {
-		fprintf(stderr, "Error: Could not open file: '%s'\n", path);
-		return NULL;
+typedef struct {
+	const char *path;
+	Stmt *root;
+	bool success;
+} FileResult;
+
+typedef struct {
+	FileResult *files;
+	u32 file_count;
+	u32 next;
+
+	SharedStringPool *pool;
+	const char *cache_dir;
+
+	// Only filled in with --stats; workers add their own totals atomically.
+	bool stats;
+	u64 phase_ns[PHASE_COUNT];
+	u64 token_kinds[STATS_MAX_KINDS];
+	u64 bytes;
+} Batch;
+
+typedef struct {
+	Batch *batch;
+	MemArena *arena;
+	pthread_t thread;
+} Worker;
+
+static void count_token_kinds(const TokenList *tokens, u64 *counts) {
+	for (u32 i = 0; i < tokens->count; i++) counts[tokens->kinds[i]]++;
+}
+
+static void add_phase(Batch *batch, Phase phase, double seconds) {
+	__atomic_fetch_add(&batch->phase_ns[phase], (u64)(seconds * 1e9), __ATOMIC_RELAXED);
+}
+
+// With --stats a file is lexed into a token list first, so lexing and
+// parsing can be timed apart; otherwise the parser pulls tokens directly.
+static ParseResult parse_source(SourceFile *source, StringPool *pool, MemArena *arena, Batch *batch, u64 *token_kinds) {
+	if (!batch->stats) {
+		Scanner scanner;
+		scanner_init(&scanner, source->data, source->length, pool);
+		return parse_stream(&scanner, arena);
 	}
 
-	fseek(f, 0, SEEK_END);
-	long length = ftell(f);
-	fseek(f, 0, SEEK_SET);
+	double start = stats_now();
+	TokenList tokens = tokenize(source->data, source->length, pool);
+	double lexed = stats_now();
+	ParseResult result = parse(&tokens, pool, arena);
+	add_phase(batch, PHASE_LEX, lexed - start);
+	add_phase(batch, PHASE_PARSE, stats_now() - lexed);
+
+	count_token_kinds(&tokens, token_kinds);
+	token_list_free(&tokens);
+	return result;
+}
+
+// Files are handed out one at a time so a single huge input doesn't leave
+// the other workers idle. ASTs stay in the worker's arena until exit.
+static void *worker_main(void *arg) {
+	Worker *worker = arg;
+	Batch *batch = worker->batch;
+	StringPool pool = pool_create_view(batch->pool, worker->arena, KiB(1));
+	u64 token_kinds[STATS_MAX_KINDS] = {0};
+
+	while (true) {
+		u32 index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+		if (index >= batch->file_count) break;
+
+		FileResult *file = &batch->files[index];
+
+		double start = stats_now();
+		SourceFile source;
+		if (!source_open(&source, worker->arena, file->path)) continue;
+		add_phase(batch, PHASE_READ, stats_now() - start);
+		__atomic_fetch_add(&batch->bytes, source.length, __ATOMIC_RELAXED);
+
+		u64 key = 0;
+		if (batch->cache_dir) {
+			key = ast_cache_key(source.data, source.length);
+			TypeTable *types = type_table_create(worker->arena, 0);
+			file->root = ast_cache_load(batch->cache_dir, key, source.length, &pool, types, worker->arena, NULL);
+			file->success = file->root != NULL;
+		}
+
+		if (!file->root) {
+			ParseResult result = parse_source(&source, &pool, worker->arena, batch, token_kinds);
+
+			file->root = result.root;
+			file->success = result.success;
+			fprint_diagnostics(stderr, file->path, &result);
+
+			if (result.success && batch->cache_dir) {
+				ast_cache_store(batch->cache_dir, key, source.length, result.root, &pool, &result.spans);
+			}
+		}
 
-	if (length < 0) {
-		fclose(f);
-		return NULL;
+		source_close(&source);
 	}
 
-	char *buffer = (char*)arena_push(arena, length+1, false);
+	if (batch->stats) {
+		for (u32 i = 0; i < STATS_MAX_KINDS; i++) {
+			__atomic_fetch_add(&batch->token_kinds[i], token_kinds[i], __ATOMIC_RELAXED);
+		}
+	}
+
+	pool_destroy(&pool);
+	return NULL;
+}
+
+static int run_batch(const char **paths, u32 count, u32 jobs, const char *cache_dir, bool stats) {
+	if (jobs > count) jobs = count;
+
+	Batch batch = {0};
+	batch.cache_dir = cache_dir;
+	batch.stats = stats;
+	batch.files = calloc(count, sizeof(FileResult));
+	batch.file_count = count;
+	batch.pool = shared_pool_create(KiB(4));
+
+	Worker *workers = calloc(jobs, sizeof(Worker));
+	if (!batch.files || !batch.pool || !workers) {
+		fprintf(stderr, "Error: could not allocate batch state.\n");
+		return 1;
+	}
+
+	for (u32 i = 0; i < count; i++) batch.files[i].path = paths[i];
+
+	u32 started = 0;
+	for (; started < jobs; started++) {
+		Worker *worker = &workers[started];
+		worker->batch = &batch;
+		worker->arena = arena_create_reserve(WORKER_ARENA_RESERVE);
+		if (!worker->arena) break;
+		if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+			arena_destroy(worker->arena);
+			worker->arena = NULL;
+			break;
+		}
+	}
+
+	// With no threads at all the main thread does the work itself.
+	if (started == 0) {
+		Worker *worker = &workers[0];
+		worker->batch = &batch;
+		worker->arena = arena_create_reserve(WORKER_ARENA_RESERVE);
+		if (!worker->arena) {
+			fprintf(stderr, "Error: could not reserve arena memory.\n");
+			return 1;
+		}
+		worker_main(worker);
+	}
+
+	for (u32 i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+
+	int failed = 0;
+	for (u32 i = 0; i < count; i++) failed += !batch.files[i].success;
+
+	// Phase times are summed over workers, so they can exceed wall time.
+	if (stats) {
+		StatsReport report = {0};
+		report.bytes = batch.bytes;
+		report.files = count;
+		report.token_kinds = batch.token_kinds;
+		for (u32 i = 0; i < PHASE_COUNT; i++) report.phase_seconds[i] = (double)batch.phase_ns[i] * 1e-9;
+
+		ArenaUsage workers_usage = { "workers", 0, 0 };
+		for (u32 i = 0; i < jobs; i++) {
+			if (!workers[i].arena) continue;
+			workers_usage.high_water += arena_high_water(workers[i].arena);
+			workers_usage.committed += arena_committed(workers[i].arena);
+		}
+		report.arenas[report.arena_count++] = workers_usage;
+		report.arenas[report.arena_count++] = (ArenaUsage){ "strings",
+			arena_high_water(batch.pool->pool.strings), arena_committed(batch.pool->pool.strings) };
+		report.arenas[report.arena_count++] = (ArenaUsage){ "shared_slots",
+			arena_high_water(batch.pool->pool.arena), arena_committed(batch.pool->pool.arena) };
+		stats_fprint_json(stdout, &report);
+	}
 
-	size_t read_count = fread(buffer, 1, length, f);
-	if (read_count != (size_t)length) {
-		fprintf(stderr, "Error: could not read entire file: '%s'\n", path);
-		fclose(f);
-		return NULL;
+	for (u32 i = 0; i < jobs; i++) {
+		if (workers[i].arena) arena_destroy(workers[i].arena);
 	}
+	shared_pool_destroy(batch.pool);
+	free(workers);
+	free(batch.files);
 
-	buffer[length] = '\0';
-	fclose(f);
-	return buffer;
+	return failed ? 1 : 0;
 }
 
 int main(int argc, char **argv) {
-	if (argc < 2) {
-		printf("Usage: %s <file.luat>\n", argv[0]);
+	const char **paths = calloc(argc, sizeof(const char*));
+	u32 path_count = 0;
+	u32 jobs = 0;
+	bool compact_ast = false;
+	bool type_check = false;
+	bool run_program = false;
+	bool stats = false;
+	bool dump_tokens = false;
+	bool dump_ast = false;
+	bool watch = false;
+	const char *json_path = NULL;
+	const char *lua_path = NULL;
+	const char *cache_dir = NULL;
+	const char *socket_path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--compact-ast") == 0) compact_ast = true;
+		else if (strcmp(argv[i], "--stats") == 0) stats = true;
+		else if (strcmp(argv[i], "--check") == 0) type_check = true;
+		else if (strcmp(argv[i], "--run") == 0) run_program = type_check = true;
+		else if (strcmp(argv[i], "--dump-tokens") == 0) dump_tokens = true;
+		else if (strcmp(argv[i], "--dump-ast") == 0) dump_ast = true;
+		else if (strcmp(argv[i], "--dump-json") == 0 && i + 1 < argc) json_path = argv[++i];
+		else if (strcmp(argv[i], "--emit-lua") == 0 && i + 1 < argc) { lua_path = argv[++i]; type_check = true; }
+		else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) parser_set_max_depth((u32)atoi(argv[++i]));
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) cache_dir = argv[++i];
+		else if (strcmp(argv[i], "--watch") == 0) watch = true;
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) { socket_path = argv[++i]; watch = true; }
+		else if (strncmp(argv[i], "-j", 2) == 0 && strcmp(argv[i], "-") != 0) {
+			const char *value = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+			jobs = (u32)atoi(value);
+			if (jobs == 0 || jobs > MAX_JOBS) {
+				fprintf(stderr, "Error: -j expects a job count between 1 and %d.\n", MAX_JOBS);
+				free(paths);
+				return 1;
+			}
+		}
+		else paths[path_count++] = argv[i];
+	}
+
+	if (path_count == 0) {
+		printf("Usage: %s [--dump-tokens] [--dump-ast] [--dump-json FILE|-] [--emit-lua FILE|-] [--compact-ast] [--check] [--run] [--stats] [--max-depth N] [--cache DIR] [-j N] <file.luat>\n", argv[0]);
+		printf("       %s [--stats] [--max-depth N] [--cache DIR] [-j N] <file.luat>...\n", argv[0]);
+		printf("       %s --watch|--serve SOCKET [--check] [--max-depth N] <file.luat>...\n", argv[0]);
+		free(paths);
 		return 1;
 	}
 
-	MemArena *perm_arena = arena_create(MiB(1));
-	StringPool pool = pool_create(perm_arena, KiB(50));
+	if (watch) {
+		int status = watch_run(paths, path_count, socket_path, type_check);
+		free(paths);
+		return status;
+	}
+
+	// Several files only check that they parse; the dumps are for looking
+	// at a single file, which -j then lexes in parallel chunks.
+	if (path_count > 1) {
+		int status = run_batch(paths, path_count, jobs ? jobs : 1, cache_dir, stats);
+		free(paths);
+		return status;
+	}
 
-	char *source = read_file(perm_arena, argv[1]);
-	if (!source) return 1;
+	const char *path = paths[0];
+	free(paths);
 
-	Token *tokens = tokenize(source, &pool);
-	ParseResult parse_result = parse(tokens, perm_arena);
+	MemArena *perm_arena = arena_create_reserve(GiB(8));
+	if (!perm_arena) {
+		fprintf(stderr, "Error: could not reserve arena memory.\n");
+		return 1;
+	}
+
+	SharedStringPool *shared = jobs > 1 ? shared_pool_create(KiB(1)) : NULL;
+	StringPool pool = shared ? pool_create_view(shared, perm_arena, KiB(1)) : pool_create(perm_arena, KiB(1));
+
+	StatsReport report = {0};
+	report.files = 1;
+	int status = 0;
+
+	double phase_start = stats_now();
+	SourceFile source;
+	if (!source_open(&source, perm_arena, path)) {
+		pool_destroy(&pool);
+		if (shared) shared_pool_destroy(shared);
+		arena_destroy(perm_arena);
+		return 1;
+	}
+	report.bytes = source.length;
+	report.phase_seconds[PHASE_READ] = stats_now() - phase_start;
+
+	u64 ast_mark = perm_arena->pos;
+
+	ParseResult parse_result = {0};
+	u64 cache_key = 0;
+	if (cache_dir) {
+		cache_key = ast_cache_key(source.data, source.length);
+		parse_result.types = type_table_create(perm_arena, 0);
+		parse_result.spans.source = source.data;
+		parse_result.spans.source_length = source.length;
+		parse_result.root = ast_cache_load(cache_dir, cache_key, source.length, &pool, parse_result.types, perm_arena, &parse_result.spans);
+		parse_result.success = parse_result.root != NULL;
+	}
+
+	TokenList tokens = {0};
+	if (parse_result.root) {
+		report.cache_hit = true;
+		report.phase_seconds[PHASE_PARSE] = stats_now() - phase_start - report.phase_seconds[PHASE_READ];
+	} else {
+		// --stats lexes up front so the two phases can be timed apart.
+		if (shared || stats) {
+			phase_start = stats_now();
+			if (shared) tokens = tokenize_parallel(source.data, source.length, shared, jobs);
+			else tokens = tokenize(source.data, source.length, &pool);
+			report.phase_seconds[PHASE_LEX] = stats_now() - phase_start;
+
+			phase_start = stats_now();
+			parse_result = parse(&tokens, &pool, perm_arena);
+			report.phase_seconds[PHASE_PARSE] = stats_now() - phase_start;
+		} else {
+			Scanner scanner;
+			scanner_init(&scanner, source.data, source.length, &pool);
+			parse_result = parse_stream(&scanner, perm_arena);
+		}
+
+		if (parse_result.success && cache_dir) {
+			ast_cache_store(cache_dir, cache_key, source.length, parse_result.root, &pool, &parse_result.spans);
+		}
+	}
 
 	if (parse_result.success) {
 		Stmt *root = parse_result.root;
 
-		FILE *token_dump = fopen("token_dump.txt", "w");
+		// Only reports what the tree would take in compact form; every pass
+		// still works on the pointer tree.
+		if (compact_ast) {
+			u64 tree_bytes = perm_arena->pos - ast_mark;
+			CompactAst ast = compact_ast_build(root, &pool, &parse_result.spans);
+			fprintf(stderr, "AST: %llu bytes as pointer tree, %llu bytes compact (%u nodes)\n",
+				(unsigned long long)tree_bytes, (unsigned long long)compact_ast_bytes(&ast),
+				(unsigned)vec_size(ast.tags));
+			compact_ast_free(&ast);
+		}
+
+		phase_start = stats_now();
+		Resolution resolution = resolve(root, &pool, perm_arena);
+		report.phase_seconds[PHASE_RESOLVE] = stats_now() - phase_start;
+
+		CheckResult checked = {0};
+		if (type_check) {
+			phase_start = stats_now();
+			checked = check(root, &resolution, parse_result.types, &parse_result.spans, &pool, perm_arena);
+			report.phase_seconds[PHASE_CHECK] = stats_now() - phase_start;
+
+			fprint_diagnostic_list(stderr, NULL, checked.diagnostics, checked.diagnostic_count);
+			if (!checked.success) status = 1;
+
+			// Only checked programs run: the compiler relies on the types.
+			if (run_program && checked.success) {
+				phase_start = stats_now();
+				CompileResult compiled = compile(root, &resolution, &checked, perm_arena);
+				report.phase_seconds[PHASE_COMPILE] = stats_now() - phase_start;
+
+				fprint_diagnostic_list(stderr, NULL, compiled.diagnostics, compiled.diagnostic_count);
+				if (!compiled.success) status = 1;
+
+				if (compiled.success) {
+					phase_start = stats_now();
+					const char *error = NULL;
+					if (!vm_run(compiled.program, perm_arena, &error)) {
+						fprintf(stderr, "Runtime error in %s\n", error);
+						status = 1;
+					}
+					report.phase_seconds[PHASE_RUN] = stats_now() - phase_start;
+				}
+			}
+		}
+
+		phase_start = stats_now();
+		FILE *token_dump = dump_tokens ? fopen("token_dump.txt", "w") : NULL;
 		if (token_dump) {
-			fprint_tokens(token_dump, tokens);
+			if (!tokens.count) tokens = tokenize(source.data, source.length, &pool);
+			fprint_tokens(token_dump, &tokens, &pool);
 			fclose(token_dump);
 		}
-		FILE *ast_dump = fopen("ast_dump.txt", "w");
+		FILE *ast_dump = dump_ast ? fopen("ast_dump.txt", "w") : NULL;
 		if (ast_dump) {
 			fprint_ast(ast_dump, root);
 			fclose(ast_dump);
 		}
+		if (json_path) {
+			bool to_stdout = strcmp(json_path, "-") == 0;
+			FILE *json = to_stdout ? stdout : fopen(json_path, "w");
+			if (json) {
+				fprint_ast_json(json, root);
+				if (!to_stdout) fclose(json);
+			} else {
+				fprintf(stderr, "Error: could not open '%s' for writing.\n", json_path);
+			}
+		}
+		// Folding rewrites the tree, so this comes after everything else
+		// that reads it.
+		if (lua_path && checked.success) {
+			fold_constants(root, perm_arena);
+			bool to_stdout = strcmp(lua_path, "-") == 0;
+			FILE *lua = to_stdout ? stdout : fopen(lua_path, "w");
+			if (lua) {
+				fprint_lua(lua, root, &checked);
+				if (!to_stdout) fclose(lua);
+			} else {
+				fprintf(stderr, "Error: could not open '%s' for writing.\n", lua_path);
+				status = 1;
+			}
+		}
+		report.phase_seconds[PHASE_DUMP] = stats_now() - phase_start;
 	} else {
+		fprint_diagnostics(stderr, NULL, &parse_result);
 		printf("Parser Error.\n");
+		status = 1;
 	}
 
+	if (stats) {
+		u64 token_kinds[STATS_MAX_KINDS] = {0};
+		if (tokens.count) {
+			count_token_kinds(&tokens, token_kinds);
+			report.token_kinds = token_kinds;
+		}
+
+		report.arenas[report.arena_count++] = (ArenaUsage){ "perm",
+			arena_high_water(perm_arena), arena_committed(perm_arena) };
+		report.arenas[report.arena_count++] = (ArenaUsage){ "strings",
+			arena_high_water(pool.strings), arena_committed(pool.strings) };
+		report.arenas[report.arena_count++] = (ArenaUsage){ "scratch",
+			arena_high_water(arena_scratch()), arena_committed(arena_scratch()) };
+		if (shared) {
+			report.arenas[report.arena_count++] = (ArenaUsage){ "shared_slots",
+				arena_high_water(shared->pool.arena), arena_committed(shared->pool.arena) };
+		}
+		stats_fprint_json(stdout, &report);
+	}
 
-	vec_free(tokens);
+	token_list_free(&tokens);
+	source_close(&source);
+	pool_destroy(&pool);
+	if (shared) shared_pool_destroy(shared);
 
 	arena_destroy(perm_arena);
-	return 0;
+	return status;
 }
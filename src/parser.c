@@ -4,34 +4,164 @@
 #include <string.h>
 
 #include "debug.h"
+#include "lexer.h"
 #include "parser.h"
 #include "arena.h"
+#include "source.h"
+#include "stats.h"
 #include "token.h"
-#include "vec.h"
+#include "type_table.h"
+
+#define PARSER_LOOKAHEAD 4
+#define PARSER_RING_MASK (PARSER_LOOKAHEAD - 1)
+#define SPAN_CHUNK 1024
+
+// Keys are a node's distance from the start of the arena in words, which
+// lets a u32 cover the largest arena the parser is ever given.
+struct SpanChunk {
+	SpanChunk *prev;
+	u32 count;
+	u32 keys[SPAN_CHUNK];
+	u32 offsets[SPAN_CHUNK];
+};
 
+// Tokens are read through a small ring, filled either from a Scanner or from
+// a materialized token vector, so the parser only ever holds the current
+// token and the one before it.
 typedef struct {
-	Token *tokens;
+	Scanner *scanner;
+	const TokenList *tokens;
+	u32 next;
+
+	Token ring[PARSER_LOOKAHEAD];
 	int current;
-	int count;
+
+	const char *source;
+	u64 source_length;
+	StringPool *pool;
+	TypeTable *types;
+	LineIndex lines;
 
 	MemArena *arena;
 
+	Diagnostic *diagnostics;
+	u32 diagnostic_count;
+
+	SpanBuilder spans;
+
+	// Offset of the first token of the innermost statement being parsed.
+	// Statement nodes are mostly built once their last token is read, so
+	// this is where they take their span from.
+	u32 stmt_start;
+
+	// Set on the first error of a statement and cleared once parsing has
+	// resynchronized at the next statement boundary; errors in between are
+	// almost always fallout of the first one.
 	bool panic_mode;
 	bool had_error;
+
+	// Past the error cap the token source reports EOF, so everything above
+	// unwinds without producing more diagnostics.
+	u32 max_errors;
+	bool halted;
+
+	// Expressions, statements and types currently being parsed inside one
+	// another; bounded by max_depth so deep input can't exhaust the stack.
+	u32 depth;
 } Parser;
 
-static void error_at(Parser *p, Token t, const char *msg) {
+static u32 max_depth = PARSER_DEFAULT_MAX_DEPTH;
+
+void parser_set_max_depth(u32 depth) {
+	max_depth = depth ? depth : PARSER_DEFAULT_MAX_DEPTH;
+}
+
+u32 parser_max_depth(void) {
+	return max_depth;
+}
+
+#define TEXT(t) token_text(p->pool, (t))
+
+// A halted parser still enters panic mode, so loops that rely on recovery
+// to move past a bad token don't spin on the last one read before halting.
+static void report(Parser *p, Token t, const char *lexeme, const char *msg) {
+	if (p->halted) p->panic_mode = true;
 	if (p->panic_mode) return;
 	p->panic_mode = true;
 	p->had_error = true;
-	fprintf(stderr, "[line %d] Error at '%s': %s\n", (int)t.line, t.text, msg);
+
+	if (!p->diagnostics) p->diagnostics = PUSH_ARRAY(p->arena, Diagnostic, PARSER_MAX_ERRORS);
+	if (!p->lines.starts) p->lines = line_index_build(p->arena, p->source, p->source_length);
+
+	Diagnostic *d = &p->diagnostics[p->diagnostic_count++];
+	d->offset = t.offset;
+	line_index_locate(&p->lines, t.offset, &d->line, &d->column);
+	d->lexeme = lexeme;
+	d->message = msg;
+	d->declaration = false;
+
+	if (p->diagnostic_count == p->max_errors) p->halted = true;
+}
+
+// Numbers are the only tokens without text in the pool; an error is rare
+// enough to intern the spelling on the spot.
+static void error_at(Parser *p, Token t, const char *msg) {
+	bool number = t.kind == TOKEN_NUMBER || t.kind == TOKEN_INTEGER;
+	const char *lexeme = number ? pool_intern(p->pool, p->source + t.offset, t.length) : TEXT(t);
+	report(p, t, lexeme, msg);
+}
+
+#define peek(p) ((p)->ring[(p)->current & PARSER_RING_MASK])
+#define previous(p) ((p)->ring[((p)->current-1) & PARSER_RING_MASK])
+
+static Token read_token(Parser *p) {
+	if (p->halted) {
+		Token eof = { TOKEN_EOF, (u32)p->source_length, 0, 0 };
+		return eof;
+	}
+
+	if (p->scanner) return lexer_next(p->scanner);
+	if (p->next < p->tokens->count) return token_list_get(p->tokens, p->next++);
+	return token_list_get(p->tokens, p->tokens->count-1);
+}
+
+// Lexer errors are reported here and never reach the grammar. They don't
+// enter panic mode on their own: the token is simply dropped.
+static Token next_token(Parser *p) {
+	Token t = read_token(p);
+	while (t.kind == TOKEN_ERROR) {
+		bool panic = p->panic_mode;
+		p->panic_mode = false;
+		report(p, t, NULL, TEXT(t));
+		p->panic_mode = panic;
+		t = read_token(p);
+	}
+	return t;
+}
+
+// Nothing sensible can follow a nesting overflow, so it halts the parser
+// like the error cap does and the recursion unwinds at once.
+static bool enter_nested(Parser *p) {
+	if (p->depth < max_depth) {
+		p->depth++;
+		return true;
+	}
+
+	if (!p->halted) {
+		p->panic_mode = false;
+		error_at(p, peek(p), "Nesting too deep.");
+		p->halted = true;
+	}
+	return false;
 }
 
-#define peek(p) ((p)->tokens[(p)->current])
-#define previous(p) ((p)->tokens[(p)->current-1])
+static void leave_nested(Parser *p) {
+	p->depth--;
+}
 
 static Token advance(Parser *p) {
-	if (p->current < p->count) p->current++;
+	p->current++;
+	p->ring[p->current & PARSER_RING_MASK] = next_token(p);
 	return previous(p);
 }
 
@@ -81,12 +211,60 @@ ParseRule rules[];
 static Expr *parse_precedence(Parser *p, Precedence precedence);
 static Expr *parse_expression(Parser *p);
 
-static Expr *new_expr(Parser *p, ExprKind kind) {
+void span_record(SpanBuilder *b, const void *node, u32 offset) {
+	SpanChunk *chunk = b->last;
+	if (!chunk || chunk->count == SPAN_CHUNK) {
+		SpanChunk *next = PUSH_STRUCT_NZ(b->arena, SpanChunk);
+		if (!next) return;
+		next->prev = chunk;
+		next->count = 0;
+		b->last = chunk = next;
+		b->chunk_count++;
+	}
+
+	u32 i = chunk->count++;
+	chunk->keys[i] = (u32)(((const u8*)node - (const u8*)b->arena) / sizeof(void*));
+	chunk->offsets[i] = offset;
+}
+
+SpanTable span_finish(SpanBuilder *b, const char *source, u64 source_length) {
+	SpanTable spans = {0};
+	spans.base = (const u8*)b->arena;
+	spans.source = source;
+	spans.source_length = source_length;
+	spans.chunk_count = b->chunk_count;
+	spans.chunks = PUSH_ARRAY_NZ(b->arena, SpanChunk*, b->chunk_count + 1);
+
+	u32 i = b->chunk_count;
+	for (SpanChunk *chunk = b->last; chunk; chunk = chunk->prev) spans.chunks[--i] = chunk;
+	return spans;
+}
+
+// Called right after the node is allocated, which keeps the keys sorted.
+static void record_span(Parser *p, const void *node, u32 offset) {
+	span_record(&p->spans, node, offset);
+}
+
+static Expr *new_expr_at(Parser *p, ExprKind kind, u32 offset) {
 	Expr *e = PUSH_STRUCT(p->arena, Expr);
 	e->kind = kind;
+	record_span(p, e, offset);
+	STAT_INC(expr_kinds[kind]);
 	return e;
 }
 
+static Expr *new_expr(Parser *p, ExprKind kind) {
+	return new_expr_at(p, kind, previous(p).offset);
+}
+
+static Stmt *new_stmt(Parser *p, StmtKind kind) {
+	Stmt *s = PUSH_STRUCT(p->arena, Stmt);
+	s->kind = kind;
+	record_span(p, s, p->stmt_start);
+	STAT_INC(stmt_kinds[kind]);
+	return s;
+}
+
 static BinaryOp get_binary_op(TokenKind kind) {
 	switch (kind) {
 		case TOKEN_PLUS:    return OP_ADD;
@@ -98,7 +276,7 @@ static BinaryOp get_binary_op(TokenKind kind) {
 		
 		case TOKEN_DOT_DOT: return OP_CONCAT;
 
-		case TOKEN_EQ:      return OP_EQ;
+		case TOKEN_EQ_EQ:   return OP_EQ;
 		case TOKEN_NOT_EQ:  return OP_NEQ;
 		case TOKEN_LT:      return OP_LT;
 		case TOKEN_LTEQ:    return OP_LTE;
@@ -123,13 +301,13 @@ static UnaryOp get_unary_op(TokenKind kind) {
 static Expr *number(Parser *p) {
 	Expr *e = new_expr(p, EXPR_NUMBER);
 	e->kind = EXPR_NUMBER;
-	e->as.number  = strtod(previous(p).text, NULL);
+	e->as.number  = token_number(p->pool, previous(p));
 	return e;
 }
 
 static Expr *string(Parser *p) {
 	Expr *e = new_expr(p, EXPR_STRING);
-	e->as.string = previous(p).text;
+	e->as.string = TEXT(previous(p));
 	return e;
 }
 
@@ -145,7 +323,7 @@ static Expr *literal(Parser *p) {
 
 static Expr *variable(Parser *p) {
 	Expr *e = new_expr(p, EXPR_VARIABLE);
-	e->as.variable = previous(p).text;
+	e->as.variable.name = TEXT(previous(p));
 	return e;
 }
 
@@ -156,27 +334,59 @@ static Expr *grouping(Parser *p) {
 }
 
 static Expr *unary(Parser *p) {
-	TokenKind op_token = previous(p).kind;
+	Token op = previous(p);
+	TokenKind op_token = op.kind;
 	Expr *operand = parse_precedence(p, PREC_UNARY);
 
-	Expr *e = new_expr(p, EXPR_UNARY);
+	Expr *e = new_expr_at(p, EXPR_UNARY, op.offset);
 	e->as.unary.op = get_unary_op(op_token);
 	e->as.unary.operand = operand;
 	return e;
 }
 
+// Right-associative chains (a .. b .. c, a ^ b ^ c) are collected in a loop
+// and folded from the right, so generated code with thousands of operands
+// doesn't recurse once per operand.
+// Each operand is kept with the offset of the operator before it.
+typedef struct {
+	Expr *expr;
+	u32 op_offset;
+} ChainOperand;
+
+static Expr *right_assoc_chain(Parser *p, Expr *left, TokenKind op_token, int operand_prec) {
+	ArenaList operands = ARENA_LIST(ChainOperand);
+	ARENA_LIST_PUSH(operands, ChainOperand, ((ChainOperand){ left, 0 }));
+	do {
+		u32 op_offset = previous(p).offset;
+		Expr *operand = parse_precedence(p, operand_prec);
+		ARENA_LIST_PUSH(operands, ChainOperand, ((ChainOperand){ operand, op_offset }));
+	} while (match(p, op_token));
+
+	Expr *right = ARENA_LIST_AT(operands, ChainOperand, operands.count - 1).expr;
+	for (u64 i = operands.count - 1; i-- > 0;) {
+		Expr *e = new_expr_at(p, EXPR_BINARY, ARENA_LIST_AT(operands, ChainOperand, i + 1).op_offset);
+		e->as.binary.op = get_binary_op(op_token);
+		e->as.binary.left = ARENA_LIST_AT(operands, ChainOperand, i).expr;
+		e->as.binary.right = right;
+		right = e;
+	}
+
+	arena_list_end(&operands);
+	return right;
+}
+
 static Expr *binary(Parser *p, Expr *left) {
-	TokenKind op_token = previous(p).kind;
+	Token op = previous(p);
+	TokenKind op_token = op.kind;
 	ParseRule *rule = prec_rule(op_token);
 
-	int next_prec = rule->precedence;
-	if (op_token != TOKEN_CARET && op_token != TOKEN_DOT_DOT) {
-		next_prec++;
+	if (op_token == TOKEN_CARET || op_token == TOKEN_DOT_DOT) {
+		return right_assoc_chain(p, left, op_token, rule->precedence + 1);
 	}
 
-	Expr *right = parse_precedence(p, next_prec);
+	Expr *right = parse_precedence(p, rule->precedence + 1);
 
-	Expr *e = new_expr(p, EXPR_BINARY);
+	Expr *e = new_expr_at(p, EXPR_BINARY, op.offset);
 	e->as.binary.op = get_binary_op(op_token);
 	e->as.binary.left = left;
 	e->as.binary.right = right;
@@ -188,19 +398,15 @@ static Expr *call(Parser *p, Expr *left) {
 	Expr *e = new_expr(p, EXPR_CALL);
 	e->as.call.callee = left;
 
-	Expr **args = NULL;
+	ArenaList args = ARENA_LIST(Expr*);
 	while (!check(p, TOKEN_RPAREN) && !check(p, TOKEN_EOF)) {
-		vec_push(args, parse_expression(p));
+		ARENA_LIST_PUSH(args, Expr*, parse_expression(p));
 		if (!match(p, TOKEN_COMMA)) break;
 	}
 	consume(p, TOKEN_RPAREN, "Expected ')' after call arguments.");
 
-	e->as.call.arg_count = vec_size(args);
-	if (args) {
-		e->as.call.args = PUSH_ARRAY(p->arena, Expr*, vec_size(args));
-		memcpy(e->as.call.args, args, vec_size(args) * sizeof(Expr*));
-		vec_free(args);
-	} else e->as.call.args = NULL;
+	e->as.call.arg_count = args.count;
+	e->as.call.args = arena_list_finish(&args, p->arena);
 
 	return e;
 }
@@ -220,7 +426,7 @@ static Expr *field(Parser *p, Expr *left) {
 	e->as.field.target = left;
 
 	consume(p, TOKEN_IDENTIFIER, "Expected field name.");
-	e->as.field.field = previous(p).text;
+	e->as.field.field = TEXT(previous(p));
 	return e;
 }
 
@@ -228,24 +434,20 @@ static Expr *struct_init(Parser *p, Expr *left) {
 	Expr *e = new_expr(p, EXPR_STRUCT);
 	e->as.struct_init.name = left;
 
-	TableEntry *entries= NULL;
+	ArenaList entries = ARENA_LIST(TableEntry);
 	while (!check(p, TOKEN_RBRACE) && !check(p, TOKEN_EOF)) {
 
 		Expr *key = parse_expression(p);
 		consume(p, TOKEN_COLON, "Expected ':' after field name.");
 		Expr *value = parse_expression(p);
 		TableEntry entry = { key, value };
-		vec_push(entries, entry);
+		ARENA_LIST_PUSH(entries, TableEntry, entry);
 		if (!match(p, TOKEN_COMMA)) break;
 	}
 	consume(p, TOKEN_RBRACE, "Expected '}' after struct init");
 
-	e->as.struct_init.entry_count = vec_size(entries);
-	if (entries) {
-		e->as.struct_init.entries = PUSH_ARRAY(p->arena, TableEntry, vec_size(entries));
-		memcpy(e->as.struct_init.entries, entries, vec_size(entries) * sizeof(TableEntry));
-		vec_free(entries);
-	} else e->as.struct_init.entries = NULL;
+	e->as.struct_init.entry_count = entries.count;
+	e->as.struct_init.entries = arena_list_finish(&entries, p->arena);
 
 	return e;
 }
@@ -264,6 +466,7 @@ ParseRule rules[] = {
 	[TOKEN_DOT_DOT]   = {NULL,     binary, PREC_CONCAT},
 	
 	[TOKEN_NUMBER]    = {number,   NULL,   PREC_NONE},
+	[TOKEN_INTEGER]   = {number,   NULL,   PREC_NONE},
 	[TOKEN_STRING]    = {string,   NULL,   PREC_NONE},
 	[TOKEN_IDENTIFIER]= {variable, NULL,   PREC_NONE},
 	
@@ -287,22 +490,24 @@ ParseRule rules[] = {
 };
 
 static Expr *parse_precedence(Parser *p, Precedence precedence) {
+	if (!enter_nested(p)) return NULL;
 	advance(p);
 
+	Expr *left = NULL;
 	ParsePrefixFn prefix = prec_rule(previous(p).kind)->prefix;
 	if (prefix == NULL) {
 		error_at(p, previous(p), "Expected expression.");
-		return NULL;
-	}
-
-	Expr *left = prefix(p);
+	} else {
+		left = prefix(p);
 
-	while (precedence <= prec_rule(peek(p).kind)->precedence) {
-		advance(p);
-		ParseInfixFn infix = prec_rule(previous(p).kind)->infix;
-		left = infix(p, left);
+		while (precedence <= prec_rule(peek(p).kind)->precedence) {
+			advance(p);
+			ParseInfixFn infix = prec_rule(previous(p).kind)->infix;
+			left = infix(p, left);
+		}
 	}
 
+	leave_nested(p);
 	return left;
 }
 
@@ -321,49 +526,52 @@ static bool is_block_end(TokenKind kind) {
 
 static FuncSignature *parse_func_signature(Parser *p);
 
-static Type *parse_type(Parser *p) {
-	Type *t = PUSH_STRUCT(p->arena, Type);
+static Type *parse_type(Parser *p);
+
+static Type *type_annotation(Parser *p) {
+	Type key = {0};
 
 	switch(peek(p).kind) {
 		case TOKEN_LBRACK:
 			advance(p);
-			t->kind = TYPE_ARRAY;
-			t->as.array.inner = parse_type(p);
+			key.kind = TYPE_ARRAY;
+			key.as.array.inner = parse_type(p);
 			consume(p, TOKEN_RBRACK, "Expected ']' after array type.");
-			return t;
+			return type_intern(p->types, &key);
 		case TOKEN_FUNCTION:
 			advance(p);
-			t->kind = TYPE_FUNCTION;
-			t->as.function.sig = parse_func_signature(p);
-			return t;
+			key.kind = TYPE_FUNCTION;
+			key.as.function.sig = parse_func_signature(p);
+			return type_intern(p->types, &key);
 		case TOKEN_IDENTIFIER: {
 			advance(p);
-			const char *name = previous(p).text;
+			const char *name = TEXT(previous(p));
 
-			if (strcmp(name, "void") == 0)   { t->kind = TYPE_VOID; return t; }
-			if (strcmp(name, "nil") == 0)    { t->kind = TYPE_NIL; return t; }
-			if (strcmp(name, "bool") == 0)   { t->kind = TYPE_BOOL; return t; }
-			if (strcmp(name, "number") == 0) { t->kind = TYPE_NUMBER; return t; }
-			if (strcmp(name, "string") == 0) { t->kind = TYPE_STRING; return t; }
+			if (strcmp(name, "void") == 0)   key.kind = TYPE_VOID;
+			else if (strcmp(name, "nil") == 0)    key.kind = TYPE_NIL;
+			else if (strcmp(name, "bool") == 0)   key.kind = TYPE_BOOL;
+			else if (strcmp(name, "number") == 0) key.kind = TYPE_NUMBER;
+			else if (strcmp(name, "string") == 0) key.kind = TYPE_STRING;
+			else key.kind = TYPE_STRUCT;
 
-			t->kind = TYPE_STRUCT;
-			t->as.user_type.name = name;
+			if (key.kind != TYPE_STRUCT) return type_intern(p->types, &key);
+			key.as.user_type.name = name;
 
+			// The arguments only need to live until the type is interned,
+			// which copies them if the type is new.
+			ArenaList args = ARENA_LIST(Type*);
 			if (match(p, TOKEN_LT)) {
-				Type **args = NULL;
 				do {
-					vec_push(args, parse_type(p));
+					ARENA_LIST_PUSH(args, Type*, parse_type(p));
 	 			} while (match(p, TOKEN_COMMA));
 				consume(p, TOKEN_GT, "Expected '>' after type arguments.");
 
-				t->as.user_type.arg_count = vec_size(args);
-				if (args) {
-					t->as.user_type.args = PUSH_ARRAY(p->arena, Type*, vec_size(args));
-					memcpy(t->as.user_type.args, args, vec_size(args) * sizeof(Type*));
-					vec_free(args);
-				} else t->as.user_type.args = NULL;
+				key.as.user_type.arg_count = args.count;
+				key.as.user_type.args = (Type**)args.base;
 			}
 
+			Type *t = type_intern(p->types, &key);
+			arena_list_end(&args);
 			return t;
 		}
 		default:
@@ -375,24 +583,27 @@ static Type *parse_type(Parser *p) {
 	return NULL;
 }
 
+static Type *parse_type(Parser *p) {
+	if (!enter_nested(p)) return NULL;
+	Type *t = type_annotation(p);
+	leave_nested(p);
+	return t;
+}
+
 static GenericParam parse_generic(Parser *p) {
 	consume(p, TOKEN_IDENTIFIER, "Expected generic name.");
 	
 	GenericParam gp = {0};
-	gp.name = previous(p).text;
+	gp.name = TEXT(previous(p));
 
 	if (match(p, TOKEN_COLON)) {
-		Type **constraints = NULL;
+		ArenaList constraints = ARENA_LIST(Type*);
 		do {
-			vec_push(constraints, parse_type(p));
+			ARENA_LIST_PUSH(constraints, Type*, parse_type(p));
 	 	} while (match(p, TOKEN_PLUS));
 
-		gp.constraint_count = vec_size(constraints);
-		if (constraints) {
-			gp.constraints = PUSH_ARRAY(p->arena, Type*, vec_size(constraints));
-			memcpy(gp.constraints, constraints, gp.constraint_count * sizeof(Type*));
-			vec_free(constraints);
-		} else gp.constraints = NULL;
+		gp.constraint_count = constraints.count;
+		gp.constraints = arena_list_finish(&constraints, p->arena);
 	}
 
 	return gp;
@@ -400,7 +611,7 @@ static GenericParam parse_generic(Parser *p) {
 
 static Param parse_param(Parser *p) {
 	consume(p, TOKEN_IDENTIFIER, "Expected param name.");
-	const char *name = previous(p).text;
+	const char *name = TEXT(previous(p));
 	consume(p, TOKEN_COLON, "Expected ':' after param name.");
 	Type *type = parse_type(p);
 
@@ -410,81 +621,112 @@ static Param parse_param(Parser *p) {
 	return param;
 }
 
-static Stmt *parse_block(Parser *p) {
-	Stmt **list = NULL;
+// Skips ahead to a point where a new statement can start: just past a ';',
+// or at a keyword that begins a statement or ends the enclosing block.
+static void synchronize(Parser *p) {
+	p->panic_mode = false;
+
+	while (true) {
+		if (previous(p).kind == TOKEN_SEMICOLON) return;
+
+		switch (peek(p).kind) {
+			case TOKEN_LOCAL:
+			case TOKEN_FUNCTION:
+			case TOKEN_STRUCT:
+			case TOKEN_TRAIT:
+			case TOKEN_IMPL:
+			case TOKEN_TYPE:
+			case TOKEN_IF:
+			case TOKEN_WHILE:
+			case TOKEN_FOR:
+			case TOKEN_REPEAT:
+			case TOKEN_RETURN:
+			case TOKEN_BREAK:
+				return;
+			default:
+				if (is_block_end(peek(p).kind)) return;
+				advance(p);
+		}
+	}
+}
+
+// At the top level a stray block terminator is reported and skipped so the
+// rest of the file still gets parsed. A halted parser stops at once rather
+// than starting a statement at the token it read last.
+static Stmt *parse_statements(Parser *p, bool top_level) {
+	ArenaList list = ARENA_LIST(Stmt*);
+
+	while (!p->halted && (!is_block_end(peek(p).kind) || (top_level && !check(p, TOKEN_EOF)))) {
+		if (is_block_end(peek(p).kind)) {
+			error_at(p, peek(p), "Expected statement.");
+			advance(p);
+			synchronize(p);
+			continue;
+		}
 
-	while (!is_block_end(peek(p).kind)) {
 		Stmt *stmt = parse_statement(p);
-		vec_push(list, stmt);
+		ARENA_LIST_PUSH(list, Stmt*, stmt);
+		if (p->panic_mode) synchronize(p);
 	}
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_BLOCK;
-	node->as.block.stmt_count = vec_size(list);
-
-	if (list) {
-		node->as.block.stmts = PUSH_ARRAY(p->arena, Stmt*, vec_size(list));
-		memcpy(node->as.block.stmts, list, vec_size(list) * sizeof(Stmt*));
-		vec_free(list);
-	} else node->as.block.stmts = NULL;
+	Stmt *node = new_stmt(p, STMT_BLOCK);
+	node->as.block.stmt_count = list.count;
+	node->as.block.stmts = arena_list_finish(&list, p->arena);
 
 	return node;
 }
 
-static GenericParam *parse_generics(Parser *p) {
-	GenericParam *generics = NULL;
+static Stmt *parse_block(Parser *p) {
+	return parse_statements(p, false);
+}
+
+// Impl and trait bodies only hold functions, so recovery there skips to the
+// next 'function' or the closing 'end'.
+static void synchronize_member(Parser *p) {
+	p->panic_mode = false;
+	while (!check(p, TOKEN_FUNCTION) && !check(p, TOKEN_END) && !check(p, TOKEN_EOF)) advance(p);
+}
+
+static GenericParam *parse_generics(Parser *p, int *count) {
+	ArenaList generics = ARENA_LIST(GenericParam);
 	if (match(p, TOKEN_LT)) {
 		while (!check(p, TOKEN_GT) && !check(p, TOKEN_EOF)) {
-			vec_push(generics, parse_generic(p));
+			ARENA_LIST_PUSH(generics, GenericParam, parse_generic(p));
 			if (!match(p, TOKEN_COMMA)) break;
 		}
 		consume(p, TOKEN_GT, "Expected '>' after generic params.");
 	}
 
-	return generics;
+	*count = generics.count;
+	return arena_list_finish(&generics, p->arena);
 }
 
 static FuncSignature *parse_func_signature(Parser *p) {
-	GenericParam *generics = parse_generics(p);
+	FuncSignature *sig = PUSH_STRUCT(p->arena, FuncSignature);
+	sig->generics = parse_generics(p, &sig->generic_count);
 
 	consume(p, TOKEN_LPAREN, "Expected '(' before function params.");
-	Param *params = NULL;
+	ArenaList params = ARENA_LIST(Param);
 
 	while (!check(p, TOKEN_RPAREN) && !check(p, TOKEN_EOF)) {
-		vec_push(params, parse_param(p));
+		ARENA_LIST_PUSH(params, Param, parse_param(p));
 		if (!match(p, TOKEN_COMMA)) break;
 	}
 	consume(p, TOKEN_RPAREN, "Expected ')' after function params.");
 
-	Type **return_types = NULL;
+	sig->param_count = params.count;
+	sig->params = arena_list_finish(&params, p->arena);
+
+	ArenaList return_types = ARENA_LIST(Type*);
 	if (match(p, TOKEN_COLON)) {
 		do {
 			Type *type = parse_type(p);
-			vec_push(return_types, type);
+			ARENA_LIST_PUSH(return_types, Type*, type);
 		} while (match(p, TOKEN_COMMA));
 	}
 
-	FuncSignature *sig = PUSH_STRUCT(p->arena, FuncSignature);
-	sig->generic_count = vec_size(generics);
-	if (generics) {
-		sig->generics = PUSH_ARRAY(p->arena, GenericParam, vec_size(generics));
-		memcpy(sig->generics, generics, vec_size(generics) * sizeof(GenericParam));
-		vec_free(generics);
-	} else sig->generics = NULL;
-
-	sig->param_count = vec_size(params);
-	if (params) {
-		sig->params = PUSH_ARRAY(p->arena, Param, vec_size(params));
-		memcpy(sig->params, params, vec_size(params) * sizeof(Param));
-		vec_free(params);
-	}
-
-	sig->return_count = vec_size(return_types);
-	if (return_types) {
-		sig->return_types = PUSH_ARRAY(p->arena, Type*, vec_size(return_types));
-		memcpy(sig->return_types, return_types, vec_size(return_types) * sizeof(Type*));
-		vec_free(return_types);
-	}
+	sig->return_count = return_types.count;
+	sig->return_types = arena_list_finish(&return_types, p->arena);
 
 	return sig;
 }
@@ -492,15 +734,14 @@ static FuncSignature *parse_func_signature(Parser *p) {
 static Stmt *type_alias(Parser *p) {
 	consume(p, TOKEN_TYPE, "Expected 'type'.");
 	consume(p, TOKEN_IDENTIFIER, "Expected type alias name.");
-	const char *name = previous(p).text;
+	const char *name = TEXT(previous(p));
 
 	consume(p, TOKEN_EQ, "Expected '=' after type alias name.");
 
 	Type *type = parse_type(p);
 	consume(p, TOKEN_SEMICOLON, "Expected ';' after type alias.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_TYPE_ALIAS;
+	Stmt *node = new_stmt(p, STMT_TYPE_ALIAS);
 	node->as.type_alias.name = name;
 	node->as.type_alias.type = type;
 
@@ -511,150 +752,107 @@ static Stmt *function_decl(Parser *p) {
 	consume(p, TOKEN_FUNCTION, "Expected 'function'.");
 	consume(p, TOKEN_IDENTIFIER, "Expected function name.");
 
-	const char *name = previous(p).text;
+	const char *name = TEXT(previous(p));
 
 	FuncSignature *sig = parse_func_signature(p);
 
 	Stmt *body = parse_block(p);
 	consume(p, TOKEN_END, "Expected 'end' after function.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_FUNCTION;
+	Stmt *node = new_stmt(p, STMT_FUNCTION);
 	node->as.func_decl.name = name;
 	node->as.func_decl.body = body;
 	node->as.func_decl.signature = sig;
 	return node;
 }
 
-static Stmt *impl_decl(Parser *p) {
-	consume(p, TOKEN_IMPL, "Expected 'impl'.");
-	GenericParam *generics = parse_generics(p);
-
-	consume(p, TOKEN_IDENTIFIER, "Expected trait or struct name.");
-	const char *first_name = previous(p).text;
-
-	Type **first_args = NULL;
+static Type **parse_impl_args(Parser *p, int *count) {
+	ArenaList args = ARENA_LIST(Type*);
 	if (match(p, TOKEN_LT)) {
 		while (!match(p, TOKEN_GT) && !match(p, TOKEN_EOF)) {
-			vec_push(first_args, parse_type(p));
+			ARENA_LIST_PUSH(args, Type*, parse_type(p));
 			if (!match(p, TOKEN_COMMA)) break;
 		}
 		consume(p, TOKEN_GT, "Expected '>' after trait args.");
 	}
 
-	const char *second_name = NULL;
-	Type **second_args = NULL;
-	if (match(p, TOKEN_FOR)) {
-		consume(p, TOKEN_IDENTIFIER, "Expected struct name.");
-		second_name = previous(p).text;
-		if (match(p, TOKEN_LT)) {
-			while (!match(p, TOKEN_GT) && !match(p, TOKEN_EOF)) {
-				vec_push(second_args, parse_type(p));
-				if (!match(p, TOKEN_COMMA)) break;
-			}
-			consume(p, TOKEN_GT, "Expected '>' after trait args.");
-		}
-	}
+	*count = args.count;
+	return arena_list_finish(&args, p->arena);
+}
+
+static Stmt *impl_decl(Parser *p) {
+	Stmt *node = new_stmt(p, STMT_IMPL);
+
+	consume(p, TOKEN_IMPL, "Expected 'impl'.");
+	node->as.impl_stmt.generics = parse_generics(p, &node->as.impl_stmt.generic_count);
 
-	const char *trait_name = second_name ? first_name : NULL;
-	const char *target_name = second_name ? second_name : first_name;
+	consume(p, TOKEN_IDENTIFIER, "Expected struct name.");
+	node->as.impl_stmt.target_name = TEXT(previous(p));
+	node->as.impl_stmt.target_args = parse_impl_args(p, &node->as.impl_stmt.target_arg_count);
 
-	Type **trait_args = second_name ? first_args : NULL;
-	Type **target_args = second_name ? second_args : first_args;
+	if (match(p, TOKEN_FOR)) {
+		consume(p, TOKEN_IDENTIFIER, "Expected trait name.");
+		node->as.impl_stmt.trait_name = TEXT(previous(p));
+		node->as.impl_stmt.trait_args = parse_impl_args(p, &node->as.impl_stmt.trait_arg_count);
+	}
 
-	Stmt **functions = NULL;
+	ArenaList functions = ARENA_LIST(Stmt*);
 
 	while (!check(p, TOKEN_END) && !check(p, TOKEN_EOF)) {
-		vec_push(functions, function_decl(p));
+		ARENA_LIST_PUSH(functions, Stmt*, function_decl(p));
+		if (p->panic_mode) synchronize_member(p);
 	}
 
 	consume(p, TOKEN_END, "Expected 'end' after impl.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_IMPL;
-
-	node->as.impl_stmt.trait_name = trait_name;
-	node->as.impl_stmt.target_name = target_name;
-
-	node->as.impl_stmt.generic_count = vec_size(generics);
-	if (generics) {
-		node->as.impl_stmt.generics = PUSH_ARRAY(p->arena, GenericParam, vec_size(generics));
-		memcpy(node->as.impl_stmt.generics, generics, vec_size(generics) * sizeof(GenericParam));
-		vec_free(generics);
-	} else node->as.impl_stmt.generics = NULL;
-
-	node->as.impl_stmt.target_arg_count = vec_size(target_args);
-	if (target_args) {
-		node->as.impl_stmt.target_args = PUSH_ARRAY(p->arena, Type*, vec_size(target_args));
-		memcpy(node->as.impl_stmt.target_args, target_args, vec_size(target_args) * sizeof(Type*));
-	} else node->as.impl_stmt.target_args = NULL;
-
-	node->as.impl_stmt.trait_arg_count = vec_size(trait_args);
-	if (trait_args) {
-		node->as.impl_stmt.trait_args = PUSH_ARRAY(p->arena, Type*, vec_size(trait_args));
-		memcpy(node->as.impl_stmt.trait_args , trait_args, vec_size(trait_args) * sizeof(Type*));
-	} else node->as.impl_stmt.trait_args = NULL;
-
-	node->as.impl_stmt.func_count = vec_size(functions);
-	if (functions) {
-		node->as.impl_stmt.functions = PUSH_ARRAY(p->arena, Stmt*, vec_size(functions));
-		memcpy(node->as.impl_stmt.functions, functions, vec_size(functions) * sizeof(Stmt*));
-		vec_free(functions);
-	} else node->as.impl_stmt.functions = NULL;
-
-	vec_free(first_args);
-	vec_free(second_args);
+	node->as.impl_stmt.func_count = functions.count;
+	node->as.impl_stmt.functions = arena_list_finish(&functions, p->arena);
 
 	return node;
 }
 
+typedef struct {
+	const char *name;
+	FuncSignature *sig;
+} TraitFunc;
+
 static Stmt *trait_decl(Parser *p) {
 	consume(p, TOKEN_TRAIT, "Expected 'trait'.");
 	consume(p, TOKEN_IDENTIFIER, "Expected trait name.");
 
-	const char *name = previous(p).text;
-
-	GenericParam *generics = parse_generics(p);
+	Stmt *node = new_stmt(p, STMT_TRAIT);
+	node->as.trait_decl.name = TEXT(previous(p));
+	node->as.trait_decl.generics = parse_generics(p, &node->as.trait_decl.generic_count);
 
-	const char **func_names = NULL;
-	FuncSignature **functions = NULL;
+	ArenaList functions = ARENA_LIST(TraitFunc);
 
 	while (!check(p, TOKEN_END) && !check(p, TOKEN_EOF)) {
 		consume(p, TOKEN_FUNCTION, "Expected 'function' in trait declaration.");
 		consume(p, TOKEN_IDENTIFIER, "Expected function name in trait declaration.");
-		const char *name = previous(p).text;
-		FuncSignature *sig = parse_func_signature(p);
+		TraitFunc func;
+		func.name = TEXT(previous(p));
+		func.sig = parse_func_signature(p);
 
-		vec_push(func_names, name);
-		vec_push(functions, sig);
+		ARENA_LIST_PUSH(functions, TraitFunc, func);
+		if (p->panic_mode) synchronize_member(p);
 	};
 	consume(p, TOKEN_END, "Expected 'end' after trait declaration.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_TRAIT;
-	node->as.trait_decl.name = name;
-
-	node->as.trait_decl.generic_count = vec_size(generics);
-	if (generics) {
-		node->as.trait_decl.generics = PUSH_ARRAY(p->arena, GenericParam, vec_size(generics));
-		memcpy(node->as.trait_decl.generics, generics, vec_size(generics) * sizeof(GenericParam));
-		vec_free(generics);
-	} else node->as.trait_decl.generics = NULL;
-
-	node->as.trait_decl.func_count = vec_size(func_names);
-	if (func_names) {
-		node->as.trait_decl.func_names = PUSH_ARRAY(p->arena, const char*, vec_size(func_names));
-		node->as.trait_decl.functions =  PUSH_ARRAY(p->arena, FuncSignature*, vec_size(functions));
-
-		memcpy(node->as.trait_decl.func_names, func_names, vec_size(func_names) * sizeof(const char*));
-		memcpy(node->as.trait_decl.functions,  functions,  vec_size(functions) * sizeof(FuncSignature*));
+	int count = functions.count;
+	node->as.trait_decl.func_count = count;
+	if (count) {
+		node->as.trait_decl.func_names = PUSH_ARRAY(p->arena, const char*, count);
+		node->as.trait_decl.functions =  PUSH_ARRAY(p->arena, FuncSignature*, count);
 
-		vec_free(func_names);
-		vec_free(functions);
+		for (int i = 0; i < count; i++) {
+			node->as.trait_decl.func_names[i] = ARENA_LIST_AT(functions, TraitFunc, i).name;
+			node->as.trait_decl.functions[i] = ARENA_LIST_AT(functions, TraitFunc, i).sig;
+		}
 	} else {
 		node->as.trait_decl.func_names = NULL;
 		node->as.trait_decl.functions = NULL;
 	}
+	arena_list_end(&functions);
 
 	return node;
 }
@@ -663,34 +861,20 @@ static Stmt *struct_decl(Parser *p) {
 	consume(p, TOKEN_STRUCT, "Expected 'struct'.");
 	consume(p, TOKEN_IDENTIFIER, "Expected struct name.");
 
-	const char *name = previous(p).text;
-
-	GenericParam *generics = parse_generics(p);
+	Stmt *node = new_stmt(p, STMT_STRUCT);
+	node->as.struct_decl.name = TEXT(previous(p));
+	node->as.struct_decl.generics = parse_generics(p, &node->as.struct_decl.generic_count);
 
-	Param *fields = NULL;
+	ArenaList fields = ARENA_LIST(Param);
 
 	while (!check(p, TOKEN_END) && !check(p, TOKEN_EOF)) {
-		vec_push(fields, parse_param(p));
+		ARENA_LIST_PUSH(fields, Param, parse_param(p));
 		if (!match(p, TOKEN_COMMA)) break;
 	}
 	consume(p, TOKEN_END, "Expected 'end' after struct declaration.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_STRUCT;
-	node->as.struct_decl.name = name;
-	node->as.struct_decl.generic_count = vec_size(generics);
-	if (generics) {
-		node->as.struct_decl.generics = PUSH_ARRAY(p->arena, GenericParam, vec_size(generics));
-		memcpy(node->as.struct_decl.generics, generics, vec_size(generics) * sizeof(GenericParam));
-		vec_free(generics);
-	} else node->as.struct_decl.generics = NULL;
-
-	node->as.struct_decl.field_count = vec_size(fields);
-	if (fields) {
-		node->as.struct_decl.fields = PUSH_ARRAY(p->arena, Param, vec_size(fields));
-		memcpy(node->as.struct_decl.fields, fields, vec_size(fields) * sizeof(Param));
-		vec_free(fields);
-	} else node->as.struct_decl.fields = NULL;
+	node->as.struct_decl.field_count = fields.count;
+	node->as.struct_decl.fields = arena_list_finish(&fields, p->arena);
 
 	return node;
 }
@@ -698,43 +882,34 @@ static Stmt *struct_decl(Parser *p) {
 static Stmt *local_decl(Parser *p) {
 	consume(p, TOKEN_LOCAL, "Expected 'local'");
 
-	Param *params = NULL;
+	Stmt *node = new_stmt(p, STMT_LOCAL);
+
+	ArenaList params = ARENA_LIST(Param);
 
 	do {
-		vec_push(params, parse_param(p));
+		ARENA_LIST_PUSH(params, Param, parse_param(p));
 	} while (match(p, TOKEN_COMMA));
 
-	Expr **values = NULL;
+	node->as.local.decl_count = params.count;
+	node->as.local.decls = arena_list_finish(&params, p->arena);
+
+	ArenaList values = ARENA_LIST(Expr*);
 	if (match(p, TOKEN_EQ)) {
 		do {
-			vec_push(values, parse_expression(p));
+			ARENA_LIST_PUSH(values, Expr*, parse_expression(p));
 	 	} while (match(p, TOKEN_COMMA));
 	}
 
 	consume(p, TOKEN_SEMICOLON, "Expected ';' after local declaration.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_LOCAL;
-
-	node->as.local.decl_count = vec_size(params);
-	if (params) {
-		node->as.local.decls = PUSH_ARRAY(p->arena, Param, vec_size(params));
-		memcpy(node->as.local.decls, params, vec_size(params) * sizeof(Param));
-		vec_free(params);
-	} else node->as.local.decls = NULL;
-
-	node->as.local.value_count = vec_size(values);
-	if (values) {
-		node->as.local.values = PUSH_ARRAY(p->arena, Expr*, vec_size(values));
-		memcpy(node->as.local.values, values, vec_size(values) * sizeof(Expr*));
-		vec_free(values);
-	} else node->as.local.values = NULL;
+	node->as.local.value_count = values.count;
+	node->as.local.values = arena_list_finish(&values, p->arena);
 
 	return node;
 }
 
 static Stmt *numeric_for(Parser *p) {
-	const char *variable = previous(p).text;
+	const char *variable = TEXT(previous(p));
 	consume(p, TOKEN_EQ, "Expected '=' after variable name.");
 	Expr *start = parse_expression(p);
 
@@ -750,8 +925,7 @@ static Stmt *numeric_for(Parser *p) {
 	Stmt *body = parse_block(p);
 	consume(p, TOKEN_END, "Expected 'end' after for loop.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_FOR_NUM;
+	Stmt *node = new_stmt(p, STMT_FOR_NUM);
 	node->as.for_num.name = variable;
 	node->as.for_num.start = start;
 	node->as.for_num.end = end;
@@ -762,35 +936,26 @@ static Stmt *numeric_for(Parser *p) {
 }
 
 static Stmt *generic_for(Parser *p) {
-	const char **names = NULL;
+	ArenaList names = ARENA_LIST(const char*);
 
-	vec_push(names, previous(p).text);
+	ARENA_LIST_PUSH(names, const char*, TEXT(previous(p)));
 
 	while (match(p, TOKEN_COMMA)) {
 		consume(p, TOKEN_IDENTIFIER, "Expected variable name.");
-		const char *next_name = previous(p).text;
-		vec_push(names, next_name);
+		ARENA_LIST_PUSH(names, const char*, TEXT(previous(p)));
 	}
 
+	Stmt *node = new_stmt(p, STMT_FOR_GEN);
+	node->as.for_gen.name_count = names.count;
+	node->as.for_gen.names = arena_list_finish(&names, p->arena);
+
 	consume(p, TOKEN_IN, "Expected 'in' after for loop variables.");
-	Expr *iter = parse_expression(p);
+	node->as.for_gen.iter = parse_expression(p);
 
 	consume(p, TOKEN_DO, "Expectd 'do' after for loop iterator.");
-	Stmt *body = parse_block(p);
+	node->as.for_gen.body = parse_block(p);
 	consume(p, TOKEN_END, "Expected 'end' after for loop.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_FOR_GEN;
-	node->as.for_gen.iter = iter;
-	node->as.for_gen.body = body;
-	node->as.for_gen.name_count = vec_size(names);
-
-	if (names) {
-		node->as.for_gen.names = PUSH_ARRAY(p->arena, const char*, vec_size(names));
-		memcpy(node->as.for_gen.names, names, vec_size(names) * sizeof(const char*));
-		vec_free(names);
-	}
-
 	return node;
 }
 
@@ -810,8 +975,7 @@ static Stmt *repeat_stmt(Parser *p) {
 	consume(p, TOKEN_UNTIL, "Expected 'until' after repeat body.");
 	Expr *condition = parse_expression(p);
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_REPEAT;
+	Stmt *node = new_stmt(p, STMT_REPEAT);
 	node->as.repeat_stmt.body = body;
 	node->as.repeat_stmt.condition = condition;
 	return node;
@@ -826,8 +990,7 @@ static Stmt *while_stmt(Parser *p) {
 	Stmt *body = parse_block(p);
 	consume(p, TOKEN_END, "Expected 'end' after while statement.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_WHILE;
+	Stmt *node = new_stmt(p, STMT_WHILE);
 	node->as.while_stmt.condition = condition;
 	node->as.while_stmt.body = body;
 	return node;
@@ -836,8 +999,7 @@ static Stmt *while_stmt(Parser *p) {
 static Stmt *if_stmt(Parser *p) {
 	consume(p, TOKEN_IF, "Expected 'if'.");
 
-	Stmt *root = PUSH_STRUCT(p->arena, Stmt);
-	root->kind = STMT_IF;
+	Stmt *root = new_stmt(p, STMT_IF);
 
 	root->as.if_stmt.condition = parse_expression(p);
 	consume(p, TOKEN_THEN, "Expected 'then' after if condition.");
@@ -848,8 +1010,7 @@ static Stmt *if_stmt(Parser *p) {
 	Stmt **tail = &root->as.if_stmt.else_branch;
 
 	while (match(p, TOKEN_ELSEIF)) {
-		Stmt *elseif = PUSH_STRUCT(p->arena, Stmt);
-		elseif->kind = STMT_IF;
+		Stmt *elseif = new_stmt(p, STMT_IF);
 		elseif->as.if_stmt.condition = parse_expression(p);
 	consume(p, TOKEN_THEN, "Expected 'then' after elseif condition.");
 
@@ -872,85 +1033,67 @@ static Stmt *if_stmt(Parser *p) {
 static Stmt *break_stmt(Parser *p) {
 	consume(p, TOKEN_BREAK, "Expected 'break'.");
 	consume(p, TOKEN_SEMICOLON, "Expected ';' after break.");
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_BREAK;
+	Stmt *node = new_stmt(p, STMT_BREAK);
 	return node;
 }
 
 static Stmt *return_stmt(Parser *p) {
 	consume(p, TOKEN_RETURN, "Expected 'return'.");
 
-	Expr **list = NULL;
+	ArenaList list = ARENA_LIST(Expr*);
 
 	while (!check(p, TOKEN_SEMICOLON) && !check(p, TOKEN_EOF)) {
-		Expr *expr = parse_expression(p);
-		vec_push(list, expr);
+		ARENA_LIST_PUSH(list, Expr*, parse_expression(p));
 		if (!match(p, TOKEN_COMMA)) break;
 	}	
 	consume(p, TOKEN_SEMICOLON, "Expected ';' after return statement.");
 
-	Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-	node->kind = STMT_RETURN;
-	node->as.return_stmt.value_count = vec_size(list);
-
-	if (list) {
-		node->as.return_stmt.values = PUSH_ARRAY(p->arena, Expr*, vec_size(list));
-		memcpy(node->as.return_stmt.values, list, vec_size(list) * sizeof(Expr*));
-		vec_free(list);
-	} else node->as.return_stmt.values = NULL;
+	Stmt *node = new_stmt(p, STMT_RETURN);
+	node->as.return_stmt.value_count = list.count;
+	node->as.return_stmt.values = arena_list_finish(&list, p->arena);
 
 	return node;
 }
 
 static Stmt *expression_or_assignment(Parser *p) {
-	Expr **targets = NULL;
+	ArenaList targets = ARENA_LIST(Expr*);
 
 	do {
-		vec_push(targets, parse_expression(p));
+		ARENA_LIST_PUSH(targets, Expr*, parse_expression(p));
 	} while (match(p, TOKEN_COMMA));
 
 	if (match(p, TOKEN_EQ)) {
-		Expr **values = NULL;
+		Stmt *node = new_stmt(p, STMT_ASSIGN);
+
+		node->as.assign.target_count = targets.count;
+		node->as.assign.targets = arena_list_finish(&targets, p->arena);
+
+		ArenaList values = ARENA_LIST(Expr*);
 		do {
-			vec_push(values, parse_expression(p));
+			ARENA_LIST_PUSH(values, Expr*, parse_expression(p));
 		} while (match(p, TOKEN_COMMA));
 
 		consume(p, TOKEN_SEMICOLON, "Expected ';' after assignment.");
 
-		Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-		node->kind = STMT_ASSIGN;
-
-		node->as.assign.target_count = vec_size(targets);
-		if (targets) {
-			node->as.assign.targets = PUSH_ARRAY(p->arena, Expr*, vec_size(targets));
-			memcpy(node->as.assign.targets, targets, vec_size(targets) * sizeof(Expr*));
-			vec_free(targets);
-		} else node->as.assign.targets = NULL;
-
-		node->as.assign.value_count = vec_size(values);
-		if (values) {
-			node->as.assign.values = PUSH_ARRAY(p->arena, Expr*, vec_size(values));
-			memcpy(node->as.assign.values, values, vec_size(values) * sizeof(Expr*));
-			vec_free(values);
-		} else node->as.assign.values = NULL;
+		node->as.assign.value_count = values.count;
+		node->as.assign.values = arena_list_finish(&values, p->arena);
 
 		return node;
 	} else {
-		if (vec_size(targets) > 1) {
+		if (targets.count > 1) {
 			error_at(p, previous(p), "Unexpected ',' in expression statement.");
 		}
 
 		consume(p, TOKEN_SEMICOLON, "Expected ';' after expression.");
 
-		Stmt *node = PUSH_STRUCT(p->arena, Stmt);
-		node->kind = STMT_EXPR;
-		node->as.expression = targets[0];
-		vec_free(targets);
+		Stmt *node = new_stmt(p, STMT_EXPR);
+		node->as.expression = ARENA_LIST_AT(targets, Expr*, 0);
+		arena_list_end(&targets);
 		return node;
 	}
 }
 
-static Stmt *parse_statement(Parser *p) {
+static Stmt *statement(Parser *p) {
 	switch(peek(p).kind) {
 		case TOKEN_TYPE:     return type_alias(p);
 		case TOKEN_IMPL:     return impl_decl(p);
@@ -968,17 +1111,126 @@ static Stmt *parse_statement(Parser *p) {
 	}
 }
 
-ParseResult parse(Token *tokens, MemArena *arena) {
-	Parser parser = {
-		tokens, 0, vec_size(tokens),
-		arena, false, false
-	};
+static Stmt *parse_statement(Parser *p) {
+	if (!enter_nested(p)) return NULL;
+	u32 enclosing = p->stmt_start;
+	p->stmt_start = peek(p).offset;
+	Stmt *s = statement(p);
+	p->stmt_start = enclosing;
+	leave_nested(p);
+	return s;
+}
+
+bool span_offset(const SpanTable *spans, const void *node, u32 *offset) {
+	if (!spans || !spans->chunk_count || (const u8*)node < spans->base) return false;
+	u64 key = (u64)((const u8*)node - spans->base) / sizeof(void*);
 
-	Stmt *root = parse_block(&parser);
+	// The last chunk starting at or before the key, then the key in it.
+	u32 lo = 0, hi = spans->chunk_count;
+	while (hi - lo > 1) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (spans->chunks[mid]->keys[0] <= key) lo = mid;
+		else hi = mid;
+	}
+
+	const SpanChunk *chunk = spans->chunks[lo];
+	u32 first = 0, last = chunk->count;
+	while (first < last) {
+		u32 mid = first + (last - first) / 2;
+		if (chunk->keys[mid] < key) first = mid + 1;
+		else last = mid;
+	}
+	if (first == chunk->count || chunk->keys[first] != key) return false;
+
+	*offset = chunk->offsets[first];
+	return true;
+}
+
+static ParseResult parse_program(Parser *parser) {
+	parser->ring[0] = next_token(parser);
+
+	Stmt *root = parse_statements(parser, true);
 
 	ParseResult result;
 	result.root = root;
-	result.success = !parser.had_error;
+	result.success = !parser->had_error;
+	result.types = parser->types;
+	result.diagnostics = parser->diagnostics;
+	result.diagnostic_count = parser->diagnostic_count;
+	result.spans = span_finish(&parser->spans, parser->source, parser->source_length);
+
+	return result;
+}
+
+ParseResult parse(const TokenList *tokens, StringPool *pool, MemArena *arena) {
+	Parser parser = {0};
+	parser.tokens = tokens;
+	parser.source = tokens->source;
+	parser.source_length = tokens->source_length;
+	parser.pool = pool;
+	parser.types = type_table_create(arena, 0);
+	parser.arena = arena;
+	parser.spans.arena = arena;
+	parser.max_errors = PARSER_MAX_ERRORS;
+
+	return parse_program(&parser);
+}
+
+ParseResult parse_stream(Scanner *scanner, MemArena *arena) {
+	Parser parser = {0};
+	parser.scanner = scanner;
+	parser.source = scanner->source;
+	parser.source_length = scanner->end - scanner->source;
+	parser.pool = scanner->pool;
+	parser.types = type_table_create(arena, 0);
+	parser.arena = arena;
+	parser.spans.arena = arena;
+	parser.max_errors = PARSER_MAX_ERRORS;
+
+	return parse_program(&parser);
+}
+
+ParseResult parse_statement_at(const TokenList *tokens, u32 *index, u32 max_errors, StringPool *pool, TypeTable *types, MemArena *arena) {
+	Parser parser = {0};
+	parser.tokens = tokens;
+	parser.next = *index;
+	parser.source = tokens->source;
+	parser.source_length = tokens->source_length;
+	parser.pool = pool;
+	parser.types = types;
+	parser.arena = arena;
+	parser.spans.arena = arena;
+	parser.max_errors = MIN(max_errors, PARSER_MAX_ERRORS);
+
+	Parser *p = &parser;
+	p->ring[0] = next_token(p);
+
+	// Mirrors one iteration of the top-level loop in parse_statements, so a
+	// file parsed statement by statement gets the same tree and errors.
+	Stmt *stmt = NULL;
+	if (is_block_end(peek(p).kind)) {
+		if (!check(p, TOKEN_EOF)) {
+			error_at(p, peek(p), "Expected statement.");
+			advance(p);
+			synchronize(p);
+		}
+	} else {
+		stmt = parse_statement(p);
+		if (p->panic_mode) synchronize(p);
+	}
+
+	// The ring never reads past the current token, so that is the one
+	// just before the next unread index. A halted parser reads no further,
+	// as a full parse would not.
+	*index = p->halted ? tokens->count - 1 : p->next - 1;
+
+	ParseResult result;
+	result.root = stmt;
+	result.success = !p->had_error;
+	result.types = types;
+	result.diagnostics = p->diagnostics;
+	result.diagnostic_count = p->diagnostic_count;
+	result.spans = span_finish(&p->spans, p->source, p->source_length);
 
 	return result;
 }
@@ -1,11 +1,13 @@
 #pragma once
 #include "arena.h"
+#include "lexer.h"
 #include "token.h"
 #include <stdbool.h>
 
 typedef struct Type Type;
 typedef struct Expr Expr;
 typedef struct Stmt Stmt;
+typedef struct TypeTable TypeTable;
 
 typedef struct {
 	const char *name;
@@ -71,6 +73,13 @@ typedef enum {
 	OP_NEGATE, OP_NOT, OP_LEN
 } UnaryOp;
 
+// Filled in by the resolver; the parser leaves every variable unresolved.
+// A local's slot indexes its function's frame, an upvalue's the function's
+// upvalue list and a global's the resolution's global list.
+typedef enum {
+	VAR_UNRESOLVED, VAR_LOCAL, VAR_UPVALUE, VAR_GLOBAL
+} VarScope;
+
 typedef enum {
 	EXPR_NIL, EXPR_BOOL, EXPR_NUMBER, EXPR_STRING,
 	EXPR_VARARG, EXPR_VARIABLE,
@@ -86,7 +95,7 @@ struct Expr {
 		bool boolean;
 		double number;
 		const char *string;
-		const char *variable;
+		struct { const char *name; VarScope scope; u32 slot; } variable;
 
 		struct { Expr *left; Expr *right; BinaryOp op; } binary;
 		struct { Expr *operand; UnaryOp op; } unary;
@@ -168,9 +177,83 @@ struct Stmt {
 	} as;
 };
 
+// A parse stops at this many errors and ignores the rest of its input.
+#define PARSER_MAX_ERRORS 50
+
+// One reported error. The lexeme is pool or fixed text, the message a
+// string literal or a lexer error message, so both live as long as the pool.
+// line and column are 1-based and 0 when the position is unknown; with
+// declaration set the lexeme names the enclosing declaration instead of the
+// offending token.
+typedef struct {
+	u32 offset;
+	u32 line;
+	const char *lexeme;
+	const char *message;
+	u32 column;
+	bool declaration;
+} Diagnostic;
+
+// Where each node was parsed, kept beside the tree so nodes don't grow.
+// The offset is that of the token the node was built at: the operator of
+// a binary or unary expression, the opening token of anything else. Nodes
+// are allocated in increasing address order, so entries come out sorted
+// by node and a lookup is a binary search; they are stored in fixed chunks
+// in the parse arena at 8 bytes a node. The source is kept for turning an
+// offset into a line and column once a diagnostic needs one.
+typedef struct SpanChunk SpanChunk;
+typedef struct {
+	const u8 *base;
+	SpanChunk **chunks;
+	u32 chunk_count;
+
+	const char *source;
+	u64 source_length;
+} SpanTable;
+
+// False for nodes the table doesn't cover, such as types and parameters.
+bool span_offset(const SpanTable *spans, const void *node, u32 *offset);
+
+// Builds a SpanTable for nodes pushed onto arena. Each node is recorded
+// right after it is allocated, which keeps the keys sorted; the parser
+// does this, and so does expanding a compact tree that carries offsets.
+typedef struct {
+	MemArena *arena;
+	SpanChunk *last;
+	u32 chunk_count;
+} SpanBuilder;
+
+void span_record(SpanBuilder *b, const void *node, u32 offset);
+SpanTable span_finish(SpanBuilder *b, const char *source, u64 source_length);
+
+// Every Type in the tree is canonical in types, which lives in the arena
+// the tree was parsed into.
 typedef struct {
 	Stmt *root;
 	bool success;
+	TypeTable *types;
+
+	Diagnostic *diagnostics;
+	u32 diagnostic_count;
+
+	SpanTable spans;
 } ParseResult;
 
-ParseResult parse(Token *tokens, MemArena *arena);
+// Deepest nesting of expressions, statements and types the parser accepts
+// before it stops with "Nesting too deep.". Applies to every parse started
+// afterwards; 0 restores the default.
+#define PARSER_DEFAULT_MAX_DEPTH 1000
+void parser_set_max_depth(u32 depth);
+u32 parser_max_depth(void);
+
+ParseResult parse(const TokenList *tokens, StringPool *pool, MemArena *arena);
+ParseResult parse_stream(Scanner *scanner, MemArena *arena);
+
+// Parses the single top-level statement starting at tokens[*index] and
+// moves *index to the first token after it, including any tokens skipped
+// while recovering. root is NULL when only a stray token was skipped. Types
+// are interned in the caller's table so statements parsed one at a time
+// still share them. max_errors is what is left of the error cap after the
+// statements before this one; a statement that reaches it halts the parse
+// and moves *index to the EOF token.
+ParseResult parse_statement_at(const TokenList *tokens, u32 *index, u32 max_errors, StringPool *pool, TypeTable *types, MemArena *arena);
@@ -0,0 +1,79 @@
+#include <stdint.h>
+
+#include "ptr_map.h"
+#include "arena.h"
+
+#define PTR_MAP_MIN_CAPACITY 16
+#define PTR_MAP_MAX_LOAD_NUM 3
+#define PTR_MAP_MAX_LOAD_DEN 4
+
+#define HASH_K1 0xbf58476d1ce4e5b9ull
+
+// Addresses are aligned, so the low bits carry nothing; folding the high
+// half of the product back in spreads every bit over the index.
+static inline u64 hash_ptr(const void *key) {
+	__uint128_t r = (__uint128_t)(uintptr_t)key * HASH_K1;
+	return (u64)r ^ (u64)(r >> 64);
+}
+
+PtrMap ptr_map_create(MemArena *arena, u64 capacity) {
+	PtrMap map = {0};
+	map.arena = arena;
+
+	map.capacity = PTR_MAP_MIN_CAPACITY;
+	while (map.capacity < capacity) map.capacity <<= 1;
+	map.slots = PUSH_ARRAY(arena, PtrSlot, map.capacity);
+
+	return map;
+}
+
+u64 *ptr_map_get(const PtrMap *map, const void *key) {
+	u64 mask = map->capacity - 1;
+	u64 index = hash_ptr(key) & mask;
+
+	for (PtrSlot *slot = &map->slots[index]; slot->key; slot = &map->slots[index]) {
+		if (slot->key == key) return &slot->value;
+		index = (index + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static void ptr_map_grow(PtrMap *map) {
+	u64 new_capacity = map->capacity * 2;
+	u64 mask = new_capacity - 1;
+	PtrSlot *new_slots = PUSH_ARRAY(map->arena, PtrSlot, new_capacity);
+
+	for (u64 i = 0; i < map->capacity; i++) {
+		PtrSlot *slot = &map->slots[i];
+		if (!slot->key) continue;
+
+		u64 index = hash_ptr(slot->key) & mask;
+		while (new_slots[index].key) index = (index + 1) & mask;
+		new_slots[index] = *slot;
+	}
+
+	map->slots = new_slots;
+	map->capacity = new_capacity;
+}
+
+u64 *ptr_map_put(PtrMap *map, const void *key) {
+	// Grown ahead of the insert, so the returned slot stays put.
+	if ((map->count + 1) * PTR_MAP_MAX_LOAD_DEN > map->capacity * PTR_MAP_MAX_LOAD_NUM) {
+		ptr_map_grow(map);
+	}
+
+	u64 mask = map->capacity - 1;
+	u64 index = hash_ptr(key) & mask;
+
+	for (PtrSlot *slot = &map->slots[index]; slot->key; slot = &map->slots[index]) {
+		if (slot->key == key) return &slot->value;
+		index = (index + 1) & mask;
+	}
+
+	PtrSlot *slot = &map->slots[index];
+	slot->key = key;
+	slot->value = 0;
+	map->count++;
+	return &slot->value;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "arena.h"
+#include "typedefs.h"
+
+typedef struct {
+	const void *key;
+	u64 value;
+} PtrSlot;
+
+// Open-addressing map from an address to a u64, for tables keyed on
+// interned strings or tree nodes where pointer identity is the key. Slots
+// are regrown in the arena like the string pool's; there is no removal, a
+// value of 0 serves as "absent" for callers that need to forget a key.
+typedef struct {
+	MemArena *arena;
+	PtrSlot *slots;
+	u64 capacity;
+	u64 count;
+} PtrMap;
+
+PtrMap ptr_map_create(MemArena *arena, u64 capacity);
+
+// NULL when the key was never put.
+u64 *ptr_map_get(const PtrMap *map, const void *key);
+
+// Returns the key's value, inserted as 0 if it is new. The pointer is only
+// valid until the next put. Keys must not be NULL.
+u64 *ptr_map_put(PtrMap *map, const void *key);
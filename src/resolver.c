@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "resolver.h"
+#include "arena.h"
+#include "ptr_map.h"
+#include "vec.h"
+
+typedef struct FunctionState FunctionState;
+
+struct FunctionState {
+	FunctionState *enclosing;
+	FunctionScope *scope;
+
+	// Name -> slot + 1 of the innermost local of that name in scope, or 0
+	// once it went out of scope. Names are interned, so the pointer is the
+	// key.
+	PtrMap locals;
+	u32 active;
+	Upvalue *upvalues;
+};
+
+// What a name meant before a declaration shadowed it, restored when the
+// declaring block ends.
+typedef struct {
+	const char *name;
+	u64 previous;
+} Shadow;
+
+typedef struct {
+	u32 shadows;
+	u32 active;
+} Scope;
+
+typedef struct {
+	MemArena *arena;
+	Resolution *out;
+	FunctionState *fn;
+	const char *self_name;
+
+	Shadow *shadows;
+	Expr **work;
+
+	// Name -> global slot + 1.
+	PtrMap globals;
+	const char **global_names;
+} Resolver;
+
+static u64 pack_binding(Binding b) {
+	return ((u64)b.scope << 32) | b.slot;
+}
+
+static Binding unpack_binding(u64 value) {
+	Binding b = { (VarScope)(value >> 32), (u32)value };
+	return b;
+}
+
+static Scope begin_scope(Resolver *r) {
+	Scope scope = { (u32)vec_size(r->shadows), r->fn->active };
+	return scope;
+}
+
+static void end_scope(Resolver *r, Scope scope) {
+	while (vec_size(r->shadows) > scope.shadows) {
+		Shadow shadow = r->shadows[--vec_hdr(r->shadows)->size];
+		*ptr_map_get(&r->fn->locals, shadow.name) = shadow.previous;
+	}
+	r->fn->active = scope.active;
+}
+
+static u32 declare(Resolver *r, const char *name) {
+	FunctionState *fn = r->fn;
+	u32 slot = fn->active++;
+	if (fn->active > fn->scope->slot_count) fn->scope->slot_count = fn->active;
+
+	// Error trees can have unnamed declarations; they still take a slot.
+	if (!name) return slot;
+
+	u64 *value = ptr_map_put(&fn->locals, name);
+	Shadow shadow = { name, *value };
+	vec_push(r->shadows, shadow);
+	*value = slot + 1;
+	return slot;
+}
+
+static bool find_local(FunctionState *fn, const char *name, u32 *slot) {
+	u64 *value = ptr_map_get(&fn->locals, name);
+	if (!value || !*value) return false;
+	*slot = (u32)(*value - 1);
+	return true;
+}
+
+static u32 add_upvalue(FunctionState *fn, const char *name, bool local, u32 index) {
+	for (u32 i = 0; i < vec_size(fn->upvalues); i++) {
+		if (fn->upvalues[i].local == local && fn->upvalues[i].index == index) return i;
+	}
+
+	Upvalue upvalue = { name, local, index };
+	vec_push(fn->upvalues, upvalue);
+	return (u32)vec_size(fn->upvalues) - 1;
+}
+
+// Threads the capture through every function between the reference and
+// the declaring one, so each closure only ever copies from its parent.
+static bool find_upvalue(FunctionState *fn, const char *name, u32 *index) {
+	if (!fn->enclosing) return false;
+
+	u32 slot;
+	if (find_local(fn->enclosing, name, &slot)) {
+		*index = add_upvalue(fn, name, true, slot);
+		return true;
+	}
+
+	if (find_upvalue(fn->enclosing, name, &slot)) {
+		*index = add_upvalue(fn, name, false, slot);
+		return true;
+	}
+
+	return false;
+}
+
+static u32 global_slot(Resolver *r, const char *name) {
+	u64 *value = ptr_map_put(&r->globals, name);
+	if (!*value) {
+		vec_push(r->global_names, name);
+		*value = vec_size(r->global_names);
+	}
+	return (u32)(*value - 1);
+}
+
+static Binding lookup(Resolver *r, const char *name) {
+	Binding b = { VAR_GLOBAL, 0 };
+	if (!name) return b;
+
+	if (find_local(r->fn, name, &b.slot)) b.scope = VAR_LOCAL;
+	else if (find_upvalue(r->fn, name, &b.slot)) b.scope = VAR_UPVALUE;
+	else b.slot = global_slot(r, name);
+
+	return b;
+}
+
+static void bind_declaration(Resolver *r, const Stmt *decl, Binding b) {
+	*ptr_map_put(&r->out->declarations, decl) = pack_binding(b);
+}
+
+static void resolve_block(Resolver *r, Stmt *block, bool scoped);
+static FunctionScope *resolve_function(Resolver *r, const FuncSignature *sig, Stmt *body, bool method);
+
+#define push_work(r, e) do { if (e) vec_push((r)->work, (e)); } while (0)
+
+// Expressions declare nothing, so the order they are visited in doesn't
+// matter and an explicit stack keeps arbitrarily long operator and call
+// chains off the C stack.
+static void resolve_expr(Resolver *r, Expr *root) {
+	u32 base = (u32)vec_size(r->work);
+	push_work(r, root);
+
+	while (vec_size(r->work) > base) {
+		Expr *e = r->work[--vec_hdr(r->work)->size];
+
+		switch (e->kind) {
+			case EXPR_VARIABLE: {
+				Binding b = lookup(r, e->as.variable.name);
+				e->as.variable.scope = b.scope;
+				e->as.variable.slot = b.slot;
+				break;
+			}
+			case EXPR_BINARY:
+				push_work(r, e->as.binary.right);
+				push_work(r, e->as.binary.left);
+				break;
+			case EXPR_UNARY:
+				push_work(r, e->as.unary.operand);
+				break;
+			case EXPR_CALL:
+				for (int i = e->as.call.arg_count - 1; i >= 0; i--) push_work(r, e->as.call.args[i]);
+				push_work(r, e->as.call.callee);
+				break;
+			case EXPR_INDEX:
+				push_work(r, e->as.index.index);
+				push_work(r, e->as.index.target);
+				break;
+			case EXPR_FIELD:
+				push_work(r, e->as.field.target);
+				break;
+			case EXPR_FUNCTION:
+				resolve_function(r, &e->as.function.signature, e->as.function.body, false);
+				break;
+			case EXPR_TABLE:
+				for (int i = e->as.table.entry_count - 1; i >= 0; i--) {
+					push_work(r, e->as.table.entries[i].value);
+					push_work(r, e->as.table.entries[i].key);
+				}
+				break;
+			case EXPR_STRUCT:
+				// The struct name and plain field keys name a type and its
+				// fields, not variables, and stay unresolved.
+				for (int i = e->as.struct_init.entry_count - 1; i >= 0; i--) {
+					TableEntry *entry = &e->as.struct_init.entries[i];
+					push_work(r, entry->value);
+					if (entry->key && entry->key->kind != EXPR_VARIABLE) push_work(r, entry->key);
+				}
+				break;
+			default: break;
+		}
+	}
+}
+
+static void resolve_exprs(Resolver *r, Expr **exprs, int count) {
+	for (int i = 0; i < count; i++) resolve_expr(r, exprs[i]);
+}
+
+static void resolve_stmt(Resolver *r, Stmt *s) {
+	if (!s) return;
+
+	switch (s->kind) {
+		case STMT_EXPR:
+			resolve_expr(r, s->as.expression);
+			break;
+		case STMT_BLOCK:
+			resolve_block(r, s, true);
+			break;
+		case STMT_RETURN:
+			resolve_exprs(r, s->as.return_stmt.values, s->as.return_stmt.value_count);
+			break;
+		case STMT_ASSIGN:
+			resolve_exprs(r, s->as.assign.values, s->as.assign.value_count);
+			resolve_exprs(r, s->as.assign.targets, s->as.assign.target_count);
+			break;
+		case STMT_LOCAL: {
+			// The values are evaluated before the names exist.
+			resolve_exprs(r, s->as.local.values, s->as.local.value_count);
+			Binding first = { VAR_LOCAL, r->fn->active };
+			for (int i = 0; i < s->as.local.decl_count; i++) declare(r, s->as.local.decls[i].name);
+			bind_declaration(r, s, first);
+			break;
+		}
+		case STMT_IF:
+			// Elseif chains nest through else_branch; walk them in a loop.
+			for (Stmt *branch = s; ; branch = branch->as.if_stmt.else_branch) {
+				resolve_expr(r, branch->as.if_stmt.condition);
+				resolve_block(r, branch->as.if_stmt.then_branch, true);
+
+				Stmt *next = branch->as.if_stmt.else_branch;
+				if (!next || next->kind != STMT_IF) {
+					resolve_block(r, next, true);
+					break;
+				}
+			}
+			break;
+		case STMT_WHILE:
+			resolve_expr(r, s->as.while_stmt.condition);
+			resolve_block(r, s->as.while_stmt.body, true);
+			break;
+		case STMT_REPEAT: {
+			// The condition still sees the body's locals.
+			Scope scope = begin_scope(r);
+			resolve_block(r, s->as.repeat_stmt.body, false);
+			resolve_expr(r, s->as.repeat_stmt.condition);
+			end_scope(r, scope);
+			break;
+		}
+		case STMT_FOR_NUM: {
+			resolve_expr(r, s->as.for_num.start);
+			resolve_expr(r, s->as.for_num.end);
+			resolve_expr(r, s->as.for_num.step);
+
+			Scope scope = begin_scope(r);
+			Binding b = { VAR_LOCAL, declare(r, s->as.for_num.name) };
+			bind_declaration(r, s, b);
+			resolve_block(r, s->as.for_num.body, false);
+			end_scope(r, scope);
+			break;
+		}
+		case STMT_FOR_GEN: {
+			resolve_expr(r, s->as.for_gen.iter);
+
+			Scope scope = begin_scope(r);
+			Binding first = { VAR_LOCAL, r->fn->active };
+			for (int i = 0; i < s->as.for_gen.name_count; i++) declare(r, s->as.for_gen.names[i]);
+			bind_declaration(r, s, first);
+			resolve_block(r, s->as.for_gen.body, false);
+			end_scope(r, scope);
+			break;
+		}
+		case STMT_FUNCTION:
+			// Like Lua: the name assigns to whatever it already means, a
+			// global unless a local of that name is visible.
+			bind_declaration(r, s, lookup(r, s->as.func_decl.name));
+			resolve_function(r, s->as.func_decl.signature, s->as.func_decl.body, false);
+			break;
+		case STMT_IMPL:
+			for (int i = 0; i < s->as.impl_stmt.func_count; i++) {
+				Stmt *method = s->as.impl_stmt.functions[i];
+				if (method) resolve_function(r, method->as.func_decl.signature, method->as.func_decl.body, true);
+			}
+			break;
+		default: break;
+	}
+}
+
+static void resolve_block(Resolver *r, Stmt *block, bool scoped) {
+	if (!block) return;
+	if (block->kind != STMT_BLOCK) {
+		resolve_stmt(r, block);
+		return;
+	}
+
+	Scope scope = begin_scope(r);
+	for (int i = 0; i < block->as.block.stmt_count; i++) resolve_stmt(r, block->as.block.stmts[i]);
+	if (scoped) end_scope(r, scope);
+}
+
+// Function nesting is bounded by the parser's depth limit, so this is the
+// only recursion that follows the tree's depth.
+static FunctionScope *resolve_function(Resolver *r, const FuncSignature *sig, Stmt *body, bool method) {
+	FunctionScope *scope = PUSH_STRUCT(r->arena, FunctionScope);
+	scope->method = method;
+	scope->param_count = sig ? (u32)sig->param_count : 0;
+
+	// Locals maps of enclosing functions don't grow while this one is
+	// open, so they can all share the scratch arena.
+	MemArena *scratch = arena_scratch();
+	u64 mark = scratch->pos;
+
+	FunctionState fn = {0};
+	fn.enclosing = r->fn;
+	fn.scope = scope;
+	fn.locals = ptr_map_create(scratch, 0);
+	r->fn = &fn;
+
+	Scope outer = begin_scope(r);
+	if (method) declare(r, r->self_name);
+	for (u32 i = 0; i < scope->param_count; i++) declare(r, sig->params[i].name);
+
+	if (body) {
+		*ptr_map_put(&r->out->functions, body) = (u64)(uintptr_t)scope;
+		resolve_block(r, body, false);
+	}
+	if (r->shadows) vec_hdr(r->shadows)->size = outer.shadows;
+
+	scope->upvalue_count = (u32)vec_size(fn.upvalues);
+	if (scope->upvalue_count) {
+		scope->upvalues = PUSH_ARRAY_NZ(r->arena, Upvalue, scope->upvalue_count);
+		memcpy(scope->upvalues, fn.upvalues, scope->upvalue_count * sizeof(Upvalue));
+	}
+	vec_free(fn.upvalues);
+
+	r->fn = fn.enclosing;
+	arena_pop_to(scratch, mark);
+	return scope;
+}
+
+Resolution resolve(Stmt *root, StringPool *pool, MemArena *arena) {
+	Resolution out = {0};
+	out.functions = ptr_map_create(arena, 0);
+	out.declarations = ptr_map_create(arena, 0);
+
+	Resolver r = {0};
+	r.arena = arena;
+	r.out = &out;
+	r.self_name = pool_intern(pool, "self", 4);
+	r.globals = ptr_map_create(arena, 0);
+
+	// The chunk itself is a function without params; its locals are frame
+	// slots like any other, which functions declared in it capture.
+	out.main = resolve_function(&r, NULL, root, false);
+
+	out.global_count = (u32)vec_size(r.global_names);
+	if (out.global_count) {
+		out.globals = PUSH_ARRAY_NZ(arena, const char*, out.global_count);
+		memcpy(out.globals, r.global_names, out.global_count * sizeof(const char*));
+	}
+
+	vec_free(r.global_names);
+	vec_free(r.shadows);
+	vec_free(r.work);
+	return out;
+}
+
+FunctionScope *resolution_function(const Resolution *r, const Stmt *body) {
+	u64 *value = body ? ptr_map_get(&r->functions, body) : NULL;
+	return value ? (FunctionScope*)(uintptr_t)*value : NULL;
+}
+
+Binding resolution_binding(const Resolution *r, const Stmt *decl) {
+	u64 *value = ptr_map_get(&r->declarations, decl);
+	Binding none = { VAR_UNRESOLVED, 0 };
+	return value ? unpack_binding(*value) : none;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "arena.h"
+#include "parser.h"
+#include "ptr_map.h"
+#include "string_pool.h"
+#include "typedefs.h"
+
+// Binds every variable reference in a tree to its declaration, writing the
+// scope and slot into the EXPR_VARIABLE node itself. Locals get frame slots
+// that are reused once their block ends, references to an enclosing
+// function's locals become upvalues, and every other name is a global.
+// Impl methods receive self implicitly in slot 0.
+
+// Where a closure finds one of its upvalues when it is created: a slot in
+// the enclosing function's frame, or one of that function's upvalues.
+typedef struct {
+	const char *name;
+	bool local;
+	u32 index;
+} Upvalue;
+
+typedef struct {
+	// Frame size: the most locals alive at once, params and self included.
+	u32 slot_count;
+	u32 param_count;
+	bool method;
+
+	Upvalue *upvalues;
+	u32 upvalue_count;
+} FunctionScope;
+
+typedef struct {
+	VarScope scope;
+	u32 slot;
+} Binding;
+
+typedef struct {
+	FunctionScope *main;
+
+	// Function body -> FunctionScope*, for function expressions, function
+	// declarations and impl methods alike.
+	PtrMap functions;
+
+	// Declaring statement -> packed Binding of its first name. Locals and
+	// loop variables take consecutive slots from there; a function
+	// declaration binds its name to a local or a global.
+	PtrMap declarations;
+
+	const char **globals;
+	u32 global_count;
+} Resolution;
+
+// The tree is expected to come from a successful parse; the pool must be
+// the one its names were interned in. Results live in the arena.
+Resolution resolve(Stmt *root, StringPool *pool, MemArena *arena);
+
+FunctionScope *resolution_function(const Resolution *r, const Stmt *body);
+Binding resolution_binding(const Resolution *r, const Stmt *decl);
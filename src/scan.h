@@ -0,0 +1,124 @@
+#pragma once
+#include <stdbool.h>
+#include <string.h>
+
+#include "typedefs.h"
+
+// Byte scanning primitives for the lexer's hot loops. Each one works on the
+// range [p, end), uses 16 byte vectors where the target has them and finishes
+// the tail with plain byte loops, so callers never read past end.
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define SCAN_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define SCAN_NEON 1
+#endif
+
+#define SCAN_WIDTH 16
+
+static inline bool scan_is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+#if SCAN_NEON
+// NEON has no movemask; narrowing leaves 4 bits per byte lane instead of 1.
+static inline u64 scan_neon_mask(uint8x16_t eq) {
+	uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+#endif
+
+// First byte that is not ' ', '\t', '\r' or '\n'.
+static inline const char *scan_skip_space(const char *p, const char *end) {
+#if SCAN_SSE2
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab   = _mm_set1_epi8('\t');
+	const __m128i cr    = _mm_set1_epi8('\r');
+	const __m128i lf    = _mm_set1_epi8('\n');
+
+	while (end - p >= SCAN_WIDTH) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+		                          _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+
+		u32 other = ~(u32)_mm_movemask_epi8(ws) & 0xFFFF;
+		if (other) return p + __builtin_ctz(other);
+		p += SCAN_WIDTH;
+	}
+#elif SCAN_NEON
+	const uint8x16_t space = vdupq_n_u8(' ');
+	const uint8x16_t tab   = vdupq_n_u8('\t');
+	const uint8x16_t cr    = vdupq_n_u8('\r');
+	const uint8x16_t lf    = vdupq_n_u8('\n');
+
+	while (end - p >= SCAN_WIDTH) {
+		uint8x16_t v = vld1q_u8((const u8*)p);
+		uint8x16_t ws = vorrq_u8(vorrq_u8(vceqq_u8(v, space), vceqq_u8(v, tab)),
+		                         vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf)));
+
+		u64 other = ~scan_neon_mask(ws);
+		if (other) return p + (__builtin_ctzll(other) >> 2);
+		p += SCAN_WIDTH;
+	}
+#endif
+
+	while (p < end && scan_is_space(*p)) p++;
+	return p;
+}
+
+// First occurrence of c, or end when there is none.
+static inline const char *scan_find_byte(const char *p, const char *end, char c) {
+#if SCAN_SSE2
+	const __m128i needle = _mm_set1_epi8(c);
+
+	while (end - p >= SCAN_WIDTH) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		u32 hits = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+		if (hits) return p + __builtin_ctz(hits);
+		p += SCAN_WIDTH;
+	}
+#elif SCAN_NEON
+	const uint8x16_t needle = vdupq_n_u8((u8)c);
+
+	while (end - p >= SCAN_WIDTH) {
+		uint8x16_t v = vld1q_u8((const u8*)p);
+		u64 hits = scan_neon_mask(vceqq_u8(v, needle));
+		if (hits) return p + (__builtin_ctzll(hits) >> 2);
+		p += SCAN_WIDTH;
+	}
+#else
+	const char *hit = memchr(p, c, end - p);
+	return hit ? hit : end;
+#endif
+
+	while (p < end && *p != c) p++;
+	return p;
+}
+
+// Number of times c occurs in the range.
+static inline u64 scan_count_byte(const char *p, const char *end, char c) {
+	u64 count = 0;
+
+#if SCAN_SSE2
+	const __m128i needle = _mm_set1_epi8(c);
+
+	while (end - p >= SCAN_WIDTH) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		count += __builtin_popcount((u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+		p += SCAN_WIDTH;
+	}
+#elif SCAN_NEON
+	const uint8x16_t needle = vdupq_n_u8((u8)c);
+
+	while (end - p >= SCAN_WIDTH) {
+		uint8x16_t v = vld1q_u8((const u8*)p);
+		count += __builtin_popcountll(scan_neon_mask(vceqq_u8(v, needle))) >> 2;
+		p += SCAN_WIDTH;
+	}
+#endif
+
+	for (; p < end; p++) count += *p == c;
+	return count;
+}
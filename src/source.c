@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+#include "arena.h"
+#include "scan.h"
+#include "token.h"
+
+#define SOURCE_READ_CHUNK KiB(64)
+
+// Fallback for pipes, ttys and stdin, where the size isn't known up front.
+static bool read_stream(SourceFile *src, MemArena *arena, int fd) {
+	u64 capacity = SOURCE_READ_CHUNK;
+	u64 length = 0;
+	char *buffer = arena_push(arena, capacity, true);
+	if (!buffer) return false;
+
+	while (true) {
+		if (length == capacity) {
+			buffer = arena_resize(arena, buffer, capacity, capacity * 2);
+			if (!buffer) return false;
+			capacity *= 2;
+		}
+
+		ssize_t n = read(fd, buffer + length, capacity - length);
+		if (n < 0) return false;
+		if (n == 0) break;
+		length += n;
+
+		if (length > TOKEN_MAX_SOURCE_LENGTH) {
+			src->length = length;
+			return false;
+		}
+	}
+
+	src->data = buffer;
+	src->length = length;
+	src->mapped = false;
+	return true;
+}
+
+// Token offsets are u32, so larger inputs are turned away here rather
+// than lexed with offsets that wrap.
+static void report_too_large(const char *path) {
+	fprintf(stderr, "Error: file is too large (4 GiB or more): '%s'\n", path);
+}
+
+bool source_open(SourceFile *src, MemArena *arena, const char *path) {
+	src->length = 0;
+
+	if (strcmp(path, "-") == 0) {
+		if (!read_stream(src, arena, STDIN_FILENO)) {
+			if (src->length > TOKEN_MAX_SOURCE_LENGTH) report_too_large("-");
+			else fprintf(stderr, "Error: could not read stdin\n");
+			return false;
+		}
+		return true;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error: Could not open file: '%s'\n", path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "Error: could not stat file: '%s'\n", path);
+		close(fd);
+		return false;
+	}
+
+	if (S_ISREG(st.st_mode) && (u64)st.st_size > TOKEN_MAX_SOURCE_LENGTH) {
+		report_too_large(path);
+		close(fd);
+		return false;
+	}
+
+	bool ok = true;
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mem != MAP_FAILED) {
+			madvise(mem, st.st_size, MADV_SEQUENTIAL);
+			src->data = mem;
+			src->length = st.st_size;
+			src->mapped = true;
+		} else ok = read_stream(src, arena, fd);
+	} else if (S_ISREG(st.st_mode)) {
+		src->data = "";
+		src->length = 0;
+		src->mapped = false;
+	} else ok = read_stream(src, arena, fd);
+
+	if (!ok && src->length > TOKEN_MAX_SOURCE_LENGTH) report_too_large(path);
+	else if (!ok) fprintf(stderr, "Error: could not read entire file: '%s'\n", path);
+
+	close(fd);
+	return ok;
+}
+
+void source_close(SourceFile *src) {
+	if (src->mapped) munmap((void*)src->data, src->length);
+	src->data = NULL;
+	src->length = 0;
+	src->mapped = false;
+}
+
+LineIndex line_index_build(MemArena *arena, const char *data, u64 length) {
+	const char *end = data + length;
+
+	u32 count = 1 + (u32)scan_count_byte(data, end, '\n');
+
+	LineIndex lines;
+	lines.starts = PUSH_ARRAY_NZ(arena, u32, count);
+	lines.count = count;
+
+	lines.starts[0] = 0;
+	u32 i = 1;
+	for (const char *p = data; (p = memchr(p, '\n', end - p)); p++) {
+		lines.starts[i++] = (u32)(p + 1 - data);
+	}
+
+	return lines;
+}
+
+u32 line_index_line(const LineIndex *lines, u32 offset) {
+	u32 lo = 0, hi = lines->count;
+	while (hi - lo > 1) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (lines->starts[mid] <= offset) lo = mid;
+		else hi = mid;
+	}
+	return lo + 1;
+}
+
+void line_index_locate(const LineIndex *lines, u32 offset, u32 *line, u32 *column) {
+	*line = line_index_line(lines, offset);
+	*column = offset - lines->starts[*line - 1] + 1;
+}
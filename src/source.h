@@ -0,0 +1,29 @@
+#pragma once
+#include <stdbool.h>
+
+#include "arena.h"
+#include "typedefs.h"
+
+// Source text of one input. Regular files are mapped read-only and are not
+// NUL-terminated, so consumers must treat it as the range [data, data+length).
+typedef struct {
+	const char *data;
+	u64 length;
+	bool mapped;
+} SourceFile;
+
+bool source_open(SourceFile *src, MemArena *arena, const char *path);
+void source_close(SourceFile *src);
+
+// Offsets of the first byte of every line, for turning a byte offset back
+// into a line number when a diagnostic is reported.
+typedef struct {
+	u32 *starts;
+	u32 count;
+} LineIndex;
+
+LineIndex line_index_build(MemArena *arena, const char *data, u64 length);
+u32 line_index_line(const LineIndex *lines, u32 offset);
+
+// Line and byte column, both 1-based.
+void line_index_locate(const LineIndex *lines, u32 offset, u32 *line, u32 *column);
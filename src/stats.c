@@ -0,0 +1,100 @@
+#include <time.h>
+
+#include "stats.h"
+#include "debug.h"
+#include "parser.h"
+#include "token.h"
+
+_Static_assert(TOKEN_PIPE < STATS_MAX_KINDS, "token kinds don't fit the stats tables");
+_Static_assert(EXPR_STRUCT < STATS_MAX_KINDS, "expr kinds don't fit the stats tables");
+_Static_assert(STMT_TYPE_ALIAS < STATS_MAX_KINDS, "stmt kinds don't fit the stats tables");
+
+#ifdef LUAT_STATS
+Stats luat_stats;
+#endif
+
+static const char *phase_names[PHASE_COUNT] = {
+	[PHASE_READ]  = "read",
+	[PHASE_LEX]   = "lex",
+	[PHASE_PARSE] = "parse",
+	[PHASE_RESOLVE] = "resolve",
+	[PHASE_CHECK] = "check",
+	[PHASE_COMPILE] = "compile",
+	[PHASE_RUN] = "run",
+	[PHASE_DUMP]  = "dump",
+};
+
+double stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Zero counts are left out to keep the object readable.
+static void fprint_kind_counts(FILE *f, const char *key, const u64 *counts, u32 count, const char *(*name)(u32)) {
+	fprintf(f, ",\"%s\":{", key);
+	bool first = true;
+	for (u32 i = 0; i < count; i++) {
+		if (!counts[i]) continue;
+		fprintf(f, "%s\"%s\":%llu", first ? "" : ",", name(i), (unsigned long long)counts[i]);
+		first = false;
+	}
+	fprintf(f, "}");
+}
+
+static const char *token_name(u32 kind) { return token_kind_str((TokenKind)kind); }
+
+#ifdef LUAT_STATS
+static const char *expr_name(u32 kind) { return expr_kind_str((ExprKind)kind); }
+static const char *stmt_name(u32 kind) { return stmt_kind_str((StmtKind)kind); }
+#endif
+
+void stats_fprint_json(FILE *f, const StatsReport *report) {
+	fprintf(f, "{\"bytes\":%llu,\"files\":%u,\"cache_hit\":%s,\"counters\":%s",
+		(unsigned long long)report->bytes, report->files,
+		report->cache_hit ? "true" : "false", STATS_ENABLED ? "true" : "false");
+
+	double total = 0;
+	fprintf(f, ",\"phases_ms\":{");
+	for (u32 i = 0; i < PHASE_COUNT; i++) {
+		fprintf(f, "%s\"%s\":%.3f", i ? "," : "", phase_names[i], report->phase_seconds[i] * 1e3);
+		total += report->phase_seconds[i];
+	}
+	fprintf(f, ",\"total\":%.3f}", total * 1e3);
+
+	if (report->token_kinds) {
+		u64 tokens = 0;
+		for (u32 i = 0; i <= TOKEN_PIPE; i++) tokens += report->token_kinds[i];
+		fprintf(f, ",\"tokens\":%llu", (unsigned long long)tokens);
+		fprint_kind_counts(f, "token_kinds", report->token_kinds, TOKEN_PIPE + 1, token_name);
+	}
+
+	fprintf(f, ",\"arenas\":{");
+	for (u32 i = 0; i < report->arena_count; i++) {
+		const ArenaUsage *a = &report->arenas[i];
+		fprintf(f, "%s\"%s\":{\"high_water\":%llu,\"committed\":%llu}", i ? "," : "",
+			a->name, (unsigned long long)a->high_water, (unsigned long long)a->committed);
+	}
+	fprintf(f, "}");
+
+#ifdef LUAT_STATS
+	const Stats *s = &luat_stats;
+	u64 nodes = 0;
+	for (u32 i = 0; i <= EXPR_STRUCT; i++) nodes += s->expr_kinds[i];
+	for (u32 i = 0; i <= STMT_TYPE_ALIAS; i++) nodes += s->stmt_kinds[i];
+
+	fprintf(f, ",\"nodes\":%llu", (unsigned long long)nodes);
+	fprint_kind_counts(f, "expr_kinds", s->expr_kinds, EXPR_STRUCT + 1, expr_name);
+	fprint_kind_counts(f, "stmt_kinds", s->stmt_kinds, STMT_TYPE_ALIAS + 1, stmt_name);
+
+	u64 lookups = s->intern_hits + s->intern_misses;
+	fprintf(f, ",\"intern\":{\"hits\":%llu,\"misses\":%llu,\"avg_probe_length\":%.3f}",
+		(unsigned long long)s->intern_hits, (unsigned long long)s->intern_misses,
+		lookups ? (double)s->intern_probes / (double)lookups : 0.0);
+	fprintf(f, ",\"arena_push\":{\"calls\":%llu,\"bytes\":%llu},\"vec_grows\":%llu",
+		(unsigned long long)s->arena_pushes, (unsigned long long)s->arena_push_bytes,
+		(unsigned long long)s->vec_grows);
+#endif
+
+	fprintf(f, "}\n");
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "typedefs.h"
+
+// Counters behind --stats. They only exist when built with LUAT_STATS
+// (make STATS=1); otherwise the STAT_ macros expand to nothing and the
+// instrumented paths compile exactly as they would without them.
+
+#define STATS_MAX_KINDS 64
+
+typedef struct {
+	u64 expr_kinds[STATS_MAX_KINDS];
+	u64 stmt_kinds[STATS_MAX_KINDS];
+
+	// A view that misses locally and finds the string in the shared pool
+	// counts as one hit; probes count every slot looked at on both levels.
+	u64 intern_hits;
+	u64 intern_misses;
+	u64 intern_probes;
+
+	u64 arena_pushes;
+	u64 arena_push_bytes;
+	u64 vec_grows;
+} Stats;
+
+#ifdef LUAT_STATS
+extern Stats luat_stats;
+#define STATS_ENABLED 1
+#define STAT_ADD(field, n) __atomic_fetch_add(&luat_stats.field, (u64)(n), __ATOMIC_RELAXED)
+#else
+#define STATS_ENABLED 0
+#define STAT_ADD(field, n) ((void)0)
+#endif
+
+#define STAT_INC(field) STAT_ADD(field, 1)
+
+typedef enum {
+	PHASE_READ, PHASE_LEX, PHASE_PARSE, PHASE_RESOLVE, PHASE_CHECK, PHASE_COMPILE, PHASE_RUN, PHASE_DUMP,
+	PHASE_COUNT
+} Phase;
+
+typedef struct {
+	const char *name;
+	u64 high_water;
+	u64 committed;
+} ArenaUsage;
+
+// What main measured itself; the counters above are added when compiled in.
+typedef struct {
+	double phase_seconds[PHASE_COUNT];
+	u64 bytes;
+	u32 files;
+	bool cache_hit;
+
+	// Left NULL when the run never had a token list.
+	const u64 *token_kinds;
+
+	ArenaUsage arenas[8];
+	u32 arena_count;
+} StatsReport;
+
+double stats_now(void);
+void stats_fprint_json(FILE *f, const StatsReport *report);
@@ -3,47 +3,204 @@
 
 #include "string_pool.h"
 #include "arena.h"
+#include "stats.h"
 
+#define POOL_MIN_CAPACITY 64
+#define POOL_MAX_LOAD_NUM 3
+#define POOL_MAX_LOAD_DEN 4
+
+#define POOL_STRINGS_RESERVE GiB(4)
+#define POOL_SHARED_SLOTS_RESERVE GiB(1)
+
+#define HASH_K0 0x9e3779b97f4a7c15ull
+#define HASH_K1 0xbf58476d1ce4e5b9ull
+
+static inline u64 load_u64(const char *p) {
+	u64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u64 load_u32(const char *p) {
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u64 mix(u64 a, u64 b) {
+	__uint128_t r = (__uint128_t)(a ^ HASH_K0) * (b ^ HASH_K1);
+	return (u64)r ^ (u64)(r >> 64);
+}
+
+// Word-at-a-time hash: eight bytes per step, and the tail is read with
+// overlapping loads instead of a byte loop.
 static u64 hash_string(const char *str, u64 length) {
-	u64 hash = 0xcbf29ce484222325;
-	for (u64 i = 0; i < length; i++) {
-			hash ^= (u8)str[i];
-			hash *= 0x100000001b3;
+	const char *p = str;
+	u64 hash = length * HASH_K1;
+
+	if (length <= 8) {
+		u64 a = 0, b = 0;
+		if (length >= 4) {
+			a = load_u32(p);
+			b = load_u32(p + length - 4);
+		} else if (length > 0) {
+			a = ((u64)(u8)p[0] << 16) | ((u64)(u8)p[length >> 1] << 8) | (u8)p[length - 1];
+		}
+		return mix(hash ^ a, b);
 	}
-	return hash;
+
+	const char *end = str + length;
+	while (end - p > 8) {
+		hash = mix(hash, load_u64(p));
+		p += 8;
+	}
+	return mix(hash, load_u64(end - 8));
 }
 
-StringPool pool_create(MemArena *arena, u64 capacity) {
+u64 hash_bytes(const char *data, u64 length) {
+	return hash_string(data, length);
+}
+
+static StringPool pool_init(MemArena *arena, MemArena *strings, u64 capacity) {
 	StringPool pool;
 	pool.arena = arena;
-	pool.capacity = capacity;
+	pool.strings = strings;
+	pool.count = 0;
+	pool.shared = NULL;
+
+	pool.capacity = POOL_MIN_CAPACITY;
+	while (pool.capacity < capacity) pool.capacity <<= 1;
 
-	pool.buckets = arena_push(arena, sizeof(StringEntry*) * capacity, false);
+	pool.slots = PUSH_ARRAY(arena, StringSlot, pool.capacity);
 
 	return pool;
+}
+
+StringPool pool_create(MemArena *arena, u64 capacity) {
+	return pool_init(arena, arena_create_reserve(POOL_STRINGS_RESERVE), capacity);
 };
 
-const char *pool_intern(StringPool *pool, const char *start, u64 length) {
-	u64 hash = hash_string(start, length);
-	u64 index = hash % pool->capacity;
+void pool_destroy(StringPool *pool) {
+	if (!pool->shared) arena_destroy(pool->strings);
+	pool->strings = NULL;
+	pool->slots = NULL;
+	pool->count = 0;
+}
+
+void pool_clear(StringPool *pool) {
+	memset(pool->slots, 0, pool->capacity * sizeof(StringSlot));
+	pool->count = 0;
+	if (!pool->shared) arena_clear(pool->strings);
+}
+
+// The shared table grows while other threads wait on the lock, so it gets
+// an arena of its own instead of borrowing one from a caller.
+SharedStringPool *shared_pool_create(u64 capacity) {
+	MemArena *arena = arena_create_reserve(POOL_SHARED_SLOTS_RESERVE);
+	if (!arena) return NULL;
+
+	SharedStringPool *shared = PUSH_STRUCT(arena, SharedStringPool);
+	shared->pool = pool_create(arena, capacity);
+	pthread_mutex_init(&shared->lock, NULL);
+
+	return shared;
+}
 
-	for (StringEntry *entry = pool->buckets[index]; entry != NULL; entry = entry->next) {
+void shared_pool_destroy(SharedStringPool *shared) {
+	MemArena *arena = shared->pool.arena;
+	pthread_mutex_destroy(&shared->lock);
+	pool_destroy(&shared->pool);
+	arena_destroy(arena);
+}
+
+StringPool pool_create_view(SharedStringPool *shared, MemArena *arena, u64 capacity) {
+	StringPool pool = pool_init(arena, shared->pool.strings, capacity);
+	pool.shared = shared;
+	return pool;
+}
+
+static void pool_grow(StringPool *pool) {
+	u64 new_capacity = pool->capacity * 2;
+	u64 mask = new_capacity - 1;
+	StringSlot *new_slots = PUSH_ARRAY(pool->arena, StringSlot, new_capacity);
+
+	for (u64 i = 0; i < pool->capacity; i++) {
+		StringSlot *slot = &pool->slots[i];
+		if (!slot->str) continue;
+
+		u64 index = slot->hash & mask;
+		while (new_slots[index].str) index = (index + 1) & mask;
+		new_slots[index] = *slot;
+	}
+
+	pool->slots = new_slots;
+	pool->capacity = new_capacity;
+}
+
+static const char *intern_hashed(StringPool *pool, const char *start, u64 length, u64 hash) {
+	u64 mask = pool->capacity - 1;
+	u64 index = hash & mask;
+
+	for (StringSlot *slot = &pool->slots[index]; slot->str; slot = &pool->slots[index]) {
+		STAT_INC(intern_probes);
 		if (
-			entry->length == length &&
-			memcmp(entry->str, start, length) == 0
-		) return entry->str;
+			slot->hash == hash &&
+			slot->length == length &&
+			memcmp(slot->str, start, length) == 0
+		) {
+			STAT_INC(intern_hits);
+			return slot->str;
+		}
+		index = (index + 1) & mask;
 	}
 
-	char *new_str = arena_push(pool->arena, length+1, false);
-	memcpy(new_str, start, length);
-	new_str[length] = '\0';
+	char *new_str;
+	if (pool->shared) {
+		pthread_mutex_lock(&pool->shared->lock);
+		new_str = (char*)intern_hashed(&pool->shared->pool, start, length, hash);
+		pthread_mutex_unlock(&pool->shared->lock);
+	} else {
+		STAT_INC(intern_misses);
+		new_str = arena_push(pool->strings, length+1, true);
+		memcpy(new_str, start, length);
+		new_str[length] = '\0';
+	}
 
-	StringEntry *new_entry = PUSH_STRUCT(pool->arena, StringEntry);
-	new_entry->length = length;
-	new_entry->str = new_str;
+	StringSlot *slot = &pool->slots[index];
+	slot->hash = hash;
+	slot->str = new_str;
+	slot->length = length;
 
-	new_entry->next = pool->buckets[index];
-	pool->buckets[index] = new_entry;
+	if (++pool->count * POOL_MAX_LOAD_DEN > pool->capacity * POOL_MAX_LOAD_NUM) {
+		pool_grow(pool);
+	}
 
 	return new_str;
 };
+
+static const char *find_hashed(StringPool *pool, const char *start, u64 length, u64 hash) {
+	u64 mask = pool->capacity - 1;
+	for (u64 index = hash & mask; pool->slots[index].str; index = (index + 1) & mask) {
+		StringSlot *slot = &pool->slots[index];
+		if (slot->hash == hash && slot->length == length && memcmp(slot->str, start, length) == 0) return slot->str;
+	}
+
+	if (!pool->shared) return NULL;
+
+	pthread_mutex_lock(&pool->shared->lock);
+	const char *str = find_hashed(&pool->shared->pool, start, length, hash);
+	pthread_mutex_unlock(&pool->shared->lock);
+	return str;
+}
+
+const char *pool_find(StringPool *pool, const char *start, u64 length) {
+	return find_hashed(pool, start, length, hash_string(start, length));
+}
+
+const char *pool_intern(StringPool *pool, const char *start, u64 length) {
+	return intern_hashed(pool, start, length, hash_string(start, length));
+}
+
+u32 pool_intern_id(StringPool *pool, const char *start, u64 length) {
+	return pool_id(pool, pool_intern(pool, start, length));
+}
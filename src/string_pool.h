@@ -1,19 +1,61 @@
 #pragma once
+#include <pthread.h>
 
 #include "arena.h"
 #include "typedefs.h"
 
-typedef struct StringEntry {
-	struct StringEntry *next;
+typedef struct {
+	u64 hash;
+	const char *str;
 	u64 length;
-	char *str;
-} StringEntry;
+} StringSlot;
 
-typedef struct {
+// Open-addressing table of interned strings. The slot array is regrown in
+// the arena once it passes the load factor; the strings themselves live in
+// a separate reserved arena and are never moved, so interned pointers stay
+// valid across a resize and a string's offset in that arena doubles as a
+// compact u32 id. Id 0 is never handed out.
+typedef struct StringPool StringPool;
+typedef struct SharedStringPool SharedStringPool;
+
+struct StringPool {
 	MemArena *arena;
-	StringEntry **buckets;
+	MemArena *strings;
+	StringSlot *slots;
 	u64 capacity;
-} StringPool;
+	u64 count;
+
+	// Set for a per-thread view of a shared pool. The local table is only a
+	// cache: misses are interned in the shared pool under its lock, so every
+	// view hands out the same pointer (and id) for the same text.
+	SharedStringPool *shared;
+};
+
+struct SharedStringPool {
+	StringPool pool;
+	pthread_mutex_t lock;
+};
 
 StringPool pool_create(MemArena *arena, u64 capacity);
+void pool_destroy(StringPool *pool);
+
+// Forgets every string, invalidating their pointers and ids, but keeps the
+// slot table at the size it has grown to. A view only drops its cache.
+void pool_clear(StringPool *pool);
+
+SharedStringPool *shared_pool_create(u64 capacity);
+void shared_pool_destroy(SharedStringPool *shared);
+StringPool pool_create_view(SharedStringPool *shared, MemArena *arena, u64 capacity);
+
+// The pool's string hash, exposed for content keys elsewhere.
+u64 hash_bytes(const char *data, u64 length);
+
 const char *pool_intern(StringPool *pool, const char *start, u64 length);
+u32 pool_intern_id(StringPool *pool, const char *start, u64 length);
+
+// The interned copy of the text, or NULL if it was never interned; the
+// pool is left as it was.
+const char *pool_find(StringPool *pool, const char *start, u64 length);
+
+#define pool_str(pool, id) ((const char*)(pool)->strings + (id))
+#define pool_id(pool, str) ((u32)((const char*)(str) - (const char*)(pool)->strings))
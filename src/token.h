@@ -7,6 +7,7 @@ typedef enum {
 	TOKEN_IDENTIFIER,
 	TOKEN_STRING,
 	TOKEN_NUMBER,
+	TOKEN_INTEGER,
 
 	TOKEN_LOCAL, TOKEN_FUNCTION, TOKEN_STRUCT, TOKEN_TRAIT, TOKEN_IMPL,
 	TOKEN_RETURN, TOKEN_IF, TOKEN_THEN, TOKEN_ELSE, TOKEN_ELSEIF,
@@ -36,11 +37,31 @@ typedef enum {
 	TOKEN_PIPE,
 } TokenKind;
 
+// A single token as seen by the parser. Text is referenced by offset into
+// the source and by intern id; the line is looked up from the offset only
+// when it is actually needed. Numbers have no interned text: an integer's
+// id is its value, a number's id names its double in the pool.
 typedef struct {
 	TokenKind kind;
-	const char *start;
-	u64 length;
-	u64 line;
-
-	const char *text;
+	u32 offset;
+	u32 length;
+	u32 id;
 } Token;
+
+// Offsets and lengths are u32, so sources are limited to this many bytes.
+// The lexer turns a longer one into a single error token.
+#define TOKEN_MAX_SOURCE_LENGTH ((u64)UINT32_MAX - 1)
+
+// Structure-of-arrays storage for a fully lexed file, so a scan over token
+// kinds touches one byte per token.
+typedef struct {
+	u8 *kinds;
+	u32 *offsets;
+	u32 *lengths;
+	u32 *ids;
+	u32 count;
+	u32 capacity;
+
+	const char *source;
+	u64 source_length;
+} TokenList;
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "type_table.h"
+#include "arena.h"
+
+#define TYPE_TABLE_MIN_CAPACITY 64
+#define TYPE_TABLE_MAX_LOAD_NUM 3
+#define TYPE_TABLE_MAX_LOAD_DEN 4
+
+#define HASH_K0 0x9e3779b97f4a7c15ull
+#define HASH_K1 0xbf58476d1ce4e5b9ull
+
+static inline u64 mix(u64 hash, u64 value) {
+	__uint128_t r = (__uint128_t)(hash ^ value ^ HASH_K0) * HASH_K1;
+	return (u64)r ^ (u64)(r >> 64);
+}
+
+#define mix_ptr(hash, p) mix((hash), (u64)(uintptr_t)(p))
+
+static u64 hash_types(u64 hash, Type **types, int count) {
+	hash = mix(hash, (u64)count);
+	for (int i = 0; i < count; i++) hash = mix_ptr(hash, types[i]);
+	return hash;
+}
+
+static u64 hash_signature(u64 hash, const FuncSignature *sig) {
+	if (!sig) return mix(hash, 0);
+
+	hash = mix(hash, (u64)sig->generic_count);
+	for (int i = 0; i < sig->generic_count; i++) {
+		hash = mix_ptr(hash, sig->generics[i].name);
+		hash = hash_types(hash, sig->generics[i].constraints, sig->generics[i].constraint_count);
+	}
+
+	hash = mix(hash, (u64)sig->param_count);
+	for (int i = 0; i < sig->param_count; i++) {
+		hash = mix_ptr(hash, sig->params[i].name);
+		hash = mix_ptr(hash, sig->params[i].type);
+	}
+
+	return hash_types(hash, sig->return_types, sig->return_count);
+}
+
+static u64 hash_type(const Type *t) {
+	u64 hash = mix(0, (u64)t->kind);
+
+	switch (t->kind) {
+		case TYPE_STRUCT:
+		case TYPE_TRAIT:
+			hash = mix_ptr(hash, t->as.user_type.name);
+			return hash_types(hash, t->as.user_type.args, t->as.user_type.arg_count);
+		case TYPE_GENERIC:  return mix_ptr(hash, t->as.param_name);
+		case TYPE_ARRAY:    return mix_ptr(hash, t->as.array.inner);
+		case TYPE_FUNCTION: return hash_signature(hash, t->as.function.sig);
+		default:            return hash;
+	}
+}
+
+static bool same_types(Type **a, Type **b, int count) {
+	return count == 0 || memcmp(a, b, count * sizeof(Type*)) == 0;
+}
+
+static bool same_signature(const FuncSignature *a, const FuncSignature *b) {
+	if (a == b) return true;
+	if (!a || !b) return false;
+
+	if (
+		a->generic_count != b->generic_count ||
+		a->param_count != b->param_count ||
+		a->return_count != b->return_count
+	) return false;
+
+	for (int i = 0; i < a->generic_count; i++) {
+		const GenericParam *x = &a->generics[i], *y = &b->generics[i];
+		if (x->name != y->name || x->constraint_count != y->constraint_count) return false;
+		if (!same_types(x->constraints, y->constraints, x->constraint_count)) return false;
+	}
+
+	for (int i = 0; i < a->param_count; i++) {
+		if (a->params[i].name != b->params[i].name || a->params[i].type != b->params[i].type) return false;
+	}
+
+	return same_types(a->return_types, b->return_types, a->return_count);
+}
+
+static bool same_type(const Type *a, const Type *b) {
+	if (a->kind != b->kind) return false;
+
+	switch (a->kind) {
+		case TYPE_STRUCT:
+		case TYPE_TRAIT:
+			return a->as.user_type.name == b->as.user_type.name &&
+			       a->as.user_type.arg_count == b->as.user_type.arg_count &&
+			       same_types(a->as.user_type.args, b->as.user_type.args, a->as.user_type.arg_count);
+		case TYPE_GENERIC:  return a->as.param_name == b->as.param_name;
+		case TYPE_ARRAY:    return a->as.array.inner == b->as.array.inner;
+		case TYPE_FUNCTION: return same_signature(a->as.function.sig, b->as.function.sig);
+		default:            return true;
+	}
+}
+
+TypeTable *type_table_create(MemArena *arena, u64 capacity) {
+	TypeTable *table = PUSH_STRUCT(arena, TypeTable);
+	table->arena = arena;
+
+	table->capacity = TYPE_TABLE_MIN_CAPACITY;
+	while (table->capacity < capacity) table->capacity <<= 1;
+	table->slots = PUSH_ARRAY(arena, TypeSlot, table->capacity);
+
+	return table;
+}
+
+static void type_table_grow(TypeTable *table) {
+	u64 new_capacity = table->capacity * 2;
+	u64 mask = new_capacity - 1;
+	TypeSlot *new_slots = PUSH_ARRAY(table->arena, TypeSlot, new_capacity);
+
+	for (u64 i = 0; i < table->capacity; i++) {
+		TypeSlot *slot = &table->slots[i];
+		if (!slot->type) continue;
+
+		u64 index = slot->hash & mask;
+		while (new_slots[index].type) index = (index + 1) & mask;
+		new_slots[index] = *slot;
+	}
+
+	table->slots = new_slots;
+	table->capacity = new_capacity;
+}
+
+Type *type_intern(TypeTable *table, const Type *key) {
+	// Primitives carry nothing but their kind, so they skip the hash table.
+	if (key->kind <= TYPE_STRING) {
+		Type **primitive = &table->primitives[key->kind];
+		if (!*primitive) {
+			*primitive = PUSH_STRUCT(table->arena, Type);
+			(*primitive)->kind = key->kind;
+		}
+		return *primitive;
+	}
+
+	u64 hash = hash_type(key);
+	u64 mask = table->capacity - 1;
+	u64 index = hash & mask;
+
+	for (TypeSlot *slot = &table->slots[index]; slot->type; slot = &table->slots[index]) {
+		if (slot->hash == hash && same_type(slot->type, key)) return slot->type;
+		index = (index + 1) & mask;
+	}
+
+	Type *t = PUSH_STRUCT_NZ(table->arena, Type);
+	*t = *key;
+
+	bool user_type = key->kind == TYPE_STRUCT || key->kind == TYPE_TRAIT;
+	if (user_type && key->as.user_type.arg_count) {
+		u64 size = key->as.user_type.arg_count * sizeof(Type*);
+		t->as.user_type.args = arena_push(table->arena, size, true);
+		memcpy(t->as.user_type.args, key->as.user_type.args, size);
+	}
+
+	TypeSlot *slot = &table->slots[index];
+	slot->hash = hash;
+	slot->type = t;
+
+	if (++table->count * TYPE_TABLE_MAX_LOAD_DEN > table->capacity * TYPE_TABLE_MAX_LOAD_NUM) {
+		type_table_grow(table);
+	}
+
+	return t;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "arena.h"
+#include "parser.h"
+#include "typedefs.h"
+
+typedef struct {
+	u64 hash;
+	Type *type;
+} TypeSlot;
+
+// Hash-consing table for types: every structurally distinct type exists
+// once, so two types are equal exactly when their pointers are. A type is
+// keyed on its kind, its interned name pointer and the (already canonical)
+// pointers of its parts, which makes hashing and comparing it shallow.
+// Canonical types are shared by every annotation that spells them and must
+// never be modified.
+struct TypeTable {
+	MemArena *arena;
+	TypeSlot *slots;
+	u64 capacity;
+	u64 count;
+
+	Type *primitives[TYPE_STRING + 1];
+};
+
+TypeTable *type_table_create(MemArena *arena, u64 capacity);
+
+// Returns the canonical type equal to key, adding a copy of it on a miss.
+// The key's argument array may be temporary; it is copied on insertion.
+// A function type keeps the key's signature, which must outlive the table.
+Type *type_intern(TypeTable *table, const Type *key);
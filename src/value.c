@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "value.h"
+#include "string_pool.h"
+
+#define TABLE_MIN_CAPACITY 8
+#define TABLE_MAX_LOAD_NUM 3
+#define TABLE_MAX_LOAD_DEN 4
+
+#define HASH_K1 0xbf58476d1ce4e5b9ull
+
+ObjString *string_copy(MemArena *arena, const char *chars, u32 length) {
+	ObjString *s = arena_push(arena, sizeof(ObjString) + length + 1, true);
+	s->hash = hash_bytes(chars, length);
+	s->length = length;
+	memcpy(s->chars, chars, length);
+	s->chars[length] = '\0';
+	return s;
+}
+
+bool string_equal(const ObjString *a, const ObjString *b) {
+	return a == b || (a->hash == b->hash && a->length == b->length && memcmp(a->chars, b->chars, a->length) == 0);
+}
+
+bool value_equal(Value a, Value b) {
+	if (a.tag != b.tag) return false;
+
+	switch (a.tag) {
+		case VAL_NIL:     return true;
+		case VAL_BOOL:    return a.as.boolean == b.as.boolean;
+		case VAL_NUMBER:  return a.as.number == b.as.number;
+		case VAL_STRING:  return string_equal(a.as.string, b.as.string);
+		case VAL_TABLE:   return a.as.table == b.as.table;
+		case VAL_STRUCT:  return a.as.instance == b.as.instance;
+		case VAL_CLOSURE: return a.as.closure == b.as.closure;
+		case VAL_NATIVE:  return a.as.native == b.as.native;
+	}
+	return false;
+}
+
+const char *value_type_name(Value v) {
+	switch (v.tag) {
+		case VAL_NIL:     return "nil";
+		case VAL_BOOL:    return "boolean";
+		case VAL_NUMBER:  return "number";
+		case VAL_STRING:  return "string";
+		case VAL_TABLE:   return "table";
+		case VAL_STRUCT:  return v.as.instance->layout->name->chars;
+		case VAL_CLOSURE:
+		case VAL_NATIVE:  return "function";
+	}
+	return "?";
+}
+
+static int format_value(char *buf, u32 size, Value v) {
+	switch (v.tag) {
+		case VAL_NIL:     return snprintf(buf, size, "nil");
+		case VAL_BOOL:    return snprintf(buf, size, v.as.boolean ? "true" : "false");
+		case VAL_NUMBER:  return snprintf(buf, size, "%.14g", v.as.number);
+		case VAL_TABLE:   return snprintf(buf, size, "table: %p", (void*)v.as.table);
+		case VAL_STRUCT:  return snprintf(buf, size, "%s: %p", v.as.instance->layout->name->chars, (void*)v.as.instance);
+		case VAL_CLOSURE: return snprintf(buf, size, "function: %p", (void*)v.as.closure);
+		case VAL_NATIVE:  return snprintf(buf, size, "function: builtin");
+		default:          return snprintf(buf, size, "?");
+	}
+}
+
+ObjString *value_to_string(MemArena *arena, Value v) {
+	if (v.tag == VAL_STRING) return v.as.string;
+
+	char buf[64];
+	int n = format_value(buf, sizeof(buf), v);
+	return string_copy(arena, buf, n < 0 ? 0 : (u32)MIN((u32)n, sizeof(buf) - 1));
+}
+
+void fprint_value(FILE *f, Value v) {
+	if (v.tag == VAL_STRING) {
+		fwrite(v.as.string->chars, 1, v.as.string->length, f);
+		return;
+	}
+
+	char buf[64];
+	format_value(buf, sizeof(buf), v);
+	fputs(buf, f);
+}
+
+static inline u64 hash_word(u64 word) {
+	__uint128_t r = (__uint128_t)word * HASH_K1;
+	return (u64)r ^ (u64)(r >> 64);
+}
+
+static u64 hash_value(Value v) {
+	switch (v.tag) {
+		case VAL_BOOL:   return v.as.boolean ? 1 : 2;
+		case VAL_STRING: return v.as.string->hash;
+		case VAL_NUMBER: {
+			// -0 and 0 are the same key.
+			double n = v.as.number == 0 ? 0 : v.as.number;
+			u64 bits;
+			memcpy(&bits, &n, sizeof(bits));
+			return hash_word(bits);
+		}
+		default:         return hash_word((u64)(uintptr_t)v.as.table);
+	}
+}
+
+static TableSlot *find_slot(TableSlot *slots, u32 capacity, Value key) {
+	u32 mask = capacity - 1;
+	u32 index = (u32)hash_value(key) & mask;
+
+	for (;;) {
+		TableSlot *slot = &slots[index];
+		if (IS_NIL(slot->key) || value_equal(slot->key, key)) return slot;
+		index = (index + 1) & mask;
+	}
+}
+
+bool table_get(const Table *table, Value key, Value *out) {
+	if (!table->capacity) return false;
+
+	TableSlot *slot = find_slot(table->slots, table->capacity, key);
+	if (IS_NIL(slot->key) || IS_NIL(slot->value)) return false;
+	*out = slot->value;
+	return true;
+}
+
+static void table_grow(MemArena *arena, Table *table) {
+	u32 capacity = table->capacity ? table->capacity * 2 : TABLE_MIN_CAPACITY;
+	TableSlot *slots = PUSH_ARRAY(arena, TableSlot, capacity);
+
+	// Keys set to nil are dropped on the way.
+	u32 count = 0;
+	for (u32 i = 0; i < table->capacity; i++) {
+		TableSlot *slot = &table->slots[i];
+		if (IS_NIL(slot->key) || IS_NIL(slot->value)) continue;
+		*find_slot(slots, capacity, slot->key) = *slot;
+		count++;
+	}
+
+	table->slots = slots;
+	table->capacity = capacity;
+	table->count = count;
+}
+
+void table_set(MemArena *arena, Table *table, Value key, Value value) {
+	if ((table->count + 1) * TABLE_MAX_LOAD_DEN > table->capacity * TABLE_MAX_LOAD_NUM) {
+		if (IS_NIL(value) && !table->capacity) return;
+		table_grow(arena, table);
+	}
+
+	TableSlot *slot = find_slot(table->slots, table->capacity, key);
+	if (IS_NIL(slot->key)) {
+		if (IS_NIL(value)) return;
+		slot->key = key;
+		table->count++;
+	}
+	slot->value = value;
+}
+
+u32 table_length(const Table *table) {
+	u32 n = 0;
+	Value v;
+	while (table_get(table, NUMBER_VAL((double)n + 1), &v)) n++;
+	return n;
+}
+
+bool table_next(const Table *table, u32 *cursor, Value *key, Value *value) {
+	for (; *cursor < table->capacity; (*cursor)++) {
+		TableSlot *slot = &table->slots[*cursor];
+		if (IS_NIL(slot->key) || IS_NIL(slot->value)) continue;
+
+		*key = slot->key;
+		*value = slot->value;
+		(*cursor)++;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "typedefs.h"
+
+// Runtime values of the bytecode VM. Objects are allocated in the VM's
+// arena and live until it is destroyed; there is no collector, programs
+// run to completion and the arena goes away with them.
+
+typedef struct ObjString ObjString;
+typedef struct Table Table;
+typedef struct Instance Instance;
+typedef struct Closure Closure;
+typedef struct StructLayout StructLayout;
+typedef struct VM VM;
+
+typedef enum {
+	VAL_NIL, VAL_BOOL, VAL_NUMBER, VAL_STRING,
+	VAL_TABLE, VAL_STRUCT, VAL_CLOSURE, VAL_NATIVE
+} ValueTag;
+
+typedef struct Value Value;
+
+// Natives get their arguments in place and write up to
+// NATIVE_MAX_RESULTS results; they return how many, or -1 after setting
+// the VM's error.
+#define NATIVE_MAX_RESULTS 3
+typedef int (*NativeFn)(VM *vm, Value *args, int arg_count, Value *results);
+
+struct Value {
+	ValueTag tag;
+	union {
+		bool boolean;
+		double number;
+		ObjString *string;
+		Table *table;
+		Instance *instance;
+		Closure *closure;
+		NativeFn native;
+	} as;
+};
+
+#define NIL_VAL ((Value){ .tag = VAL_NIL })
+#define BOOL_VAL(b) ((Value){ .tag = VAL_BOOL, .as.boolean = (b) })
+#define NUMBER_VAL(n) ((Value){ .tag = VAL_NUMBER, .as.number = (n) })
+#define STRING_VAL(s) ((Value){ .tag = VAL_STRING, .as.string = (s) })
+
+#define IS_NIL(v) ((v).tag == VAL_NIL)
+#define IS_FALSY(v) ((v).tag == VAL_NIL || ((v).tag == VAL_BOOL && !(v).as.boolean))
+
+struct ObjString {
+	u64 hash;
+	u32 length;
+	char chars[];
+};
+
+typedef struct {
+	Value key;
+	Value value;
+} TableSlot;
+
+// Open addressing on the key's value; assigning nil leaves the key in
+// place with a nil value, which lookups and iteration treat as absent.
+struct Table {
+	TableSlot *slots;
+	u32 capacity;
+	u32 count;
+};
+
+// Field names in declaration order, so a statically typed field access is
+// an index into the instance and only untyped code looks names up.
+// Methods are filled in as the struct's impls run.
+struct StructLayout {
+	ObjString *name;
+	ObjString **fields;
+	u32 field_count;
+	Table methods;
+};
+
+struct Instance {
+	StructLayout *layout;
+	Value fields[];
+};
+
+ObjString *string_copy(MemArena *arena, const char *chars, u32 length);
+bool string_equal(const ObjString *a, const ObjString *b);
+
+bool value_equal(Value a, Value b);
+const char *value_type_name(Value v);
+
+// Lua's tostring rules: numbers as "%.14g", objects by kind and address.
+ObjString *value_to_string(MemArena *arena, Value v);
+void fprint_value(FILE *f, Value v);
+
+// Keys must not be nil or NaN; the VM raises those before getting here.
+bool table_get(const Table *table, Value key, Value *out);
+void table_set(MemArena *arena, Table *table, Value key, Value value);
+
+// Border of the array part: the last n with t[1..n] all non-nil.
+u32 table_length(const Table *table);
+
+// Iteration in slot order. *cursor starts at 0; returns false at the end.
+bool table_next(const Table *table, u32 *cursor, Value *key, Value *value);
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include "arena.h"
+#include "stats.h"
 
 typedef struct {
 	size_t size;
@@ -40,6 +41,7 @@ static inline void *_vec_create(size_t init_cap, size_t elem_size) {
 static inline void _vec_grow(void** vec_ptr, size_t elem_size) {
 	void *vec = *vec_ptr;
 	size_t new_cap = 0;
+	STAT_INC(vec_grows);
 
 	if (vec) {
 		new_cap = vec_hdr(vec)->capacity * 2;
@@ -0,0 +1,559 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "vm.h"
+#include "string_pool.h"
+
+#define VM_STACK_SIZE (1u << 20)
+#define VM_MAX_FRAMES (1u << 16)
+#define VM_ERROR_MAX 256
+
+typedef struct {
+	Closure *closure;
+	Instr *ip;
+	Value *base;
+
+	// Where the caller wants its results, and how many.
+	Value *ret;
+	u32 want;
+} CallFrame;
+
+struct VM {
+	MemArena *arena;
+	const Program *program;
+
+	Value *stack;
+	Value *stack_end;
+	CallFrame *frames;
+	u32 frame_count;
+
+	Value *globals;
+
+	// Closures of impl methods by proto index, for CALL_DIRECT.
+	Closure **methods;
+
+	// Open upvalues, highest stack slot first.
+	Upval *open;
+	const char *error;
+};
+
+static void runtime_error(VM *vm, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void runtime_error(VM *vm, const char *fmt, ...) {
+	char buf[VM_ERROR_MAX];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+
+	const char *where = vm->frame_count ? vm->frames[vm->frame_count - 1].closure->proto->name : NULL;
+	int n = snprintf(NULL, 0, "%s: %s", where ? where : "?", buf);
+	char *message = arena_push(vm->arena, (u64)n + 1, true);
+	snprintf(message, (u64)n + 1, "%s: %s", where ? where : "?", buf);
+	vm->error = message;
+}
+
+// ==========================================
+// NATIVES
+// ==========================================
+
+static int native_print(VM *vm, Value *args, int arg_count, Value *results) {
+	(void)vm; (void)results;
+	for (int i = 0; i < arg_count; i++) {
+		if (i) fputc('\t', stdout);
+		fprint_value(stdout, args[i]);
+	}
+	fputc('\n', stdout);
+	return 0;
+}
+
+static int native_tostring(VM *vm, Value *args, int arg_count, Value *results) {
+	results[0] = STRING_VAL(value_to_string(vm->arena, arg_count ? args[0] : NIL_VAL));
+	return 1;
+}
+
+static int native_type(VM *vm, Value *args, int arg_count, Value *results) {
+	Value v = arg_count ? args[0] : NIL_VAL;
+	// Struct values are tables to Lua code.
+	const char *name = v.tag == VAL_STRUCT ? "table" : value_type_name(v);
+	results[0] = STRING_VAL(string_copy(vm->arena, name, (u32)strlen(name)));
+	return 1;
+}
+
+static const struct { const char *name; NativeFn fn; } natives[] = {
+	{ "print", native_print },
+	{ "tostring", native_tostring },
+	{ "type", native_type },
+};
+
+// ==========================================
+// OBJECTS
+// ==========================================
+
+static Upval *capture(VM *vm, Value *slot) {
+	Upval **link = &vm->open;
+	while (*link && (*link)->location > slot) link = &(*link)->next;
+	if (*link && (*link)->location == slot) return *link;
+
+	Upval *upval = PUSH_STRUCT(vm->arena, Upval);
+	upval->location = slot;
+	upval->next = *link;
+	*link = upval;
+	return upval;
+}
+
+static void close_upvalues(VM *vm, Value *from) {
+	while (vm->open && vm->open->location >= from) {
+		Upval *upval = vm->open;
+		upval->closed = *upval->location;
+		upval->location = &upval->closed;
+		vm->open = upval->next;
+	}
+}
+
+static Closure *new_closure(VM *vm, Proto *proto, Closure *enclosing, Value *base) {
+	Closure *closure = arena_push(vm->arena, sizeof(Closure) + proto->upvalue_count * sizeof(Upval*), true);
+	closure->proto = proto;
+	for (u32 i = 0; i < proto->upvalue_count; i++) {
+		Upvalue *up = &proto->upvalues[i];
+		closure->upvalues[i] = up->local ? capture(vm, base + up->index) : enclosing->upvalues[up->index];
+	}
+	return closure;
+}
+
+static int find_field(const StructLayout *layout, const ObjString *name) {
+	for (u32 i = 0; i < layout->field_count; i++) {
+		if (string_equal(layout->fields[i], name)) return (int)i;
+	}
+	return -1;
+}
+
+static bool get_index(VM *vm, Value object, Value key, Value *out) {
+	if (object.tag == VAL_TABLE) {
+		if (!table_get(object.as.table, key, out)) *out = NIL_VAL;
+		return true;
+	}
+
+	if (object.tag == VAL_STRUCT && key.tag == VAL_STRING) {
+		Instance *instance = object.as.instance;
+		int field = find_field(instance->layout, key.as.string);
+		if (field >= 0) *out = instance->fields[field];
+		else if (!table_get(&instance->layout->methods, key, out)) *out = NIL_VAL;
+		return true;
+	}
+
+	runtime_error(vm, "attempt to index a %s value.", value_type_name(object));
+	return false;
+}
+
+static bool set_index(VM *vm, Value object, Value key, Value value) {
+	if (object.tag == VAL_TABLE) {
+		if (IS_NIL(key)) {
+			runtime_error(vm, "table index is nil.");
+			return false;
+		}
+		if (key.tag == VAL_NUMBER && isnan(key.as.number)) {
+			runtime_error(vm, "table index is NaN.");
+			return false;
+		}
+		table_set(vm->arena, object.as.table, key, value);
+		return true;
+	}
+
+	if (object.tag == VAL_STRUCT && key.tag == VAL_STRING) {
+		Instance *instance = object.as.instance;
+		int field = find_field(instance->layout, key.as.string);
+		if (field < 0) {
+			runtime_error(vm, "'%s' has no field '%s'.", instance->layout->name->chars, key.as.string->chars);
+			return false;
+		}
+		instance->fields[field] = value;
+		return true;
+	}
+
+	runtime_error(vm, "attempt to index a %s value.", value_type_name(object));
+	return false;
+}
+
+static bool concat(VM *vm, Value *from, u32 count, Value *out) {
+	u64 length = 0;
+	for (u32 i = 0; i < count; i++) {
+		Value v = from[i];
+		if (v.tag == VAL_NUMBER) from[i] = STRING_VAL(value_to_string(vm->arena, v));
+		else if (v.tag != VAL_STRING) {
+			runtime_error(vm, "attempt to concatenate a %s value.", value_type_name(v));
+			return false;
+		}
+		length += from[i].as.string->length;
+	}
+	if (length > UINT32_MAX) {
+		runtime_error(vm, "string length overflow.");
+		return false;
+	}
+
+	ObjString *s = arena_push(vm->arena, sizeof(ObjString) + length + 1, true);
+	u64 at = 0;
+	for (u32 i = 0; i < count; i++) {
+		memcpy(s->chars + at, from[i].as.string->chars, from[i].as.string->length);
+		at += from[i].as.string->length;
+	}
+	s->chars[length] = '\0';
+	s->length = (u32)length;
+	s->hash = hash_bytes(s->chars, s->length);
+
+	*out = STRING_VAL(s);
+	return true;
+}
+
+static bool less(VM *vm, Value a, Value b, bool or_equal, bool *out) {
+	if (a.tag == VAL_NUMBER && b.tag == VAL_NUMBER) {
+		*out = or_equal ? a.as.number <= b.as.number : a.as.number < b.as.number;
+		return true;
+	}
+
+	if (a.tag == VAL_STRING && b.tag == VAL_STRING) {
+		u32 n = MIN(a.as.string->length, b.as.string->length);
+		int cmp = memcmp(a.as.string->chars, b.as.string->chars, n);
+		if (cmp == 0) cmp = (a.as.string->length > b.as.string->length) - (a.as.string->length < b.as.string->length);
+		*out = or_equal ? cmp <= 0 : cmp < 0;
+		return true;
+	}
+
+	runtime_error(vm, "attempt to compare %s with %s.", value_type_name(a), value_type_name(b));
+	return false;
+}
+
+static double lua_mod(double a, double b) {
+	return a - floor(a / b) * b;
+}
+
+// ==========================================
+// CALLS
+// ==========================================
+
+// Calls callee with its arguments already at args. A closure gets a new
+// frame whose registers start there; a native runs to completion.
+static bool call_value(VM *vm, Value callee, Value *args, u32 arg_count, Value *ret, u32 want) {
+	if (callee.tag == VAL_NATIVE) {
+		Value results[NATIVE_MAX_RESULTS];
+		int n = callee.as.native(vm, args, (int)arg_count, results);
+		if (n < 0) return false;
+		for (u32 i = 0; i < want; i++) ret[i] = i < (u32)n ? results[i] : NIL_VAL;
+		return true;
+	}
+
+	if (callee.tag != VAL_CLOSURE) {
+		runtime_error(vm, "attempt to call a %s value.", value_type_name(callee));
+		return false;
+	}
+
+	Closure *closure = callee.as.closure;
+	Proto *proto = closure->proto;
+	if (vm->frame_count == VM_MAX_FRAMES || args + proto->frame_size > vm->stack_end) {
+		runtime_error(vm, "Stack overflow.");
+		return false;
+	}
+
+	u32 params = proto->param_count + (proto->method ? 1 : 0);
+	for (u32 i = arg_count; i < params; i++) args[i] = NIL_VAL;
+
+	CallFrame *frame = &vm->frames[vm->frame_count++];
+	frame->closure = closure;
+	frame->ip = proto->code;
+	frame->base = args;
+	frame->ret = ret;
+	frame->want = want;
+	return true;
+}
+
+// ==========================================
+// DISPATCH
+// ==========================================
+
+// With GCC and Clang every handler jumps straight to the next one through
+// a label table, which keeps one indirect branch per opcode for the
+// predictor; elsewhere it is a plain switch in a loop.
+#if defined(__GNUC__)
+#define DISPATCH_BEGIN NEXT();
+#define DISPATCH_END
+#define CASE(op) L_##op:
+#define NEXT() do { in = *ip++; goto *labels[in.op]; } while (0)
+#else
+#define DISPATCH_BEGIN for (;;) { in = *ip++; switch (in.op) {
+#define DISPATCH_END default: break; } }
+#define CASE(op) case op:
+#define NEXT() continue
+#endif
+
+#define R(i) base[i]
+#define K(i) constants[i]
+
+#define LOAD_FRAME() do { \
+	frame = &vm->frames[vm->frame_count - 1]; \
+	ip = frame->ip; \
+	base = frame->base; \
+	closure = frame->closure; \
+	constants = closure->proto->constants; \
+} while (0)
+
+#define SAVE_IP() (frame->ip = ip)
+
+#define THROW(...) do { SAVE_IP(); runtime_error(vm, __VA_ARGS__); goto fail; } while (0)
+#define CHECK(call) do { SAVE_IP(); if (!(call)) goto fail; } while (0)
+
+// Blocks rather than do-while, so NEXT() can be a continue.
+#define ARITH(expr) { \
+	Value b = R(in.b), c = R(in.c); \
+	if (b.tag != VAL_NUMBER || c.tag != VAL_NUMBER) \
+		THROW("attempt to perform arithmetic on a %s value.", value_type_name(b.tag != VAL_NUMBER ? b : c)); \
+	double x = b.as.number, y = c.as.number; \
+	R(in.a) = NUMBER_VAL(expr); \
+	NEXT(); \
+}
+
+// The checker proved both operands numbers.
+#define ARITH_NN(expr) { \
+	double x = R(in.b).as.number, y = R(in.c).as.number; \
+	R(in.a) = NUMBER_VAL(expr); \
+	NEXT(); \
+}
+
+static bool execute(VM *vm) {
+#if defined(__GNUC__)
+	static const void *labels[BC_COUNT] = {
+		[BC_MOVE] = &&L_BC_MOVE, [BC_LOADK] = &&L_BC_LOADK, [BC_LOADI] = &&L_BC_LOADI,
+		[BC_LOADNIL] = &&L_BC_LOADNIL, [BC_LOADBOOL] = &&L_BC_LOADBOOL,
+		[BC_GETUPVAL] = &&L_BC_GETUPVAL, [BC_SETUPVAL] = &&L_BC_SETUPVAL,
+		[BC_GETGLOBAL] = &&L_BC_GETGLOBAL, [BC_SETGLOBAL] = &&L_BC_SETGLOBAL,
+		[BC_ADD] = &&L_BC_ADD, [BC_SUB] = &&L_BC_SUB, [BC_MUL] = &&L_BC_MUL,
+		[BC_DIV] = &&L_BC_DIV, [BC_MOD] = &&L_BC_MOD, [BC_POW] = &&L_BC_POW,
+		[BC_ADD_NN] = &&L_BC_ADD_NN, [BC_SUB_NN] = &&L_BC_SUB_NN, [BC_MUL_NN] = &&L_BC_MUL_NN,
+		[BC_DIV_NN] = &&L_BC_DIV_NN, [BC_MOD_NN] = &&L_BC_MOD_NN, [BC_POW_NN] = &&L_BC_POW_NN,
+		[BC_CONCAT] = &&L_BC_CONCAT, [BC_EQ] = &&L_BC_EQ, [BC_NEQ] = &&L_BC_NEQ,
+		[BC_LT] = &&L_BC_LT, [BC_LE] = &&L_BC_LE, [BC_LT_NN] = &&L_BC_LT_NN, [BC_LE_NN] = &&L_BC_LE_NN,
+		[BC_NEG] = &&L_BC_NEG, [BC_NEG_N] = &&L_BC_NEG_N, [BC_NOT] = &&L_BC_NOT, [BC_LEN] = &&L_BC_LEN,
+		[BC_JMP] = &&L_BC_JMP, [BC_JMPIF] = &&L_BC_JMPIF, [BC_JMPIFNOT] = &&L_BC_JMPIFNOT,
+		[BC_JMPNIL] = &&L_BC_JMPNIL,
+		[BC_NEWTABLE] = &&L_BC_NEWTABLE, [BC_GETINDEX] = &&L_BC_GETINDEX, [BC_SETINDEX] = &&L_BC_SETINDEX,
+		[BC_GETFIELD] = &&L_BC_GETFIELD, [BC_SETFIELD] = &&L_BC_SETFIELD,
+		[BC_NEWSTRUCT] = &&L_BC_NEWSTRUCT, [BC_GETSLOT] = &&L_BC_GETSLOT, [BC_SETSLOT] = &&L_BC_SETSLOT,
+		[BC_CLOSURE] = &&L_BC_CLOSURE, [BC_METHOD] = &&L_BC_METHOD,
+		[BC_CALL] = &&L_BC_CALL, [BC_CALL_SELF] = &&L_BC_CALL_SELF, [BC_CALL_DIRECT] = &&L_BC_CALL_DIRECT,
+		[BC_EXTRA] = &&L_BC_EXTRA, [BC_RETURN] = &&L_BC_RETURN, [BC_CLOSE] = &&L_BC_CLOSE,
+		[BC_FORPREP] = &&L_BC_FORPREP, [BC_FORLOOP] = &&L_BC_FORLOOP,
+	};
+#endif
+
+	CallFrame *frame;
+	Instr *ip;
+	Value *base;
+	Closure *closure;
+	Value *constants;
+	Instr in;
+	LOAD_FRAME();
+
+	DISPATCH_BEGIN
+
+	CASE(BC_MOVE)     R(in.a) = R(in.b); NEXT();
+	CASE(BC_LOADK)    R(in.a) = K(in.bx); NEXT();
+	CASE(BC_LOADI)    R(in.a) = NUMBER_VAL((double)in.sbx); NEXT();
+	CASE(BC_LOADNIL)  for (u32 i = 0; i < in.b; i++) R(in.a + i) = NIL_VAL; NEXT();
+	CASE(BC_LOADBOOL) R(in.a) = BOOL_VAL(in.b != 0); NEXT();
+
+	CASE(BC_GETUPVAL)  R(in.a) = *closure->upvalues[in.b]->location; NEXT();
+	CASE(BC_SETUPVAL)  *closure->upvalues[in.b]->location = R(in.a); NEXT();
+	CASE(BC_GETGLOBAL) R(in.a) = vm->globals[in.bx]; NEXT();
+	CASE(BC_SETGLOBAL) vm->globals[in.bx] = R(in.a); NEXT();
+
+	CASE(BC_ADD) ARITH(x + y);
+	CASE(BC_SUB) ARITH(x - y);
+	CASE(BC_MUL) ARITH(x * y);
+	CASE(BC_DIV) ARITH(x / y);
+	CASE(BC_MOD) ARITH(lua_mod(x, y));
+	CASE(BC_POW) ARITH(pow(x, y));
+	CASE(BC_ADD_NN) ARITH_NN(x + y);
+	CASE(BC_SUB_NN) ARITH_NN(x - y);
+	CASE(BC_MUL_NN) ARITH_NN(x * y);
+	CASE(BC_DIV_NN) ARITH_NN(x / y);
+	CASE(BC_MOD_NN) ARITH_NN(lua_mod(x, y));
+	CASE(BC_POW_NN) ARITH_NN(pow(x, y));
+
+	CASE(BC_CONCAT) {
+		Value result;
+		CHECK(concat(vm, &R(in.b), (u32)in.c - in.b + 1, &result));
+		R(in.a) = result;
+		NEXT();
+	}
+
+	CASE(BC_EQ)  R(in.a) = BOOL_VAL(value_equal(R(in.b), R(in.c))); NEXT();
+	CASE(BC_NEQ) R(in.a) = BOOL_VAL(!value_equal(R(in.b), R(in.c))); NEXT();
+	CASE(BC_LT) {
+		bool result;
+		CHECK(less(vm, R(in.b), R(in.c), false, &result));
+		R(in.a) = BOOL_VAL(result);
+		NEXT();
+	}
+	CASE(BC_LE) {
+		bool result;
+		CHECK(less(vm, R(in.b), R(in.c), true, &result));
+		R(in.a) = BOOL_VAL(result);
+		NEXT();
+	}
+	CASE(BC_LT_NN) R(in.a) = BOOL_VAL(R(in.b).as.number < R(in.c).as.number); NEXT();
+	CASE(BC_LE_NN) R(in.a) = BOOL_VAL(R(in.b).as.number <= R(in.c).as.number); NEXT();
+
+	CASE(BC_NEG) {
+		Value v = R(in.b);
+		if (v.tag != VAL_NUMBER) THROW("attempt to perform arithmetic on a %s value.", value_type_name(v));
+		R(in.a) = NUMBER_VAL(-v.as.number);
+		NEXT();
+	}
+	CASE(BC_NEG_N) R(in.a) = NUMBER_VAL(-R(in.b).as.number); NEXT();
+	CASE(BC_NOT)   R(in.a) = BOOL_VAL(IS_FALSY(R(in.b))); NEXT();
+	CASE(BC_LEN) {
+		Value v = R(in.b);
+		if (v.tag == VAL_STRING) R(in.a) = NUMBER_VAL((double)v.as.string->length);
+		else if (v.tag == VAL_TABLE) R(in.a) = NUMBER_VAL((double)table_length(v.as.table));
+		else THROW("attempt to get length of a %s value.", value_type_name(v));
+		NEXT();
+	}
+
+	CASE(BC_JMP)      ip += in.sbx; NEXT();
+	CASE(BC_JMPIF)    if (!IS_FALSY(R(in.a))) ip += in.sbx; NEXT();
+	CASE(BC_JMPIFNOT) if (IS_FALSY(R(in.a))) ip += in.sbx; NEXT();
+	CASE(BC_JMPNIL)   if (IS_NIL(R(in.a))) ip += in.sbx; NEXT();
+
+	CASE(BC_NEWTABLE) {
+		Table *table = PUSH_STRUCT(vm->arena, Table);
+		R(in.a) = (Value){ .tag = VAL_TABLE, .as.table = table };
+		NEXT();
+	}
+	CASE(BC_GETINDEX) {
+		Value result;
+		CHECK(get_index(vm, R(in.b), R(in.c), &result));
+		R(in.a) = result;
+		NEXT();
+	}
+	CASE(BC_SETINDEX) CHECK(set_index(vm, R(in.a), R(in.b), R(in.c))); NEXT();
+	CASE(BC_GETFIELD) {
+		Value result;
+		CHECK(get_index(vm, R(in.b), K(in.c), &result));
+		R(in.a) = result;
+		NEXT();
+	}
+	CASE(BC_SETFIELD) CHECK(set_index(vm, R(in.a), K(in.b), R(in.c))); NEXT();
+
+	CASE(BC_NEWSTRUCT) {
+		StructLayout *layout = vm->program->layouts[in.bx];
+		Instance *instance = arena_push(vm->arena, sizeof(Instance) + layout->field_count * sizeof(Value), false);
+		instance->layout = layout;
+		R(in.a) = (Value){ .tag = VAL_STRUCT, .as.instance = instance };
+		NEXT();
+	}
+	CASE(BC_GETSLOT) R(in.a) = R(in.b).as.instance->fields[in.c]; NEXT();
+	CASE(BC_SETSLOT) R(in.a).as.instance->fields[in.b] = R(in.c); NEXT();
+
+	CASE(BC_CLOSURE) {
+		Proto *proto = vm->program->protos[in.bx];
+		Closure *made = new_closure(vm, proto, closure, base);
+		if (proto->method) vm->methods[in.bx] = made;
+		R(in.a) = (Value){ .tag = VAL_CLOSURE, .as.closure = made };
+		NEXT();
+	}
+	CASE(BC_METHOD) {
+		StructLayout *layout = vm->program->layouts[in.b];
+		table_set(vm->arena, &layout->methods, K(in.c), R(in.a));
+		NEXT();
+	}
+
+	CASE(BC_CALL) {
+		SAVE_IP();
+		CHECK(call_value(vm, R(in.a), &R(in.a + 1), in.b, &R(in.a), in.c));
+		LOAD_FRAME();
+		NEXT();
+	}
+	CASE(BC_CALL_SELF) {
+		Value callee = R(in.a);
+		bool method = callee.tag == VAL_CLOSURE && callee.as.closure->proto->method;
+		SAVE_IP();
+		if (method) CHECK(call_value(vm, callee, &R(in.a + 1), in.b + 1u, &R(in.a), in.c));
+		else CHECK(call_value(vm, callee, &R(in.a + 2), in.b, &R(in.a), in.c));
+		LOAD_FRAME();
+		NEXT();
+	}
+	CASE(BC_CALL_DIRECT) {
+		u32 proto = ip->bx;
+		ip++;
+		Closure *target = vm->methods[proto];
+		if (!target) THROW("method '%s' called before its impl ran.", vm->program->protos[proto]->name);
+		SAVE_IP();
+		CHECK(call_value(vm, (Value){ .tag = VAL_CLOSURE, .as.closure = target }, &R(in.a + 1), in.b + 1u, &R(in.a), in.c));
+		LOAD_FRAME();
+		NEXT();
+	}
+	CASE(BC_EXTRA) NEXT();
+
+	CASE(BC_RETURN) {
+		close_upvalues(vm, base);
+		Value *ret = frame->ret;
+		for (u32 i = 0; i < frame->want; i++) ret[i] = i < in.b ? R(in.a + i) : NIL_VAL;
+
+		vm->frame_count--;
+		if (vm->frame_count == 0) return true;
+		LOAD_FRAME();
+		NEXT();
+	}
+	CASE(BC_CLOSE) close_upvalues(vm, &R(in.a)); NEXT();
+
+	CASE(BC_FORPREP) {
+		Value *h = &R(in.a);
+		if (h[0].tag != VAL_NUMBER) THROW("'for' initial value must be a number.");
+		if (h[1].tag != VAL_NUMBER) THROW("'for' limit must be a number.");
+		if (h[2].tag != VAL_NUMBER) THROW("'for' step must be a number.");
+		if (h[2].as.number == 0) THROW("'for' step is zero.");
+		h[0].as.number -= h[2].as.number;
+		ip += in.sbx;
+		NEXT();
+	}
+	CASE(BC_FORLOOP) {
+		Value *h = &R(in.a);
+		double step = h[2].as.number;
+		double next = h[0].as.number + step;
+		h[0].as.number = next;
+		if (step > 0 ? next <= h[1].as.number : next >= h[1].as.number) ip += in.sbx;
+		NEXT();
+	}
+
+	DISPATCH_END
+
+fail:
+	return false;
+}
+
+bool vm_run(const Program *program, MemArena *arena, const char **error) {
+	VM vm = {0};
+	vm.arena = arena;
+	vm.program = program;
+	vm.stack = PUSH_ARRAY_NZ(arena, Value, VM_STACK_SIZE);
+	vm.stack_end = vm.stack + VM_STACK_SIZE;
+	vm.frames = PUSH_ARRAY_NZ(arena, CallFrame, VM_MAX_FRAMES);
+	vm.globals = PUSH_ARRAY(arena, Value, program->global_count + 1);
+	vm.methods = PUSH_ARRAY(arena, Closure*, program->proto_count + 1);
+
+	for (u32 i = 0; i < program->global_count; i++) {
+		for (u32 j = 0; j < sizeof(natives) / sizeof(natives[0]); j++) {
+			if (strcmp(program->globals[i], natives[j].name) == 0) {
+				vm.globals[i] = (Value){ .tag = VAL_NATIVE, .as.native = natives[j].fn };
+			}
+		}
+	}
+
+	Closure *main = new_closure(&vm, program->main, NULL, vm.stack);
+	Value results[1];
+	bool ok = call_value(&vm, (Value){ .tag = VAL_CLOSURE, .as.closure = main }, vm.stack, 0, results, 0) && execute(&vm);
+	fflush(stdout);
+
+	if (!ok) *error = vm.error;
+	return ok;
+}
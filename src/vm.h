@@ -0,0 +1,24 @@
+#pragma once
+#include "arena.h"
+#include "bytecode.h"
+#include "typedefs.h"
+#include "value.h"
+
+// An upvalue points into the stack while its variable is alive and at its
+// own copy once the variable's block has ended.
+typedef struct Upval Upval;
+struct Upval {
+	Value *location;
+	Value closed;
+	Upval *next;
+};
+
+struct Closure {
+	Proto *proto;
+	Upval *upvalues[];
+};
+
+// Runs the program's main chunk. Everything the program allocates goes
+// into the arena. On a runtime error returns false with *error set to a
+// message in the arena.
+bool vm_run(const Program *program, MemArena *arena, const char **error);
@@ -0,0 +1,531 @@
+#include <stdio.h>
+
+#include "watch.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "arena.h"
+#include "checker.h"
+#include "debug.h"
+#include "lexer.h"
+#include "parser.h"
+#include "ptr_map.h"
+#include "resolver.h"
+#include "source.h"
+#include "stats.h"
+#include "string_pool.h"
+#include "vec.h"
+
+#define WATCH_ARENA_RESERVE GiB(1)
+#define WATCH_FILE_ARENA_RESERVE GiB(1)
+#define WATCH_MAX_CLIENTS 64
+#define WATCH_LINE_MAX 4096
+#define WATCH_EVENT_BUFFER KiB(64)
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+
+typedef struct {
+	const char *name;
+	u32 file;
+} Require;
+
+// Paths are canonical and interned in the server's pool, so they double as
+// keys. Everything parsed from the file lives in its own arena, which is
+// cleared when the file changes; checking starts at check_mark so a file
+// that is only checked again reuses the same memory.
+typedef struct {
+	const char *path;
+	const char *dir;
+	MemArena *arena;
+	bool input;
+	bool exists;
+	bool dirty;
+	bool affected;
+	bool visited;
+
+	ParseResult parsed;
+	CheckResult checked;
+	u64 check_mark;
+
+	// Requires whose file does not exist, reported like checker errors.
+	Diagnostic *missing;
+	u32 missing_count;
+
+	Require *requires;
+} WatchFile;
+
+typedef struct {
+	int wd;
+	const char *dir;
+} WatchDir;
+
+typedef struct {
+	int fd;
+	u32 length;
+	char line[WATCH_LINE_MAX];
+} Client;
+
+typedef struct {
+	MemArena *arena;
+	StringPool pool;
+	const char *root;
+	bool type_check;
+	bool running;
+
+	WatchFile **files;
+	PtrMap file_index;
+
+	int inotify;
+	WatchDir *dirs;
+
+	int listener;
+	Client clients[WATCH_MAX_CLIENTS];
+	u32 client_count;
+} Watcher;
+
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig) {
+	(void)sig;
+	stop_requested = 1;
+}
+
+static void watch_dir(Watcher *w, const char *dir) {
+	for (u32 i = 0; i < vec_size(w->dirs); i++) {
+		if (w->dirs[i].dir == dir) return;
+	}
+
+	// A directory that doesn't exist yet can't be watched; modules in it
+	// are picked up once a file that requires them is saved again.
+	int wd = inotify_add_watch(w->inotify, dir[0] ? dir : "/", WATCH_EVENTS);
+	if (wd < 0) return;
+
+	WatchDir entry = { wd, dir };
+	vec_push(w->dirs, entry);
+}
+
+static u32 file_for(Watcher *w, const char *path) {
+	path = pool_intern(&w->pool, path, strlen(path));
+
+	u64 *index = ptr_map_put(&w->file_index, path);
+	if (*index) return (u32)(*index - 1);
+
+	WatchFile *f = PUSH_STRUCT(w->arena, WatchFile);
+	f->path = path;
+	f->dirty = true;
+
+	const char *slash = strrchr(path, '/');
+	f->dir = pool_intern(&w->pool, path, slash ? slash - path : 0);
+	f->arena = arena_create_reserve(WATCH_FILE_ARENA_RESERVE);
+
+	*index = vec_size(w->files) + 1;
+	vec_push(w->files, f);
+	watch_dir(w, f->dir);
+	return (u32)(*index - 1);
+}
+
+static u32 module_file(Watcher *w, const char *name) {
+	char path[PATH_MAX];
+	int n = snprintf(path, sizeof(path), "%s/%s.luat", w->root, name);
+	if (n < 0 || (size_t)n >= sizeof(path)) n = sizeof(path) - 1;
+
+	char *module = path + strlen(w->root) + 1;
+	for (char *p = module; p < path + n - 5; p++) {
+		if (*p == '.') *p = '/';
+	}
+	return file_for(w, path);
+}
+
+static const char *required_module(Expr *e) {
+	if (!e || e->kind != EXPR_CALL || e->as.call.arg_count != 1) return NULL;
+
+	Expr *callee = e->as.call.callee;
+	Expr *arg = e->as.call.args[0];
+	if (callee->kind != EXPR_VARIABLE || strcmp(callee->as.variable.name, "require") != 0) return NULL;
+	return arg->kind == EXPR_STRING ? arg->as.string : NULL;
+}
+
+static void collect_requires(Watcher *w, WatchFile *f) {
+	Stmt *root = f->parsed.root;
+	if (!root || root->kind != STMT_BLOCK) return;
+
+	for (int i = 0; i < root->as.block.stmt_count; i++) {
+		Stmt *stmt = root->as.block.stmts[i];
+		if (stmt->kind == STMT_EXPR) {
+			const char *name = required_module(stmt->as.expression);
+			if (name) {
+				Require r = { name, module_file(w, name) };
+				vec_push(f->requires, r);
+			}
+		} else if (stmt->kind == STMT_LOCAL) {
+			for (int j = 0; j < stmt->as.local.value_count; j++) {
+				const char *name = required_module(stmt->as.local.values[j]);
+				if (name) {
+					Require r = { name, module_file(w, name) };
+					vec_push(f->requires, r);
+				}
+			}
+		}
+	}
+}
+
+static void check_file(Watcher *w, WatchFile *f) {
+	arena_pop_to(f->arena, f->check_mark);
+	f->checked = (CheckResult){0};
+	f->missing_count = 0;
+
+	if (f->parsed.success && w->type_check) {
+		Resolution resolution = resolve(f->parsed.root, &w->pool, f->arena);
+		f->checked = check(f->parsed.root, &resolution, f->parsed.types, &f->parsed.spans, &w->pool, f->arena);
+	}
+
+	u32 count = vec_size(f->requires);
+	f->missing = PUSH_ARRAY(f->arena, Diagnostic, count);
+	for (u32 i = 0; i < count; i++) {
+		if (w->files[f->requires[i].file]->exists) continue;
+		f->missing[f->missing_count++] = (Diagnostic){ 0, 0, f->requires[i].name, "Module not found.", 0, true };
+	}
+}
+
+// Sources are copied into the file's arena rather than kept mapped, since
+// an editor may truncate the file while the tree is still in use.
+static void load_file(Watcher *w, WatchFile *f) {
+	f->dirty = false;
+	f->affected = true;
+	f->parsed = (ParseResult){0};
+	if (f->requires) vec_hdr(f->requires)->size = 0;
+	arena_clear(f->arena);
+
+	SourceFile source;
+	f->exists = access(f->path, R_OK) == 0 && source_open(&source, f->arena, f->path);
+	if (f->exists) {
+		u64 length = source.length;
+		char *text = arena_push(f->arena, length, true);
+		memcpy(text, source.data, length);
+		source_close(&source);
+
+		Scanner scanner;
+		scanner_init(&scanner, text, length, &w->pool);
+		f->parsed = parse_stream(&scanner, f->arena);
+		collect_requires(w, f);
+	}
+
+	f->check_mark = f->arena->pos;
+}
+
+// A module that doesn't exist is reported by the files requiring it.
+static u32 file_errors(const WatchFile *f) {
+	if (!f->exists) return f->input;
+	u32 parse_errors = f->parsed.success ? 0 : f->parsed.diagnostic_count;
+	return parse_errors + f->checked.diagnostic_count + f->missing_count;
+}
+
+static void print_file(FILE *out, const WatchFile *f) {
+	if (!f->exists) {
+		if (f->input) fprintf(out, "%s:Error: Could not open file.\n", f->path);
+		return;
+	}
+	if (!f->parsed.success) fprint_diagnostics(out, f->path, &f->parsed);
+	fprint_diagnostic_list(out, f->path, f->checked.diagnostics, f->checked.diagnostic_count);
+	fprint_diagnostic_list(out, f->path, f->missing, f->missing_count);
+}
+
+// Re-parses every dirty file and checks it along with whatever requires
+// one of them, then reports the lot. New modules found along the way are
+// appended dirty, so the first loop reaches them too. Checking waits until
+// everything is loaded, since whether a module exists is part of it.
+static void refresh(Watcher *w) {
+	double start = stats_now();
+
+	bool any = false;
+	for (u32 i = 0; i < vec_size(w->files); i++) {
+		if (w->files[i]->dirty) {
+			load_file(w, w->files[i]);
+			any = true;
+		}
+	}
+	if (!any) return;
+
+	u32 count = vec_size(w->files);
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (u32 i = 0; i < count; i++) {
+			WatchFile *f = w->files[i];
+			if (f->affected) continue;
+			for (u32 j = 0; j < vec_size(f->requires); j++) {
+				if (!w->files[f->requires[j].file]->affected) continue;
+				f->affected = changed = true;
+				break;
+			}
+		}
+	}
+
+	u32 checked = 0, errors = 0;
+	for (u32 i = 0; i < count; i++) {
+		WatchFile *f = w->files[i];
+		if (!f->affected) continue;
+		f->affected = false;
+		check_file(w, f);
+		print_file(stderr, f);
+		errors += file_errors(f);
+		checked++;
+	}
+
+	fprintf(stderr, "Checked %u file%s in %.2f ms, %u error%s.\n",
+		checked, checked == 1 ? "" : "s", (stats_now() - start) * 1e3, errors, errors == 1 ? "" : "s");
+}
+
+static void handle_events(Watcher *w) {
+	_Alignas(struct inotify_event) char buffer[WATCH_EVENT_BUFFER];
+
+	while (true) {
+		ssize_t n = read(w->inotify, buffer, sizeof(buffer));
+		if (n <= 0) break;
+
+		for (char *p = buffer; p < buffer + n;) {
+			struct inotify_event *event = (struct inotify_event*)p;
+			p += sizeof(struct inotify_event) + event->len;
+
+			// Events were dropped, so anything may have changed.
+			if (event->mask & IN_Q_OVERFLOW) {
+				for (u32 i = 0; i < vec_size(w->files); i++) w->files[i]->dirty = true;
+				continue;
+			}
+			if (!event->len) continue;
+
+			const char *dir = NULL;
+			for (u32 i = 0; i < vec_size(w->dirs); i++) {
+				if (w->dirs[i].wd == event->wd) dir = w->dirs[i].dir;
+			}
+			if (!dir) continue;
+
+			char path[PATH_MAX];
+			int len = snprintf(path, sizeof(path), "%s/%s", dir, event->name);
+			if (len < 0 || (size_t)len >= sizeof(path)) continue;
+
+			// Editors churn through swap and temporary files in watched
+			// directories, so only paths already in the graph are looked up.
+			const char *key = pool_find(&w->pool, path, len);
+			u64 *index = key ? ptr_map_get(&w->file_index, key) : NULL;
+			if (index && *index) w->files[*index - 1]->dirty = true;
+		}
+	}
+
+	refresh(w);
+}
+
+static void mark_closure(Watcher *w, u32 index, bool visited) {
+	WatchFile *f = w->files[index];
+	if (f->visited == visited) return;
+	f->visited = visited;
+	for (u32 i = 0; i < vec_size(f->requires); i++) mark_closure(w, f->requires[i].file, visited);
+}
+
+static void handle_request(Watcher *w, int fd, char *line) {
+	FILE *out = fdopen(dup(fd), "w");
+	if (!out) return;
+
+	char *arg = strchr(line, ' ');
+	if (arg) *arg++ = '\0';
+
+	char path[PATH_MAX];
+	if (strcmp(line, "stop") == 0) {
+		fprintf(out, "done 0\n");
+		w->running = false;
+	} else if ((strcmp(line, "check") == 0 || strcmp(line, "deps") == 0) && arg) {
+		if (!realpath(arg, path)) {
+			fprintf(out, "error Could not open file: '%s'\n", arg);
+		} else {
+			u32 index = file_for(w, path);
+			w->files[index]->input = true;
+			refresh(w);
+
+			if (strcmp(line, "deps") == 0) {
+				WatchFile *f = w->files[index];
+				u32 count = vec_size(f->requires);
+				for (u32 i = 0; i < count; i++) fprintf(out, "%s\n", w->files[f->requires[i].file]->path);
+				fprintf(out, "done %u\n", count);
+			} else {
+				// Requires may be cyclic, hence the marks; they are cleared
+				// again the same way once the report is written.
+				mark_closure(w, index, true);
+				u32 errors = 0;
+				for (u32 i = 0; i < vec_size(w->files); i++) {
+					if (!w->files[i]->visited) continue;
+					print_file(out, w->files[i]);
+					errors += file_errors(w->files[i]);
+				}
+				mark_closure(w, index, false);
+				fprintf(out, "done %u\n", errors);
+			}
+		}
+	} else {
+		fprintf(out, "error Unknown request.\n");
+	}
+
+	fclose(out);
+}
+
+static void close_client(Watcher *w, u32 i) {
+	close(w->clients[i].fd);
+	w->clients[i] = w->clients[--w->client_count];
+}
+
+// Returns false once the client is gone.
+static bool handle_client(Watcher *w, Client *c) {
+	ssize_t n = read(c->fd, c->line + c->length, sizeof(c->line) - 1 - c->length);
+	if (n <= 0) return false;
+	c->length += (u32)n;
+
+	char *start = c->line;
+	char *newline;
+	while ((newline = memchr(start, '\n', c->line + c->length - start))) {
+		*newline = '\0';
+		if (newline > start && newline[-1] == '\r') newline[-1] = '\0';
+		handle_request(w, c->fd, start);
+		start = newline + 1;
+	}
+
+	u32 rest = (u32)(c->line + c->length - start);
+	if (rest == sizeof(c->line) - 1) return false;
+	memmove(c->line, start, rest);
+	c->length = rest;
+	return true;
+}
+
+static int open_listener(const char *socket_path) {
+	struct sockaddr_un addr = {0};
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path '%s' is too long.\n", socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	unlink(socket_path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, WATCH_MAX_CLIENTS) != 0) {
+		fprintf(stderr, "Error: could not listen on '%s': %s\n", socket_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int watch_run(const char **paths, u32 count, const char *socket_path, bool type_check) {
+	Watcher w = {0};
+	w.type_check = type_check;
+	w.running = true;
+	w.listener = -1;
+
+	w.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	w.arena = arena_create_reserve(WATCH_ARENA_RESERVE);
+	if (w.inotify < 0 || !w.arena) {
+		fprintf(stderr, "Error: could not set up file watching.\n");
+		return 1;
+	}
+	w.pool = pool_create(w.arena, KiB(4));
+	w.file_index = ptr_map_create(w.arena, 64);
+
+	int status = 0;
+	char path[PATH_MAX];
+	if (!getcwd(path, sizeof(path))) status = 1;
+	else w.root = pool_intern(&w.pool, path, strlen(path));
+
+	for (u32 i = 0; status == 0 && i < count; i++) {
+		if (!realpath(paths[i], path)) {
+			fprintf(stderr, "Error: Could not open file: '%s'\n", paths[i]);
+			status = 1;
+			break;
+		}
+		u32 index = file_for(&w, path);
+		w.files[index]->input = true;
+	}
+
+	if (status == 0 && socket_path) {
+		w.listener = open_listener(socket_path);
+		if (w.listener < 0) status = 1;
+	}
+
+	if (status == 0) {
+		struct sigaction action = {0};
+		action.sa_handler = on_signal;
+		sigaction(SIGINT, &action, NULL);
+		sigaction(SIGTERM, &action, NULL);
+		signal(SIGPIPE, SIG_IGN);
+
+		refresh(&w);
+	}
+
+	while (status == 0 && w.running && !stop_requested) {
+		struct pollfd fds[2 + WATCH_MAX_CLIENTS];
+		u32 nfds = 0;
+		fds[nfds++] = (struct pollfd){ w.inotify, POLLIN, 0 };
+		if (w.listener >= 0) fds[nfds++] = (struct pollfd){ w.listener, POLLIN, 0 };
+		for (u32 i = 0; i < w.client_count; i++) fds[nfds++] = (struct pollfd){ w.clients[i].fd, POLLIN, 0 };
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) continue;
+			status = 1;
+			break;
+		}
+
+		if (fds[0].revents) handle_events(&w);
+
+		// Clients are walked backwards since a closed one is replaced by
+		// the last; fds past the listener line up with clients until then.
+		u32 first_client = w.listener >= 0 ? 2 : 1;
+		for (u32 i = w.client_count; i-- > 0;) {
+			if (!fds[first_client + i].revents) continue;
+			if (!handle_client(&w, &w.clients[i]) || !w.running) close_client(&w, i);
+		}
+
+		if (w.listener >= 0 && fds[1].revents) {
+			int fd = accept(w.listener, NULL, NULL);
+			if (fd >= 0 && w.client_count < WATCH_MAX_CLIENTS) {
+				w.clients[w.client_count++] = (Client){ .fd = fd };
+			} else if (fd >= 0) {
+				close(fd);
+			}
+		}
+	}
+
+	while (w.client_count) close_client(&w, w.client_count - 1);
+	if (w.listener >= 0) {
+		close(w.listener);
+		unlink(socket_path);
+	}
+	close(w.inotify);
+
+	for (u32 i = 0; i < vec_size(w.files); i++) {
+		vec_free(w.files[i]->requires);
+		arena_destroy(w.files[i]->arena);
+	}
+	vec_free(w.files);
+	vec_free(w.dirs);
+	pool_destroy(&w.pool);
+	arena_destroy(w.arena);
+	return status;
+}
+
+#else
+
+int watch_run(const char **paths, u32 count, const char *socket_path, bool type_check) {
+	(void)paths; (void)count; (void)socket_path; (void)type_check;
+	fprintf(stderr, "Error: --watch and --serve need inotify, which this platform doesn't have.\n");
+	return 1;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+
+#include "typedefs.h"
+
+// Keeps the given files and every module they require parsed in memory and
+// re-parses a file as soon as it changes on disk. Files that require a
+// changed one, directly or through other modules, are checked again with
+// it. Diagnostics of everything that was looked at again go to stderr.
+//
+// A module named "a.b" is the file a/b.luat under the directory the server
+// was started in, as with Lua's default package.path.
+// Only top-level requires count: `require("a.b");` and
+// `local m: T = require("a.b");`.
+//
+// With a socket path the server also answers requests on that Unix socket,
+// one per line:
+//   check PATH   diagnostics of PATH and the modules it requires, then "done N"
+//                with N the number of errors; PATH is loaded if it is new
+//   deps PATH    the files PATH requires, one per line, then "done N"
+//   stop         answers "done 0" and shuts the server down
+// Anything else is answered with "error MESSAGE".
+//
+// Returns the exit status once stopped. Needs inotify, so Linux only.
+int watch_run(const char **paths, u32 count, const char *socket_path, bool type_check);
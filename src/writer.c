@@ -0,0 +1,192 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+void writer_init(Writer *w, FILE *file, MemArena *arena, u64 capacity) {
+	w->file = file;
+	w->buf = arena_push(arena, capacity, true);
+	w->len = 0;
+	w->cap = capacity;
+	w->failed = false;
+}
+
+bool writer_flush(Writer *w) {
+	if (w->len && fwrite(w->buf, 1, w->len, w->file) != w->len) w->failed = true;
+	w->len = 0;
+	return !w->failed;
+}
+
+void writer_bytes(Writer *w, const char *data, u64 length) {
+	if (w->len + length > w->cap) {
+		writer_flush(w);
+
+		// Too big to be worth copying; hand it to the FILE as it is.
+		if (length > w->cap / 2) {
+			if (fwrite(data, 1, length, w->file) != length) w->failed = true;
+			return;
+		}
+	}
+
+	memcpy(w->buf + w->len, data, length);
+	w->len += length;
+}
+
+void writer_str(Writer *w, const char *str) {
+	writer_bytes(w, str, strlen(str));
+}
+
+void writer_pad(Writer *w, char c, u64 count) {
+	while (count) {
+		if (w->len == w->cap) writer_flush(w);
+		u64 n = MIN(count, w->cap - w->len);
+		memset(w->buf + w->len, c, n);
+		w->len += n;
+		count -= n;
+	}
+}
+
+void writer_left(Writer *w, const char *str, u64 width) {
+	u64 length = strlen(str);
+	writer_bytes(w, str, length);
+	if (length < width) writer_pad(w, ' ', width - length);
+}
+
+static const char digit_pairs[] =
+	"00010203040506070809" "10111213141516171819" "20212223242526272829"
+	"30313233343536373839" "40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879" "80818283848586878889"
+	"90919293949596979899";
+
+// Two digits per division, written back to front.
+u32 format_u64(char *out, u64 value) {
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+
+	while (value >= 100) {
+		u32 pair = (u32)(value % 100) * 2;
+		value /= 100;
+		*--p = digit_pairs[pair + 1];
+		*--p = digit_pairs[pair];
+	}
+	if (value >= 10) {
+		u32 pair = (u32)value * 2;
+		*--p = digit_pairs[pair + 1];
+		*--p = digit_pairs[pair];
+	} else {
+		*--p = (char)('0' + value);
+	}
+
+	u32 length = (u32)(tmp + sizeof(tmp) - p);
+	memcpy(out, p, length);
+	return length;
+}
+
+void writer_u64(Writer *w, u64 value) {
+	char tmp[20];
+	writer_bytes(w, tmp, format_u64(tmp, value));
+}
+
+void writer_i64(Writer *w, i64 value) {
+	if (value < 0) {
+		writer_char(w, '-');
+		writer_u64(w, (u64)0 - (u64)value);
+	} else {
+		writer_u64(w, (u64)value);
+	}
+}
+
+// Integral and below the limit means the digits are exact and %g would
+// print them without an exponent.
+static bool write_integral(Writer *w, double value, double limit) {
+	if (!(value > -limit && value < limit)) return false;
+
+	i64 integral = (i64)value;
+	if ((double)integral != value) return false;
+
+	if (integral == 0 && signbit(value)) writer_bytes(w, "-0", 2);
+	else writer_i64(w, integral);
+	return true;
+}
+
+void writer_number(Writer *w, double value) {
+	if (write_integral(w, value, 1e6)) return;
+
+	char tmp[32];
+	int n = snprintf(tmp, sizeof(tmp), "%g", value);
+	writer_bytes(w, tmp, (u64)n);
+}
+
+void writer_number_exact(Writer *w, double value) {
+	if (write_integral(w, value, 9007199254740992.0)) return;
+
+	// JSON has no spelling for these.
+	if (isnan(value) || isinf(value)) {
+		writer_bytes(w, "null", 4);
+		return;
+	}
+
+	char tmp[32];
+	int n = 0;
+	for (int precision = 15; precision <= 17; precision++) {
+		n = snprintf(tmp, sizeof(tmp), "%.*g", precision, value);
+		if (strtod(tmp, NULL) == value) break;
+	}
+	writer_bytes(w, tmp, (u64)n);
+}
+
+void writer_json_string(Writer *w, const char *str) {
+	static const char hex[] = "0123456789abcdef";
+
+	writer_char(w, '"');
+	const char *run = str;
+	for (const char *p = str; *p; p++) {
+		u8 c = (u8)*p;
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+		writer_bytes(w, run, (u64)(p - run));
+		run = p + 1;
+
+		switch (c) {
+			case '"':  writer_bytes(w, "\\\"", 2); break;
+			case '\\': writer_bytes(w, "\\\\", 2); break;
+			case '\n': writer_bytes(w, "\\n", 2); break;
+			case '\r': writer_bytes(w, "\\r", 2); break;
+			case '\t': writer_bytes(w, "\\t", 2); break;
+			default: {
+				char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+				writer_bytes(w, esc, sizeof(esc));
+			}
+		}
+	}
+	writer_str(w, run);
+	writer_char(w, '"');
+}
+
+void writer_lua_string(Writer *w, const char *str) {
+	writer_char(w, '"');
+	const char *run = str;
+	for (const char *p = str; *p; p++) {
+		u8 c = (u8)*p;
+		if ((c >= 0x20 && c != 0x7f && c != '"' && c != '\\') || c >= 0x80) continue;
+
+		writer_bytes(w, run, (u64)(p - run));
+		run = p + 1;
+
+		switch (c) {
+			case '"':  writer_bytes(w, "\\\"", 2); break;
+			case '\\': writer_bytes(w, "\\\\", 2); break;
+			case '\n': writer_bytes(w, "\\n", 2); break;
+			case '\r': writer_bytes(w, "\\r", 2); break;
+			case '\t': writer_bytes(w, "\\t", 2); break;
+			default: {
+				// Always three digits, so a following digit can't join in.
+				char esc[4] = { '\\', (char)('0' + c / 100), (char)('0' + c / 10 % 10), (char)('0' + c % 10) };
+				writer_bytes(w, esc, sizeof(esc));
+			}
+		}
+	}
+	writer_str(w, run);
+	writer_char(w, '"');
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "arena.h"
+#include "typedefs.h"
+
+// Buffered output to a FILE. The buffer comes from an arena and is flushed
+// whenever it fills up, so output of any size goes through a fixed amount
+// of memory and the FILE sees a few large writes instead of many small ones.
+typedef struct {
+	FILE *file;
+	char *buf;
+	u64 len;
+	u64 cap;
+	bool failed;
+} Writer;
+
+#define WRITER_DEFAULT_CAPACITY KiB(256)
+
+void writer_init(Writer *w, FILE *file, MemArena *arena, u64 capacity);
+bool writer_flush(Writer *w);
+
+void writer_bytes(Writer *w, const char *data, u64 length);
+void writer_str(Writer *w, const char *str);
+void writer_pad(Writer *w, char c, u64 count);
+
+// Writes str and pads it with spaces to at least width bytes, like %-*s.
+void writer_left(Writer *w, const char *str, u64 width);
+
+void writer_u64(Writer *w, u64 value);
+void writer_i64(Writer *w, i64 value);
+
+// Same text as printf("%g"). Integral values are formatted directly; the
+// rest goes through snprintf.
+void writer_number(Writer *w, double value);
+
+// Shortest text that reads back as the same double; integers have no
+// fraction or exponent. Used where the output is parsed again.
+void writer_number_exact(Writer *w, double value);
+
+// Quoted and escaped as a JSON string.
+void writer_json_string(Writer *w, const char *str);
+
+// Quoted and escaped as a Lua string literal; bytes above 0x7f pass
+// through, other control bytes become decimal escapes.
+void writer_lua_string(Writer *w, const char *str);
+
+// Formats value into out (at least 20 bytes) and returns the length.
+u32 format_u64(char *out, u64 value);
+
+static inline void writer_char(Writer *w, char c) {
+	if (w->len == w->cap) writer_flush(w);
+	w->buf[w->len++] = c;
+}
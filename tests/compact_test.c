@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/ast_compact.h"
+#include "../src/debug.h"
+#include "../src/luat.h"
+#include "../src/source.h"
+#include "../src/type_table.h"
+#include "../src/vec.h"
+
+// Corrupts one word of a portable compact tree at a time and expands it
+// the way a cache load does, which must either fail or produce a tree but
+// never read outside the arrays (run under the sanitizer to see that):
+//   compact_test FILE [TRIALS] [SEED]
+
+static u64 rng_state = 0x9e3779b97f4a7c15ull;
+
+static u64 next_random(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static u32 range(u32 lo, u32 hi) {
+	return lo + (u32)(next_random() % (hi - lo + 1));
+}
+
+// Mostly values near the real counts, which pass the coarse checks and
+// reach the ones further in.
+static u32 corrupt_word(u32 limit) {
+	switch (range(0, 3)) {
+		case 0:  return (u32)next_random();
+		case 1:  return UINT32_MAX - range(0, 2);
+		default: return range(0, limit + 2);
+	}
+}
+
+static char *dump_ast(Stmt *root) {
+	char *text = NULL;
+	size_t size = 0;
+	FILE *f = open_memstream(&text, &size);
+	if (root) fprint_ast(f, root);
+	fclose(f);
+	return text;
+}
+
+static u32 *copy_words(const u32 *words, u32 count) {
+	u32 *copy = malloc((count ? count : 1) * sizeof(u32));
+	memcpy(copy, words, count * sizeof(u32));
+	return copy;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE [TRIALS] [SEED]\n", argv[0]);
+		return 1;
+	}
+	u32 trials = argc > 2 ? (u32)strtoul(argv[2], NULL, 0) : 2000;
+	if (argc > 3) rng_state ^= strtoull(argv[3], NULL, 0) * 0xbf58476d1ce4e5b9ull;
+
+	MemArena *arena = arena_create_reserve(GiB(1));
+	SourceFile source;
+	if (!source_open(&source, arena, argv[1])) {
+		fprintf(stderr, "Error: Could not open file: '%s'\n", argv[1]);
+		return 1;
+	}
+
+	LuatContext *ctx = luat_context_create(true);
+	ParseResult parsed = luat_parse(ctx, source.data, source.length);
+	source_close(&source);
+	CompactAst ast = compact_ast_build_portable(parsed.root, &ctx->pool, NULL);
+	u32 node_count = (u32)vec_size(ast.tags);
+	u32 extra_count = (u32)vec_size(ast.extra);
+
+	u64 mark = arena->pos;
+	int status = 0;
+
+	Stmt *trusted = compact_ast_expand(&ast, &ctx->pool, type_table_create(arena, 0), arena, NULL);
+	Stmt *checked = compact_ast_expand_checked(&ast, node_count, extra_count, &ctx->pool, type_table_create(arena, 0), arena, NULL);
+	char *a = dump_ast(trusted);
+	char *b = dump_ast(checked);
+	if (!checked || strcmp(a, b) != 0) {
+		fprintf(stderr, "Checked expansion of an intact tree differs from the unchecked one.\n");
+		status = 1;
+	}
+	free(a);
+	free(b);
+
+	u32 failed = 0;
+	for (u32 n = 0; n < trials && !status; n++) {
+		arena_pop_to(arena, mark);
+
+		CompactAst copy = ast;
+		copy.lhs = copy_words(ast.lhs, node_count);
+		copy.rhs = copy_words(ast.rhs, node_count);
+		copy.extra = copy_words(ast.extra, extra_count);
+		copy.tags = malloc(node_count);
+		memcpy(copy.tags, ast.tags, node_count);
+
+		switch (range(0, 3)) {
+			case 0: copy.lhs[range(0, node_count - 1)] = corrupt_word(extra_count); break;
+			case 1: copy.rhs[range(0, node_count - 1)] = corrupt_word(node_count); break;
+			case 2: if (extra_count) copy.extra[range(0, extra_count - 1)] = corrupt_word(node_count); break;
+			case 3: copy.tags[range(0, node_count - 1)] = (u8)next_random(); break;
+		}
+
+		TypeTable *types = type_table_create(arena, 0);
+		if (!compact_ast_expand_checked(&copy, node_count, extra_count, &ctx->pool, types, arena, NULL)) failed++;
+
+		free(copy.lhs);
+		free(copy.rhs);
+		free(copy.extra);
+		free(copy.tags);
+	}
+
+	if (!status) printf("ok    %u corrupted compact trees (%u rejected)\n", trials, failed);
+
+	compact_ast_free(&ast);
+	luat_context_destroy(ctx);
+	arena_destroy(arena);
+	return status;
+}
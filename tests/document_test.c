@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/debug.h"
+#include "../src/luat.h"
+#include "../src/source.h"
+
+// Applies random edits to a document and after each one compares its tree
+// and diagnostics with those of a full parse of the same text:
+//   document_test FILE [EDITS] [SEED]
+
+static u64 rng_state = 0x9e3779b97f4a7c15ull;
+
+static u64 next_random(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static u32 range(u32 lo, u32 hi) {
+	return lo + (u32)(next_random() % (hi - lo + 1));
+}
+
+// Pieces that open or close statements, comments and strings, so edits
+// move statement boundaries around rather than just renaming things.
+static const char *fragments[] = {
+	"", " ", "\n", ";", "x", "1", "+", "(", ")", ",", "=", ".",
+	"end", "then", "do", "if x then", "while true do", "return 1;",
+	"local y: number = 2;", "print(\"hi\");", "function f(a: number): number",
+	"\"", "--", "--[[", "]]", "[[", "r#\"", "\"#", "struct S", "impl S",
+};
+
+static char *dump_ast(Stmt *root) {
+	char *text = NULL;
+	size_t size = 0;
+	FILE *f = open_memstream(&text, &size);
+	if (root) fprint_ast(f, root);
+	fclose(f);
+	return text;
+}
+
+static bool same_diagnostics(const ParseResult *a, const ParseResult *b) {
+	if (a->diagnostic_count != b->diagnostic_count) return false;
+	for (u32 i = 0; i < a->diagnostic_count; i++) {
+		const Diagnostic *x = &a->diagnostics[i], *y = &b->diagnostics[i];
+		if (x->offset != y->offset || x->line != y->line || x->column != y->column) return false;
+		if (strcmp(x->message, y->message) != 0) return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE [EDITS] [SEED]\n", argv[0]);
+		return 1;
+	}
+	u32 edits = argc > 2 ? (u32)strtoul(argv[2], NULL, 0) : 2000;
+	if (argc > 3) rng_state ^= strtoull(argv[3], NULL, 0) * 0xbf58476d1ce4e5b9ull;
+
+	MemArena *arena = arena_create_reserve(GiB(1));
+	SourceFile source;
+	if (!source_open(&source, arena, argv[1])) {
+		fprintf(stderr, "Error: Could not open file: '%s'\n", argv[1]);
+		return 1;
+	}
+
+	u64 length = source.length;
+	u64 capacity = length * 4 + 4096;
+	char *text = malloc(capacity);
+	memcpy(text, source.data, length);
+	source_close(&source);
+
+	// The pristine text, for pasting back real statements.
+	char *original = malloc(length + 1);
+	memcpy(original, text, length);
+	u64 original_length = length;
+
+	LuatDocument *doc = luat_document_open(text, length);
+	LuatContext *ctx = luat_context_create(false);
+	int status = 0;
+
+	for (u32 n = 0; n < edits; n++) {
+		u32 offset = range(0, (u32)length);
+		u32 removed = range(0, 24);
+		removed = MIN(removed, (u32)(length - offset));
+
+		const char *inserted;
+		u32 inserted_length;
+		if (range(0, 1) && original_length) {
+			u32 from = range(0, (u32)original_length - 1);
+			inserted = original + from;
+			inserted_length = range(0, 64);
+			inserted_length = MIN(inserted_length, (u32)(original_length - from));
+		} else {
+			inserted = fragments[range(0, sizeof(fragments) / sizeof(*fragments) - 1)];
+			inserted_length = (u32)strlen(inserted);
+		}
+
+		// Starting over keeps the text from drifting into pure noise.
+		if (length - removed + inserted_length > capacity || range(0, 199) == 0) {
+			luat_document_edit(doc, 0, (u32)length, original, (u32)original_length);
+			memcpy(text, original, original_length);
+			length = original_length;
+			continue;
+		}
+
+		luat_document_edit(doc, offset, removed, inserted, inserted_length);
+		memmove(text + offset + inserted_length, text + offset + removed, length - offset - removed);
+		memcpy(text + offset, inserted, inserted_length);
+		length = length - removed + inserted_length;
+
+		ParseResult incremental = luat_document_result(doc);
+		ParseResult full = luat_parse(ctx, text, length);
+
+		char *a = dump_ast(incremental.root);
+		char *b = dump_ast(full.root);
+		bool same = incremental.success == full.success && strcmp(a, b) == 0 && same_diagnostics(&incremental, &full);
+		free(a);
+		free(b);
+
+		if (!same) {
+			fprintf(stderr, "Edit %u (%u, %u, \"%.*s\") left the document different from a full parse:\n",
+				n, offset, removed, (int)inserted_length, inserted);
+			fwrite(text, 1, length, stderr);
+			fprintf(stderr, "\n-- document:\n");
+			fprint_diagnostics(stderr, NULL, &incremental);
+			fprintf(stderr, "-- full parse:\n");
+			fprint_diagnostics(stderr, NULL, &full);
+			status = 1;
+			break;
+		}
+	}
+
+	if (!status) printf("ok    %u random document edits\n", edits);
+
+	luat_context_destroy(ctx);
+	luat_document_close(doc);
+	free(original);
+	free(text);
+	arena_destroy(arena);
+	return status;
+}
@@ -0,0 +1,114 @@
+#!/bin/sh
+# Regression tests for the luat binary: run.sh LUAT WORK_DIR
+# Each case runs luat on an input and expects it to exit with status 0,
+# and with expect_output also to print a line matching a pattern.
+
+LUAT=$1
+WORK=$2
+failed=0
+
+mkdir -p "$WORK"
+
+expect_ok() {
+	name=$1
+	shift
+	if "$@" > "$WORK/out.txt" 2>&1; then
+		echo "ok    $name"
+	else
+		echo "FAIL  $name"
+		tail -n 20 "$WORK/out.txt"
+		failed=$((failed + 1))
+	fi
+}
+
+expect_output() {
+	pattern=$1
+	shift
+	expect_ok "$@"
+	if ! grep -q "$pattern" "$WORK/out.txt"; then
+		echo "FAIL  $1: no output matching '$pattern'"
+		failed=$((failed + 1))
+	fi
+}
+
+# Like expect_output, but the command has to fail cleanly: with a non-zero
+# status that isn't a signal.
+expect_error() {
+	pattern=$1
+	name=$2
+	shift 2
+	"$@" > "$WORK/out.txt" 2>&1
+	status=$?
+	if [ $status -eq 0 ] || [ $status -ge 128 ]; then
+		echo "FAIL  $name: exit status $status"
+		tail -n 20 "$WORK/out.txt"
+		failed=$((failed + 1))
+	elif ! grep -q "$pattern" "$WORK/out.txt"; then
+		echo "FAIL  $name: no output matching '$pattern'"
+		failed=$((failed + 1))
+	else
+		echo "ok    $name"
+	fi
+}
+
+# One 300000-operator expression: the parser builds it without recursion,
+# so every later walk over the tree has to cope with it as well.
+awk 'BEGIN { printf "local x: number = 1"; for (i = 0; i < 300000; i++) printf " + 1"; print ";" }' > "$WORK/chain.luat"
+
+expect_ok "long operator chain" "$LUAT" --check "$WORK/chain.luat"
+expect_ok "long operator chain, compact ast" "$LUAT" --compact-ast --check "$WORK/chain.luat"
+
+rm -rf "$WORK/cache"
+expect_ok "long operator chain, cache store" "$LUAT" --cache "$WORK/cache" --check "$WORK/chain.luat"
+expect_output '"cache_hit":true' "long operator chain, cache load" "$LUAT" --cache "$WORK/cache" --check --stats "$WORK/chain.luat"
+
+# A damaged entry of the right size has to be a miss, not a crash.
+for entry in "$WORK"/cache/*.ast; do
+	dd if=/dev/zero bs=1 seek=4096 count=4096 conv=notrunc of="$entry" 2>/dev/null
+done
+expect_output '"cache_hit":false' "corrupted cache entry" "$LUAT" --cache "$WORK/cache" --check --stats "$WORK/chain.luat"
+
+# Cached trees keep each node's offset, so a type error found after a
+# cache hit still says where it is.
+printf 'local x: number = 1;\nlocal y: string = x;\n' > "$WORK/located.luat"
+rm -rf "$WORK/cache"
+expect_error "line 2:1" "type error position, cache store" "$LUAT" --cache "$WORK/cache" --check "$WORK/located.luat"
+expect_error "line 2:1" "type error position, cache load" "$LUAT" --cache "$WORK/cache" --check "$WORK/located.luat"
+
+# A syntax error fails the run like a type error does.
+awk 'BEGIN { printf "print("; for (i = 0; i < 50; i++) printf "("; printf "1"; for (i = 0; i < 50; i++) printf ")"; print ");" }' > "$WORK/deep.luat"
+expect_error "Nesting too deep" "syntax error exit status" "$LUAT" --max-depth 10 --check "$WORK/deep.luat"
+
+# A tree cached under the default nesting limit can't stand in for a
+# parse under a stricter one.
+rm -rf "$WORK/cache"
+expect_ok "deep nesting, cache store" "$LUAT" --cache "$WORK/cache" --check "$WORK/deep.luat"
+expect_error "Nesting too deep" "deep nesting, stricter limit" "$LUAT" --cache "$WORK/cache" --max-depth 10 --check "$WORK/deep.luat"
+
+# No declared type admits nil, whether it is left out or written out, so
+# the VM's typed fast paths never see one.
+printf 'struct P\n\tx: number\nend\nlocal p: P;\nprint(p.x);\n' > "$WORK/uninit_local.luat"
+printf 'struct P\n\tx: number\nend\nlocal p: P = nil;\nprint(p.x);\n' > "$WORK/nil_struct.luat"
+printf 'local x: number = nil;\nprint(x + 1);\n' > "$WORK/nil_number.luat"
+printf 'function f(n: number): number\n\treturn n + 1;\nend\nprint(f(nil));\n' > "$WORK/nil_argument.luat"
+printf 'function f(): number\n\treturn nil;\nend\n' > "$WORK/nil_return.luat"
+printf 'local x: number = 1;\nx = nil;\n' > "$WORK/nil_assign.luat"
+printf 'struct P\n\tx: number,\n\ty: number\nend\nlocal p: P = P { x: 1 };\n' > "$WORK/missing_field.luat"
+printf 'function f(n: number): number\n\tif n > 0 then\n\t\treturn 1;\n\tend\nend\n' > "$WORK/missing_return.luat"
+
+expect_error "needs an initial value" "uninitialized typed local" "$LUAT" --check "$WORK/uninit_local.luat"
+expect_error "Cannot assign 'nil' to 'p'" "nil struct local" "$LUAT" --check "$WORK/nil_struct.luat"
+expect_error "Cannot assign 'nil' to 'x'" "nil number local" "$LUAT" --check "$WORK/nil_number.luat"
+expect_error "expects 'number' but got 'nil'" "nil argument" "$LUAT" --check "$WORK/nil_argument.luat"
+expect_error "Cannot return 'nil'" "nil return" "$LUAT" --check "$WORK/nil_return.luat"
+expect_error "Cannot assign 'nil' to a value" "nil assignment" "$LUAT" --check "$WORK/nil_assign.luat"
+expect_error "missing field 'y'" "struct constructor missing a field" "$LUAT" --check "$WORK/missing_field.luat"
+expect_error "without returning a value" "function falling off its end" "$LUAT" --check "$WORK/missing_return.luat"
+
+# Token offsets are u32, so a 4 GiB input is turned away before it is read.
+# The file is sparse and never mapped.
+truncate -s 4G "$WORK/huge.luat"
+expect_error "too large" "source of 4 GiB" "$LUAT" --check "$WORK/huge.luat"
+rm -f "$WORK/huge.luat"
+
+[ $failed -eq 0 ] || { echo "$failed failed"; exit 1; }